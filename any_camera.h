@@ -0,0 +1,67 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef ANY_CAMERA_H
+#define ANY_CAMERA_H
+
+#include <stdint.h>
+#include "any_frame_queue.h"
+
+/**********************************************************************
+ * @brief Base class for all frame sources: real V4L2 cameras, and the
+ *        simulated cameras used for testing without hardware.
+ *
+ * A camera is an Any_Frame_Queue.  pop() returns the next captured frame;
+ * push() gives a frame back so its buffer can be refilled.
+ */
+class Any_Camera: public Any_Frame_Queue {
+public:
+
+    /*******************************************************************//*
+     * @brief Return the name of this camera, for example "/dev/video10".
+     */
+    virtual const char* get_device_name() const = 0;
+
+    /*******************************************************************//*
+     * @brief Return the number of frame buffers owned by this camera.
+     */
+    virtual int get_buf_count() const = 0;
+
+    /*******************************************************************//*
+     * @brief Return the number of rows in each image.
+     */
+    virtual int get_rows() const = 0;
+
+    /*******************************************************************//*
+     * @brief Return the number of columns in each image.
+     */
+    virtual int get_cols() const = 0;
+
+    /*******************************************************************//*
+     * @brief Return the fourcc code (V4L2_PIX_FMT_XXXX) of the images.
+     */
+    virtual uint32_t get_pixel_format() const = 0;
+
+    /*******************************************************************//*
+     * @brief Start the video stream.  Call before the first pop().
+     */
+    virtual void stream_start() = 0;
+
+    /*******************************************************************//*
+     * @brief Stop the video stream.
+     */
+    virtual void stream_stop() = 0;
+
+    /*******************************************************************//*
+     * @brief Return true if pop() will never return another frame; for
+     *        example, a replayed file has run out.  A live camera never
+     *        ends, so by default this is false, and a NULL pop() is only
+     *        a timeout.
+     */
+    virtual bool is_end_of_stream() const
+    {
+        return false;
+    }
+};
+
+#endif
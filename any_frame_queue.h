@@ -11,6 +11,7 @@ class Usb_Frame;
  */
 class Any_Frame_Queue {
 public:
+    virtual ~Any_Frame_Queue() { }
     virtual int push(Usb_Frame* frame_ptr) = 0;
     virtual Usb_Frame* pop(int& count) = 0;
 };
@@ -0,0 +1,170 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "cam_cap_cache.h"
+
+// The start of the file.  A file whose header doesn't match exactly was
+// written by some other build, and is ignored.
+class Cap_File_Header {
+public:
+    char magic[8];
+    uint32_t version;
+    uint32_t caps_bytes;      // sizeof(Cam_Caps)
+    uint32_t device_count;
+};
+
+static const char CAP_FILE_MAGIC[8] = { 'C', 'A', 'M', 'C', 'A', 'P', 'S',
+                                        '\0' };
+static const uint32_t CAP_FILE_VERSION = 1;
+
+static Cap_File_Header make_header(uint32_t device_count)
+{
+    Cap_File_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = CAP_FILE_VERSION;
+    header.caps_bytes = sizeof(Cam_Caps);
+    header.device_count = device_count;
+    return header;
+}
+
+bool Cam_Caps::matches(const struct v4l2_capability& other) const
+{
+    return memcmp(cap.driver, other.driver, sizeof(cap.driver)) == 0 &&
+           memcmp(cap.card, other.card, sizeof(cap.card)) == 0 &&
+           memcmp(cap.bus_info, other.bus_info, sizeof(cap.bus_info)) == 0 &&
+           cap.version == other.version &&
+           cap.capabilities == other.capabilities;
+}
+
+const Cam_Caps::Size_List* Cam_Caps::find_sizes(uint32_t pixel_format) const
+{
+    for (int i = 0; i < size_list_count; ++i) {
+        if (size_list[i].pixel_format == pixel_format) return &size_list[i];
+    }
+    return NULL;
+}
+
+const Cam_Caps::Ival_List* Cam_Caps::find_ivals(uint32_t pixel_format,
+                                                int req_rows,
+                                                int req_cols) const
+{
+    for (int i = 0; i < ival_list_count; ++i) {
+        const Ival_List& list = ival_list[i];
+        if (list.pixel_format == pixel_format && list.req_rows == req_rows &&
+            list.req_cols == req_cols) return &list;
+    }
+    return NULL;
+}
+
+// Return true if the counts in a Cam_Caps read from a file are in range.
+static bool is_sane(const Cam_Caps& caps)
+{
+    if (caps.fmt_count < -1 || caps.fmt_count > Cam_Caps::MAX_FORMATS ||
+        caps.size_list_count < 0 ||
+        caps.size_list_count > Cam_Caps::MAX_FORMATS ||
+        caps.ival_list_count < 0 ||
+        caps.ival_list_count > Cam_Caps::MAX_MODES) return false;
+    for (int i = 0; i < caps.size_list_count; ++i) {
+        int count = caps.size_list[i].count;
+        if (count < 0 || count > Cam_Caps::MAX_SIZES) return false;
+    }
+    for (int i = 0; i < caps.ival_list_count; ++i) {
+        int count = caps.ival_list[i].count;
+        if (count < 0 || count > Cam_Caps::MAX_IVALS) return false;
+    }
+    return true;
+}
+
+Cam_Cap_Cache::Cam_Cap_Cache()
+: device_count(0),
+  dirty(false),
+  hit_count(0),
+  miss_count(0)
+{
+    path[0] = '\0';
+}
+
+bool Cam_Cap_Cache::load(const char* arg_path)
+{
+    strncpy(path, arg_path, FILENAME_MAX);
+    path[FILENAME_MAX - 1] = '\0';
+    device_count = 0;
+    dirty = false;
+
+    FILE* file_ptr = fopen(path, "rb");
+    if (file_ptr == NULL) return false;
+
+    Cap_File_Header expect = make_header(0);
+    Cap_File_Header header;
+    bool ok = fread(&header, sizeof(header), 1, file_ptr) == 1 &&
+              memcmp(header.magic, expect.magic, sizeof(header.magic)) == 0 &&
+              header.version == expect.version &&
+              header.caps_bytes == expect.caps_bytes &&
+              header.device_count <= (uint32_t)MAX_DEVICES;
+    if (ok) {
+        ok = fread(device, sizeof(device[0]), header.device_count,
+                   file_ptr) == header.device_count;
+    }
+    for (uint32_t i = 0; ok && i < header.device_count; ++i) {
+        ok = is_sane(device[i]);
+    }
+    fclose(file_ptr);
+    if (ok) device_count = header.device_count;
+    return ok;
+}
+
+bool Cam_Cap_Cache::save()
+{
+    if (!dirty) return true;
+    if (path[0] == '\0') return false;
+
+    // Write a new file and rename it over the old, so a crash part way
+    // through can't leave a truncated cache behind.
+
+    char tmp_path[FILENAME_MAX + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* file_ptr = fopen(tmp_path, "wb");
+    if (file_ptr == NULL) return false;
+    Cap_File_Header header = make_header(device_count);
+    bool ok = fwrite(&header, sizeof(header), 1, file_ptr) == 1 &&
+              fwrite(device, sizeof(device[0]), device_count, file_ptr) ==
+                  (size_t)device_count;
+    if (fclose(file_ptr) != 0) ok = false;
+    if (ok) ok = rename(tmp_path, path) == 0;
+    if (!ok) {
+        remove(tmp_path);
+        return false;
+    }
+    dirty = false;
+    return true;
+}
+
+Cam_Caps* Cam_Cap_Cache::lookup(const struct v4l2_capability& cap)
+{
+    for (int i = 0; i < device_count; ++i) {
+        if (device[i].matches(cap)) return &device[i];
+    }
+
+    // A new device, or a changed one on the same port.  Forget what the
+    // changed one said before; it may no longer be true.
+
+    Cam_Caps* caps_ptr = NULL;
+    for (int i = 0; i < device_count; ++i) {
+        if (memcmp(device[i].cap.bus_info, cap.bus_info,
+                   sizeof(cap.bus_info)) == 0) {
+            caps_ptr = &device[i];
+            break;
+        }
+    }
+    if (caps_ptr == NULL) {
+        if (device_count == MAX_DEVICES) return NULL;
+        caps_ptr = &device[device_count++];
+    }
+    memset(caps_ptr, 0, sizeof(*caps_ptr));
+    caps_ptr->cap = cap;
+    caps_ptr->fmt_count = -1;
+    return caps_ptr;
+}
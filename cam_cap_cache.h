@@ -0,0 +1,178 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef CAM_CAP_CACHE_H
+#define CAM_CAP_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/**********************************************************************
+ * @brief What one V4L2 device said it supports: the answers to its
+ *        enumeration ioctls, saved so they needn't be asked again.
+ *
+ * This is plain data, so a Cam_Cap_Cache can write it to disk as is.
+ * Lists that didn't fit are not saved at all, so a saved list is always
+ * complete.
+ */
+class Cam_Caps {
+public:
+    static const int MAX_FORMATS = 16;
+    static const int MAX_SIZES = 24;   /// Frame sizes per format.
+    static const int MAX_MODES = 24;   /// Format and size combinations.
+    static const int MAX_IVALS = 16;   /// Frame intervals per mode.
+
+    /** The frame sizes of one format (VIDIOC_ENUM_FRAMESIZES). */
+    class Size_List {
+    public:
+        uint32_t pixel_format;
+        int count;
+        struct v4l2_frmsizeenum size[MAX_SIZES];
+    };
+
+    /** The size a requested size is adjusted to (VIDIOC_TRY_FMT), and
+        the frame intervals at that size (VIDIOC_ENUM_FRAMEINTERVALS). */
+    class Ival_List {
+    public:
+        uint32_t pixel_format;
+        int req_rows;
+        int req_cols;
+        int rows;
+        int cols;
+        int count;
+        struct v4l2_frmivalenum ival[MAX_IVALS];
+    };
+
+    /** Identifies the device: VIDIOC_QUERYCAP's answer. */
+    struct v4l2_capability cap;
+
+    /** The formats (VIDIOC_ENUM_FMT), or fmt_count -1 if not yet known. */
+    int fmt_count;
+    struct v4l2_fmtdesc fmt_desc[MAX_FORMATS];
+
+    int size_list_count;
+    Size_List size_list[MAX_FORMATS];
+
+    int ival_list_count;
+    Ival_List ival_list[MAX_MODES];
+
+    /*******************************************************************//*
+     * @brief Return true if this describes the device that gave the given
+     *        VIDIOC_QUERYCAP answer: the same driver and version, the same
+     *        card, on the same bus, with the same capabilities.
+     */
+    bool matches(const struct v4l2_capability& other) const;
+
+    /*******************************************************************//*
+     * @brief Return the frame sizes of the given format, or NULL if not
+     *        known.
+     */
+    const Size_List* find_sizes(uint32_t pixel_format) const;
+
+    /*******************************************************************//*
+     * @brief Return the frame intervals of the given format at the given
+     *        requested size, or NULL if not known.
+     */
+    const Ival_List* find_ivals(uint32_t pixel_format,
+                                int req_rows,
+                                int req_cols) const;
+};
+
+/**********************************************************************
+ * @brief A file of Cam_Caps, one per device seen, so a restarted process
+ *        can open and configure its cameras without enumerating them
+ *        again.
+ *
+ * Some UVC cameras take hundreds of milliseconds to answer each
+ * enumeration ioctl.  Give a Usb_Camera the cache with
+ * Usb_Camera::set_cap_cache() before its init(); it then asks only
+ * VIDIOC_QUERYCAP, and if the answer matches a saved device, takes the
+ * formats, frame sizes and frame intervals from the cache instead of the
+ * camera.  Anything not in the cache is asked of the camera as before and
+ * added.  Call save() once the cameras are set up.
+ *
+ * A file written by a different build (one whose structures differ in
+ * size) is ignored, as is an entry whose device no longer gives the same
+ * QUERYCAP answer; for example after a driver update.
+ *
+ * Not thread safe: set up all the cameras from one thread.
+ */
+class Cam_Cap_Cache {
+public:
+    /** The most devices remembered. */
+    static const int MAX_DEVICES = 8;
+
+private:
+    char path[FILENAME_MAX];
+    int device_count;
+    Cam_Caps device[MAX_DEVICES];
+    bool dirty;
+    int hit_count;
+    int miss_count;
+
+    // Not copyable.
+    Cam_Cap_Cache(const Cam_Cap_Cache&);
+    Cam_Cap_Cache& operator=(const Cam_Cap_Cache&);
+
+public:
+    Cam_Cap_Cache();
+
+    /*******************************************************************//*
+     * @brief Read the cache from the given file.
+     *
+     * @param [in] path  The file; save() writes here too.
+     * @return False if the file is missing or not valid; the cache is
+     *         then empty.
+     */
+    bool load(const char* path);
+
+    /*******************************************************************//*
+     * @brief Write the cache back to the file given to load(), if
+     *        anything has been added.  The file is replaced atomically.
+     *
+     * @return False if it couldn't be written.
+     */
+    bool save();
+
+    /*******************************************************************//*
+     * @brief Return the entry for the device that gave the given
+     *        VIDIOC_QUERYCAP answer, adding an empty one if there is none.
+     *
+     * @return The entry, or NULL if the cache is full.
+     */
+    Cam_Caps* lookup(const struct v4l2_capability& cap);
+
+    /*******************************************************************//*
+     * @brief Note that an entry has been changed, so save() must write.
+     */
+    void mark_dirty()
+    {
+        dirty = true;
+    }
+
+    /*******************************************************************//*
+     * @brief Count a question answered from the cache (a hit), or asked of
+     *        the camera (a miss).
+     */
+    void count(bool hit)
+    {
+        if (hit) {
+            ++hit_count;
+        } else {
+            ++miss_count;
+        }
+    }
+
+    int get_hit_count() const
+    {
+        return hit_count;
+    }
+
+    int get_miss_count() const
+    {
+        return miss_count;
+    }
+};
+
+#endif
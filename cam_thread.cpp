@@ -1,88 +1,314 @@
 /**********************************************************************
  * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
  */
+#include <stdio.h>
+#include <stdlib.h>
 #include <pthread.h>
-#include <time.h>
+#ifndef HEADLESS
 #include <opencv2/opencv.hpp>
-#include "frame_queue.h"
+#endif
+#include "yuv_convert.h"
 #include "cam_thread.h"
+#include "capture_reactor.h"
+#include "pipeline_stats.h"
+#include "pipeline_stage.h"
+#include "frame_handle.h"
+#include "frame_recorder.h"
+#include "target_detector.h"
+#include "frame_pyramid.h"
+#include "parallel_stage.h"
 
+#ifndef HEADLESS
 extern pthread_mutex_t disp_mutex;
+#endif
+
+/* The first stage: frames come straight from the camera.  Any recorder is
+   a tap on this stage, so it sees every frame captured. */
+
+class Capture_Stage: public Pipeline_Stage {
+    Any_Camera* cam_ptr;
+
+protected:
+    virtual void begin()
+    {
+        cam_ptr->stream_start();
+    }
+
+    virtual void process(Usb_Frame*)
+    { }
 
-class Thread_Info {
 public:
-    Any_Frame_Queue* in_queue_ptr;
-    Any_Frame_Queue* out_queue_ptr;
-    Usb_Camera* cam_ptr;
+    Capture_Stage(Any_Camera* arg_cam_ptr)
+    : Pipeline_Stage("capture"),
+      cam_ptr(arg_cam_ptr)
+    { }
 };
 
-static double tv_subtract(const struct timeval& a, const struct timeval& b)
-{
-    const long USEC_PER_SECOND = 1000000;
-    suseconds_t usec_diff = a.tv_usec - b.tv_usec;
-    time_t sec_diff = a.tv_sec - b.tv_sec;
-    if (usec_diff < 0) {
-        usec_diff += USEC_PER_SECOND;
-        sec_diff -= 1;
-    }
-    return sec_diff + usec_diff / (double)USEC_PER_SECOND;
-}
+class Pyramid_Stage: public Pipeline_Stage {
+    Frame_Pyramid* pyramid_ptr;
 
-static double ts_subtract(const struct timespec& a, const struct timespec& b)
-{
-    const long NSEC_PER_SECOND = 1000000000;
-    long nsec_diff = a.tv_nsec - b.tv_nsec;
-    time_t sec_diff = a.tv_sec - b.tv_sec;
-    if (nsec_diff < 0) {
-        nsec_diff += NSEC_PER_SECOND;
-        sec_diff -= 1;
-    }
-    return sec_diff + nsec_diff / (double)NSEC_PER_SECOND;
-}
+protected:
+    virtual void process(Usb_Frame* frame_ptr)
+    {
+        pyramid_ptr->build(frame_ptr);
+    }
 
-static void* capture_thread(void* thread_arg_ptr)
-{
-    Thread_Info* iptr = (Thread_Info*)thread_arg_ptr;
-    Usb_Camera* cam_ptr = iptr->cam_ptr;
-    cam_ptr->stream_start();
-    struct timeval start_time;
-    struct timespec start_cpu_time;
-    gettimeofday(&start_time, NULL);
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start_cpu_time);
-    while (1) {
-        int in_count;
-        Usb_Frame* frame_ptr = iptr->in_queue_ptr->pop(in_count);
-
-        struct timeval now;
-        struct timespec now_cpu_time;
-        gettimeofday(&now, NULL);
-        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now_cpu_time);
-        double secs = tv_subtract(now, start_time);
-        double cpu_secs = ts_subtract(now_cpu_time, start_cpu_time);
-        struct timeval tv = frame_ptr->get_timestamp();
-        int out_count = iptr->out_queue_ptr->push(frame_ptr);
-        printf("capture %s: in=%d out=%d frame=%7d time=%10ld.%06ld cpu=%.6f (%3d%%)\n",
-               cam_ptr->get_device_name(), in_count, out_count,
-               frame_ptr->get_frame_num(), tv.tv_sec, tv.tv_usec, cpu_secs,
-               (int)(cpu_secs / secs * 100.0 + 0.5));
+public:
+    Pyramid_Stage(Frame_Pyramid* arg_pyramid_ptr)
+    : Pipeline_Stage("pyramid"),
+      pyramid_ptr(arg_pyramid_ptr)
+    { }
+};
+
+/* Where the last stage gets the targets it outlines. */
+
+class Target_Source {
+public:
+    virtual ~Target_Source()
+    { }
+
+    virtual void get_latest(Target_Result& latest_out) = 0;
+};
+
+/* Finds the targets in each frame.  As a worker of a Parallel_Detect_Stage
+   it doesn't publish, but leaves each frame's result in result_by_buf,
+   indexed by the frame's buffer, for the results to be published in
+   order. */
+
+class Detect_Stage: public Pipeline_Stage, public Target_Source {
+    Target_Detector* detector_ptr;
+    Result_Publisher* publisher_ptr;
+    Target_Result* result_by_buf;
+    Yuv422_Order order;
+
+protected:
+    virtual void process(Usb_Frame* frame_ptr)
+    {
+        detector_ptr->detect(order, frame_ptr);
+        if (result_by_buf != NULL) {
+            result_by_buf[frame_ptr->get_buf_index()] =
+                    detector_ptr->get_result();
+        }
+        if (publisher_ptr != NULL) {
+            publisher_ptr->publish(detector_ptr->get_result(),
+                                   frame_age_usec(frame_ptr));
+        }
+    }
+
+public:
+    Detect_Stage(Target_Detector* arg_detector_ptr,
+                 Result_Publisher* arg_publisher_ptr,
+                 uint32_t pixel_format,
+                 Target_Result* arg_result_by_buf = NULL)
+    : Pipeline_Stage("detect"),
+      detector_ptr(arg_detector_ptr),
+      publisher_ptr(arg_publisher_ptr),
+      result_by_buf(arg_result_by_buf),
+      order((pixel_format == V4L2_PIX_FMT_UYVY) ? YUV422_UYVY : YUV422_YUYV)
+    { }
 
+    virtual void get_latest(Target_Result& latest_out)
+    {
+        detector_ptr->get_latest(latest_out);
+    }
+};
+
+/* Finds the targets in several frames at once, with a Target_Detector per
+   worker, and publishes the results in frame order.  Tracking is left
+   off, since no worker sees consecutive frames. */
+
+class Parallel_Detect_Stage: public Parallel_Stage, public Target_Source {
+    int worker_count;
+    Target_Detector* detector_ptr[MAX_WORKERS];
+    Pipeline_Stage* worker_ptr[MAX_WORKERS];
+    Target_Result* result_by_buf;
+    Result_Publisher* publisher_ptr;
+
+    /** A copy of the latest result emitted, for the last stage. */
+    pthread_mutex_t latest_mutex;
+    Target_Result latest;
+
+protected:
+    virtual void emit(Usb_Frame* frame_ptr)
+    {
+        const Target_Result& result =
+                result_by_buf[frame_ptr->get_buf_index()];
+        if (publisher_ptr != NULL) {
+            publisher_ptr->publish(result, frame_age_usec(frame_ptr));
+        }
+        pthread_mutex_lock(&latest_mutex);
+        latest = result;
+        pthread_mutex_unlock(&latest_mutex);
+    }
+
+public:
+    Parallel_Detect_Stage(const Any_Camera* cam_ptr,
+                          const Yuv_Range& range,
+                          Result_Publisher* arg_publisher_ptr,
+                          int arg_worker_count,
+                          int max_in_flight,
+                          const Thread_Placement& worker_placement)
+    : Parallel_Stage("detect"),
+      worker_count(arg_worker_count),
+      result_by_buf(new Target_Result[cam_ptr->get_buf_count()]),
+      publisher_ptr(arg_publisher_ptr)
+    {
+        pthread_mutex_init(&latest_mutex, NULL);
+        if (worker_count > MAX_WORKERS) worker_count = MAX_WORKERS;
+        for (int w = 0; w < worker_count; ++w) {
+            detector_ptr[w] = new Target_Detector;
+            detector_ptr[w]->init(cam_ptr->get_rows(), cam_ptr->get_cols(),
+                                  range);
+            worker_ptr[w] = new Detect_Stage(detector_ptr[w], NULL,
+                                             cam_ptr->get_pixel_format(),
+                                             result_by_buf);
+            worker_ptr[w]->set_placement(worker_placement);
+        }
+        init(worker_ptr, worker_count, max_in_flight);
+    }
+
+    virtual ~Parallel_Detect_Stage()
+    {
+        for (int w = 0; w < worker_count; ++w) {
+            delete worker_ptr[w];
+            delete detector_ptr[w];
+        }
+        delete[] result_by_buf;
+        pthread_mutex_destroy(&latest_mutex);
+    }
+
+    virtual void get_latest(Target_Result& latest_out)
+    {
+        pthread_mutex_lock(&latest_mutex);
+        latest_out = latest;
+        pthread_mutex_unlock(&latest_mutex);
+    }
+};
+
+/* Return the level of the frame's pyramid that is the preview's size, or
+   NULL if there is no pyramid or it has no such level. */
+
+static const Pyramid_Level* preview_level(const Frame_Pyramid* pyramid_ptr,
+                                          const Preview_Streamer* preview_ptr,
+                                          const Usb_Frame* frame_ptr,
+                                          Pyramid_Level& level)
+{
+    if (pyramid_ptr == NULL) return NULL;
+    for (int i = 1; i < Frame_Pyramid::LEVEL_COUNT; ++i) {
+        if ((1 << i) != preview_ptr->get_scale()) continue;
+        return pyramid_ptr->get_level(frame_ptr, i, level) ? &level : NULL;
     }
     return NULL;
 }
 
-static void* display_thread(void* thread_arg_ptr)
+/* The last stage when there is no display: hand the frame to the preview,
+   if any, and pass it on. */
+
+class Sink_Stage: public Pipeline_Stage {
+    Preview_Streamer* preview_ptr;
+    Target_Source* targets_src_ptr;
+    const Frame_Pyramid* pyramid_ptr;
+    Target_Result targets;
+
+protected:
+    virtual void process(Usb_Frame* frame_ptr)
+    {
+        if (preview_ptr == NULL) return;
+        const Target_Result* targets_ptr = NULL;
+        if (targets_src_ptr != NULL) {
+            targets_src_ptr->get_latest(targets);
+            targets_ptr = &targets;
+        }
+        Pyramid_Level level;
+        preview_ptr->offer(frame_ptr, targets_ptr,
+                           preview_level(pyramid_ptr, preview_ptr, frame_ptr,
+                                         level));
+    }
+
+public:
+    Sink_Stage(Preview_Streamer* arg_preview_ptr,
+               Target_Source* arg_targets_src_ptr,
+               const Frame_Pyramid* arg_pyramid_ptr)
+    : Pipeline_Stage("sink"),
+      preview_ptr(arg_preview_ptr),
+      targets_src_ptr(arg_targets_src_ptr),
+      pyramid_ptr(arg_pyramid_ptr)
+    { }
+};
+
+#ifndef HEADLESS
+/* Wrap the image of a frame in a cv::Mat, with the frame's own type and
+   step, without copying it; the Mat is valid only while the frame is
+   held.  Compressed images give an empty Mat. */
+
+static cv::Mat frame_mat(const Usb_Frame* frame_ptr)
 {
-    Thread_Info* iptr = (Thread_Info*)thread_arg_ptr;
-    const char* dev_name = iptr->cam_ptr->get_device_name();
-    struct timeval start_time;
-    struct timespec start_cpu_time;
-    gettimeofday(&start_time, NULL);
-    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start_cpu_time);
-    while (1) {
-        int in_count;
-        Usb_Frame* frame_ptr = iptr->in_queue_ptr->pop(in_count);
-        cv::Mat image(frame_ptr->get_rows(), frame_ptr->get_cols(),
-                      CV_8UC3, frame_ptr->get_img_data());
+    Gray_View gray;
+    if (frame_ptr->get_view(gray)) {
+        return cv::Mat(gray.rows, gray.cols, CV_8UC1, (void*)gray.data,
+                       gray.step);
+    }
+    Bgr_View bgr;
+    if (frame_ptr->get_view(bgr)) {
+        return cv::Mat(bgr.rows, bgr.cols, CV_8UC3, (void*)bgr.data,
+                       bgr.step);
+    }
+    Yuv422_View yuv;
+    if (frame_ptr->get_view(yuv)) {
+        return cv::Mat(yuv.rows, yuv.cols, CV_8UC2, (void*)yuv.data,
+                       yuv.step);
+    }
+    return cv::Mat();
+}
+
+class Display_Stage: public Pipeline_Stage {
+    const char* dev_name;
+    Preview_Streamer* preview_ptr;
+    Target_Source* targets_src_ptr;
+    const Frame_Pyramid* pyramid_ptr;
+    cv::Mat bgr_image;
+    Target_Result targets;
+
+protected:
+    virtual void process(Usb_Frame* frame_ptr)
+    {
+        const Target_Result* targets_ptr = NULL;
+        if (targets_src_ptr != NULL) {
+            targets_src_ptr->get_latest(targets);
+            targets_ptr = &targets;
+        }
+        if (preview_ptr != NULL) {
+            Pyramid_Level level;
+            preview_ptr->offer(frame_ptr, targets_ptr,
+                               preview_level(pyramid_ptr, preview_ptr,
+                                             frame_ptr, level));
+        }
+        cv::Mat image;
+        Yuv422_View yuv;
+        if (frame_ptr->get_view(yuv)) {
+
+            // Packed 4:2:2 frames must be converted to BGR before display.
+
+            bgr_image.create(yuv.rows, yuv.cols, CV_8UC3);
+            yuv422_to_bgr(yuv.order, yuv.data, yuv.step,
+                          bgr_image.data, bgr_image.step, yuv.rows, yuv.cols);
+            image = bgr_image;
+
+            // Outline the targets; drawing on the converted copy leaves
+            // the frame itself untouched.
+
+            if (targets_ptr != NULL) {
+                for (int i = 0; i < targets.blob_count; ++i) {
+                    const Target_Blob& b = targets.blob[i];
+                    cv::rectangle(image, cv::Point(b.x_min, b.y_min),
+                                  cv::Point(b.x_max, b.y_max),
+                                  cv::Scalar(0, 0, 255));
+                }
+            }
+        } else {
+            image = frame_mat(frame_ptr);
+            if (image.empty()) return;  // compressed; nothing to show
+        }
 
         pthread_mutex_lock(&disp_mutex);
         cv::namedWindow(dev_name, 1);
@@ -90,52 +316,219 @@ static void* display_thread(void* thread_arg_ptr)
 
         cv::imshow(dev_name, image);
         cv::waitKey(1);
+    }
+
+public:
+    Display_Stage(const Any_Camera* cam_ptr,
+                  Preview_Streamer* arg_preview_ptr,
+                  Target_Source* arg_targets_src_ptr,
+                  const Frame_Pyramid* arg_pyramid_ptr)
+    : Pipeline_Stage("display"),
+      dev_name(cam_ptr->get_device_name()),
+      preview_ptr(arg_preview_ptr),
+      targets_src_ptr(arg_targets_src_ptr),
+      pyramid_ptr(arg_pyramid_ptr)
+    { }
+};
+#endif
 
-        struct timeval now;
-        struct timespec now_cpu_time;
-        gettimeofday(&now, NULL);
-        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now_cpu_time);
-        double secs = tv_subtract(now, start_time);
-        double cpu_secs = ts_subtract(now_cpu_time, start_cpu_time);
-        struct timeval tv = frame_ptr->get_timestamp();
-        int out_count = iptr->out_queue_ptr->push(frame_ptr);
-        printf("display %s: in=%d out=%d frame=%7d time=%10ld.%06ld cpu=%.6f (%3d%%)\n",
-               dev_name, in_count, out_count, frame_ptr->get_frame_num(),
-               tv.tv_sec, tv.tv_usec, cpu_secs,
-               (int)(cpu_secs / secs * 100.0 + 0.5));
+/* The last stage: the display, or with no display just the preview. */
 
+static Pipeline_Stage* new_out_stage(bool headless,
+                                     Any_Camera* cam_ptr,
+                                     Preview_Streamer* preview_ptr,
+                                     Target_Source* targets_src_ptr,
+                                     const Frame_Pyramid* pyramid_ptr)
+{
+#ifndef HEADLESS
+    if (!headless) {
+        return new Display_Stage(cam_ptr, preview_ptr, targets_src_ptr,
+                                 pyramid_ptr);
     }
-    return NULL;
+#else
+    (void)headless;
+    (void)cam_ptr;
+#endif
+    return new Sink_Stage(preview_ptr, targets_src_ptr, pyramid_ptr);
 }
 
 void* cam_thread(void* thread_arg_ptr)
 {
-    Usb_Camera* cam_ptr = (Usb_Camera*)thread_arg_ptr;
+    Cam_Thread_Arg* arg_ptr = (Cam_Thread_Arg*)thread_arg_ptr;
+    Any_Camera* cam_ptr = arg_ptr->cam_ptr;
     int buf_count = cam_ptr->get_buf_count();
     printf("buf_count= %d\n", buf_count);
-    Frame_Queue* q1_ptr = new Frame_Queue(buf_count, true, true);
 
-    Thread_Info display_thread_info;
-    display_thread_info.in_queue_ptr = q1_ptr;
-    display_thread_info.out_queue_ptr = cam_ptr;
-    display_thread_info.cam_ptr = cam_ptr;
+    /* When recording, frames are shared between the display and the
+       recorder, so the display must release frames rather than give them
+       straight back to the camera. */
+
+    Frame_Recorder* recorder_ptr = NULL;
+    Frame_Releaser releaser;
+    Any_Frame_Queue* return_queue_ptr = cam_ptr;
+    if (arg_ptr->record_file_name != NULL) {
+        uint32_t pixel_format = cam_ptr->get_pixel_format();
+
+        // Compressed frames are bounded by the size of BGR.
+
+        int bytes_per_pixel = packed_pixel_bytes(pixel_format);
+        if (bytes_per_pixel == 0) bytes_per_pixel = 3;
+        recorder_ptr = new Frame_Recorder;
+        if (recorder_ptr->open(arg_ptr->record_file_name,
+                               cam_ptr->get_rows(), cam_ptr->get_cols(),
+                               pixel_format,
+                               cam_ptr->get_rows() * cam_ptr->get_cols() *
+                               bytes_per_pixel,
+                               arg_ptr->record_max_frames)) {
+            return_queue_ptr = &releaser;
+        } else {
+            printf("can't record to %s\n", arg_ptr->record_file_name);
+            delete recorder_ptr;
+            recorder_ptr = NULL;
+        }
+    }
+
+    /* Stages run in this order, each optional one only if asked for:
+       capture -> pyramid -> detect -> display (or sink).  Every queue
+       between them is of the requested type. */
+
+    const char* dev_name = cam_ptr->get_device_name();
+    uint32_t pixel_format = cam_ptr->get_pixel_format();
+    Stage_Link link(arg_ptr->queue_type);
+    Pipeline pipeline(dev_name, cam_ptr, return_queue_ptr, buf_count);
+
+    Capture_Stage capture_stage(cam_ptr);
+    capture_stage.set_placement(arg_ptr->placement[THREAD_ROLE_CAPTURE]);
+    if (recorder_ptr != NULL) capture_stage.add_tap(recorder_ptr);
+    pipeline.add_stage(&capture_stage);
+
+    Frame_Pyramid* pyramid_ptr = NULL;
+    Pyramid_Stage* pyramid_stage_ptr = NULL;
+    if (arg_ptr->build_pyramid && Frame_Pyramid::supports(pixel_format)) {
+        pyramid_ptr = new Frame_Pyramid;
+        pyramid_ptr->init(buf_count, cam_ptr->get_rows(), cam_ptr->get_cols(),
+                          pixel_format);
+        pyramid_stage_ptr = new Pyramid_Stage(pyramid_ptr);
+        pyramid_stage_ptr->set_placement(
+                                arg_ptr->placement[THREAD_ROLE_PROCESS]);
+        pipeline.add_stage(pyramid_stage_ptr, link);
+    } else if (arg_ptr->build_pyramid) {
+        printf("%s: pyramid needs YUYV, UYVY or GREY\n", dev_name);
+    }
+
+    Target_Detector* detector_ptr = NULL;
+    Pipeline_Stage* detect_stage_ptr = NULL;
+    Target_Source* targets_src_ptr = NULL;
+    if (arg_ptr->target_range_ptr != NULL &&
+        (pixel_format == V4L2_PIX_FMT_YUYV ||
+         pixel_format == V4L2_PIX_FMT_UYVY) &&
+        arg_ptr->detect_workers > 1) {
 
-    pthread_t display_thread_id;
-    int rc = pthread_create(&display_thread_id, NULL, display_thread,
-                            (void*)&display_thread_info);
-    if (rc != 0) {
-        printf("can't pthread_create, error_code= %d\n", rc);
-        exit(-1);
+        /* Leave buffers for the capture stage and the display, so the
+           detect stage never holds all of them. */
+
+        if (arg_ptr->target_sweep_period > 0) {
+            printf("%s: detecting on %d workers; tracking is off\n",
+                   dev_name, arg_ptr->detect_workers);
+        }
+        int max_in_flight = arg_ptr->max_in_flight;
+        if (max_in_flight <= 0) max_in_flight = arg_ptr->detect_workers + 1;
+        if (max_in_flight > buf_count - 2) max_in_flight = buf_count - 2;
+        if (max_in_flight < 1) max_in_flight = 1;
+        Parallel_Detect_Stage* parallel_ptr =
+                new Parallel_Detect_Stage(cam_ptr, *arg_ptr->target_range_ptr,
+                                          arg_ptr->publisher_ptr,
+                                          arg_ptr->detect_workers,
+                                          max_in_flight,
+                                          arg_ptr->placement[
+                                                THREAD_ROLE_PROCESS]);
+        detect_stage_ptr = parallel_ptr;
+        targets_src_ptr = parallel_ptr;
+    } else if (arg_ptr->target_range_ptr != NULL &&
+               (pixel_format == V4L2_PIX_FMT_YUYV ||
+                pixel_format == V4L2_PIX_FMT_UYVY)) {
+        detector_ptr = new Target_Detector;
+        detector_ptr->init(cam_ptr->get_rows(), cam_ptr->get_cols(),
+                           *arg_ptr->target_range_ptr);
+        if (arg_ptr->target_sweep_period > 0) {
+            detector_ptr->set_tracking(true, 16,
+                                       arg_ptr->target_sweep_period);
+        }
+        Detect_Stage* serial_ptr = new Detect_Stage(detector_ptr,
+                                                    arg_ptr->publisher_ptr,
+                                                    pixel_format);
+        detect_stage_ptr = serial_ptr;
+        targets_src_ptr = serial_ptr;
+    } else if (arg_ptr->target_range_ptr != NULL) {
+        printf("%s: target detection needs YUYV or UYVY\n", dev_name);
+    }
+    if (detect_stage_ptr != NULL) {
+        detect_stage_ptr->set_placement(
+                                arg_ptr->placement[THREAD_ROLE_PROCESS]);
+        pipeline.add_stage(detect_stage_ptr, link);
     }
 
-    // don't start a new thread for capture_thread; just morph this one.
+    Pipeline_Stage* out_stage_ptr = new_out_stage(arg_ptr->headless, cam_ptr,
+                                                  arg_ptr->preview_ptr,
+                                                  targets_src_ptr,
+                                                  pyramid_ptr);
+    out_stage_ptr->set_placement(arg_ptr->placement[THREAD_ROLE_DISPLAY]);
+    pipeline.add_stage(out_stage_ptr, link);
+
+    // don't start a new thread for the capture stage; just morph this one.
 
-    Thread_Info capture_thread_info;
-    capture_thread_info.in_queue_ptr = cam_ptr;
-    capture_thread_info.out_queue_ptr = q1_ptr;
-    capture_thread_info.cam_ptr = cam_ptr;
-    void* return_val = capture_thread(&capture_thread_info);
+    pipeline.run();
+
+    delete out_stage_ptr;
+    delete detect_stage_ptr;
+    delete pyramid_stage_ptr;
+    delete detector_ptr;
+    delete pyramid_ptr;
+    delete recorder_ptr;
+    return NULL;
+}
 
-    delete q1_ptr;
-    return return_val;
+void* multi_cam_thread(void* thread_arg_ptr)
+{
+    Multi_Cam_Thread_Arg* arg_ptr = (Multi_Cam_Thread_Arg*)thread_arg_ptr;
+    int cam_count = arg_ptr->cam_count;
+    Capture_Reactor reactor;
+    Any_Frame_Queue** q_ptr = new Any_Frame_Queue*[cam_count];
+    Pipeline_Stage** out_stage_ptr = new Pipeline_Stage*[cam_count];
+
+    for (int i = 0; i < cam_count; ++i) {
+        Usb_Camera* cam_ptr = arg_ptr->cam_ptr[i];
+        const char* dev_name = cam_ptr->get_device_name();
+
+        /* The reactor serves every camera, so it must never block on a
+           full queue. */
+
+        q_ptr[i] = new_frame_queue(arg_ptr->queue_type, cam_ptr,
+                                   cam_ptr->get_buf_count(), true, false);
+        reactor.add(cam_ptr, q_ptr[i],
+                    pipeline_stats.add_stage(dev_name, "capture"));
+
+        out_stage_ptr[i] = new_out_stage(arg_ptr->headless, cam_ptr,
+                                         NULL, NULL, NULL);
+        out_stage_ptr[i]->set_placement(
+                                arg_ptr->placement[THREAD_ROLE_DISPLAY]);
+        out_stage_ptr[i]->connect(dev_name, q_ptr[i], cam_ptr, cam_ptr,
+                                  pipeline_stats.add_stage(dev_name,
+                                            out_stage_ptr[i]->get_name()));
+        out_stage_ptr[i]->start();
+    }
+
+    // don't start a new thread for the reactor; just morph this one.
+
+    apply_thread_placement(arg_ptr->placement[THREAD_ROLE_CAPTURE],
+                           "all cameras", "reactor");
+    reactor.run();
+
+    for (int i = 0; i < cam_count; ++i) {
+        delete out_stage_ptr[i];
+        delete q_ptr[i];
+    }
+    delete[] out_stage_ptr;
+    delete[] q_ptr;
+    return NULL;
 }
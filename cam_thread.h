@@ -5,17 +5,143 @@
 #define CAM_THREAD_H
 
 #include "usb_camera.h"
+#include "yuv_convert.h"
+#include "thread_placement.h"
+#include "result_publisher.h"
+#include "preview_streamer.h"
+#include "pipeline_stage.h"
+
+/**********************************************************************
+ * @brief The argument to cam_thread().
+ */
+class Cam_Thread_Arg {
+public:
+    /** The camera to run.  It must already have been initialized; for
+        example, via a call to Usb_Camera::init(). */
+    Any_Camera* cam_ptr;
+
+    /** The type of queue used between pipeline stages. */
+    Cam_Queue_Type queue_type;
+
+    /** If not NULL, every captured frame is also recorded to this capture
+        file by a Frame_Recorder.  Recording never stalls capture; frames
+        are dropped from the recording instead. */
+    const char* record_file_name;
+
+    /** The maximum number of frames to record. */
+    int record_max_frames;
+
+    /** If not NULL, a detect stage between capture and display finds
+        targets of this color with a Target_Detector, and the display
+        outlines them.  Only packed 4:2:2 cameras are supported. */
+    const Yuv_Range* target_range_ptr;
+
+    /** If greater than 0, the detector searches only around the targets it
+        found in the previous frame, with a full-frame sweep at least this
+        often (in frames).  0 searches every frame in full.  Ignored, with
+        a message, when detect_workers is greater than 1. */
+    int target_sweep_period;
+
+    /** If not NULL, the detect stage sends the targets of every frame
+        through this publisher as soon as they are found. */
+    Result_Publisher* publisher_ptr;
+
+    /** If not NULL, the display stage offers every frame to this streamer,
+        which must already be started, with the targets outlined. */
+    Preview_Streamer* preview_ptr;
+
+    /** If true, there is no display: the last stage only offers frames to
+        the preview, and OpenCV HighGUI is never touched.  Always true when
+        built with HEADLESS defined. */
+    bool headless;
+
+    /** If greater than 1, the detect stage finds targets in this many
+        frames at once, one per core, with a Parallel_Stage; results are
+        still published in frame order.  Tracking is then off. */
+    int detect_workers;
+
+    /** With detect_workers greater than 1, the most frames in the detect
+        stage at once, or 0 for detect_workers + 1.  Never more than the
+        camera's buffer count less 2. */
+    int max_in_flight;
+
+    /** If true, a pyramid stage right after capture builds half and
+        quarter size gray copies of every frame with a Frame_Pyramid, for
+        the stages after it; the preview takes its luma from the level of
+        its size.  Packed 4:2:2 and GREY cameras are supported. */
+    bool build_pyramid;
+
+    /** Where each of this camera's threads runs, indexed by Thread_Role.
+        The pyramid and detect stages are THREAD_ROLE_PROCESS threads. */
+    Thread_Placement placement[THREAD_ROLE_COUNT];
+
+    Cam_Thread_Arg()
+    : cam_ptr(NULL),
+      queue_type(CAM_QUEUE_SPSC),
+      record_file_name(NULL),
+      record_max_frames(125 * 60 * 3),
+      target_range_ptr(NULL),
+      target_sweep_period(0),
+      publisher_ptr(NULL),
+      preview_ptr(NULL),
+      headless(false),
+      detect_workers(1),
+      max_in_flight(0),
+      build_pyramid(false)
+    { }
+};
 
 /**********************************************************************
  * @brief Camera thread.  One thread per camera.
  *
  * @param [in,out] thread_arg_ptr Points to the single arugment to this
  *                                thread.  See pthread_create(3).  The caller
- *                                must point this at Usb_Camera that has
- *                                already been initialized via a call to
- *                                Usb_Camera::init().
+ *                                must point this at a Cam_Thread_Arg.
  * @return Return value is meaningless.
  */
 void* cam_thread(void* thread_arg_ptr);
 
+/**********************************************************************
+ * @brief The argument to multi_cam_thread().
+ */
+class Multi_Cam_Thread_Arg {
+public:
+    /** The number of cameras in cam_ptr. */
+    int cam_count;
+
+    /** The cameras to run.  Each must already have been initialized via a
+        call to Usb_Camera::init(). */
+    Usb_Camera** cam_ptr;
+
+    /** The type of queue used between pipeline stages. */
+    Cam_Queue_Type queue_type;
+
+    /** Where the reactor (THREAD_ROLE_CAPTURE) and each display thread
+        (THREAD_ROLE_DISPLAY) run. */
+    Thread_Placement placement[THREAD_ROLE_COUNT];
+
+    /** As for Cam_Thread_Arg::headless. */
+    bool headless;
+
+    Multi_Cam_Thread_Arg()
+    : cam_count(0),
+      cam_ptr(NULL),
+      queue_type(CAM_QUEUE_MAILBOX),
+      headless(false)
+    { }
+};
+
+/**********************************************************************
+ * @brief Capture thread for several cameras at once.
+ *
+ * Like cam_thread(), but rather than one capture thread per camera, a
+ * single Capture_Reactor thread dequeues frames from all the cameras.
+ * One display thread is still started per camera.  A camera whose display
+ * falls behind has its frames dropped; it never delays the others.
+ *
+ * @param [in,out] thread_arg_ptr Points to a Multi_Cam_Thread_Arg.
+ * @return Return value is meaningless.
+ */
+void* multi_cam_thread(void* thread_arg_ptr);
+
 #endif
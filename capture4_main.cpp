@@ -3,16 +3,97 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include "usb_camera.h"
 #include "cam_thread.h"
+#include "pipeline_stats.h"
+#include "mjpeg_decoder.h"
+#include "result_publisher.h"
+#include "preview_streamer.h"
+#include "frame_sync.h"
+#include "cam_cap_cache.h"
+#include "mode_planner.h"
 
 pthread_mutex_t disp_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 const int CAM_COUNT = 2;
+
+/* Capture buffers per camera.  buffer_sweep puts the drops at about 1%
+   with five, against processing that now and then takes several frame
+   times; each one more adds a frame of latency behind such a spike. */
+const int CAPTURE_BUFS = 5;
 Usb_Camera cam[CAM_COUNT];
+Cam_Thread_Arg cam_arg[CAM_COUNT];
+Mjpeg_Decoder decoder[CAM_COUNT];
+
+/* The color of the lit targets: the green LED ring reflected off
+   retroreflective tape is bright, with low U and V. */
+Yuv_Range target_range;
+
+/* Targets go to the robot controller, on one port per camera; 5800-5810
+   are the ports the field leaves open for team use. */
+Result_Publisher publisher[CAM_COUNT];
+
+/* A low rate, half size preview of each camera for the drivers, at
+   http://<host>:5805/ and up. */
+Preview_Streamer preview[CAM_COUNT];
+
+/* What each camera supports, kept from one run to the next, so a restart
+   on the field doesn't wait for the cameras to be enumerated again. */
+Cam_Cap_Cache cap_cache;
+
+static void usage()
+{
+    printf("usage: capture4 [-reactor | -sync] [-parallel] [-dmabuf] "
+           "[-pyramid] [cam_count]\n"
+           "  cam_count  cameras to run, from /dev/video10 up; default 1\n"
+           "  -reactor   capture from every camera on one thread, and "
+           "only display\n"
+           "  -sync      pair up the cameras' frames by timestamp, and "
+           "report the skew;\n"
+           "             needs 2 or more cameras\n"
+           "  -parallel  with one camera, detect on two frames at once; "
+           "turns tracking off\n"
+           "  -dmabuf    export every capture buffer as a DMABUF\n"
+           "  -pyramid   build reduced copies of every frame, and take the "
+           "preview's luma\n"
+           "             from them\n");
+    exit(1);
+}
+
+/* Pair up the frames the cameras took at the same moment, as stereo
+   ranging will need, instead of running each camera on its own.  Frames
+   more than a quarter of a 60 fps frame period apart are not paired.
+   There is no ranging yet: the loop only times each set through and
+   reports how well the cameras stay in sync.  Never returns. */
 
-int main()
+static void run_stereo(int cam_count, int capture_priority)
+{
+    static Frame_Sync sync(4000);
+    for (int i = 0; i < cam_count; ++i) {
+        cam[i].stream_start();
+        sync.add_input(&cam[i], &cam[i]);
+    }
+    sync.set_placement(Thread_Placement(1, SCHED_FIFO, capture_priority));
+    sync.start();
+    apply_thread_placement(Thread_Placement(-1, SCHED_OTHER, 0),
+                           "stereo", "range");
+    static Stage_Stats unlisted_stats;
+    Stage_Stats* stats_ptr = pipeline_stats.add_stage("stereo", "range");
+    if (stats_ptr == NULL) stats_ptr = &unlisted_stats;
+    for (int n = 1; ; ++n) {
+        Frame_Set set;
+        stats_ptr->begin_pop();
+        sync.pop(set);
+        stats_ptr->end_pop(set.frame_ptr[0]);
+        stats_ptr->end_process();
+        sync.push(set);
+        if (n % 100 == 0) sync.report(stdout);
+    }
+}
+
+int main(int argc, char** argv)
 {
     /* Looks like this code will run:
        one 480x640 camera at about 43 fps.
@@ -22,19 +103,88 @@ int main()
      */
     pthread_t thread_id[CAM_COUNT];
 
-    cam[0].init("/dev/video10", 2, 240, 320, 5);
-    cam[0].set_frame_interval(1, 60);
+    /* By default each camera gets a cam_thread() of its own, with
+       detection and tracking.  With -reactor, a single Capture_Reactor
+       thread captures from all of them, and each camera's frames are only
+       displayed.  With -sync, the cameras' frames are paired for stereo
+       instead (see run_stereo()).  With -parallel and one camera,
+       detection works on two frames at once, on the cores capture and
+       display leave free; no worker then sees consecutive frames, so
+       tracking is off and every frame is searched in full.  With -dmabuf
+       every capture buffer is also exported with VIDIOC_EXPBUF, for
+       sharing with other devices; a driver that can't export fails at
+       startup.  With -pyramid a Frame_Pyramid stage averages every frame
+       down for the preview, which otherwise samples one frame in four; it
+       costs a little CPU on every frame, for a preview that doesn't
+       alias. */
 
-    //cam[0].init("/dev/video10", 2, 480, 640, 5);
-    //cam[0].set_frame_interval(1, 30);
-    //cam[1].init("/dev/video11", 2, 480, 640, 5);
-/*
-    cam[1].init("/dev/video11", 2, 240, 320, 5);
-    cam[1].set_frame_interval(1, 40);
-
-    int cam_count = 2;
-*/
+    bool use_reactor = false;
+    bool use_sync = false;
+    bool parallel_detect = false;
+    bool export_dmabuf = false;
+    bool build_pyramid = false;
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-reactor") == 0) {
+            use_reactor = true;
+        } else if (strcmp(argv[arg], "-sync") == 0) {
+            use_sync = true;
+        } else if (strcmp(argv[arg], "-parallel") == 0) {
+            parallel_detect = true;
+        } else if (strcmp(argv[arg], "-dmabuf") == 0) {
+            export_dmabuf = true;
+        } else if (strcmp(argv[arg], "-pyramid") == 0) {
+            build_pyramid = true;
+        } else {
+            usage();
+        }
+        ++arg;
+    }
     int cam_count = 1;
+    if (arg < argc) cam_count = atoi(argv[arg++]);
+    if (arg < argc || cam_count < 1 || cam_count > CAM_COUNT ||
+        (use_reactor && use_sync) || (use_sync && cam_count < 2)) {
+        usage();
+    }
+
+    target_range.y_min = 100;
+    target_range.u_max = 100;
+    target_range.v_max = 100;
+
+    /* Let the planner pick each camera's format, size and frame interval
+       from what it supports; the notes above are what its cost model is
+       fitted to.  In MJPEG mode the cameras can send 640x480 at full rate
+       over USB 2.0; the frames are then decoded to YUYV on a pool of
+       worker threads.  Only the cam_thread() path has decoders, so with
+       -reactor or -sync MJPEG is never chosen.  Detection needs packed
+       4:2:2 color, so gray modes never are either.  If no mode fits, fall
+       back to the one found by trial and error. */
+
+    cap_cache.load("/var/tmp/capture4_caps");
+    for (int i = 0; i < CAM_COUNT; ++i) cam[i].set_cap_cache(&cap_cache);
+
+    const char* dev_name[CAM_COUNT] = { "/dev/video10", "/dev/video11" };
+    Mode_Planner planner;
+    planner.remove_cost(V4L2_PIX_FMT_GREY);
+    if (use_reactor || use_sync) planner.remove_cost(V4L2_PIX_FMT_MJPEG);
+    Mode_Need need;
+    need.min_fps = 60.0;
+    need.min_rows = 240;
+    need.min_cols = 320;
+    need.cam_count = cam_count;
+    for (int i = 0; i < cam_count; ++i) {
+        cam[i].open_device(dev_name[i]);
+        Mode_Plan mode;
+        if (planner.plan(cam[i], need, mode, stdout)) {
+            cam[i].init(dev_name[i], mode.format_id, mode.rows, mode.cols,
+                        CAPTURE_BUFS, export_dmabuf);
+            cam[i].set_frame_interval(mode.numerator, mode.denominator);
+        } else {
+            cam[i].init(dev_name[i], 2, 240, 320, CAPTURE_BUFS,
+                        export_dmabuf);
+            cam[i].set_frame_interval(1, 60);
+        }
+    }
     for (int i = 0; i < cam_count; ++i) {
         const int STR_BYTES = 81;
         char str[STR_BYTES];
@@ -66,10 +216,95 @@ int main()
                Usb_Camera::frame_interval_str(frm_ival[j], STR_BYTES, str));
         }
     }
+    printf("capability cache: %d hits, %d misses\n",
+           cap_cache.get_hit_count(), cap_cache.get_miss_count());
+    if (!cap_cache.save()) printf("can't save capability cache\n");
 
+    /* Give each camera's capture thread a core of its own, under
+       SCHED_FIFO, so nothing else delays its dequeues.  The display shares
+       core 0 with the rest of the system; processing runs wherever there
+       is room.  Core 0 is left to the system's interrupts. */
+
+    const int CAPTURE_PRIORITY = 50;
     for (int i = 0; i < cam_count; ++i) {
+        cam_arg[i].placement[THREAD_ROLE_CAPTURE] =
+                Thread_Placement(1 + i, SCHED_FIFO, CAPTURE_PRIORITY);
+        cam_arg[i].placement[THREAD_ROLE_PROCESS] =
+                Thread_Placement(-1, SCHED_OTHER, 0);
+        cam_arg[i].placement[THREAD_ROLE_DISPLAY] =
+                Thread_Placement(0, SCHED_OTHER, 0);
+    }
+
+    /* On the robot there is no X server; run without a display, and
+       watch the preview instead. */
+
+    bool headless = (getenv("DISPLAY") == NULL);
+#ifdef HEADLESS
+    headless = true;
+#endif
+    if (headless) printf("no display; running headless\n");
+
+    // Print latency and throughput summaries once a second.
+
+    pipeline_stats.start_reporter(1.0);
+
+    if (use_reactor) {
+        static Usb_Camera* cam_ptr[CAM_COUNT];
+        static Multi_Cam_Thread_Arg multi_arg;
+        for (int i = 0; i < cam_count; ++i) cam_ptr[i] = &cam[i];
+        multi_arg.cam_count = cam_count;
+        multi_arg.cam_ptr = cam_ptr;
+        multi_arg.headless = headless;
+        multi_arg.placement[THREAD_ROLE_CAPTURE] =
+                Thread_Placement(1, SCHED_FIFO, CAPTURE_PRIORITY);
+        multi_arg.placement[THREAD_ROLE_DISPLAY] =
+                Thread_Placement(0, SCHED_OTHER, 0);
+        int rc = pthread_create(&thread_id[0], NULL, multi_cam_thread,
+                                (void*)&multi_arg);
+        if (rc != 0) {
+            printf("can't pthread_create, error_code= %d\n", rc);
+            exit(-1);
+        }
+        pthread_exit(NULL);
+    }
+
+    if (use_sync) run_stereo(cam_count, CAPTURE_PRIORITY);
+
+    /* With one camera, capture and display keep to cores 1 and 0, which
+       leaves two cores for detection to work on two frames at once. */
+
+    const int DETECT_WORKERS = 2;
+    for (int i = 0; i < cam_count; ++i) {
+        cam_arg[i].cam_ptr = &cam[i];
+        if (cam[i].get_pixel_format() == V4L2_PIX_FMT_MJPEG) {
+            decoder[i].init(&cam[i], MJPEG_OUT_YUYV, 1, 2, 4);
+            decoder[i].set_worker_placement(
+                                cam_arg[i].placement[THREAD_ROLE_PROCESS]);
+            cam_arg[i].cam_ptr = &decoder[i];
+        }
+        cam_arg[i].queue_type = CAM_QUEUE_SPSC;
+        cam_arg[i].headless = headless;
+        cam_arg[i].target_range_ptr = &target_range;
+        cam_arg[i].target_sweep_period = 30;
+        cam_arg[i].build_pyramid = build_pyramid;
+        if (parallel_detect && cam_count == 1) {
+            cam_arg[i].detect_workers = DETECT_WORKERS;
+        }
+        if (publisher[i].add_destination("10.6.96.2", 5800 + i)) {
+            cam_arg[i].publisher_ptr = &publisher[i];
+        } else {
+            printf("can't publish results\n");
+        }
+        Any_Camera* out_cam_ptr = cam_arg[i].cam_ptr;
+        if (preview[i].start(5805 + i, out_cam_ptr->get_rows(),
+                             out_cam_ptr->get_cols(),
+                             out_cam_ptr->get_pixel_format(), 4, 2, 60)) {
+            cam_arg[i].preview_ptr = &preview[i];
+        } else {
+            printf("can't serve preview on port %d\n", 5805 + i);
+        }
         int rc = pthread_create(&thread_id[i], NULL, cam_thread,
-                                (void*)&cam[i]);
+                                (void*)&cam_arg[i]);
         if (rc != 0) {
             printf("can't pthread_create, error_code= %d\n", rc);
             exit(-1);
@@ -0,0 +1,152 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "capture_file.h"
+
+Capture_File::Capture_File()
+: fd(-1),
+  map_ptr(NULL),
+  map_bytes(0),
+  header_ptr(NULL),
+  index_ptr(NULL)
+{ }
+
+Capture_File::~Capture_File()
+{
+    close();
+}
+
+bool Capture_File::open(const char* file_name)
+{
+    close();
+    fd = ::open(file_name, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        (size_t)st.st_size < sizeof(Capture_File_Header)) {
+        close();
+        return false;
+    }
+    map_bytes = st.st_size;
+    void* p = mmap(NULL, map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        map_ptr = NULL;
+        close();
+        return false;
+    }
+    map_ptr = (uint8_t*)p;
+    header_ptr = (const Capture_File_Header*)map_ptr;
+    const Capture_File_Header& h = *header_ptr;
+    if (memcmp(h.magic, CAPTURE_FILE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.record_count > h.index_capacity ||
+        h.frame_bytes > h.slot_bytes ||
+        h.index_offset + (uint64_t)h.index_capacity *
+                         sizeof(Capture_Index_Entry) > map_bytes ||
+        h.data_offset + (uint64_t)h.index_capacity * h.slot_bytes >
+                         map_bytes) {
+        close();
+        return false;
+    }
+    index_ptr = (const Capture_Index_Entry*)(map_ptr + h.index_offset);
+    return true;
+}
+
+void Capture_File::close()
+{
+    if (map_ptr != NULL) munmap(map_ptr, map_bytes);
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    map_ptr = NULL;
+    header_ptr = NULL;
+    index_ptr = NULL;
+}
+
+namespace {
+
+struct Sequence_Key {
+    int64_t operator()(const Capture_Index_Entry& e) const
+    {
+        return e.sequence;
+    }
+};
+
+struct Timestamp_Key {
+    int64_t operator()(const Capture_Index_Entry& e) const
+    {
+        return e.timestamp_usec;
+    }
+};
+
+}
+
+// The most records search_from() steps past its guess before it searches
+// by halves instead.
+static const int MAX_WALK = 8;
+
+template <typename Key_Func>
+int Capture_File::search_from(int guess, int64_t key, Key_Func key_func) const
+{
+    int count = get_record_count();
+    if (count == 0) return 0;
+    if (guess < 0) guess = 0;
+    if (guess >= count) guess = count - 1;
+
+    /* The answer lies in [lo, hi].  Walk a few records from the guess,
+       which is usually right or nearly so, narrowing the range as we go. */
+
+    int lo = 0;
+    int hi = count;
+    int i = guess;
+    if (key_func(index_ptr[i]) < key) {
+        lo = i + 1;
+        for (int n = 0; n < MAX_WALK && lo < hi; ++n, ++lo) {
+            if (key_func(index_ptr[lo]) >= key) return lo;
+        }
+    } else {
+        hi = i;
+        for (int n = 0; n < MAX_WALK && hi > lo; ++n, --hi) {
+            if (key_func(index_ptr[hi - 1]) < key) return hi;
+        }
+    }
+
+    // Many frames were dropped, or the rate wasn't steady.
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (key_func(index_ptr[mid]) < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int Capture_File::find_frame_num(uint32_t frame_num) const
+{
+    if (get_record_count() == 0) return 0;
+    int64_t guess = (int64_t)frame_num - index_ptr[0].sequence;
+    if (guess > 0x7fffffff) guess = 0x7fffffff;
+    return search_from((int)guess, frame_num, Sequence_Key());
+}
+
+int Capture_File::find_timestamp(int64_t timestamp_usec) const
+{
+    int count = get_record_count();
+    if (count == 0) return 0;
+    int64_t first = index_ptr[0].timestamp_usec;
+    int64_t last = index_ptr[count - 1].timestamp_usec;
+    int guess = 0;
+    if (last > first) {
+        double f = (double)(timestamp_usec - first) / (last - first);
+        if (f < 0.0) f = 0.0;
+        if (f > 1.0) f = 1.0;
+        guess = (int)(f * (count - 1) + 0.5);
+    }
+    return search_from(guess, timestamp_usec, Timestamp_Key());
+}
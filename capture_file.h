@@ -0,0 +1,152 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**********************************************************************
+ * @brief Layout of a file of recorded raw frames.
+ *
+ * A capture file is allocated at its full size when recording starts,
+ * and is written through a shared memory map.  It holds three regions:
+ *
+ *   offset 0             Capture_File_Header
+ *   index_offset         index_capacity Capture_Index_Entry structs
+ *   data_offset          index_capacity slots of slot_bytes each
+ *
+ * Record i's image data is in slot i, at data_offset + i * slot_bytes.
+ * Images of packed formats are stored with their rows packed, whatever
+ * the driver's padding, so a row is cols times the bytes per pixel.
+ * Records appear in the order they were captured, so frame numbers and
+ * timestamps increase with i.  record_count is updated after a record's
+ * data and index entry are complete, so a reader never sees a partial
+ * record.  All fields are in host byte order.
+ */
+
+/** The value of Capture_File_Header::magic. */
+#define CAPTURE_FILE_MAGIC "CAPFILE2"
+
+struct Capture_File_Header {
+    char magic[8];           /// CAPTURE_FILE_MAGIC, without the NUL.
+    uint32_t pixel_format;   /// fourcc code (V4L2_PIX_FMT_XXXX).
+    int32_t rows;            /// Rows in every image.
+    int32_t cols;            /// Columns in every image.
+    uint32_t frame_bytes;    /// Maximum bytes of image data per record.
+    uint32_t slot_bytes;     /// frame_bytes rounded up to a page.
+    uint32_t index_capacity; /// Maximum number of records.
+    uint32_t record_count;   /// Number of complete records.
+    uint32_t reserved;
+    uint64_t index_offset;   /// File offset of the index.
+    uint64_t data_offset;    /// File offset of slot 0.
+};
+
+struct Capture_Index_Entry {
+    uint32_t sequence;       /// Usb_Frame::get_frame_num() when recorded.
+    uint32_t bytesused;      /// Meaningful bytes of image data.
+    uint32_t flags;          /// Usb_Frame::get_flags() when recorded.
+    uint32_t reserved;
+    int64_t timestamp_usec;  /// Usb_Frame::get_timestamp_nsec() / 1000.
+};
+
+
+/**********************************************************************
+ * @brief Read access to a capture file through a memory map.
+ */
+class Capture_File {
+private:
+    int fd;
+    uint8_t* map_ptr;
+    size_t map_bytes;
+    const Capture_File_Header* header_ptr;
+    const Capture_Index_Entry* index_ptr;
+
+    /*******************************************************************//*
+     * @brief Return the first record whose key is >= the given key, where
+     *        key(i) is increasing in i, searching from record guess.
+     *
+     * A few steps either way from guess find the answer when the guess is
+     * close; otherwise the search narrows by halves.
+     */
+    template <typename Key_Func>
+    int search_from(int guess, int64_t key, Key_Func key_func) const;
+
+public:
+    Capture_File();
+    ~Capture_File();
+
+    /*******************************************************************//*
+     * @brief Map the given capture file for reading.
+     *
+     * @return False if the file can't be opened, isn't a capture file, or
+     *         is truncated or corrupt: its header must describe an index
+     *         and data that fit in the file, no more records than the
+     *         index holds, and frames that fit in their slots.  Index
+     *         entries are not checked; a reader must not trust an entry's
+     *         bytesused beyond frame_bytes.
+     */
+    bool open(const char* file_name);
+
+    /*******************************************************************//*
+     * @brief Unmap and close the file.
+     */
+    void close();
+
+    const Capture_File_Header& get_header() const
+    {
+        return *header_ptr;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of complete records.
+     */
+    int get_record_count() const
+    {
+        uint32_t count = __atomic_load_n(&header_ptr->record_count,
+                                         __ATOMIC_ACQUIRE);
+        return (int)((count <= header_ptr->index_capacity) ?
+                     count : header_ptr->index_capacity);
+    }
+
+    /*******************************************************************//*
+     * @brief Return the index entry of record i.
+     */
+    const Capture_Index_Entry& get_entry(int i) const
+    {
+        return index_ptr[i];
+    }
+
+    /*******************************************************************//*
+     * @brief Return the image data of record i.
+     */
+    const uint8_t* get_data(int i) const
+    {
+        return map_ptr + header_ptr->data_offset +
+               (size_t)i * header_ptr->slot_bytes;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the first record with a frame number >= frame_num,
+     *        or get_record_count() if there is none.
+     *
+     * Frame numbers grow by one per frame less any dropped frames, so the
+     * search starts at the exact answer for a recording with no drops, and
+     * takes constant time unless frames were dropped before the one
+     * sought; then it takes time logarithmic in the number of records.
+     */
+    int find_frame_num(uint32_t frame_num) const;
+
+    /*******************************************************************//*
+     * @brief Return the first record with a timestamp >= timestamp_usec,
+     *        or get_record_count() if there is none.
+     *
+     * The search starts at the record interpolated from the first and
+     * last timestamps, which for a steady frame rate is the answer; at
+     * worst it takes time logarithmic in the number of records.
+     */
+    int find_timestamp(int64_t timestamp_usec) const;
+};
+
+#endif
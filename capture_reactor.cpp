@@ -0,0 +1,77 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "capture_reactor.h"
+
+Capture_Reactor::Capture_Reactor()
+: cam_count(0),
+  stop_requested(false)
+{
+    epoll_fd = epoll_create(MAX_CAMERAS);
+    if (epoll_fd < 0) throw Usb_Cam_Err("Capture_Reactor: epoll_create failed");
+}
+
+Capture_Reactor::~Capture_Reactor()
+{
+    close(epoll_fd);
+}
+
+int Capture_Reactor::add(Usb_Camera* cam_arg_ptr,
+                         Any_Frame_Queue* out_arg_ptr,
+                         Stage_Stats* stats_arg_ptr)
+{
+    if (cam_count >= MAX_CAMERAS) return -1;
+    int index = cam_count;
+    struct epoll_event ev = { 0 };
+    ev.events = EPOLLIN;
+    ev.data.u32 = index;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cam_arg_ptr->get_fd(), &ev) < 0) {
+        throw Usb_Cam_Err("Capture_Reactor: epoll_ctl failed");
+    }
+    cam_ptr[index] = cam_arg_ptr;
+    out_queue_ptr[index] = out_arg_ptr;
+    drop_count[index] = 0;
+    stats_ptr[index] = stats_arg_ptr;
+    ++cam_count;
+    return index;
+}
+
+int Capture_Reactor::run_once(int timeout_ms)
+{
+    struct epoll_event ev[MAX_CAMERAS];
+    int n = epoll_wait(epoll_fd, ev, MAX_CAMERAS, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
+        throw Usb_Cam_Err("Capture_Reactor: epoll_wait failed");
+    }
+    for (int i = 0; i < n; ++i) {
+        int index = ev[i].data.u32;
+        int count;
+        Stage_Stats* sp = stats_ptr[index];
+        if (sp != NULL) sp->begin_pop();
+        Usb_Frame* frame_ptr = cam_ptr[index]->dequeue(count);
+        if (sp != NULL) {
+            sp->end_pop(frame_ptr);
+            sp->end_process();
+        }
+        if (out_queue_ptr[index]->push(frame_ptr) < 0) {
+
+            // The consumer is behind.  Drop the frame rather than wait.
+
+            ++drop_count[index];
+            cam_ptr[index]->push(frame_ptr);
+        }
+    }
+    return n;
+}
+
+void Capture_Reactor::run()
+{
+    for (int i = 0; i < cam_count; ++i) cam_ptr[i]->stream_start();
+    while (!stop_requested) {
+        run_once(100);
+    }
+}
@@ -0,0 +1,88 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef CAPTURE_REACTOR_H
+#define CAPTURE_REACTOR_H
+
+#include "usb_camera.h"
+#include "pipeline_stats.h"
+
+/**********************************************************************
+ * @brief Captures frames from several cameras with a single thread.
+ *
+ * The file descriptors of all registered cameras are watched by one
+ * epoll(7) instance.  Whenever a camera has a frame ready, the reactor
+ * dequeues it and pushes it onto that camera's output queue.
+ *
+ * The reactor thread must never block on one camera's behalf, or it would
+ * delay all the others.  So output queues should be non-blocking on push
+ * (a Mailbox_Frame_Queue, or a Frame_Queue or Spsc_Frame_Queue created with
+ * block_on_full false).  If a push fails because the queue is full, the
+ * frame is dropped and given straight back to its camera.
+ */
+class Capture_Reactor {
+private:
+    /** The maximum number of cameras one reactor can serve. */
+    static const int MAX_CAMERAS = 8;
+
+    int epoll_fd;                              /// from epoll_create(2)
+    int cam_count;                             /// cameras registered
+    Usb_Camera* cam_ptr[MAX_CAMERAS];          /// the cameras
+    Any_Frame_Queue* out_queue_ptr[MAX_CAMERAS];  /// where frames go
+    int drop_count[MAX_CAMERAS];               /// frames dropped, per camera
+    Stage_Stats* stats_ptr[MAX_CAMERAS];       /// timing, per camera, or NULL
+    volatile bool stop_requested;
+
+public:
+    Capture_Reactor();
+    ~Capture_Reactor();
+
+    /*******************************************************************//*
+     * @brief Register a camera.
+     *
+     * @param [in] cam_ptr        An initialized camera.  Its frames are
+     *                            pushed to out_queue_ptr, and consumers must
+     *                            push them back to the camera when done.
+     * @param [in] out_queue_ptr  The camera's output queue.
+     * @param [in] stats_ptr      If not NULL, the dequeue of every frame
+     *                            from this camera is recorded here.
+     * @return The index of the camera within this reactor, or -1 if
+     *         MAX_CAMERAS are already registered.
+     */
+    int add(Usb_Camera* cam_ptr,
+            Any_Frame_Queue* out_queue_ptr,
+            Stage_Stats* stats_ptr = NULL);
+
+    /*******************************************************************//*
+     * @brief Start streaming on all cameras, then dispatch frames until
+     *        stop() is called.
+     */
+    void run();
+
+    /*******************************************************************//*
+     * @brief Wait for and dispatch one round of ready frames.
+     *
+     * @param [in] timeout_ms  The maximum time to wait; -1 waits forever.
+     * @return The number of frames dispatched (or dropped).
+     */
+    int run_once(int timeout_ms);
+
+    /*******************************************************************//*
+     * @brief Ask run() to return after the current round.
+     */
+    void stop()
+    {
+        stop_requested = true;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of frames dropped from the given camera
+     *        because its output queue was full.
+     */
+    int get_drop_count(int cam_index) const
+    {
+        return drop_count[cam_index];
+    }
+};
+
+#endif
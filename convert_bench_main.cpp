@@ -0,0 +1,182 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+
+/* Check the vector color conversion kernels against the scalar reference,
+   then measure the throughput of each kernel at the frame sizes we
+   capture. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include "yuv_convert.h"
+
+typedef void (*Convert_Func)(Yuv422_Order order,
+                             const uint8_t* src, int src_step,
+                             uint8_t* dst, int dst_step,
+                             int rows, int cols);
+
+static double now_secs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The threshold kernels take a range; wrap them to fit Convert_Func.  The
+   range is chosen so that random input lands on both sides of every
+   bound. */
+
+static Yuv_Range bench_range;
+
+static void threshold(Yuv422_Order order, const uint8_t* src, int src_step,
+                      uint8_t* dst, int dst_step, int rows, int cols)
+{
+    yuv422_threshold(order, src, src_step, bench_range, dst, dst_step,
+                     rows, cols);
+}
+
+static void threshold_scalar(Yuv422_Order order,
+                             const uint8_t* src, int src_step,
+                             uint8_t* dst, int dst_step, int rows, int cols)
+{
+    yuv422_threshold_scalar(order, src, src_step, bench_range, dst, dst_step,
+                            rows, cols);
+}
+
+/* The gray reduction takes a 1 byte per pixel image, which doesn't care
+   about order; treat each row of the 4:2:2 source as 2 * cols gray
+   pixels. */
+
+static void gray_half_wrap(Yuv422_Order, const uint8_t* src, int src_step,
+                           uint8_t* dst, int dst_step, int rows, int cols)
+{
+    gray_half(src, src_step, dst, dst_step, rows, 2 * cols);
+}
+
+static void gray_half_scalar_wrap(Yuv422_Order,
+                                  const uint8_t* src, int src_step,
+                                  uint8_t* dst, int dst_step,
+                                  int rows, int cols)
+{
+    gray_half_scalar(src, src_step, dst, dst_step, rows, 2 * cols);
+}
+
+static const char* order_name(Yuv422_Order order)
+{
+    return (order == YUV422_YUYV) ? "YUYV" : "UYVY";
+}
+
+// Return the number of bytes that differ between func and ref_func.
+static int compare(const char* name, Convert_Func func, Convert_Func ref_func,
+                   Yuv422_Order order, const uint8_t* src,
+                   int rows, int cols, int channels)
+{
+    int dst_bytes = rows * cols * channels;
+
+    // Cleared, since the reductions don't write every byte.
+
+    uint8_t* dst = (uint8_t*)calloc(dst_bytes, 1);
+    uint8_t* ref = (uint8_t*)calloc(dst_bytes, 1);
+    func(order, src, 2 * cols, dst, cols * channels, rows, cols);
+    ref_func(order, src, 2 * cols, ref, cols * channels, rows, cols);
+    int mismatch = 0;
+    for (int i = 0; i < dst_bytes; ++i) {
+        if (dst[i] != ref[i]) ++mismatch;
+    }
+    printf("check %-5s %s %dx%d: %s", name, order_name(order), rows, cols,
+           mismatch == 0 ? "ok\n" : "MISMATCH");
+    if (mismatch != 0) printf(" (%d bytes)\n", mismatch);
+    free(ref);
+    free(dst);
+    return mismatch;
+}
+
+static void bench(const char* name, Convert_Func func, Yuv422_Order order,
+                  const uint8_t* src, int rows, int cols, int channels)
+{
+    uint8_t* dst = (uint8_t*)malloc(rows * cols * channels);
+
+    // Warm up, then run for at least half a second.
+
+    func(order, src, 2 * cols, dst, cols * channels, rows, cols);
+    int iters = 0;
+    double start = now_secs();
+    double elapsed;
+    do {
+        for (int i = 0; i < 10; ++i) {
+            func(order, src, 2 * cols, dst, cols * channels, rows, cols);
+        }
+        iters += 10;
+        elapsed = now_secs() - start;
+    } while (elapsed < 0.5);
+    double usec_per_frame = elapsed / iters * 1e6;
+    printf("bench %-12s %s %3dx%3d: %8.1f usec/frame %7.1f Mpix/s\n",
+           name, order_name(order), rows, cols, usec_per_frame,
+           rows * cols / usec_per_frame);
+    free(dst);
+}
+
+int main()
+{
+    const int SIZES = 2;
+    const int size_rows[SIZES] = { 240, 480 };
+    const int size_cols[SIZES] = { 320, 640 };
+    const Yuv422_Order orders[2] = { YUV422_YUYV, YUV422_UYVY };
+
+    printf("kernels: %s\n", yuv_convert_simd_name());
+    bench_range.y_min = 20;
+    bench_range.y_max = 230;
+    bench_range.u_min = 40;
+    bench_range.u_max = 200;
+    bench_range.v_min = 30;
+    bench_range.v_max = 220;
+    int mismatch = 0;
+    for (int s = 0; s < SIZES; ++s) {
+        int rows = size_rows[s];
+        int cols = size_cols[s];
+        uint8_t* src = (uint8_t*)malloc(rows * cols * 2);
+        srand(1);
+        for (int i = 0; i < rows * cols * 2; ++i) src[i] = rand() & 0xff;
+
+        for (int o = 0; o < 2; ++o) {
+            mismatch += compare("bgr", yuv422_to_bgr, yuv422_to_bgr_scalar,
+                                orders[o], src, rows, cols, 3);
+            mismatch += compare("gray", yuv422_to_gray, yuv422_to_gray_scalar,
+                                orders[o], src, rows, cols, 1);
+            mismatch += compare("hsv", yuv422_to_hsv, yuv422_to_hsv_scalar,
+                                orders[o], src, rows, cols, 3);
+            mismatch += compare("thresh", threshold, threshold_scalar,
+                                orders[o], src, rows, cols, 1);
+            mismatch += compare("lhalf", yuv422_luma_half,
+                                yuv422_luma_half_scalar,
+                                orders[o], src, rows, cols, 1);
+        }
+        mismatch += compare("ghalf", gray_half_wrap, gray_half_scalar_wrap,
+                            YUV422_YUYV, src, rows, cols, 1);
+        for (int o = 0; o < 2; ++o) {
+            bench("bgr", yuv422_to_bgr, orders[o], src, rows, cols, 3);
+            bench("bgr_scalar", yuv422_to_bgr_scalar, orders[o], src,
+                  rows, cols, 3);
+            bench("gray", yuv422_to_gray, orders[o], src, rows, cols, 1);
+            bench("gray_scalar", yuv422_to_gray_scalar, orders[o], src,
+                  rows, cols, 1);
+            bench("hsv", yuv422_to_hsv, orders[o], src, rows, cols, 3);
+            bench("hsv_scalar", yuv422_to_hsv_scalar, orders[o], src,
+                  rows, cols, 3);
+            bench("thresh", threshold, orders[o], src, rows, cols, 1);
+            bench("thresh_scalar", threshold_scalar, orders[o], src,
+                  rows, cols, 1);
+            bench("lhalf", yuv422_luma_half, orders[o], src, rows, cols, 1);
+            bench("lhalf_scalar", yuv422_luma_half_scalar, orders[o], src,
+                  rows, cols, 1);
+        }
+        bench("ghalf", gray_half_wrap, YUV422_YUYV, src, rows, cols, 1);
+        bench("ghalf_scalar", gray_half_scalar_wrap, YUV422_YUYV, src,
+              rows, cols, 1);
+        free(src);
+    }
+    return (mismatch == 0) ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+
+/* Run the capture pipeline on a synthetic camera, with either the display
+   or the headless sink as its last stage, and report what the last stage
+   costs:
+
+     startup   time from main() to the first frame coming back to the
+               camera, which includes creating the display window
+     cpu       process CPU time per frame once running, for every thread
+     rss       resident memory at the end, and its peak
+     libs      shared libraries mapped; HighGUI brings in dozens
+
+   Build it both ways ("make display_bench" and "make HEADLESS=1
+   display_bench") to compare; a full build can also be run with -headless
+   to skip the display at run time, though the libraries are then still
+   loaded.
+
+   Usage: display_bench [-headless] [seconds [rows cols [fps]]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "synthetic_camera.h"
+#include "cam_thread.h"
+#include "pipeline_stats.h"
+
+pthread_mutex_t disp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* A Synthetic_Camera that counts the frames given back to it, so the
+   benchmark knows when the pipeline is running and how much it did. */
+class Counting_Camera: public Synthetic_Camera {
+public:
+    int returned_count;
+    int64_t first_usec;
+
+    Counting_Camera()
+    : returned_count(0),
+      first_usec(0)
+    { }
+
+    virtual int push(Usb_Frame* frame_ptr)
+    {
+        if (__atomic_add_fetch(&returned_count, 1, __ATOMIC_RELAXED) == 1) {
+            __atomic_store_n(&first_usec, monotonic_usec(), __ATOMIC_RELAXED);
+        }
+        return Synthetic_Camera::push(frame_ptr);
+    }
+};
+
+static int64_t cpu_usec()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    int64_t secs = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec;
+    return secs * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Return the value in kB of the given field of /proc/self/status.
+static long status_kb(const char* field)
+{
+    FILE* file_ptr = fopen("/proc/self/status", "r");
+    if (file_ptr == NULL) return -1;
+    char line[256];
+    long kb = -1;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), file_ptr) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            kb = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(file_ptr);
+    return kb;
+}
+
+// Return the number of distinct shared libraries mapped.
+static int shared_lib_count()
+{
+    FILE* file_ptr = fopen("/proc/self/maps", "r");
+    if (file_ptr == NULL) return -1;
+    char line[512];
+    char last[512] = "";
+    int count = 0;
+    while (fgets(line, sizeof(line), file_ptr) != NULL) {
+        char* path = strchr(line, '/');
+        if (path == NULL || strstr(path, ".so") == NULL) continue;
+        if (strcmp(path, last) != 0) {
+            ++count;
+            strcpy(last, path);
+        }
+    }
+    fclose(file_ptr);
+    return count;
+}
+
+int main(int argc, char** argv)
+{
+    int64_t start_usec = monotonic_usec();
+    bool headless = false;
+#ifdef HEADLESS
+    headless = true;
+#endif
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-headless") == 0) {
+        headless = true;
+        ++arg;
+    }
+    double secs = (arg < argc) ? atof(argv[arg++]) : 10.0;
+    int rows = (arg + 1 < argc) ? atoi(argv[arg]) : 480;
+    int cols = (arg + 1 < argc) ? atoi(argv[arg + 1]) : 640;
+    if (arg + 1 < argc) arg += 2;
+    double fps = (arg < argc) ? atof(argv[arg]) : 30.0;
+
+    static Counting_Camera cam;
+    cam.init("bench", rows, cols, fps, 4);
+    static Cam_Thread_Arg cam_arg;
+    cam_arg.cam_ptr = &cam;
+    cam_arg.queue_type = CAM_QUEUE_SPSC;
+    cam_arg.headless = headless;
+    pthread_t thread_id;
+    int rc = pthread_create(&thread_id, NULL, cam_thread, (void*)&cam_arg);
+    if (rc != 0) {
+        printf("can't pthread_create, error_code= %d\n", rc);
+        exit(-1);
+    }
+
+    // Wait for the first frame to make it all the way through.
+
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000;
+    while (__atomic_load_n(&cam.returned_count, __ATOMIC_RELAXED) == 0) {
+        nanosleep(&ts, NULL);
+    }
+    int64_t first_usec = __atomic_load_n(&cam.first_usec, __ATOMIC_RELAXED);
+
+    int64_t cpu_begin = cpu_usec();
+    int count_begin = __atomic_load_n(&cam.returned_count, __ATOMIC_RELAXED);
+    ts.tv_sec = (time_t)secs;
+    ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+    int64_t cpu = cpu_usec() - cpu_begin;
+    int frames = __atomic_load_n(&cam.returned_count, __ATOMIC_RELAXED) -
+                 count_begin;
+
+    printf("mode %s, %dx%d at %.0f fps for %.1f s\n",
+           headless ? "headless" : "display", cols, rows, fps, secs);
+    printf("startup_ms %.1f\n", (first_usec - start_usec) / 1000.0);
+    printf("frames %d\n", frames);
+    printf("cpu_usec_per_frame %.1f\n",
+           frames > 0 ? (double)cpu / frames : 0.0);
+    printf("rss_kb %ld\n", status_kb("VmRSS"));
+    printf("peak_rss_kb %ld\n", status_kb("VmHWM"));
+    printf("shared_libs %d\n", shared_lib_count());
+    fflush(stdout);
+
+    // The pipeline threads never return; just leave.
+
+    exit(0);
+}
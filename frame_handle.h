@@ -0,0 +1,119 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef FRAME_HANDLE_H
+#define FRAME_HANDLE_H
+
+#include <stddef.h>
+#include "usb_camera.h"
+
+/**********************************************************************
+ * @brief A counted reference to a Usb_Frame.
+ *
+ * Copying a handle adds a reference to the frame; destroying or resetting
+ * a handle releases one.  When the last reference goes away the frame is
+ * given back to its camera, which re-queues the buffer to the driver.
+ * This lets several consumers hold on to one captured buffer, each for as
+ * long as it needs, without copying the image.
+ */
+class Frame_Handle {
+private:
+    Usb_Frame* frame_ptr;
+
+public:
+
+    /*******************************************************************//*
+     * @brief Construct an empty handle.
+     */
+    Frame_Handle()
+    : frame_ptr(NULL)
+    { }
+
+    /*******************************************************************//*
+     * @brief Construct a handle that takes over a reference the caller
+     *        already holds, such as the one returned by a camera's pop().
+     */
+    explicit Frame_Handle(Usb_Frame* adopt_ptr)
+    : frame_ptr(adopt_ptr)
+    { }
+
+    Frame_Handle(const Frame_Handle& other)
+    : frame_ptr(other.frame_ptr)
+    {
+        if (frame_ptr != NULL) frame_ptr->add_ref();
+    }
+
+    ~Frame_Handle()
+    {
+        reset();
+    }
+
+    Frame_Handle& operator=(const Frame_Handle& other)
+    {
+        if (other.frame_ptr != NULL) other.frame_ptr->add_ref();
+        reset();
+        frame_ptr = other.frame_ptr;
+        return *this;
+    }
+
+    /*******************************************************************//*
+     * @brief Release the reference, if any, and take over the one given,
+     *        which the caller already holds; by default, leave the handle
+     *        empty.
+     */
+    void reset(Usb_Frame* adopt_ptr = NULL)
+    {
+        Usb_Frame* old_ptr = frame_ptr;
+        frame_ptr = adopt_ptr;
+        if (old_ptr != NULL) old_ptr->release();
+    }
+
+    /*******************************************************************//*
+     * @brief Give up the reference without releasing it, leaving the handle
+     *        empty.  The caller becomes responsible for the reference.
+     */
+    Usb_Frame* detach()
+    {
+        Usb_Frame* old_ptr = frame_ptr;
+        frame_ptr = NULL;
+        return old_ptr;
+    }
+
+    Usb_Frame* get() const { return frame_ptr; }
+    Usb_Frame* operator->() const { return frame_ptr; }
+    bool empty() const { return frame_ptr == NULL; }
+};
+
+
+/**********************************************************************
+ * @brief A queue that releases every frame pushed onto it.
+ *
+ * Use one as the output queue of a pipeline stage whose input frames are
+ * shared with other stages: instead of pushing a frame straight back to
+ * the camera, the stage drops its reference, and the frame goes back to
+ * the camera only when every stage is done with it.
+ */
+class Frame_Releaser: public Any_Frame_Queue {
+public:
+
+    /*******************************************************************//*
+     * @brief Release one reference to the given frame.
+     *
+     * @return The number of references that remain.
+     */
+    virtual int push(Usb_Frame* frame_ptr)
+    {
+        return frame_ptr->release();
+    }
+
+    /*******************************************************************//*
+     * @brief Always returns NULL; nothing is ever stored.
+     */
+    virtual Usb_Frame* pop(int& count)
+    {
+        count = 0;
+        return NULL;
+    }
+};
+
+#endif
@@ -0,0 +1,128 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <linux/videodev2.h>
+#include "frame_pyramid.h"
+#include "yuv_convert.h"
+
+Frame_Pyramid::Frame_Pyramid()
+: buf_count(0),
+  rows(0),
+  cols(0),
+  pixel_format(0),
+  buf_bytes(0),
+  arena(NULL),
+  built(NULL),
+  last_usec(0)
+{
+    for (int i = 0; i < LEVEL_COUNT; ++i) {
+        level_rows[i] = 0;
+        level_cols[i] = 0;
+        level_step[i] = 0;
+        level_offset[i] = 0;
+    }
+}
+
+Frame_Pyramid::~Frame_Pyramid()
+{
+    delete[] built;
+    delete[] arena;
+}
+
+bool Frame_Pyramid::supports(uint32_t pixel_format)
+{
+    return (pixel_format == V4L2_PIX_FMT_YUYV ||
+            pixel_format == V4L2_PIX_FMT_UYVY ||
+            pixel_format == V4L2_PIX_FMT_GREY);
+}
+
+void Frame_Pyramid::init(int arg_buf_count,
+                         int arg_rows,
+                         int arg_cols,
+                         uint32_t arg_pixel_format)
+{
+    if (!supports(arg_pixel_format)) {
+        throw Usb_Cam_Err("Frame_Pyramid: unsupported pixel format");
+    }
+    delete[] built;
+    delete[] arena;
+    buf_count = arg_buf_count;
+    rows = arg_rows;
+    cols = arg_cols;
+    pixel_format = arg_pixel_format;
+
+    level_rows[0] = rows;
+    level_cols[0] = cols;
+    level_step[0] = 0;   // the frame's own step
+
+    // Round each row up to 16 bytes, so every row starts aligned.
+
+    buf_bytes = 0;
+    for (int i = 1; i < LEVEL_COUNT; ++i) {
+        level_rows[i] = level_rows[i - 1] / 2;
+        level_cols[i] = level_cols[i - 1] / 2;
+        level_step[i] = (level_cols[i] + 15) & ~15;
+        level_offset[i] = buf_bytes;
+        buf_bytes += (size_t)level_rows[i] * level_step[i];
+    }
+    arena = new uint8_t[buf_bytes * buf_count];
+    built = new bool[buf_count];
+    for (int i = 0; i < buf_count; ++i) built[i] = false;
+}
+
+bool Frame_Pyramid::build(const Usb_Frame* frame_ptr)
+{
+    int64_t start_usec = monotonic_usec();
+    int buf_index = frame_ptr->get_buf_index();
+    if (buf_index < 0 || buf_index >= buf_count) return false;
+
+    // Until level 1 is rebuilt, the buffer's levels are of an older frame.
+
+    built[buf_index] = false;
+    uint8_t* base = arena + buf_bytes * buf_index;
+    uint8_t* level1 = base + level_offset[1];
+    Gray_View gray;
+    Yuv422_View yuv;
+    if (frame_ptr->get_view(gray) && gray.rows == rows && gray.cols == cols) {
+        gray_half(gray.data, gray.step, level1, level_step[1], rows, cols);
+    } else if (frame_ptr->get_view(yuv) && yuv.rows == rows &&
+               yuv.cols == cols) {
+        yuv422_luma_half(yuv.order, yuv.data, yuv.step,
+                         level1, level_step[1], rows, cols);
+    } else {
+        return false;
+    }
+    for (int i = 2; i < LEVEL_COUNT; ++i) {
+        gray_half(base + level_offset[i - 1], level_step[i - 1],
+                  base + level_offset[i], level_step[i],
+                  level_rows[i - 1], level_cols[i - 1]);
+    }
+    built[buf_index] = true;
+    last_usec = monotonic_usec() - start_usec;
+    time_hist.record(last_usec);
+    return true;
+}
+
+bool Frame_Pyramid::get_level(const Usb_Frame* frame_ptr,
+                              int level,
+                              Pyramid_Level& out) const
+{
+    if (level < 0 || level >= LEVEL_COUNT) return false;
+    int buf_index = frame_ptr->get_buf_index();
+    if (level > 0 &&
+        (buf_index < 0 || buf_index >= buf_count || !built[buf_index])) {
+        return false;
+    }
+    out.rows = level_rows[level];
+    out.cols = level_cols[level];
+    if (level == 0) {
+        out.data = frame_ptr->get_img_data();
+        out.step = frame_ptr->get_step();
+        out.pixel_bytes = packed_pixel_bytes(frame_ptr->get_pixel_format());
+    } else {
+        out.data = arena + buf_bytes * buf_index + level_offset[level];
+        out.step = level_step[level];
+        out.pixel_bytes = 1;
+    }
+    return true;
+}
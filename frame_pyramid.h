@@ -0,0 +1,128 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef FRAME_PYRAMID_H
+#define FRAME_PYRAMID_H
+
+#include <stdint.h>
+#include "usb_camera.h"
+#include "pipeline_stats.h"
+
+/**********************************************************************
+ * @brief One level of a Frame_Pyramid.
+ */
+class Pyramid_Level {
+public:
+    const uint8_t* data;   /// Points to the first pixel.
+    int rows;
+    int cols;
+    int step;              /// Bytes per row.
+    int pixel_bytes;       /// 1 for gray; 2 for the packed 4:2:2 level 0.
+};
+
+/**********************************************************************
+ * @brief Builds reduced size gray copies of each frame.
+ *
+ * Level 0 is the frame itself.  Level 1 is a gray image of half the rows
+ * and columns, made from the luma of a packed 4:2:2 frame or from a
+ * V4L2_PIX_FMT_GREY frame by averaging each 2x2 block; level 2 is made
+ * from level 1 the same way.  Later stages can work at whichever level
+ * gives enough resolution for what they look for; the preview, for one,
+ * takes its luma from the level that matches its scale.
+ *
+ * Each of the camera's buffers has its own set of levels, kept in one
+ * arena allocated by init(), and picked by Usb_Frame::get_buf_index().
+ * So build() never allocates, and the levels of a frame stay valid for
+ * as long as the frame is held, even while later frames are being built.
+ *
+ * build() must be called by one thread at a time.  Once it returns, any
+ * thread holding the frame may read its levels.
+ */
+class Frame_Pyramid {
+public:
+    /** The number of levels, including level 0. */
+    static const int LEVEL_COUNT = 3;
+
+private:
+    int buf_count;
+    int rows;
+    int cols;
+    uint32_t pixel_format;
+
+    int level_rows[LEVEL_COUNT];
+    int level_cols[LEVEL_COUNT];
+    int level_step[LEVEL_COUNT];   /// Level 0 uses the frame's step.
+
+    /** Offset of each level within a buffer's part of the arena.  Level 0
+        lives in the frame, so its entry is unused. */
+    size_t level_offset[LEVEL_COUNT];
+    size_t buf_bytes;          /// Size of each buffer's part of the arena.
+    uint8_t* arena;
+    bool* built;               /// Per buffer: levels 1 and up are valid.
+
+    int64_t last_usec;         /// Time taken by the most recent build().
+    Latency_Histogram time_hist;
+
+    // Not copyable.
+    Frame_Pyramid(const Frame_Pyramid&);
+    Frame_Pyramid& operator=(const Frame_Pyramid&);
+
+public:
+    Frame_Pyramid();
+    ~Frame_Pyramid();
+
+    /*******************************************************************//*
+     * @brief Allocate the levels for every buffer of a camera.
+     *
+     * @param [in] buf_count     The camera's get_buf_count().
+     * @param [in] rows          The camera's get_rows().
+     * @param [in] cols          The camera's get_cols().
+     * @param [in] pixel_format  The camera's get_pixel_format(): YUYV,
+     *                           UYVY, or GREY.
+     */
+    void init(int buf_count, int rows, int cols, uint32_t pixel_format);
+
+    /*******************************************************************//*
+     * @brief Return true if build() can reduce frames of the given format.
+     */
+    static bool supports(uint32_t pixel_format);
+
+    /*******************************************************************//*
+     * @brief Fill in levels 1 and up for the given frame.
+     *
+     * @return False if the frame's buffer index or format doesn't match
+     *         init(); its levels are then marked as not built.
+     */
+    bool build(const Usb_Frame* frame_ptr);
+
+    /*******************************************************************//*
+     * @brief Describe one level of a frame passed to build().
+     *
+     * @param [in] frame_ptr  The frame.
+     * @param [in] level      0 to LEVEL_COUNT - 1.
+     * @param [out] out       Returns the level.
+     * @return False if level is out of range, or is 1 or more and the
+     *         frame's levels weren't built.
+     */
+    bool get_level(const Usb_Frame* frame_ptr,
+                   int level,
+                   Pyramid_Level& out) const;
+
+    /*******************************************************************//*
+     * @brief Return the time in usec taken by the most recent build().
+     */
+    int64_t get_last_usec() const
+    {
+        return last_usec;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the histogram of build() times, in usec.
+     */
+    Latency_Histogram* get_time_histogram()
+    {
+        return &time_hist;
+    }
+};
+
+#endif
@@ -12,10 +12,20 @@ Frame_Queue::Frame_Queue(int max_size,
     block_on_full = do_block_on_full;
     size = max_size;
     if (size < 1) size = 1;
-    if (size >= MAX_QUEUE_SIZE) size = MAX_QUEUE_SIZE;
+    ptr = new Usb_Frame*[size + 1];
     head = 0;
     tail = 0;
     pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&empty_cond, NULL);
+    pthread_cond_init(&full_cond, NULL);
+}
+
+Frame_Queue::~Frame_Queue()
+{
+    pthread_cond_destroy(&full_cond);
+    pthread_cond_destroy(&empty_cond);
+    pthread_mutex_destroy(&mutex);
+    delete[] ptr;
 }
 
 // on success returns 0, else -1; failure occurs if the queue is full.
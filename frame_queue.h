@@ -16,9 +16,6 @@
  */
 class Frame_Queue: public Any_Frame_Queue {
 private:
-    /** The maximum number of items that will fit in any queue. */
-    static const int MAX_QUEUE_SIZE = 32;
-
     /** True indicates that if the queue is empty, pop() will block until a
         new item is available.  False indicates that if the queue is empty,
         pop() will return NULL immediately. */
@@ -34,7 +31,7 @@ private:
     int size;
     int head; /// Index in ptr array of the head of the queue.
     int tail; /// Index in ptr array of the tail of the queue.
-    Usb_Frame* ptr[MAX_QUEUE_SIZE + 1];  /// Contains all items on the queue
+    Usb_Frame** ptr;  /// Contains all items on the queue; size + 1 elements
 
     /** Before accessing any field of this class, a function must first acquire
         exclusive access by holding this mutex.  See pthread_mutex_lock(3). */
@@ -53,6 +50,10 @@ private:
      */
     int get_item_count();
 
+    // Not copyable; the ptr array is owned.
+    Frame_Queue(const Frame_Queue&);
+    Frame_Queue& operator=(const Frame_Queue&);
+
 public:
 
 
@@ -60,7 +61,8 @@ public:
      * @brief Construct a new Frame_Queue.
      *
      * @param [in] max_size        The maximum number of items the queue will
-     *                             be able to hold.
+     *                             be able to hold.  Storage is allocated
+     *                             to fit; there is no fixed upper limit.
      * @param [in] block_on_empty  True indicates that if the queue is empty,
      *                             pop() will block until a new item is
      *                             available.
@@ -73,6 +75,12 @@ public:
                 bool block_on_full = true);
 
 
+    /******************************************************************//**
+     * @brief Destructor.
+     */
+    ~Frame_Queue();
+
+
     /******************************************************************//**
      * @brief Push a new item onto the queue.
      *
@@ -0,0 +1,246 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "usb_camera.h"
+#include "frame_recorder.h"
+
+Frame_Recorder::Frame_Recorder()
+: fd(-1),
+  map_ptr(NULL),
+  map_bytes(0),
+  header_ptr(NULL),
+  index_ptr(NULL),
+  pending_ptr(NULL),
+  pending_head(0),
+  pending_count(0),
+  queue_size(0),
+  drop_count(0),
+  overflow_count(0),
+  stop_requested(false),
+  writer_running(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&pending_cond, NULL);
+}
+
+Frame_Recorder::~Frame_Recorder()
+{
+    close();
+    pthread_cond_destroy(&pending_cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+bool Frame_Recorder::open(const char* file_name,
+                          int rows,
+                          int cols,
+                          uint32_t pixel_format,
+                          uint32_t frame_bytes,
+                          int max_frames,
+                          int arg_queue_size)
+{
+    close();
+    if (max_frames < 1) max_frames = 1;
+    if (arg_queue_size < 1) arg_queue_size = 1;
+
+    /* Lay out the file.  Slots are page aligned so each frame's data
+       starts on its own page. */
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    uint32_t slot_bytes = (uint32_t)((frame_bytes + page - 1) / page * page);
+    uint64_t index_offset = sizeof(Capture_File_Header);
+    uint64_t index_bytes = (uint64_t)max_frames * sizeof(Capture_Index_Entry);
+    uint64_t data_offset = (index_offset + index_bytes + page - 1) /
+                           page * page;
+    map_bytes = data_offset + (uint64_t)max_frames * slot_bytes;
+
+    fd = ::open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    // Allocate every block now, so recording never waits on the allocator.
+
+    if (posix_fallocate(fd, 0, map_bytes) != 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    void* p = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    map_ptr = (uint8_t*)p;
+    header_ptr = (Capture_File_Header*)map_ptr;
+    index_ptr = (Capture_Index_Entry*)(map_ptr + index_offset);
+
+    memset(header_ptr, 0, sizeof(*header_ptr));
+    memcpy(header_ptr->magic, CAPTURE_FILE_MAGIC, sizeof(header_ptr->magic));
+    header_ptr->pixel_format = pixel_format;
+    header_ptr->rows = rows;
+    header_ptr->cols = cols;
+    header_ptr->frame_bytes = frame_bytes;
+    header_ptr->slot_bytes = slot_bytes;
+    header_ptr->index_capacity = max_frames;
+    header_ptr->record_count = 0;
+    header_ptr->index_offset = index_offset;
+    header_ptr->data_offset = data_offset;
+
+    queue_size = arg_queue_size;
+    pending_ptr = new Frame_Handle[queue_size];
+    pending_head = 0;
+    pending_count = 0;
+    stop_requested = false;
+    int rc = pthread_create(&writer_id, NULL, writer_thread, (void*)this);
+    if (rc != 0) {
+        printf("can't pthread_create, error_code= %d\n", rc);
+        close();
+        return false;
+    }
+    writer_running = true;
+    return true;
+}
+
+void Frame_Recorder::close()
+{
+    if (writer_running) {
+        pthread_mutex_lock(&mutex);
+        stop_requested = true;
+        pthread_cond_signal(&pending_cond);
+        pthread_mutex_unlock(&mutex);
+        pthread_join(writer_id, NULL);
+        writer_running = false;
+    }
+    if (map_ptr != NULL) {
+        msync(map_ptr, map_bytes, MS_SYNC);
+        munmap(map_ptr, map_bytes);
+    }
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    map_ptr = NULL;
+    header_ptr = NULL;
+    index_ptr = NULL;
+    delete[] pending_ptr;
+    pending_ptr = NULL;
+}
+
+int Frame_Recorder::push(Usb_Frame* frame_ptr)
+{
+    pthread_mutex_lock(&mutex);
+    if (!writer_running || pending_count == queue_size) {
+
+        // The writer is behind.  Drop the frame rather than wait.
+
+        pthread_mutex_unlock(&mutex);
+        __atomic_add_fetch(&drop_count, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    int tail = pending_head + pending_count;
+    if (tail >= queue_size) tail -= queue_size;
+    pending_ptr[tail].reset(frame_ptr);
+    int count = ++pending_count;
+    if (count == 1) pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&mutex);
+    return count;
+}
+
+Usb_Frame* Frame_Recorder::pop(int& count)
+{
+    count = 0;
+    return NULL;
+}
+
+void Frame_Recorder::write_record(Usb_Frame* frame_ptr)
+{
+    uint32_t i = header_ptr->record_count;
+    if (i >= header_ptr->index_capacity) {
+        __atomic_add_fetch(&overflow_count, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    uint8_t* slot_ptr = map_ptr + header_ptr->data_offset +
+                        (size_t)i * header_ptr->slot_bytes;
+    const uint8_t* src = frame_ptr->get_img_data();
+    uint32_t bytes;
+    int row_bytes = frame_ptr->get_cols() *
+                    packed_pixel_bytes(frame_ptr->get_pixel_format());
+    int step = frame_ptr->get_step();
+    if (row_bytes > 0 && step > row_bytes) {
+
+        // The driver pads its rows; store them packed.
+
+        int rows = frame_ptr->get_rows();
+        if ((uint32_t)(rows * row_bytes) > header_ptr->frame_bytes) {
+            rows = header_ptr->frame_bytes / row_bytes;
+        }
+        for (int r = 0; r < rows; ++r) {
+            memcpy(slot_ptr + (size_t)r * row_bytes,
+                   src + (size_t)r * step, row_bytes);
+        }
+        bytes = rows * row_bytes;
+    } else {
+        bytes = frame_ptr->get_bytes_used();
+        if (bytes == 0 || bytes > header_ptr->frame_bytes) {
+            bytes = header_ptr->frame_bytes;
+        }
+        memcpy(slot_ptr, src, bytes);
+    }
+
+    Capture_Index_Entry& e = index_ptr[i];
+    e.sequence = frame_ptr->get_frame_num();
+    e.bytesused = bytes;
+    e.flags = frame_ptr->get_flags();
+    e.reserved = 0;
+    e.timestamp_usec = frame_ptr->get_timestamp_nsec() / 1000;
+
+    // Publish the record only once its data and index entry are complete.
+
+    __atomic_store_n(&header_ptr->record_count, i + 1, __ATOMIC_RELEASE);
+}
+
+void* Frame_Recorder::writer_thread(void* recorder_ptr)
+{
+    Frame_Recorder* r = (Frame_Recorder*)recorder_ptr;
+    Frame_Handle* batch = new Frame_Handle[r->queue_size];
+    while (1) {
+
+        // Take every pending frame at once, so the lock is held briefly.
+
+        pthread_mutex_lock(&r->mutex);
+        while (r->pending_count == 0 && !r->stop_requested) {
+            pthread_cond_wait(&r->pending_cond, &r->mutex);
+        }
+        int n = r->pending_count;
+        for (int i = 0; i < n; ++i) {
+            batch[i].reset(r->pending_ptr[r->pending_head].detach());
+            if (++r->pending_head == r->queue_size) r->pending_head = 0;
+        }
+        r->pending_count = 0;
+        bool stop = r->stop_requested;
+        pthread_mutex_unlock(&r->mutex);
+
+        uint32_t first = r->header_ptr->record_count;
+        for (int i = 0; i < n; ++i) {
+            r->write_record(batch[i].get());
+            batch[i].reset();
+        }
+
+        // Start writeback of the batch without waiting for it.
+
+        uint32_t last = r->header_ptr->record_count;
+        if (last > first) {
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t begin = r->header_ptr->data_offset +
+                           (size_t)first * r->header_ptr->slot_bytes;
+            size_t end = r->header_ptr->data_offset +
+                         (size_t)last * r->header_ptr->slot_bytes;
+            msync(r->map_ptr + begin / page * page, end - begin / page * page,
+                  MS_ASYNC);
+        }
+        if (stop && n == 0) break;
+    }
+    delete[] batch;
+    return NULL;
+}
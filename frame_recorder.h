@@ -0,0 +1,130 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "any_frame_queue.h"
+#include "capture_file.h"
+#include "frame_handle.h"
+
+/**********************************************************************
+ * @brief Records frames to a capture file (see capture_file.h) without
+ *        slowing down the pipeline that feeds it.
+ *
+ * The file is allocated at its full size and memory mapped when it is
+ * opened, so recording never extends the file.  push() hands a frame
+ * reference to the recorder and returns at once; a writer thread copies
+ * the pending frames into the file in batches, releasing each frame as
+ * soon as it has been copied.  If the writer falls so far behind that
+ * queue_size frames are pending, push() refuses the new frame rather than
+ * wait.  Recording stops when the file is full.
+ *
+ * Push frames here directly, or make the recorder a tap of a
+ * Pipeline_Stage.  Any number of threads may push.
+ */
+class Frame_Recorder: public Any_Frame_Queue {
+private:
+    int fd;
+    uint8_t* map_ptr;
+    size_t map_bytes;
+    Capture_File_Header* header_ptr;
+    Capture_Index_Entry* index_ptr;
+
+    /** Frames waiting to be written, oldest first.  Each handle holds the
+        reference given to push(), so a frame goes back to its camera as
+        soon as it has been copied, or if the recorder is closed first. */
+    Frame_Handle* pending_ptr;
+    int pending_head;
+    int pending_count;
+    int queue_size;
+
+    int drop_count;        /// frames dropped because the writer was behind
+    int overflow_count;    /// frames dropped because the file was full
+
+    bool stop_requested;
+    bool writer_running;
+    pthread_t writer_id;
+
+    /** Protects the pending queue and stop_requested. */
+    pthread_mutex_t mutex;
+
+    /** Signals the writer that frames are pending, or it should stop. */
+    pthread_cond_t pending_cond;
+
+    /*******************************************************************//*
+     * @brief Copy one frame into the next record.
+     */
+    void write_record(Usb_Frame* frame_ptr);
+
+    static void* writer_thread(void* recorder_ptr);
+
+public:
+    Frame_Recorder();
+    virtual ~Frame_Recorder();
+
+    /*******************************************************************//*
+     * @brief Create a capture file and start the writer thread.
+     *
+     * @param [in] file_name     The file to create (or overwrite).
+     * @param [in] rows          Rows in every image.
+     * @param [in] cols          Columns in every image.
+     * @param [in] pixel_format  fourcc code of the images.
+     * @param [in] frame_bytes   Maximum bytes of image data per frame.
+     * @param [in] max_frames    The number of frames the file will hold.
+     * @param [in] queue_size    The number of frames that may wait to be
+     *                           written before new ones are dropped.
+     * @return False if the file can't be created at the requested size.
+     */
+    bool open(const char* file_name,
+              int rows,
+              int cols,
+              uint32_t pixel_format,
+              uint32_t frame_bytes,
+              int max_frames,
+              int queue_size = 4);
+
+    /*******************************************************************//*
+     * @brief Write any pending frames, stop the writer, and close the
+     *        file.
+     */
+    void close();
+
+    /*******************************************************************//*
+     * @brief Queue a frame to be recorded.  The recorder takes over the
+     *        caller's reference to the frame and releases it when done.
+     *
+     * @return The number of frames now pending, or -1 if the frame was
+     *         dropped, in which case the caller keeps its reference.
+     */
+    virtual int push(Usb_Frame* frame_ptr);
+
+    /*******************************************************************//*
+     * @brief Always returns NULL; recorded frames are not handed on.
+     */
+    virtual Usb_Frame* pop(int& count);
+
+    /*******************************************************************//*
+     * @brief Return the number of frames written to the file.
+     */
+    int get_record_count() const
+    {
+        return (header_ptr == NULL) ? 0 :
+               (int)__atomic_load_n(&header_ptr->record_count,
+                                    __ATOMIC_ACQUIRE);
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of frames dropped, either because the
+     *        writer was behind or because the file was full.
+     */
+    int get_drop_count() const
+    {
+        return __atomic_load_n(&drop_count, __ATOMIC_RELAXED) +
+               __atomic_load_n(&overflow_count, __ATOMIC_RELAXED);
+    }
+};
+
+#endif
@@ -0,0 +1,192 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame_sync.h"
+#include "usb_camera.h"
+
+// Return the frame's capture time in microseconds.  Cameras whose drivers
+// use different clocks still compare correctly.
+static int64_t timestamp_usec(const Usb_Frame* frame_ptr)
+{
+    return frame_ptr->get_timestamp_nsec() / 1000;
+}
+
+Frame_Sync::Frame_Sync(int64_t arg_tolerance_usec)
+: input_count(0),
+  tolerance_usec(arg_tolerance_usec),
+  ready_head(0),
+  ready_count(0),
+  set_count(0),
+  overrun_count(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&ready_cond, NULL);
+    memset(&skew_prev, 0, sizeof(skew_prev));
+}
+
+Frame_Sync::~Frame_Sync()
+{
+    pthread_cond_destroy(&ready_cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+int Frame_Sync::add_input(Any_Frame_Queue* in_queue_ptr,
+                          Any_Frame_Queue* return_queue_ptr)
+{
+    if (input_count == MAX_INPUTS) return -1;
+    Input& in = input[input_count];
+    in.sync_ptr = this;
+    in.index = input_count;
+    in.in_queue_ptr = in_queue_ptr;
+    in.return_queue_ptr = return_queue_ptr;
+    in.pending_ptr = NULL;
+    in.pending_usec = 0;
+    in.frame_count = 0;
+    in.replaced_count = 0;
+    in.unmatched_count = 0;
+    return input_count++;
+}
+
+void Frame_Sync::offer(int i, Usb_Frame* frame_ptr,
+                       Give_Back* give_back, int& give_back_count)
+{
+    Input& in = input[i];
+    ++in.frame_count;
+    if (in.pending_ptr != NULL) {
+        give_back[give_back_count].frame_ptr = in.pending_ptr;
+        give_back[give_back_count++].input = i;
+        ++in.replaced_count;
+    }
+    in.pending_ptr = frame_ptr;
+    in.pending_usec = timestamp_usec(frame_ptr);
+
+    // Nothing to do until every input has a frame waiting.
+
+    int oldest = 0;
+    int64_t min_usec = input[0].pending_usec;
+    int64_t max_usec = min_usec;
+    for (int j = 0; j < input_count; ++j) {
+        if (input[j].pending_ptr == NULL) return;
+        int64_t usec = input[j].pending_usec;
+        if (usec < min_usec) {
+            min_usec = usec;
+            oldest = j;
+        }
+        if (usec > max_usec) max_usec = usec;
+    }
+
+    if (max_usec - min_usec > tolerance_usec) {
+        give_back[give_back_count].frame_ptr = input[oldest].pending_ptr;
+        give_back[give_back_count++].input = oldest;
+        input[oldest].pending_ptr = NULL;
+        ++input[oldest].unmatched_count;
+        return;
+    }
+
+    // A match.  If pop() is behind, give back the oldest set to make room.
+
+    if (ready_count == MAX_READY) {
+        Frame_Set& old = ready[ready_head];
+        for (int j = 0; j < old.count; ++j) {
+            give_back[give_back_count].frame_ptr = old.frame_ptr[j];
+            give_back[give_back_count++].input = j;
+        }
+        ready_head = (ready_head + 1) % MAX_READY;
+        --ready_count;
+        ++overrun_count;
+    }
+    Frame_Set& set = ready[(ready_head + ready_count) % MAX_READY];
+    set.count = input_count;
+    for (int j = 0; j < input_count; ++j) {
+        set.frame_ptr[j] = input[j].pending_ptr;
+        input[j].pending_ptr = NULL;
+    }
+    set.skew_usec = max_usec - min_usec;
+    skew_hist.record(set.skew_usec);
+    ++ready_count;
+    ++set_count;
+    pthread_cond_signal(&ready_cond);
+}
+
+void Frame_Sync::feed(int i)
+{
+    Input& in = input[i];
+    apply_thread_placement(placement, "sync", "feeder");
+    Give_Back give_back[2 + MAX_INPUTS];
+    while (1) {
+        int count;
+        Usb_Frame* frame_ptr = in.in_queue_ptr->pop(count);
+        if (frame_ptr == NULL) continue;  // timeout
+
+        int give_back_count = 0;
+        pthread_mutex_lock(&mutex);
+        offer(i, frame_ptr, give_back, give_back_count);
+        pthread_mutex_unlock(&mutex);
+
+        // Give frames back outside the lock; the camera may block briefly.
+
+        for (int j = 0; j < give_back_count; ++j) {
+            Give_Back& back = give_back[j];
+            input[back.input].return_queue_ptr->push(back.frame_ptr);
+        }
+    }
+}
+
+void* Frame_Sync::feeder_main(void* input_ptr)
+{
+    Input* in_ptr = (Input*)input_ptr;
+    in_ptr->sync_ptr->feed(in_ptr->index);
+    return NULL;
+}
+
+void Frame_Sync::start()
+{
+    for (int i = 0; i < input_count; ++i) {
+        pthread_t thread_id;
+        int rc = pthread_create(&thread_id, NULL, feeder_main,
+                                (void*)&input[i]);
+        if (rc != 0) {
+            printf("can't pthread_create, error_code= %d\n", rc);
+            exit(-1);
+        }
+    }
+}
+
+void Frame_Sync::pop(Frame_Set& set)
+{
+    pthread_mutex_lock(&mutex);
+    while (ready_count == 0) pthread_cond_wait(&ready_cond, &mutex);
+    set = ready[ready_head];
+    ready_head = (ready_head + 1) % MAX_READY;
+    --ready_count;
+    pthread_mutex_unlock(&mutex);
+}
+
+void Frame_Sync::push(Frame_Set& set)
+{
+    for (int j = 0; j < set.count; ++j) {
+        input[j].return_queue_ptr->push(set.frame_ptr[j]);
+    }
+    set.count = 0;
+}
+
+void Frame_Sync::report(FILE* file_ptr)
+{
+    Latency_Histogram::Snapshot skew;
+    skew_hist.take_interval(skew_prev, skew);
+    pthread_mutex_lock(&mutex);
+    fprintf(file_ptr, "sync sets=%u overrun=%u skew_us p50/p99/max=%u/%u/%u",
+            set_count, overrun_count,
+            skew.percentile(0.50), skew.percentile(0.99), skew.max_usec);
+    for (int i = 0; i < input_count; ++i) {
+        fprintf(file_ptr, " in%d frames=%u replaced=%u unmatched=%u", i,
+                input[i].frame_count, input[i].replaced_count,
+                input[i].unmatched_count);
+    }
+    pthread_mutex_unlock(&mutex);
+    fprintf(file_ptr, "\n");
+    fflush(file_ptr);
+}
@@ -0,0 +1,188 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef FRAME_SYNC_H
+#define FRAME_SYNC_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "any_frame_queue.h"
+#include "pipeline_stats.h"
+#include "thread_placement.h"
+
+/**********************************************************************
+ * @brief Frames from several cameras taken at the same moment.
+ */
+class Frame_Set {
+public:
+    /** The most frames in a set. */
+    static const int MAX_FRAMES = 4;
+
+    int count;                         /// The number of frames.
+    Usb_Frame* frame_ptr[MAX_FRAMES];  /// One per input, in input order.
+    int64_t skew_usec;                 /// Latest minus earliest timestamp.
+
+    Frame_Set()
+    : count(0),
+      skew_usec(0)
+    { }
+};
+
+/**********************************************************************
+ * @brief Matches frames from several cameras by driver timestamp, for
+ *        stereo.
+ *
+ * Each input has a feeder thread that pops frames from the input's queue
+ * (normally the camera itself) and offers them to the synchronizer.  At
+ * most one frame per input is held waiting for its partners:
+ *
+ *   - When a frame arrives and the input already has one waiting, the
+ *     older is given back at once; a newer frame from the others can only
+ *     be closer to the new one.
+ *   - When every input has a frame waiting, and their timestamps are all
+ *     within the tolerance, they leave together as a Frame_Set.
+ *   - Otherwise the oldest can never be matched, since the others only
+ *     get newer, and it is given back at once.
+ *
+ * So no frame is held for longer than about one frame period of its own
+ * camera, and a camera that stops never makes the others wait.
+ *
+ * Matched sets wait for pop() in a short queue; if the consumer falls
+ * that far behind, the oldest set is given back to make room.  The
+ * consumer gives each set back with push() when done.
+ *
+ * The skew of every matched set is recorded in a histogram; see report().
+ */
+class Frame_Sync {
+public:
+    /** The most inputs. */
+    static const int MAX_INPUTS = Frame_Set::MAX_FRAMES;
+
+    /** The most matched sets waiting for pop(). */
+    static const int MAX_READY = 2;
+
+private:
+    class Input {
+    public:
+        Frame_Sync* sync_ptr;
+        int index;
+        Any_Frame_Queue* in_queue_ptr;
+        Any_Frame_Queue* return_queue_ptr;
+        Usb_Frame* pending_ptr;       /// The frame waiting, or NULL.
+        int64_t pending_usec;         /// Its timestamp.
+        uint32_t frame_count;         /// Frames offered.
+        uint32_t replaced_count;      /// Given back for a newer frame.
+        uint32_t unmatched_count;     /// Given back with no partner.
+    };
+
+    /** A frame to be given back to an input. */
+    class Give_Back {
+    public:
+        Usb_Frame* frame_ptr;
+        int input;
+    };
+
+    int input_count;
+    Input input[MAX_INPUTS];
+    int64_t tolerance_usec;
+    Thread_Placement placement;
+
+    /** Matched sets waiting for pop(): a ring. */
+    Frame_Set ready[MAX_READY];
+    int ready_head;
+    int ready_count;
+
+    uint32_t set_count;        /// Sets matched.
+    uint32_t overrun_count;    /// Sets given back because pop() was behind.
+
+    /** Protects everything above that changes after start(). */
+    pthread_mutex_t mutex;
+
+    /** Signals pop() that a set is ready. */
+    pthread_cond_t ready_cond;
+
+    /** The skew of each matched set. */
+    Latency_Histogram skew_hist;
+    Latency_Histogram::Snapshot skew_prev;
+
+    /*******************************************************************//*
+     * @brief Take a frame from input i, and match what can be matched.
+     *        Frames to give back are appended to give_back, which must
+     *        have room for 2 + MAX_INPUTS.  Call with mutex locked.
+     */
+    void offer(int i, Usb_Frame* frame_ptr,
+               Give_Back* give_back, int& give_back_count);
+
+    /*******************************************************************//*
+     * @brief The body of input i's feeder thread.
+     */
+    void feed(int i);
+
+    static void* feeder_main(void* input_ptr);
+
+    // Not copyable.
+    Frame_Sync(const Frame_Sync&);
+    Frame_Sync& operator=(const Frame_Sync&);
+
+public:
+    /*******************************************************************//*
+     * @param [in] tolerance_usec  The most the timestamps of a matched set
+     *                             may differ.  Something under half the
+     *                             frame period.
+     */
+    Frame_Sync(int64_t tolerance_usec);
+    ~Frame_Sync();
+
+    /*******************************************************************//*
+     * @brief Add an input.  Call before start().
+     *
+     * @param [in] in_queue_ptr      Frames are popped from here.
+     * @param [in] return_queue_ptr  Frames are given back here; normally
+     *                               the same camera.
+     * @return The input's index in each Frame_Set, or -1 if there are
+     *         already MAX_INPUTS.
+     */
+    int add_input(Any_Frame_Queue* in_queue_ptr,
+                  Any_Frame_Queue* return_queue_ptr);
+
+    /*******************************************************************//*
+     * @brief Set where the feeder threads run.  Call before start().
+     */
+    void set_placement(const Thread_Placement& new_placement)
+    {
+        placement = new_placement;
+    }
+
+    /*******************************************************************//*
+     * @brief Start a feeder thread per input.  The cameras must already be
+     *        streaming.
+     */
+    void start();
+
+    /*******************************************************************//*
+     * @brief Return the next matched set, waiting for one.
+     */
+    void pop(Frame_Set& set);
+
+    /*******************************************************************//*
+     * @brief Give every frame of a set back to its input.
+     */
+    void push(Frame_Set& set);
+
+    /*******************************************************************//*
+     * @brief Return the histogram of the skew of matched sets, in usec.
+     */
+    Latency_Histogram* get_skew_histogram()
+    {
+        return &skew_hist;
+    }
+
+    /*******************************************************************//*
+     * @brief Print the sets matched and the frames given back per input
+     *        so far, and the skew distribution since the previous call.
+     */
+    void report(FILE* file_ptr);
+};
+
+#endif
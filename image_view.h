@@ -0,0 +1,89 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef IMAGE_VIEW_H
+#define IMAGE_VIEW_H
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+#include "yuv_convert.h"
+
+/**********************************************************************
+ * @brief Typed views of the image in a frame's buffer.
+ *
+ * A view is only a description: it points into the buffer, which is not
+ * copied, and so is valid only while the frame is held.  Get one from
+ * Usb_Frame::get_view(), which fails if the frame's pixel format doesn't
+ * match the view.  Steps are the distance in bytes between the starts of
+ * consecutive rows, as the driver reported them; they may exceed the
+ * width of a row.
+ */
+
+/** One byte per pixel gray (V4L2_PIX_FMT_GREY). */
+class Gray_View {
+public:
+    const uint8_t* data;   /// Points to the first pixel.
+    int rows;
+    int cols;
+    int step;
+
+    uint8_t at(int r, int c) const
+    {
+        return data[(size_t)r * step + c];
+    }
+};
+
+/** Packed 4:2:2 YUV (V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY). */
+class Yuv422_View {
+public:
+    const uint8_t* data;   /// Points to the first pixel.
+    int rows;
+    int cols;
+    int step;
+    Yuv422_Order order;
+
+    /** Return the luma of a pixel. */
+    uint8_t luma(int r, int c) const
+    {
+        return data[(size_t)r * step + 2 * c + (order == YUV422_UYVY)];
+    }
+};
+
+/** Three bytes per pixel, blue first (V4L2_PIX_FMT_BGR24). */
+class Bgr_View {
+public:
+    const uint8_t* data;   /// Points to the first pixel.
+    int rows;
+    int cols;
+    int step;
+};
+
+/** A compressed image, such as MJPEG: only its payload. */
+class Compressed_View {
+public:
+    const uint8_t* data;   /// Points to the first byte.
+    uint32_t bytes;        /// The payload length, which varies per frame.
+    uint32_t pixel_format;
+};
+
+/**********************************************************************
+ * @brief Return the bytes per pixel of a packed pixel format, or 0 if the
+ *        format is compressed or unknown.
+ */
+inline int packed_pixel_bytes(uint32_t pixel_format)
+{
+    switch (pixel_format) {
+    case V4L2_PIX_FMT_GREY:
+        return 1;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        return 2;
+    case V4L2_PIX_FMT_BGR24:
+    case V4L2_PIX_FMT_RGB24:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+#endif
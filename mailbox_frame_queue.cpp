@@ -0,0 +1,71 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <pthread.h>
+#include "mailbox_frame_queue.h"
+
+/* The slot is handed off with an atomic exchange, so neither side takes
+   the mutex unless a consumer must park.  Parking uses the same
+   flag-then-recheck pattern as Spsc_Frame_Queue. */
+
+Mailbox_Frame_Queue::Mailbox_Frame_Queue(Any_Frame_Queue* recycle_ptr,
+                                         bool do_block_on_empty)
+{
+    recycle_queue_ptr = recycle_ptr;
+    block_on_empty = do_block_on_empty;
+    slot_ptr = NULL;
+    overwritten_count = 0;
+    empty_waiting = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&empty_cond, NULL);
+}
+
+Mailbox_Frame_Queue::~Mailbox_Frame_Queue()
+{
+    Usb_Frame* frame_ptr = __atomic_exchange_n(&slot_ptr, (Usb_Frame*)NULL,
+                                               __ATOMIC_ACQ_REL);
+    if (frame_ptr != NULL) recycle_queue_ptr->push(frame_ptr);
+    pthread_cond_destroy(&empty_cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+int Mailbox_Frame_Queue::push(Usb_Frame* frame_ptr)
+{
+    Usb_Frame* old_ptr = __atomic_exchange_n(&slot_ptr, frame_ptr,
+                                             __ATOMIC_SEQ_CST);
+    if (old_ptr != NULL) {
+
+        // Nobody wanted the old frame.  Give it back right away.
+
+        __atomic_add_fetch(&overwritten_count, 1, __ATOMIC_RELAXED);
+        recycle_queue_ptr->push(old_ptr);
+    } else if (__atomic_load_n(&empty_waiting, __ATOMIC_SEQ_CST)) {
+
+        // A consumer is parked on an empty mailbox.  Wake it.
+
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&empty_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+    return 1;
+}
+
+Usb_Frame* Mailbox_Frame_Queue::pop(int& count)
+{
+    count = 0;
+    Usb_Frame* frame_ptr = __atomic_exchange_n(&slot_ptr, (Usb_Frame*)NULL,
+                                               __ATOMIC_SEQ_CST);
+    if (frame_ptr != NULL || !block_on_empty) return frame_ptr;
+
+    // Mailbox is empty.  Park until a producer fills it.
+
+    pthread_mutex_lock(&mutex);
+    __atomic_add_fetch(&empty_waiting, 1, __ATOMIC_SEQ_CST);
+    while ((frame_ptr = __atomic_exchange_n(&slot_ptr, (Usb_Frame*)NULL,
+                                            __ATOMIC_SEQ_CST)) == NULL) {
+        pthread_cond_wait(&empty_cond, &mutex);
+    }
+    __atomic_sub_fetch(&empty_waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&mutex);
+    return frame_ptr;
+}
@@ -0,0 +1,97 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef MAILBOX_FRAME_QUEUE_H
+#define MAILBOX_FRAME_QUEUE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "any_frame_queue.h"
+
+/******************************************************************//**
+ * @brief Implements a queue that holds only the most recent frame.
+ *
+ * push() never blocks.  If the mailbox already holds a frame when a new one
+ * is pushed, the old frame is replaced, and immediately handed back to the
+ * recycle queue given to the constructor (normally the Usb_Camera that
+ * produced it, so the driver can refill the buffer).  A consumer that falls
+ * behind therefore sees only the newest frame, and never stalls the
+ * producer.
+ *
+ * Any number of threads may push or pop.
+ */
+class Mailbox_Frame_Queue: public Any_Frame_Queue {
+private:
+    /** Replaced frames are pushed here. */
+    Any_Frame_Queue* recycle_queue_ptr;
+
+    /** True indicates that if the mailbox is empty, pop() will block until a
+        new item is available.  False indicates that if the mailbox is empty,
+        pop() will return NULL immediately. */
+    bool block_on_empty;
+
+    /** The frame in the mailbox, or NULL if the mailbox is empty. */
+    Usb_Frame* slot_ptr;
+
+    /** The number of frames replaced before anyone popped them. */
+    int overwritten_count;
+
+    /** The number of consumers parked waiting for a frame. */
+    int empty_waiting;
+
+    /** Protects empty_cond.  Only acquired when a consumer must park, or
+        a parked consumer must be woken. */
+    pthread_mutex_t mutex;
+
+    /** Signals a consumer waiting for an empty mailbox to become full. */
+    pthread_cond_t empty_cond;
+
+public:
+
+    /******************************************************************//**
+     * @brief Construct a new, empty Mailbox_Frame_Queue.
+     *
+     * @param [in] recycle_queue_ptr  Replaced frames are pushed onto this
+     *                                queue.
+     * @param [in] block_on_empty     True indicates that if the mailbox is
+     *                                empty, pop() will block until a new item
+     *                                is available.
+     */
+    Mailbox_Frame_Queue(Any_Frame_Queue* recycle_queue_ptr,
+                        bool block_on_empty = true);
+
+    virtual ~Mailbox_Frame_Queue();
+
+    /******************************************************************//**
+     * @brief Put a new item in the mailbox, replacing any item already
+     *        there.
+     *
+     * The replaced item, if any, is pushed onto the recycle queue before
+     * this routine returns.
+     *
+     * @param [in] frame_ptr  The item to push.
+     * @return Always 1, the number of items now in the mailbox.
+     */
+    virtual int push(Usb_Frame* frame_ptr);
+
+    /******************************************************************//**
+     * @brief Remove the item from the mailbox.
+     *
+     * @param [out] count  Always returns 0, the number of items in the
+     *                     mailbox after the pop operation.
+     * @return The newest item pushed, or NULL if the mailbox is empty and
+     *         block_on_empty is false.
+     */
+    virtual Usb_Frame* pop(int& count);
+
+    /******************************************************************//**
+     * @brief Return the number of frames that were replaced before they
+     *        could be popped.
+     */
+    int get_overwritten_count() const
+    {
+        return __atomic_load_n(&overwritten_count, __ATOMIC_RELAXED);
+    }
+};
+
+#endif
@@ -0,0 +1,451 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+#include "mjpeg_decoder.h"
+
+/* libjpeg reports fatal errors by calling error_exit(), which must not
+   return.  We longjmp() back into decode_jpeg() instead, and count the
+   frame as failed. */
+
+class Jpeg_Error_Mgr {
+public:
+    struct jpeg_error_mgr pub;
+    jmp_buf env;
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    Jpeg_Error_Mgr* err_ptr = (Jpeg_Error_Mgr*)cinfo->err;
+    longjmp(err_ptr->env, 1);
+}
+
+// Corrupt data warnings are common with USB cameras; don't print them.
+static void jpeg_output_message(j_common_ptr)
+{ }
+
+/* Decode one JPEG image into dst.  Returns false if the image is corrupt
+   or wouldn't fit in dst_bytes.  YUYV output is decoded a row at a time
+   into ycc_row, which must hold ycc_row_bytes, 3 bytes per pixel.
+
+   Many UVC cameras leave the Huffman tables out of their MJPEG frames.
+   libjpeg-turbo fills in the standard tables when that happens. */
+
+static bool decode_jpeg(j_decompress_ptr cinfo,
+                        Jpeg_Error_Mgr* err_ptr,
+                        const uint8_t* src,
+                        uint32_t src_bytes,
+                        Mjpeg_Output output,
+                        int scale_denom,
+                        uint8_t* dst,
+                        int dst_bytes,
+                        uint8_t* ycc_row,
+                        int ycc_row_bytes,
+                        int& rows,
+                        int& cols)
+{
+    if (setjmp(err_ptr->env)) {
+        jpeg_abort_decompress(cinfo);
+        return false;
+    }
+    jpeg_mem_src(cinfo, (unsigned char*)src, src_bytes);
+    if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_abort_decompress(cinfo);
+        return false;
+    }
+    if (output == MJPEG_OUT_GRAY) {
+        cinfo->out_color_space = JCS_GRAYSCALE;
+    } else if (output == MJPEG_OUT_YUYV) {
+        cinfo->out_color_space = JCS_YCbCr;
+    } else {
+#ifdef JCS_EXTENSIONS
+        cinfo->out_color_space = JCS_EXT_BGR;
+#else
+        cinfo->out_color_space = JCS_RGB;
+#endif
+    }
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = scale_denom;
+    cinfo->dct_method = JDCT_IFAST;
+    cinfo->do_fancy_upsampling = FALSE;
+    jpeg_start_decompress(cinfo);
+
+    if (output == MJPEG_OUT_YUYV) {
+
+        /* Pack each pair of pixels as Y0 Cb Y1 Cr.  Without fancy
+           upsampling both pixels of a pair have the same chroma, so taking
+           the first's loses nothing for 4:2:x JPEGs, which is what UVC
+           cameras send. */
+
+        int width = cinfo->output_width;
+        int row_bytes = width * 2;
+        if ((width & 1) != 0 || width * 3 > ycc_row_bytes ||
+            row_bytes * (int)cinfo->output_height > dst_bytes) {
+            jpeg_abort_decompress(cinfo);
+            return false;
+        }
+        while (cinfo->output_scanline < cinfo->output_height) {
+            uint8_t* out = dst + cinfo->output_scanline * row_bytes;
+            JSAMPROW row_ptr = ycc_row;
+            jpeg_read_scanlines(cinfo, &row_ptr, 1);
+            const uint8_t* in = ycc_row;
+            for (int c = 0; c < width; c += 2) {
+                out[0] = in[0];
+                out[1] = in[1];
+                out[2] = in[3];
+                out[3] = in[2];
+                out += 4;
+                in += 6;
+            }
+        }
+        rows = cinfo->output_height;
+        cols = width;
+        jpeg_finish_decompress(cinfo);
+        return true;
+    }
+
+    int row_bytes = cinfo->output_width * cinfo->output_components;
+    if (row_bytes * (int)cinfo->output_height > dst_bytes) {
+        jpeg_abort_decompress(cinfo);
+        return false;
+    }
+    while (cinfo->output_scanline < cinfo->output_height) {
+        JSAMPROW row_ptr[4];
+        int n = cinfo->output_height - cinfo->output_scanline;
+        if (n > 4) n = 4;
+        for (int i = 0; i < n; ++i) {
+            row_ptr[i] = dst + (cinfo->output_scanline + i) * row_bytes;
+        }
+        jpeg_read_scanlines(cinfo, row_ptr, n);
+    }
+#ifndef JCS_EXTENSIONS
+    if (output != MJPEG_OUT_GRAY) {
+        uint8_t* end = dst + row_bytes * cinfo->output_height;
+        for (uint8_t* p = dst; p < end; p += 3) {
+            uint8_t r = p[0];
+            p[0] = p[2];
+            p[2] = r;
+        }
+    }
+#endif
+    rows = cinfo->output_height;
+    cols = cinfo->output_width;
+    jpeg_finish_decompress(cinfo);
+    return true;
+}
+
+
+Mjpeg_Decoder::Mjpeg_Decoder()
+: src_ptr(NULL),
+  output(MJPEG_OUT_BGR),
+  scale_denom(1),
+  rows(0),
+  cols(0),
+  buf_count(0),
+  buf_bytes(0),
+  frame(NULL),
+  vbuf(NULL),
+  img_mem(NULL),
+  free_ptr(NULL),
+  free_count(0),
+  slot_frame_ptr(NULL),
+  slot_state(NULL),
+  next_ticket(0),
+  next_pop(0),
+  source_ended(false),
+  end_ticket(0),
+  worker_count(0),
+  running(false),
+  stop_requested(false),
+  error_count(0)
+{
+    dev_name[0] = '\0';
+    pthread_mutex_init(&src_mutex, NULL);
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&free_cond, NULL);
+    pthread_cond_init(&ready_cond, NULL);
+}
+
+Mjpeg_Decoder::~Mjpeg_Decoder()
+{
+    if (running) stream_stop();
+    deinit();
+    pthread_cond_destroy(&ready_cond);
+    pthread_cond_destroy(&free_cond);
+    pthread_mutex_destroy(&mutex);
+    pthread_mutex_destroy(&src_mutex);
+}
+
+void Mjpeg_Decoder::deinit()
+{
+    delete[] slot_state;
+    delete[] slot_frame_ptr;
+    delete[] free_ptr;
+    delete[] img_mem;
+    delete[] vbuf;
+    delete[] frame;
+    slot_state = NULL;
+    slot_frame_ptr = NULL;
+    free_ptr = NULL;
+    img_mem = NULL;
+    vbuf = NULL;
+    frame = NULL;
+    buf_count = 0;
+}
+
+void Mjpeg_Decoder::init(Any_Camera* arg_src_ptr,
+                         Mjpeg_Output arg_output,
+                         int arg_scale_denom,
+                         int arg_worker_count,
+                         int arg_buf_count)
+{
+    deinit();
+    src_ptr = arg_src_ptr;
+    snprintf(dev_name, FILENAME_MAX, "%s", src_ptr->get_device_name());
+    output = arg_output;
+    scale_denom = arg_scale_denom;
+    if (scale_denom != 2 && scale_denom != 4 && scale_denom != 8) {
+        scale_denom = 1;
+    }
+    worker_count = arg_worker_count;
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > MAX_WORKERS) worker_count = MAX_WORKERS;
+    buf_count = (arg_buf_count < 1) ? 1 : arg_buf_count;
+
+    // libjpeg rounds scaled sizes up.
+
+    rows = (src_ptr->get_rows() + scale_denom - 1) / scale_denom;
+    cols = (src_ptr->get_cols() + scale_denom - 1) / scale_denom;
+    buf_bytes = rows * cols * packed_pixel_bytes(get_pixel_format());
+
+    frame = new Usb_Frame[buf_count];
+    vbuf = new struct v4l2_buffer[buf_count];
+    img_mem = new uint8_t[(size_t)buf_count * buf_bytes];
+    free_ptr = new Usb_Frame*[buf_count];
+    slot_frame_ptr = new Usb_Frame*[buf_count];
+    slot_state = new Slot_State[buf_count];
+    free_count = 0;
+    for (int i = 0; i < buf_count; ++i) {
+        memset(&vbuf[i], 0, sizeof(vbuf[i]));
+        vbuf[i].type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        vbuf[i].memory = V4L2_MEMORY_USERPTR;
+        vbuf[i].index = i;
+        vbuf[i].length = buf_bytes;
+        frame[i].vbuf_ptr = &vbuf[i];
+        frame[i].img_data = img_mem + (size_t)i * buf_bytes;
+        frame[i].rows = rows;
+        frame[i].cols = cols;
+        frame[i].step = cols * packed_pixel_bytes(get_pixel_format());
+        frame[i].pixel_format = get_pixel_format();
+        frame[i].owner_ptr = this;
+        free_ptr[free_count++] = &frame[i];
+        slot_frame_ptr[i] = NULL;
+        slot_state[i] = SLOT_EMPTY;
+    }
+}
+
+void Mjpeg_Decoder::stream_start()
+{
+    // Reclaim any frames decoded but not popped before the last stop.
+
+    for (int i = 0; i < buf_count; ++i) {
+        if (slot_state[i] != SLOT_EMPTY) {
+            free_ptr[free_count++] = slot_frame_ptr[i];
+            slot_state[i] = SLOT_EMPTY;
+        }
+    }
+    next_ticket = 0;
+    next_pop = 0;
+    source_ended = false;
+    end_ticket = 0;
+    stop_requested = false;
+    src_ptr->stream_start();
+    for (int i = 0; i < worker_count; ++i) {
+        int rc = pthread_create(&worker_id[i], NULL, worker_main, this);
+        if (rc != 0) {
+            printf("can't pthread_create, error_code= %d\n", rc);
+            exit(-1);
+        }
+    }
+    running = true;
+}
+
+void Mjpeg_Decoder::stream_stop()
+{
+    pthread_mutex_lock(&mutex);
+    stop_requested = true;
+    pthread_cond_broadcast(&free_cond);
+    pthread_cond_broadcast(&ready_cond);
+    pthread_mutex_unlock(&mutex);
+    for (int i = 0; i < worker_count; ++i) {
+        pthread_join(worker_id[i], NULL);
+    }
+    running = false;
+    src_ptr->stream_stop();
+}
+
+Usb_Frame* Mjpeg_Decoder::take_free()
+{
+    Usb_Frame* frame_ptr = NULL;
+    pthread_mutex_lock(&mutex);
+    while (free_count == 0 && !stop_requested) {
+        pthread_cond_wait(&free_cond, &mutex);
+    }
+    if (!stop_requested) frame_ptr = free_ptr[--free_count];
+    pthread_mutex_unlock(&mutex);
+    return frame_ptr;
+}
+
+void* Mjpeg_Decoder::worker_main(void* decoder_ptr)
+{
+    Mjpeg_Decoder* self_ptr = (Mjpeg_Decoder*)decoder_ptr;
+    apply_thread_placement(self_ptr->worker_placement, self_ptr->dev_name,
+                           "decode");
+    self_ptr->work();
+    return NULL;
+}
+
+void Mjpeg_Decoder::work()
+{
+    struct jpeg_decompress_struct cinfo;
+    Jpeg_Error_Mgr err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = jpeg_error_exit;
+    err.pub.output_message = jpeg_output_message;
+    jpeg_create_decompress(&cinfo);
+    int ycc_row_bytes = (output == MJPEG_OUT_YUYV) ? cols * 3 : 0;
+    uint8_t* ycc_row = (ycc_row_bytes > 0) ? new uint8_t[ycc_row_bytes]
+                                           : NULL;
+
+    while (1) {
+
+        /* Take a buffer to decode into, then the next compressed frame.
+           Holding src_mutex across both keeps tickets in capture order. */
+
+        pthread_mutex_lock(&src_mutex);
+        Usb_Frame* out_ptr = take_free();
+        Usb_Frame* in_ptr = NULL;
+        bool ended = false;
+        while (out_ptr != NULL && in_ptr == NULL &&
+               !__atomic_load_n(&stop_requested, __ATOMIC_RELAXED)) {
+            ended = source_ended || src_ptr->is_end_of_stream();
+            if (ended) break;
+            int count;
+            in_ptr = src_ptr->pop(count);  // NULL on timeout
+        }
+        if (in_ptr == NULL) {
+
+            /* Only a frame gets a ticket, so pop() can tell when it has
+               had the last one. */
+
+            pthread_mutex_lock(&mutex);
+            if (out_ptr != NULL) {
+                free_ptr[free_count++] = out_ptr;
+                pthread_cond_signal(&free_cond);
+            }
+            if (ended && !source_ended) {
+                end_ticket = next_ticket;
+                __atomic_store_n(&source_ended, true, __ATOMIC_RELEASE);
+                pthread_cond_broadcast(&ready_cond);
+            }
+            pthread_mutex_unlock(&mutex);
+            pthread_mutex_unlock(&src_mutex);
+            break;
+        }
+        uint32_t ticket = next_ticket++;
+        pthread_mutex_unlock(&src_mutex);
+
+        int64_t start_usec = monotonic_usec();
+        int out_rows = 0;
+        int out_cols = 0;
+        bool ok = decode_jpeg(&cinfo, &err, in_ptr->get_img_data(),
+                              in_ptr->get_bytes_used(), output, scale_denom,
+                              out_ptr->img_data, buf_bytes,
+                              ycc_row, ycc_row_bytes, out_rows, out_cols);
+        decode_hist.record(monotonic_usec() - start_usec);
+
+        // The decoded frame takes the number and timestamp of the original.
+
+        struct v4l2_buffer* vp = out_ptr->vbuf_ptr;
+        uint32_t index = vp->index;
+        *vp = *in_ptr->vbuf_ptr;
+        vp->index = index;
+        vp->memory = V4L2_MEMORY_USERPTR;
+        vp->length = buf_bytes;
+        vp->bytesused = out_rows * out_cols *
+                        packed_pixel_bytes(get_pixel_format());
+        out_ptr->dequeue_nsec = in_ptr->dequeue_nsec;
+        out_ptr->timestamp_nsec = in_ptr->timestamp_nsec;
+        out_ptr->timestamp_known = in_ptr->timestamp_known;
+        out_ptr->rows = out_rows;
+        out_ptr->cols = out_cols;
+        out_ptr->step = out_cols * packed_pixel_bytes(get_pixel_format());
+        out_ptr->ref_count = 1;
+        src_ptr->push(in_ptr);
+
+        pthread_mutex_lock(&mutex);
+        int slot = ticket % buf_count;
+        slot_frame_ptr[slot] = out_ptr;
+        slot_state[slot] = ok ? SLOT_DONE : SLOT_FAILED;
+        if (ticket == next_pop) pthread_cond_signal(&ready_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    delete[] ycc_row;
+    jpeg_destroy_decompress(&cinfo);
+}
+
+Usb_Frame* Mjpeg_Decoder::pop(int& count)
+{
+    Usb_Frame* frame_ptr = NULL;
+    pthread_mutex_lock(&mutex);
+    while (frame_ptr == NULL) {
+        int slot = next_pop % buf_count;
+        while (slot_state[slot] == SLOT_EMPTY && !stop_requested &&
+               !(source_ended && next_pop == end_ticket)) {
+            pthread_cond_wait(&ready_cond, &mutex);
+        }
+        if (slot_state[slot] == SLOT_EMPTY) break;  // stopped or ended
+        if (slot_state[slot] == SLOT_FAILED) {
+            free_ptr[free_count++] = slot_frame_ptr[slot];
+            pthread_cond_signal(&free_cond);
+            ++error_count;
+        } else {
+            frame_ptr = slot_frame_ptr[slot];
+        }
+        slot_state[slot] = SLOT_EMPTY;
+        ++next_pop;
+    }
+
+    // Count the decoded frames lined up behind this one.
+
+    count = 0;
+    while (count < buf_count &&
+           slot_state[(next_pop + count) % buf_count] == SLOT_DONE) {
+        ++count;
+    }
+    pthread_mutex_unlock(&mutex);
+    return frame_ptr;
+}
+
+int Mjpeg_Decoder::push(Usb_Frame* frame_ptr)
+{
+    pthread_mutex_lock(&mutex);
+    free_ptr[free_count++] = frame_ptr;
+    int count = free_count;
+    pthread_cond_signal(&free_cond);
+    pthread_mutex_unlock(&mutex);
+    return count;
+}
+
+int Mjpeg_Decoder::get_error_count()
+{
+    pthread_mutex_lock(&mutex);
+    int count = error_count;
+    pthread_mutex_unlock(&mutex);
+    return count;
+}
@@ -0,0 +1,252 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef MJPEG_DECODER_H
+#define MJPEG_DECODER_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+#include "any_camera.h"
+#include "usb_camera.h"
+#include "pipeline_stats.h"
+#include "thread_placement.h"
+
+/**********************************************************************
+ * @brief The kind of image an Mjpeg_Decoder produces.
+ */
+enum Mjpeg_Output {
+    MJPEG_OUT_BGR,   /// 3 bytes per pixel, V4L2_PIX_FMT_BGR24.
+    MJPEG_OUT_GRAY,  /// 1 byte per pixel, V4L2_PIX_FMT_GREY.  Much cheaper;
+                     /// the chroma is never decoded.
+    MJPEG_OUT_YUYV   /// 2 bytes per pixel, V4L2_PIX_FMT_YUYV: the JPEG's
+                     /// own YCbCr, with no color conversion.  What
+                     /// Target_Detector takes.
+};
+
+/**********************************************************************
+ * @brief Decodes the frames of an MJPEG camera on a pool of worker
+ *        threads.
+ *
+ * An Mjpeg_Decoder wraps a camera that produces V4L2_PIX_FMT_MJPEG, and
+ * is itself a camera producing decoded images, so it can be handed to
+ * cam_thread() in place of the camera it wraps.
+ *
+ * Each worker pops a compressed frame from the camera, decodes it into
+ * one of the decoder's own buffers, and gives the compressed frame
+ * straight back to the camera.  Several frames are decoded at once, but
+ * pop() returns them in the order they were captured.  The decoded frame
+ * keeps the frame number and timestamp of the compressed one.  Consumers
+ * push decoded frames back to the decoder when done.
+ *
+ * When every decoded buffer is in use the workers wait, and the camera
+ * holds on to its frames; so buf_count bounds the number of frames in
+ * flight.  Frames that fail to decode are skipped, and show up as a gap
+ * in the frame numbers.
+ *
+ * A scale_denom of 2, 4, or 8 decodes at reduced size directly in the DCT
+ * domain, which costs a fraction of a full decode.
+ */
+class Mjpeg_Decoder: public Any_Camera {
+private:
+    /** The maximum number of worker threads. */
+    static const int MAX_WORKERS = 8;
+
+    /** The state of each slot of the reorder ring. */
+    enum Slot_State {
+        SLOT_EMPTY,   /// Not yet decoded.
+        SLOT_DONE,    /// Holds a decoded frame.
+        SLOT_FAILED   /// Decode failed; holds a buffer to be freed.
+    };
+
+    Any_Camera* src_ptr;               /// The MJPEG camera.
+    char dev_name[FILENAME_MAX];
+    Mjpeg_Output output;
+    int scale_denom;
+    int rows;                          /// Maximum rows after scaling.
+    int cols;                          /// Maximum columns after scaling.
+    int buf_count;                     /// size of frame and vbuf arrays
+    int buf_bytes;                     /// size of each image buffer
+    Usb_Frame* frame;                  /// space for the decoded frames
+    struct v4l2_buffer* vbuf;          /// space for their video buffers
+    uint8_t* img_mem;                  /// space for all decoded images
+
+    /** Decoded buffers given back with push(), available to decode into. */
+    Usb_Frame** free_ptr;
+    int free_count;
+
+    /** The reorder ring.  The frame with ticket t goes in slot
+        t % buf_count.  Since a ticket is only handed out with a free
+        buffer, ticket t - buf_count has always been popped by then. */
+    Usb_Frame** slot_frame_ptr;
+    Slot_State* slot_state;
+
+    /** The ticket for the next frame popped from the camera.  Protected by
+        src_mutex. */
+    uint32_t next_ticket;
+
+    /** The ticket of the next frame pop() returns. */
+    uint32_t next_pop;
+
+    /** Set once the camera has ended; no ticket is handed out from
+        end_ticket on.  Set under src_mutex and mutex both. */
+    bool source_ended;
+    uint32_t end_ticket;
+
+    int worker_count;
+    pthread_t worker_id[MAX_WORKERS];
+    Thread_Placement worker_placement;
+    bool running;
+    bool stop_requested;
+
+    /** The number of frames that failed to decode. */
+    int error_count;
+
+    /** The time taken by each decode. */
+    Latency_Histogram decode_hist;
+
+    /** Serializes popping from the camera and handing out tickets. */
+    pthread_mutex_t src_mutex;
+
+    /** Protects the free list, the reorder ring, next_pop, error_count,
+        stop_requested, and source_ended. */
+    pthread_mutex_t mutex;
+
+    /** Signals a worker waiting for a free buffer. */
+    pthread_cond_t free_cond;
+
+    /** Signals pop() that the frame it waits for has been decoded. */
+    pthread_cond_t ready_cond;
+
+    /*******************************************************************//*
+     * @brief Take a buffer off the free list, waiting if there are none.
+     *        Returns NULL if the decoder is stopping.
+     */
+    Usb_Frame* take_free();
+
+    /*******************************************************************//*
+     * @brief The body of each worker thread.
+     */
+    void work();
+
+    /*******************************************************************//*
+     * @brief A pthread_create(3) start routine that calls work() on the
+     *        Mjpeg_Decoder its argument points at.
+     */
+    static void* worker_main(void* decoder_ptr);
+
+    void deinit();
+
+    // Not copyable.
+    Mjpeg_Decoder(const Mjpeg_Decoder&);
+    Mjpeg_Decoder& operator=(const Mjpeg_Decoder&);
+
+public:
+    Mjpeg_Decoder();
+    virtual ~Mjpeg_Decoder();
+
+    /*******************************************************************//*
+     * @brief Initialize the decoder.
+     *
+     * @param [in] src_ptr      The camera to decode.  It must already be
+     *                          initialized and producing V4L2_PIX_FMT_MJPEG.
+     * @param [in] output       Decode to BGR, grayscale, or YUYV.
+     * @param [in] scale_denom  Decode at 1/scale_denom of the camera's size
+     *                          in each dimension: 1, 2, 4, or 8.
+     * @param [in] worker_count The number of frames to decode at once.
+     * @param [in] buf_count    The number of decoded buffers.  Should be
+     *                          more than worker_count, so the workers can
+     *                          keep going while the consumer holds a frame.
+     */
+    void init(Any_Camera* src_ptr,
+              Mjpeg_Output output = MJPEG_OUT_BGR,
+              int scale_denom = 1,
+              int worker_count = 2,
+              int buf_count = 4);
+
+    virtual const char* get_device_name() const { return dev_name; }
+    virtual int get_buf_count() const { return buf_count; }
+    virtual int get_rows() const { return rows; }
+    virtual int get_cols() const { return cols; }
+
+    /*******************************************************************//*
+     * @brief Return V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_GREY, or
+     *        V4L2_PIX_FMT_YUYV.
+     */
+    virtual uint32_t get_pixel_format() const
+    {
+        switch (output) {
+        case MJPEG_OUT_GRAY:
+            return V4L2_PIX_FMT_GREY;
+        case MJPEG_OUT_YUYV:
+            return V4L2_PIX_FMT_YUYV;
+        default:
+            return V4L2_PIX_FMT_BGR24;
+        }
+    }
+
+    /*******************************************************************//*
+     * @brief Start the camera, then the workers.
+     */
+    virtual void stream_start();
+
+    /*******************************************************************//*
+     * @brief Stop the workers, then the camera.  Any pop() waiting for a
+     *        frame returns NULL.
+     */
+    virtual void stream_stop();
+
+    /*******************************************************************//*
+     * @brief Return the next decoded frame, in capture order, waiting for
+     *        it if need be.
+     *
+     * @param [out] count  Returns the number of decoded frames that are
+     *                     ready to be popped after this one.
+     * @return The frame, or NULL if the decoder has been stopped, or the
+     *         camera has ended and every frame has been popped.
+     */
+    virtual Usb_Frame* pop(int& count);
+
+    /*******************************************************************//*
+     * @brief Return true once the camera has ended and every frame
+     *        decoded from it has been popped.  Call only from the thread
+     *        that calls pop().
+     */
+    virtual bool is_end_of_stream() const
+    {
+        return __atomic_load_n(&source_ended, __ATOMIC_ACQUIRE) &&
+               next_pop == end_ticket;
+    }
+
+    /*******************************************************************//*
+     * @brief Give a decoded frame back, so its buffer can be reused.
+     *
+     * @return The number of free buffers.
+     */
+    virtual int push(Usb_Frame* frame_ptr);
+
+    /*******************************************************************//*
+     * @brief Set where the worker threads run.  Takes effect at the next
+     *        stream_start().
+     */
+    void set_worker_placement(const Thread_Placement& placement)
+    {
+        worker_placement = placement;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of frames that failed to decode.
+     */
+    int get_error_count();
+
+    /*******************************************************************//*
+     * @brief Return the histogram of decode times, in usec.
+     */
+    Latency_Histogram* get_decode_histogram()
+    {
+        return &decode_hist;
+    }
+};
+
+#endif
@@ -0,0 +1,285 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "mode_planner.h"
+
+// Fill str with the fourcc of a format, as text.
+static const char* fourcc_str(uint32_t pixel_format, char str[5])
+{
+    memcpy(str, &pixel_format, 4);
+    str[4] = '\0';
+    return str;
+}
+
+// Return true if mode a is better than mode b: more pixels, then less CPU,
+// then less USB.
+static bool is_better(const Mode_Plan& a, const Mode_Plan& b)
+{
+    int a_pixels = a.rows * a.cols;
+    int b_pixels = b.rows * b.cols;
+    if (a_pixels != b_pixels) return a_pixels > b_pixels;
+    if (a.cpu_load != b.cpu_load) return a.cpu_load < b.cpu_load;
+    return a.bus_load < b.bus_load;
+}
+
+Mode_Planner::Mode_Planner()
+: cost_count(0),
+  cpu_cores(3.0),
+  max_load(0.85),
+  bus_bytes_per_sec(24e6)
+{
+
+    // Fitted to one 480x640 camera at about 43 fps and one 240x320 camera
+    // at 125 fps, each limited by its processing thread.
+
+    Mode_Cost packed = { V4L2_PIX_FMT_YUYV, 2900.0, 66.0, 2.0 };
+    set_cost(packed);
+    packed.pixel_format = V4L2_PIX_FMT_UYVY;
+    set_cost(packed);
+    Mode_Cost grey = { V4L2_PIX_FMT_GREY, 2900.0, 66.0, 1.0 };
+    set_cost(grey);
+
+    // Decoding to YUYV on the Mjpeg_Decoder's workers; about 0.3 bytes
+    // per pixel is typical of these cameras' MJPEG.
+
+    Mode_Cost mjpeg = { V4L2_PIX_FMT_MJPEG, 2900.0, 110.0, 0.3 };
+    set_cost(mjpeg);
+}
+
+bool Mode_Planner::set_cost(const Mode_Cost& new_cost)
+{
+    for (int i = 0; i < cost_count; ++i) {
+        if (cost[i].pixel_format == new_cost.pixel_format) {
+            cost[i] = new_cost;
+            return true;
+        }
+    }
+    if (cost_count == MAX_COSTS) return false;
+    cost[cost_count++] = new_cost;
+    return true;
+}
+
+void Mode_Planner::remove_cost(uint32_t pixel_format)
+{
+    for (int i = 0; i < cost_count; ++i) {
+        if (cost[i].pixel_format == pixel_format) {
+            cost[i] = cost[--cost_count];
+            return;
+        }
+    }
+}
+
+const Mode_Cost* Mode_Planner::find_cost(uint32_t pixel_format) const
+{
+    for (int i = 0; i < cost_count; ++i) {
+        if (cost[i].pixel_format == pixel_format) return &cost[i];
+    }
+    return NULL;
+}
+
+void Mode_Planner::set_budget(double arg_cpu_cores,
+                              double arg_max_load,
+                              double arg_bus_bytes_per_sec)
+{
+    cpu_cores = arg_cpu_cores;
+    max_load = arg_max_load;
+    bus_bytes_per_sec = arg_bus_bytes_per_sec;
+}
+
+const char* Mode_Planner::judge(const Mode_Cost& mode_cost,
+                                const Mode_Need& need,
+                                Mode_Plan& mode) const
+{
+    int cam_count = (need.cam_count < 1) ? 1 : need.cam_count;
+    double pixels = (double)mode.rows * mode.cols;
+    mode.fps = (mode.numerator == 0) ?
+               0.0 : (double)mode.denominator / mode.numerator;
+    mode.cpu_usec = mode_cost.frame_usec +
+                    mode_cost.usec_per_kpixel * pixels / 1000.0;
+
+    // Each camera is processed on one thread, so gets at most one core.
+
+    double cpu_share = cpu_cores / cam_count;
+    if (cpu_share > 1.0) cpu_share = 1.0;
+    mode.cpu_load = mode.cpu_usec * mode.fps / (1e6 * cpu_share);
+    mode.bus_load = pixels * mode_cost.bytes_per_pixel * mode.fps /
+                    (bus_bytes_per_sec / cam_count);
+    mode.latency_usec = (mode.fps > 0.0) ?
+                        1e6 / mode.fps + mode.cpu_usec : 1e12;
+
+    if (mode.rows < need.min_rows || mode.cols < need.min_cols) {
+        return "smaller than needed";
+    }
+    if (mode.fps < need.min_fps - 1e-6) return "too slow";
+    if (mode.cpu_load > max_load) return "over its CPU share";
+    if (mode.bus_load > 1.0) return "over its USB share";
+    if (need.max_latency_usec > 0 &&
+        mode.latency_usec > need.max_latency_usec) {
+        return "over the latency budget";
+    }
+    return NULL;
+}
+
+void Mode_Planner::consider_size(Usb_Camera& cam,
+                                 int format_id,
+                                 const Mode_Cost& mode_cost,
+                                 int rows,
+                                 int cols,
+                                 Search& search) const
+{
+    const Mode_Need& need = *search.need_ptr;
+    struct v4l2_frmivalenum frm_ival[MAX_IVALS];
+    int ival_count = cam.get_supported_frame_intervals(format_id, rows, cols,
+                                                       MAX_IVALS, frm_ival);
+    for (int i = 0; i < ival_count; ++i) {
+        Mode_Plan mode;
+        mode.format_id = format_id;
+        mode.pixel_format = mode_cost.pixel_format;
+        mode.rows = rows;
+        mode.cols = cols;
+        const struct v4l2_frmivalenum& ival = frm_ival[i];
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            mode.numerator = ival.discrete.numerator;
+            mode.denominator = ival.discrete.denominator;
+        } else {
+
+            // A range: ask for just the rate needed, within the range.
+
+            const struct v4l2_fract& lo = ival.stepwise.min;
+            const struct v4l2_fract& hi = ival.stepwise.max;
+            double want = 1.0 / need.min_fps;
+            if (want * lo.denominator <= lo.numerator) {
+                mode.numerator = lo.numerator;
+                mode.denominator = lo.denominator;
+            } else if (want * hi.denominator >= hi.numerator) {
+                mode.numerator = hi.numerator;
+                mode.denominator = hi.denominator;
+            } else {
+                mode.numerator = 1000;
+                mode.denominator = (unsigned int)(need.min_fps * 1000 + 0.5);
+            }
+        }
+
+        const char* why_not = judge(mode_cost, need, mode);
+        ++search.judged_count;
+        if (search.log_ptr != NULL) {
+            char fourcc[5];
+            fprintf(search.log_ptr, "  %s %dx%d @ %u/%u (%.1f fps): "
+                    "cpu %.1f ms %.0f%%, usb %.0f%%, latency %.1f ms: %s\n",
+                    fourcc_str(mode.pixel_format, fourcc), mode.cols,
+                    mode.rows, mode.numerator, mode.denominator, mode.fps,
+                    mode.cpu_usec / 1000.0, 100.0 * mode.cpu_load,
+                    100.0 * mode.bus_load, mode.latency_usec / 1000.0,
+                    (why_not == NULL) ? "fits" : why_not);
+        }
+        if (why_not != NULL) continue;
+        ++search.fit_count;
+        if (!search.found || is_better(mode, search.best)) {
+            search.best = mode;
+            search.found = true;
+        }
+    }
+}
+
+bool Mode_Planner::plan(Usb_Camera& cam,
+                        const Mode_Need& need,
+                        Mode_Plan& chosen,
+                        FILE* log_ptr) const
+{
+    Search search;
+    search.need_ptr = &need;
+    search.log_ptr = log_ptr;
+    search.found = false;
+    search.judged_count = 0;
+    search.fit_count = 0;
+
+    if (log_ptr != NULL) {
+        fprintf(log_ptr, "%s MODES for %.1f fps at %dx%d or larger, "
+                "%d camera(s)\n--------------------\n",
+                cam.get_device_name(), need.min_fps, need.min_cols,
+                need.min_rows, need.cam_count);
+    }
+    int format_id_in = 0;
+    while (1) {
+        const struct v4l2_fmtdesc* fmt_desc_ptr;
+        int format_id = cam.get_format(format_id_in, fmt_desc_ptr);
+        if (format_id != format_id_in) break;
+        ++format_id_in;
+        const Mode_Cost* cost_ptr = find_cost(fmt_desc_ptr->pixelformat);
+        if (cost_ptr == NULL) {
+            if (log_ptr != NULL) {
+                char fourcc[5];
+                fprintf(log_ptr, "  %s: no cost known; skipped\n",
+                        fourcc_str(fmt_desc_ptr->pixelformat, fourcc));
+            }
+            continue;
+        }
+
+        struct v4l2_frmsizeenum frm_size[MAX_SIZES];
+        int size_count = cam.get_supported_frame_sizes(format_id, MAX_SIZES,
+                                                       frm_size);
+        if (size_count == 0) {
+
+            // The driver can't say; try the smallest size needed, which
+            // the driver will adjust.
+
+            consider_size(cam, format_id, *cost_ptr,
+                          need.min_rows, need.min_cols, search);
+        }
+        for (int i = 0; i < size_count; ++i) {
+            const struct v4l2_frmsizeenum& size = frm_size[i];
+            if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+                consider_size(cam, format_id, *cost_ptr,
+                              size.discrete.height, size.discrete.width,
+                              search);
+                continue;
+            }
+
+            // A range: try the smallest size needed, and the largest.
+
+            const struct v4l2_frmsize_stepwise& step = size.stepwise;
+            int cols = step.min_width;
+            int rows = step.min_height;
+            if (cols < need.min_cols) {
+                int step_width = (step.step_width > 0) ? step.step_width : 1;
+                cols += (need.min_cols - cols + step_width - 1) /
+                        step_width * step_width;
+            }
+            if (rows < need.min_rows) {
+                int step_height = (step.step_height > 0) ?
+                                  step.step_height : 1;
+                rows += (need.min_rows - rows + step_height - 1) /
+                        step_height * step_height;
+            }
+            if (cols <= (int)step.max_width && rows <= (int)step.max_height) {
+                consider_size(cam, format_id, *cost_ptr, rows, cols, search);
+            }
+            consider_size(cam, format_id, *cost_ptr,
+                          step.max_height, step.max_width, search);
+        }
+    }
+
+    if (!search.found) {
+        if (log_ptr != NULL) {
+            fprintf(log_ptr, "%s: none of %d modes fits\n",
+                    cam.get_device_name(), search.judged_count);
+        }
+        return false;
+    }
+    chosen = search.best;
+    if (log_ptr != NULL) {
+        char fourcc[5];
+        fprintf(log_ptr, "%s: chose %s %dx%d @ %u/%u (%.1f fps), the most "
+                "pixels of the %d of %d modes that fit; it uses %.0f%% of "
+                "its CPU share and %.0f%% of its USB share\n",
+                cam.get_device_name(),
+                fourcc_str(chosen.pixel_format, fourcc), chosen.cols,
+                chosen.rows, chosen.numerator, chosen.denominator, chosen.fps,
+                search.fit_count, search.judged_count,
+                100.0 * chosen.cpu_load, 100.0 * chosen.bus_load);
+        fflush(log_ptr);
+    }
+    return true;
+}
@@ -0,0 +1,190 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef MODE_PLANNER_H
+#define MODE_PLANNER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "usb_camera.h"
+
+/**********************************************************************
+ * @brief What it costs to capture and process frames of one format.
+ *
+ * Processing a frame takes frame_usec plus usec_per_kpixel for every 1000
+ * pixels, on one core; and each pixel takes bytes_per_pixel of USB
+ * bandwidth, on average for compressed formats.
+ */
+class Mode_Cost {
+public:
+    uint32_t pixel_format;     /// V4L2_PIX_FMT_XXXX
+    double frame_usec;
+    double usec_per_kpixel;
+    double bytes_per_pixel;
+};
+
+/**********************************************************************
+ * @brief What the cameras must deliver.
+ */
+class Mode_Need {
+public:
+    double min_fps;            /// Each camera's lowest acceptable rate.
+    int min_rows;              /// The smallest acceptable image.
+    int min_cols;
+    int cam_count;             /// Cameras sharing the CPU and USB budget.
+    int64_t max_latency_usec;  /// From exposure to result; 0 for no limit.
+
+    Mode_Need()
+    : min_fps(30.0),
+      min_rows(240),
+      min_cols(320),
+      cam_count(1),
+      max_latency_usec(0)
+    { }
+};
+
+/**********************************************************************
+ * @brief A camera mode: a format, size and frame interval, and what it
+ *        is expected to cost.
+ */
+class Mode_Plan {
+public:
+    int format_id;             /// For Usb_Camera::init().
+    uint32_t pixel_format;
+    int rows;
+    int cols;
+    unsigned int numerator;    /// For Usb_Camera::set_frame_interval().
+    unsigned int denominator;
+    double fps;
+    double cpu_usec;           /// Processing time per frame.
+    double cpu_load;           /// Fraction of the camera's CPU share used.
+    double bus_load;           /// Fraction of its USB bandwidth share used.
+    double latency_usec;       /// One frame interval plus processing.
+};
+
+/**********************************************************************
+ * @brief Picks each camera's format, frame size and frame interval from
+ *        what the camera supports, to meet a Mode_Need within the CPU and
+ *        USB budget.
+ *
+ * Every mode the camera offers is judged against the need and against the
+ * camera's share of the budget: an equal share of the USB bandwidth (the
+ * cameras share one bus), and of the CPU cores, but never more than one
+ * core, since each camera's frames are processed on one thread.  Of the
+ * modes that fit, the one with the most pixels wins; ties go to the one
+ * with the lowest CPU load, then the lowest USB load.  So the frame rate
+ * chosen is the lowest offered that meets the need, and spare CPU goes to
+ * resolution.
+ *
+ * The cost of each format comes from a Mode_Cost.  The defaults for
+ * packed 4:2:2 formats are fitted to rates measured on the ODROID-U3 (see
+ * capture4_main.cpp); the MJPEG default adds a rough decode cost.  Measure
+ * the target with pipeline_bench and convert_bench, and give the results
+ * to set_cost(), when the hardware or the processing changes.  Formats
+ * with no cost are not considered.
+ *
+ * Every mode judged, and why the winner won, is logged.
+ */
+class Mode_Planner {
+public:
+    /** The most formats with a cost. */
+    static const int MAX_COSTS = 8;
+
+    /** The most frame sizes and frame intervals considered per format. */
+    static const int MAX_SIZES = 32;
+    static const int MAX_IVALS = 16;
+
+private:
+    int cost_count;
+    Mode_Cost cost[MAX_COSTS];
+    double cpu_cores;
+    double max_load;
+    double bus_bytes_per_sec;
+
+    /** The state of one plan(). */
+    class Search {
+    public:
+        const Mode_Need* need_ptr;
+        FILE* log_ptr;
+        Mode_Plan best;
+        bool found;
+        int judged_count;
+        int fit_count;
+    };
+
+    /*******************************************************************//*
+     * @brief Fill in mode's costs, and return NULL if it meets the need,
+     *        else why not.
+     */
+    const char* judge(const Mode_Cost& mode_cost,
+                      const Mode_Need& need,
+                      Mode_Plan& mode) const;
+
+    /*******************************************************************//*
+     * @brief Judge every interval the camera offers at one format and
+     *        size, log each, and keep the best that fits.
+     */
+    void consider_size(Usb_Camera& cam,
+                       int format_id,
+                       const Mode_Cost& mode_cost,
+                       int rows,
+                       int cols,
+                       Search& search) const;
+
+public:
+    Mode_Planner();
+
+    /*******************************************************************//*
+     * @brief Set, or add, the cost of a format.
+     *
+     * @return False if there are already MAX_COSTS formats.
+     */
+    bool set_cost(const Mode_Cost& new_cost);
+
+    /*******************************************************************//*
+     * @brief Forget the cost of a format, so it is never chosen; for
+     *        formats the processing can't use.
+     */
+    void remove_cost(uint32_t pixel_format);
+
+    /*******************************************************************//*
+     * @brief Return the cost of a format, or NULL if it has none.
+     */
+    const Mode_Cost* find_cost(uint32_t pixel_format) const;
+
+    /*******************************************************************//*
+     * @brief Set the budget shared by all the cameras.
+     *
+     * @param [in] cpu_cores          Cores for frame processing.  Default 3:
+     *                                core 0 is left to the system.
+     * @param [in] max_load           The most of its share any camera may
+     *                                plan to use, leaving headroom for
+     *                                jitter.  Default 0.85.
+     * @param [in] bus_bytes_per_sec  Usable USB bandwidth.  Default 24e6,
+     *                                the isochronous limit of USB 2.0 in
+     *                                practice.
+     */
+    void set_budget(double cpu_cores,
+                    double max_load,
+                    double bus_bytes_per_sec);
+
+    /*******************************************************************//*
+     * @brief Choose the best mode for a camera.
+     *
+     * The camera must be open_device()ed, or init()ed in any mode, so that
+     * it can be asked what it supports.  Then init() it with the plan's
+     * format and size, and set_frame_interval() to the plan's interval.
+     *
+     * @param [in] cam      The camera.
+     * @param [in] need     What it must deliver.
+     * @param [out] chosen  Returns the mode chosen.
+     * @param [in] log_ptr  Where to log the modes judged; NULL for nowhere.
+     * @return False if no mode meets the need.
+     */
+    bool plan(Usb_Camera& cam,
+              const Mode_Need& need,
+              Mode_Plan& chosen,
+              FILE* log_ptr) const;
+};
+
+#endif
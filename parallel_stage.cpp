@@ -0,0 +1,221 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "parallel_stage.h"
+#include "usb_camera.h"
+
+Parallel_Stage::Parallel_Stage(const char* stage_name)
+: Pipeline_Stage(stage_name),
+  worker_count(0),
+  max_in_flight(0),
+  slot_frame_ptr(NULL),
+  slot_done(NULL),
+  slot_done_usec(NULL),
+  next_ticket(0),
+  next_emit(0),
+  in_flight(0),
+  emitting(false),
+  queued_count(0),
+  steal_count(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&room_cond, NULL);
+    pthread_cond_init(&work_cond, NULL);
+}
+
+Parallel_Stage::~Parallel_Stage()
+{
+    for (int w = 0; w < worker_count; ++w) {
+        delete[] deque[w].ticket;
+        pthread_mutex_destroy(&deque[w].mutex);
+    }
+    delete[] slot_frame_ptr;
+    delete[] slot_done;
+    delete[] slot_done_usec;
+    pthread_cond_destroy(&work_cond);
+    pthread_cond_destroy(&room_cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+void Parallel_Stage::init(Pipeline_Stage** arg_worker_ptr,
+                          int arg_worker_count,
+                          int arg_max_in_flight)
+{
+    if (arg_worker_count < 1 || arg_worker_count > MAX_WORKERS ||
+        arg_max_in_flight < 1 || worker_count != 0) {
+        throw Usb_Cam_Err("Parallel_Stage: bad worker count or bound");
+    }
+    worker_count = arg_worker_count;
+    max_in_flight = arg_max_in_flight;
+    for (int w = 0; w < worker_count; ++w) {
+        worker_ptr[w] = arg_worker_ptr[w];
+        pthread_mutex_init(&deque[w].mutex, NULL);
+        deque[w].ticket = new uint32_t[max_in_flight];
+        deque[w].head = 0;
+        deque[w].count = 0;
+    }
+    slot_frame_ptr = new Usb_Frame*[max_in_flight];
+    slot_done = new bool[max_in_flight];
+    slot_done_usec = new int64_t[max_in_flight];
+    for (int i = 0; i < max_in_flight; ++i) {
+        slot_frame_ptr[i] = NULL;
+        slot_done[i] = false;
+    }
+}
+
+bool Parallel_Stage::take(int w, uint32_t& ticket)
+{
+    // Our own oldest ticket first.
+
+    Work_Deque* dp = &deque[w];
+    pthread_mutex_lock(&dp->mutex);
+    if (dp->count > 0) {
+        ticket = dp->ticket[dp->head];
+        dp->head = (dp->head + 1) % max_in_flight;
+        --dp->count;
+        pthread_mutex_unlock(&dp->mutex);
+        return true;
+    }
+    pthread_mutex_unlock(&dp->mutex);
+
+    // Else the newest ticket of the next worker that has any.
+
+    for (int i = 1; i < worker_count; ++i) {
+        dp = &deque[(w + i) % worker_count];
+        pthread_mutex_lock(&dp->mutex);
+        if (dp->count > 0) {
+            --dp->count;
+            ticket = dp->ticket[(dp->head + dp->count) % max_in_flight];
+            pthread_mutex_unlock(&dp->mutex);
+            __atomic_add_fetch(&steal_count, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+        pthread_mutex_unlock(&dp->mutex);
+    }
+    return false;
+}
+
+void Parallel_Stage::finish(uint32_t ticket)
+{
+    pthread_mutex_lock(&mutex);
+    int slot = ticket % max_in_flight;
+    slot_done[slot] = true;
+    slot_done_usec[slot] = monotonic_usec();
+    if (emitting) {
+
+        // Whoever is passing frames on will get to this one.
+
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    emitting = true;
+    while (in_flight > 0 && slot_done[next_emit % max_in_flight]) {
+        slot = next_emit % max_in_flight;
+        Usb_Frame* frame_ptr = slot_frame_ptr[slot];
+        reorder_hist.record(monotonic_usec() - slot_done_usec[slot]);
+        slot_done[slot] = false;
+        ++next_emit;
+        pthread_mutex_unlock(&mutex);
+
+        emit(frame_ptr);
+        pass_on(frame_ptr);
+
+        // Only now is there room, so a blocked output holds back input.
+
+        pthread_mutex_lock(&mutex);
+        --in_flight;
+        pthread_cond_signal(&room_cond);
+    }
+    emitting = false;
+    pthread_mutex_unlock(&mutex);
+}
+
+void Parallel_Stage::work(int w)
+{
+    Pipeline_Stage* stage_ptr = worker_ptr[w];
+    apply_thread_placement(stage_ptr->placement, get_cam_name(),
+                           stage_ptr->stage_name);
+    stage_ptr->begin();
+    while (1) {
+        pthread_mutex_lock(&mutex);
+        while (queued_count == 0) pthread_cond_wait(&work_cond, &mutex);
+
+        // Tickets are queued with mutex held too, so one is sure to be in
+        // some deque, and no other worker can take it first.
+
+        uint32_t ticket;
+        take(w, ticket);
+        --queued_count;
+        Usb_Frame* frame_ptr = slot_frame_ptr[ticket % max_in_flight];
+        pthread_mutex_unlock(&mutex);
+
+        int64_t start_usec = monotonic_usec();
+        stage_ptr->process(frame_ptr);
+        process_hist.record(monotonic_usec() - start_usec);
+        finish(ticket);
+    }
+}
+
+void* Parallel_Stage::worker_main(void* worker_arg_ptr)
+{
+    Worker_Arg* arg_ptr = (Worker_Arg*)worker_arg_ptr;
+    arg_ptr->stage_ptr->work(arg_ptr->worker);
+    return NULL;
+}
+
+void Parallel_Stage::run()
+{
+    apply_thread_placement(get_placement(), get_cam_name(), get_name());
+    for (int w = 0; w < worker_count; ++w) {
+        worker_arg[w].stage_ptr = this;
+        worker_arg[w].worker = w;
+        pthread_t thread_id;
+        int rc = pthread_create(&thread_id, NULL, worker_main,
+                                (void*)&worker_arg[w]);
+        if (rc != 0) {
+            printf("can't pthread_create, error_code= %d\n", rc);
+            exit(-1);
+        }
+    }
+
+    Any_Frame_Queue* in_queue_ptr = get_in_queue();
+    Stage_Stats* stats_ptr = get_stats();
+    int next_worker = 0;
+    while (1) {
+        int in_count;
+        stats_ptr->begin_pop();
+        Usb_Frame* frame_ptr = in_queue_ptr->pop(in_count);
+        if (frame_ptr == NULL) {
+            wait_if_ended();
+            continue;  // timeout
+        }
+        stats_ptr->end_pop(frame_ptr);
+
+        /* Wait for room, then give the frame a slot in the reorder ring,
+           and its ticket to the next worker in turn. */
+
+        pthread_mutex_lock(&mutex);
+        while (in_flight == max_in_flight) {
+            pthread_cond_wait(&room_cond, &mutex);
+        }
+        uint32_t ticket = next_ticket++;
+        slot_frame_ptr[ticket % max_in_flight] = frame_ptr;
+        ++in_flight;
+
+        Work_Deque* dp = &deque[next_worker];
+        pthread_mutex_lock(&dp->mutex);
+        dp->ticket[(dp->head + dp->count) % max_in_flight] = ticket;
+        ++dp->count;
+        pthread_mutex_unlock(&dp->mutex);
+        next_worker = (next_worker + 1) % worker_count;
+        ++queued_count;
+        pthread_cond_signal(&work_cond);
+        pthread_mutex_unlock(&mutex);
+
+        // The time recorded as processing is the wait for room.
+
+        stats_ptr->end_process();
+    }
+}
@@ -0,0 +1,188 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef PARALLEL_STAGE_H
+#define PARALLEL_STAGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "pipeline_stage.h"
+#include "pipeline_stats.h"
+
+/**********************************************************************
+ * @brief A pipeline stage that processes several frames at once, on a
+ *        pool of worker threads.
+ *
+ * Each worker is an ordinary Pipeline_Stage, whose process() is called
+ * from the worker's own thread, so any state it keeps (a Target_Detector,
+ * say) is never shared.  The stage's own thread pops frames from the
+ * input queue and deals them out to the workers' deques in turn; a worker
+ * whose deque is empty steals from the others, so one slow frame doesn't
+ * leave the rest of its worker's frames waiting.
+ *
+ * Frames finish out of order, but leave in the order they arrived (which,
+ * from a camera, is the order of Usb_Frame::get_frame_num()): finished
+ * frames wait in a reorder ring until every frame before them is done.
+ * At most max_in_flight frames are between the input and the output at
+ * once; after that, the stage stops popping until the oldest leaves.  So
+ * the latency added is bounded, and a slow worker holds back at most
+ * max_in_flight camera buffers.
+ *
+ * A subclass may override emit(), which sees each frame in order just
+ * before it is passed on; for example to publish results in order.
+ */
+class Parallel_Stage: public Pipeline_Stage {
+public:
+    /** The most worker threads. */
+    static const int MAX_WORKERS = 8;
+
+private:
+    /** A worker's queue of tickets.  The owner takes the oldest ticket;
+        thieves take the newest, from the other end. */
+    class Work_Deque {
+    public:
+        pthread_mutex_t mutex;
+        uint32_t* ticket;      /// ring of capacity max_in_flight
+        int head;              /// index of the oldest ticket
+        int count;
+    };
+
+    int worker_count;
+    Pipeline_Stage* worker_ptr[MAX_WORKERS];
+    Work_Deque deque[MAX_WORKERS];
+    int max_in_flight;
+
+    /** The reorder ring.  The frame with ticket t is in slot
+        t % max_in_flight; since at most max_in_flight tickets are out,
+        no two share a slot. */
+    Usb_Frame** slot_frame_ptr;
+    bool* slot_done;
+    int64_t* slot_done_usec;
+
+    uint32_t next_ticket;      /// The ticket of the next frame popped.
+    uint32_t next_emit;        /// The ticket of the next frame to leave.
+    int in_flight;             /// Frames popped but not yet passed on.
+
+    /** True while some worker is passing frames on; only one may, so they
+        leave in order. */
+    bool emitting;
+
+    /** Tickets in deques, not yet taken by a worker. */
+    int queued_count;
+
+    /** Protects the reorder ring, in_flight, emitting, and queued_count.
+        Tickets are only put in or taken from the deques with this held
+        too, so queued_count is always the number in them. */
+    pthread_mutex_t mutex;
+
+    /** Signals the stage's thread that in_flight has dropped. */
+    pthread_cond_t room_cond;
+
+    /** Signals idle workers that a ticket has been queued. */
+    pthread_cond_t work_cond;
+
+    int steal_count;           /// Tickets taken from another's deque.
+    Latency_Histogram process_hist;  /// Time in each process().
+    Latency_Histogram reorder_hist;  /// Time done frames wait to leave.
+
+    /** The argument to worker_main(). */
+    class Worker_Arg {
+    public:
+        Parallel_Stage* stage_ptr;
+        int worker;
+    };
+    Worker_Arg worker_arg[MAX_WORKERS];
+
+    /*******************************************************************//*
+     * @brief Take a ticket from worker w's own deque, or else steal one.
+     *        Call with mutex locked.
+     *
+     * @return False if every deque was empty.
+     */
+    bool take(int w, uint32_t& ticket);
+
+    /*******************************************************************//*
+     * @brief Mark the given ticket done, and pass on every frame that is
+     *        now next in order.
+     */
+    void finish(uint32_t ticket);
+
+    /*******************************************************************//*
+     * @brief The body of worker thread w.
+     */
+    void work(int w);
+
+    static void* worker_main(void* worker_arg_ptr);
+
+    // Not copyable.
+    Parallel_Stage(const Parallel_Stage&);
+    Parallel_Stage& operator=(const Parallel_Stage&);
+
+protected:
+    /*******************************************************************//*
+     * @brief Called with each frame in order, from whichever worker is
+     *        passing frames on, just before the frame is passed on.  Only
+     *        one call runs at a time.
+     */
+    virtual void emit(Usb_Frame*)
+    { }
+
+    /*******************************************************************//*
+     * @brief Not used; the workers do the processing.
+     */
+    virtual void process(Usb_Frame*)
+    { }
+
+public:
+    /*******************************************************************//*
+     * @param [in] stage_name  For logs and reports.
+     */
+    Parallel_Stage(const char* stage_name);
+    virtual ~Parallel_Stage();
+
+    /*******************************************************************//*
+     * @brief Set the workers.  Call before the stage is started.
+     *
+     * @param [in] worker_ptr     The workers; each gets a thread of its
+     *                            own, placed by its own set_placement().
+     *                            They must outlive this stage.
+     * @param [in] worker_count   How many, 1 to MAX_WORKERS.
+     * @param [in] max_in_flight  The most frames in the stage at once; at
+     *                            least 1.  More than worker_count lets a
+     *                            worker start on its next frame while an
+     *                            earlier one waits to leave.
+     */
+    void init(Pipeline_Stage** worker_ptr,
+              int worker_count,
+              int max_in_flight);
+
+    /*******************************************************************//*
+     * @brief Start the workers, then deal out frames.  Never returns.
+     */
+    virtual void run();
+
+    int get_steal_count() const
+    {
+        return __atomic_load_n(&steal_count, __ATOMIC_RELAXED);
+    }
+
+    /*******************************************************************//*
+     * @brief Return the histogram of time spent in each worker's
+     *        process(), in usec.
+     */
+    Latency_Histogram* get_process_histogram()
+    {
+        return &process_hist;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the histogram of time finished frames waited for the
+     *        ones before them, in usec.
+     */
+    Latency_Histogram* get_reorder_histogram()
+    {
+        return &reorder_hist;
+    }
+};
+
+#endif
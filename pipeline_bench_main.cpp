@@ -0,0 +1,1141 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+
+/* Benchmark the queue and pipeline layers without any camera hardware,
+   and write one row of results per configuration as CSV or JSON, so runs
+   from different commits can be compared by script.
+
+   queue     Frame_Queue and Spsc_Frame_Queue, blocking and non-blocking,
+             with 1 to max_pairs producer/consumer thread pairs, each pair
+             with a queue of its own.  Items are handed over as fast as
+             possible; latency is from push() to the matching pop(), in ns.
+
+   pipeline  cam_thread() fed by a Synthetic_Camera, headless, with each
+             queue type and each mix of stages; and once fed by a
+             Replay_Camera playing back a recording of the synthetic
+             pattern.  At fps 0 the camera makes a frame as soon as a
+             buffer comes back, which measures throughput; at a fixed
+             rate the latency, in usec, is the frame's age when it
+             reaches the last stage.
+
+   Before any of that, a set of checks makes sure the simulated sources
+   behave as the benchmarks assume.  If any check fails, so does the
+   program.  With -check, only the checks are run.
+
+   Every configuration, and every check, runs in a child process of its
+   own, so the threads of one never compete with the next.  Logging from
+   the children goes to stderr; only results go to stdout.
+
+   Usage: pipeline_bench [-json] [-check] [seconds [max_pairs [fps]]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <jpeglib.h>
+#include "frame_queue.h"
+#include "spsc_frame_queue.h"
+#include "synthetic_camera.h"
+#include "replay_camera.h"
+#include "frame_recorder.h"
+#include "frame_handle.h"
+#include "mailbox_frame_queue.h"
+#include "cam_thread.h"
+#include "frame_sync.h"
+#include "mjpeg_decoder.h"
+#include "pipeline_stats.h"
+
+#ifndef HEADLESS
+pthread_mutex_t disp_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* One row of results.  Columns that don't apply are left empty. */
+class Bench_Row {
+public:
+    const char* bench;      /// "queue" or "pipeline"
+    const char* queue;      /// "mutex", "spsc" or "mailbox"
+    const char* mode;       /// "blocking" or "nonblocking"
+    int threads;            /// Thread pairs, or cameras.
+    char stages[48];        /// The pipeline's stages, joined by '-'.
+    double fps;             /// The camera's rate; 0 for unpaced.
+    uint64_t items;         /// Items handed over, or frames delivered.
+    double secs;
+    double items_per_sec;
+    const char* unit;       /// Of the latencies: "ns" or "us".
+    uint32_t lat_p50;
+    uint32_t lat_p99;
+    uint32_t lat_max;
+    uint64_t drops;         /// Frames missing at the last stage.
+    double cpu_usec_per_item;
+
+    Bench_Row()
+    : bench(""), queue(""), mode(""), threads(0), fps(0), items(0), secs(0),
+      items_per_sec(0), unit(""), lat_p50(0), lat_p99(0), lat_max(0),
+      drops(0), cpu_usec_per_item(0)
+    {
+        stages[0] = '\0';
+    }
+};
+
+static const char* CSV_HEADER =
+    "bench,queue,mode,threads,stages,fps,items,secs,items_per_sec,"
+    "lat_unit,lat_p50,lat_p99,lat_max,drops,cpu_usec_per_item\n";
+
+static void format_row(const Bench_Row& r, bool json, char* buf, int bytes)
+{
+    if (json) {
+        snprintf(buf, bytes,
+                 "  {\"bench\": \"%s\", \"queue\": \"%s\", \"mode\": \"%s\", "
+                 "\"threads\": %d, \"stages\": \"%s\", \"fps\": %.0f, "
+                 "\"items\": %llu, \"secs\": %.3f, \"items_per_sec\": %.1f, "
+                 "\"lat_unit\": \"%s\", \"lat_p50\": %u, \"lat_p99\": %u, "
+                 "\"lat_max\": %u, \"drops\": %llu, "
+                 "\"cpu_usec_per_item\": %.3f}",
+                 r.bench, r.queue, r.mode, r.threads, r.stages, r.fps,
+                 (unsigned long long)r.items, r.secs, r.items_per_sec,
+                 r.unit, r.lat_p50, r.lat_p99, r.lat_max,
+                 (unsigned long long)r.drops, r.cpu_usec_per_item);
+    } else {
+        snprintf(buf, bytes,
+                 "%s,%s,%s,%d,%s,%.0f,%llu,%.3f,%.1f,%s,%u,%u,%u,%llu,%.3f\n",
+                 r.bench, r.queue, r.mode, r.threads, r.stages, r.fps,
+                 (unsigned long long)r.items, r.secs, r.items_per_sec,
+                 r.unit, r.lat_p50, r.lat_p99, r.lat_max,
+                 (unsigned long long)r.drops, r.cpu_usec_per_item);
+    }
+}
+
+static int64_t cpu_usec()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    int64_t secs = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec;
+    return secs * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void sleep_secs(double secs)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)secs;
+    ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+// Add the counts of b into a.
+static void add_snapshot(Latency_Histogram::Snapshot& a,
+                         const Latency_Histogram::Snapshot& b)
+{
+    for (int i = 0; i < Latency_Histogram::BUCKETS; ++i) {
+        a.count[i] += b.count[i];
+    }
+    a.total += b.total;
+    if (b.max_usec > a.max_usec) a.max_usec = b.max_usec;
+}
+
+
+/**********************************************************************
+ * Queue handoff.
+ *
+ * The queues only store pointers, so the items are addresses within a
+ * token array rather than real frames; the consumer finds the push time
+ * of each by its offset.  A pair cycles through TOKENS tokens, more than
+ * the queue can hold, so the producer never reuses a token the consumer
+ * has yet to read.
+ */
+
+static const int QUEUE_SIZE = 8;
+static const int TOKENS = 4 * QUEUE_SIZE;
+
+class Queue_Pair {
+public:
+    Any_Frame_Queue* queue_ptr;
+    bool blocking;
+    char token[TOKENS + 1];          /// The last is the stop token.
+    int64_t push_nsec[TOKENS];
+    Latency_Histogram lat_hist;      /// In ns.
+    uint64_t items;
+    pthread_barrier_t* start_ptr;
+    volatile bool* stop_ptr;
+};
+
+static Usb_Frame* token_ptr(Queue_Pair* p, int i)
+{
+    return (Usb_Frame*)&p->token[i];
+}
+
+static void* producer_main(void* pair_ptr)
+{
+    Queue_Pair* p = (Queue_Pair*)pair_ptr;
+    pthread_barrier_wait(p->start_ptr);
+    int i = 0;
+    while (!*p->stop_ptr) {
+        p->push_nsec[i] = monotonic_nsec();
+        while (p->queue_ptr->push(token_ptr(p, i)) < 0) sched_yield();
+        if (++i == TOKENS) i = 0;
+    }
+    while (p->queue_ptr->push(token_ptr(p, TOKENS)) < 0) sched_yield();
+    return NULL;
+}
+
+static void* consumer_main(void* pair_ptr)
+{
+    Queue_Pair* p = (Queue_Pair*)pair_ptr;
+    pthread_barrier_wait(p->start_ptr);
+    while (1) {
+        int count;
+        Usb_Frame* item_ptr = p->queue_ptr->pop(count);
+        if (item_ptr == NULL) {
+            if (!p->blocking) sched_yield();
+            continue;
+        }
+        int i = (char*)item_ptr - p->token;
+        if (i == TOKENS) break;
+        p->lat_hist.record(monotonic_nsec() - p->push_nsec[i]);
+        ++p->items;
+    }
+    return NULL;
+}
+
+static void run_queue(bool spsc, bool blocking, int pairs, double secs,
+                      Bench_Row& row)
+{
+    Queue_Pair* pair = new Queue_Pair[pairs];
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, 2 * pairs + 1);
+    volatile bool stop = false;
+    pthread_t* thread_id = new pthread_t[2 * pairs];
+    for (int i = 0; i < pairs; ++i) {
+        Queue_Pair* p = &pair[i];
+        if (spsc) {
+            p->queue_ptr = new Spsc_Frame_Queue(QUEUE_SIZE, blocking,
+                                                blocking);
+        } else {
+            p->queue_ptr = new Frame_Queue(QUEUE_SIZE, blocking, blocking);
+        }
+        p->blocking = blocking;
+        p->items = 0;
+        p->start_ptr = &start;
+        p->stop_ptr = &stop;
+        pthread_create(&thread_id[2 * i], NULL, consumer_main, (void*)p);
+        pthread_create(&thread_id[2 * i + 1], NULL, producer_main, (void*)p);
+    }
+
+    pthread_barrier_wait(&start);
+    int64_t cpu_begin = cpu_usec();
+    int64_t begin_nsec = monotonic_nsec();
+    sleep_secs(secs);
+    stop = true;
+    for (int i = 0; i < 2 * pairs; ++i) pthread_join(thread_id[i], NULL);
+    double elapsed = (monotonic_nsec() - begin_nsec) / 1e9;
+    int64_t cpu = cpu_usec() - cpu_begin;
+
+    Latency_Histogram::Snapshot lat = Latency_Histogram::Snapshot();
+    for (int i = 0; i < pairs; ++i) {
+        Latency_Histogram::Snapshot zero = Latency_Histogram::Snapshot();
+        Latency_Histogram::Snapshot one;
+        pair[i].lat_hist.take_interval(zero, one);
+        add_snapshot(lat, one);
+        row.items += pair[i].items;
+        delete pair[i].queue_ptr;
+    }
+    row.bench = "queue";
+    row.queue = spsc ? "spsc" : "mutex";
+    row.mode = blocking ? "blocking" : "nonblocking";
+    row.threads = pairs;
+    row.secs = elapsed;
+    row.items_per_sec = row.items / elapsed;
+    row.unit = "ns";
+    row.lat_p50 = lat.percentile(0.50);
+    row.lat_p99 = lat.percentile(0.99);
+    row.lat_max = lat.max_usec;
+    row.cpu_usec_per_item = row.items > 0 ? (double)cpu / row.items : 0.0;
+
+    pthread_barrier_destroy(&start);
+    delete[] thread_id;
+    delete[] pair;
+}
+
+
+/**********************************************************************
+ * End-to-end pipeline.
+ */
+
+class Pipeline_Config {
+public:
+    const char* queue;
+    Cam_Queue_Type queue_type;
+    bool pyramid;
+    int detect_workers;       /// 0 for no detect stage.
+    bool replay;              /// Replay replay_file_name, not synthesize.
+};
+
+static const Pipeline_Config PIPELINE_CONFIGS[] = {
+    { "mutex",   CAM_QUEUE_MUTEX,   false, 0, false },
+    { "spsc",    CAM_QUEUE_SPSC,    false, 0, false },
+    { "mailbox", CAM_QUEUE_MAILBOX, false, 0, false },
+    { "spsc",    CAM_QUEUE_SPSC,    false, 1, false },
+    { "spsc",    CAM_QUEUE_SPSC,    false, 2, false },
+    { "spsc",    CAM_QUEUE_SPSC,    true,  1, false },
+    { "spsc",    CAM_QUEUE_SPSC,    false, 1, true  }
+};
+
+static const int BENCH_ROWS = 480;
+static const int BENCH_COLS = 640;
+
+/* A recording of the synthetic pattern, for the replay configurations and
+   checks; made once by main(). */
+
+static char replay_file_name[] = "/tmp/pipeline_bench_XXXXXX";
+static const int REPLAY_FRAMES = 120;
+
+// Record the first frames of a Synthetic_Camera to a capture file.
+static bool record_synthetic(const char* file_name, int frames)
+{
+    Synthetic_Camera cam;
+    cam.init("record", BENCH_ROWS, BENCH_COLS, 0.0, 4);
+    Frame_Recorder recorder;
+
+    // The recorder can queue every buffer, so it never drops a frame.
+
+    if (!recorder.open(file_name, cam.get_rows(), cam.get_cols(),
+                       cam.get_pixel_format(), cam.get_buf_bytes(), frames,
+                       cam.get_buf_count())) {
+        return false;
+    }
+    cam.stream_start();
+    for (int i = 0; i < frames; ++i) {
+        int count;
+        Usb_Frame* frame_ptr = cam.pop(count);
+        if (recorder.push(frame_ptr) < 0) cam.push(frame_ptr);
+    }
+    bool ok = recorder.get_drop_count() == 0;
+    recorder.close();
+    return ok;
+}
+
+static void run_pipeline(const Pipeline_Config& config, double fps,
+                         double secs, Bench_Row& row)
+{
+    static Synthetic_Camera synth_cam;
+    static Replay_Camera replay_cam;
+    Any_Camera* cam_ptr = &synth_cam;
+    if (config.replay) {
+        if (!replay_cam.init(replay_file_name, fps, 6, true)) {
+            fprintf(stderr, "can't replay %s\n", replay_file_name);
+            exit(-1);
+        }
+        cam_ptr = &replay_cam;
+    } else {
+        synth_cam.init("bench", BENCH_ROWS, BENCH_COLS, fps, 6);
+    }
+    static Yuv_Range range;
+    range.y_min = 100;
+    range.u_max = 100;
+    range.v_max = 100;
+    static Cam_Thread_Arg cam_arg;
+    cam_arg.cam_ptr = cam_ptr;
+    cam_arg.queue_type = config.queue_type;
+    cam_arg.headless = true;
+    cam_arg.build_pyramid = config.pyramid;
+    if (config.detect_workers > 0) {
+        cam_arg.target_range_ptr = &range;
+        cam_arg.detect_workers = config.detect_workers;
+    }
+    pthread_t thread_id;
+    int rc = pthread_create(&thread_id, NULL, cam_thread, (void*)&cam_arg);
+    if (rc != 0) {
+        fprintf(stderr, "can't pthread_create, error_code= %d\n", rc);
+        exit(-1);
+    }
+
+    // Let it settle, then measure at the last stage.
+
+    sleep_secs(0.5);
+    Stage_Stats* stats_ptr =
+            pipeline_stats.find_stage(cam_ptr->get_device_name(), "sink");
+    if (stats_ptr == NULL) {
+        fprintf(stderr, "pipeline didn't start\n");
+        exit(-1);
+    }
+    Latency_Histogram::Snapshot age_prev = Latency_Histogram::Snapshot();
+    Latency_Histogram::Snapshot age;
+    stats_ptr->get_age_histogram()->take_interval(age_prev, age);
+    uint32_t frames_begin = stats_ptr->get_frame_count();
+    uint32_t drops_begin = stats_ptr->get_drop_count();
+    int64_t cpu_begin = cpu_usec();
+    int64_t begin_usec = monotonic_usec();
+    sleep_secs(secs);
+    stats_ptr->get_age_histogram()->take_interval(age_prev, age);
+    double elapsed = (monotonic_usec() - begin_usec) / 1e6;
+    int64_t cpu = cpu_usec() - cpu_begin;
+
+    row.bench = "pipeline";
+    row.queue = config.queue;
+    row.mode = "blocking";
+    row.threads = 1;
+    snprintf(row.stages, sizeof(row.stages), "%s%s%s%s-sink",
+             config.replay ? "replay" : "capture",
+             config.pyramid ? "-pyramid" : "",
+             config.detect_workers > 0 ? "-detect" : "",
+             config.detect_workers > 1 ? "x2" : "");
+    row.fps = fps;
+    row.items = stats_ptr->get_frame_count() - frames_begin;
+    row.secs = elapsed;
+    row.items_per_sec = row.items / elapsed;
+    row.unit = "us";
+    row.lat_p50 = age.percentile(0.50);
+    row.lat_p99 = age.percentile(0.99);
+    row.lat_max = age.max_usec;
+    row.drops = stats_ptr->get_drop_count() - drops_begin;
+    row.cpu_usec_per_item = row.items > 0 ? (double)cpu / row.items : 0.0;
+}
+
+
+/**********************************************************************
+ * Checks.  Each returns true if it passes, logging why not to stderr.
+ */
+
+/* A paced camera must lose the frames that come due while no buffer is
+   free, as a driver would, even though it only captures when pop() is
+   called.  So every frame's timestamp must be no earlier than the moment
+   its buffer was given back, and a consumer slower than the camera must
+   see gaps in the frame numbers. */
+
+static bool check_sim_pacing()
+{
+    const double FPS = 100.0;
+    const int64_t HOLD_NSEC = 25000000;
+    const int FRAMES = 40;
+    Synthetic_Camera cam;
+    cam.init("pacing", 240, 320, FPS, 2);
+    int64_t pushed_nsec[2] = { 0, 0 };
+    cam.stream_start();
+    int late = 0;
+    int first_num = 0;
+    int last_num = 0;
+    for (int i = 0; i < FRAMES; ++i) {
+        int count;
+        Usb_Frame* frame_ptr = cam.pop(count);
+        int buf = frame_ptr->get_buf_index();
+
+        // The timestamp has only usec resolution.
+
+        if (frame_ptr->get_timestamp_nsec() + 1000 < pushed_nsec[buf]) {
+            ++late;
+        }
+        if (i == 0) first_num = frame_ptr->get_frame_num();
+        last_num = frame_ptr->get_frame_num();
+        sleep_secs(HOLD_NSEC / 1e9);
+        pushed_nsec[buf] = monotonic_nsec();
+        cam.push(frame_ptr);
+    }
+    int lost = last_num - first_num + 1 - FRAMES;
+    fprintf(stderr, "check sim_pacing: %d of %d frames captured before "
+            "their buffer was free; %d frames lost\n", late, FRAMES, lost);
+
+    // The consumer takes 2.5 periods per frame, so over half are lost.
+
+    return late == 0 && lost > FRAMES / 2;
+}
+
+/* A Replay_Camera must play back exactly what was recorded, with the
+   recorded frame numbers, and then end. */
+
+static bool check_replay()
+{
+    Replay_Camera replay;
+    if (!replay.init(replay_file_name, 0.0, 3, false)) {
+        fprintf(stderr, "check replay: can't open %s\n", replay_file_name);
+        return false;
+    }
+    Synthetic_Camera synth;
+    synth.init("expect", BENCH_ROWS, BENCH_COLS, 0.0, 3);
+    replay.stream_start();
+    synth.stream_start();
+    int played = 0;
+    int mismatch = 0;
+    while (1) {
+        int count;
+        Usb_Frame* frame_ptr = replay.pop(count);
+        if (frame_ptr == NULL) break;
+        Usb_Frame* expect_ptr = synth.pop(count);
+        if (frame_ptr->get_frame_num() != expect_ptr->get_frame_num() ||
+            frame_ptr->get_bytes_used() != expect_ptr->get_bytes_used() ||
+            memcmp(frame_ptr->get_img_data(), expect_ptr->get_img_data(),
+                   expect_ptr->get_bytes_used()) != 0) {
+            ++mismatch;
+        }
+        ++played;
+        synth.push(expect_ptr);
+        replay.push(frame_ptr);
+    }
+    fprintf(stderr, "check replay: %d of %d frames played, %d differ\n",
+            played, REPLAY_FRAMES, mismatch);
+    return played == REPLAY_FRAMES && mismatch == 0;
+}
+
+/* Seeking in a capture file must find the same record as a linear scan,
+   however many frames the recording dropped; and a file whose header
+   claims more records than its index holds must be refused. */
+
+static bool check_seek()
+{
+    const int FRAMES = 3000;
+    char file_name[] = "/tmp/pipeline_bench_seek_XXXXXX";
+    int fd = mkstemp(file_name);
+    if (fd < 0) return false;
+    close(fd);
+
+    /* Record with bursts of drops of growing length, as a writer that falls
+       further and further behind would. */
+
+    Synthetic_Camera cam;
+    cam.init("seek", 16, 32, 0.0, 2);
+    Frame_Recorder recorder;
+    if (!recorder.open(file_name, cam.get_rows(), cam.get_cols(),
+                       cam.get_pixel_format(), cam.get_buf_bytes(), FRAMES,
+                       cam.get_buf_count())) {
+        unlink(file_name);
+        return false;
+    }
+    cam.stream_start();
+    for (int i = 0; i < FRAMES; ++i) {
+        int count;
+        Usb_Frame* frame_ptr = cam.pop(count);
+        bool drop = (i / 100) % 2 == 1 && i % 100 < i / 20;
+        if (drop || recorder.push(frame_ptr) < 0) cam.push(frame_ptr);
+    }
+    recorder.close();
+
+    Capture_File file;
+    bool ok = file.open(file_name);
+    int count = ok ? file.get_record_count() : 0;
+    int last_num = (count > 0) ? file.get_entry(count - 1).sequence : 0;
+    int wrong = 0;
+    for (int f = 0; ok && f <= last_num + 1; ++f) {
+        int expect = 0;
+        while (expect < count && (int)file.get_entry(expect).sequence < f) {
+            ++expect;
+        }
+        if (file.find_frame_num(f) != expect) ++wrong;
+        if (expect < count) {
+
+            // Frames may share a timestamp; the first is wanted.
+
+            int64_t usec = file.get_entry(expect).timestamp_usec;
+            int first = expect;
+            while (first > 0 &&
+                   file.get_entry(first - 1).timestamp_usec >= usec) {
+                --first;
+            }
+            if (file.find_timestamp(usec) != first) ++wrong;
+        }
+    }
+    fprintf(stderr, "check seek: %d records of %d frames, %d seeks wrong\n",
+            count, last_num + 1, wrong);
+    file.close();
+
+    // Claim one record more than the index holds.
+
+    fd = open(file_name, O_RDWR);
+    Capture_File_Header header;
+    if (fd < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        ok = false;
+    } else {
+        header.record_count = header.index_capacity + 1;
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+            file.open(file_name)) {
+            fprintf(stderr, "check seek: corrupt record count accepted\n");
+            ok = false;
+        }
+    }
+    if (fd >= 0) close(fd);
+    unlink(file_name);
+    return ok && count < FRAMES && wrong == 0;
+}
+
+/* A capture file with a record claiming more data than a frame holds
+   must play without that record rather than overflow the buffer; and a
+   file whose frames don't fit its slots must be refused. */
+
+static bool check_bad_record()
+{
+    const int FRAMES = 10;
+    const int BAD = 3;
+    char file_name[] = "/tmp/pipeline_bench_bad_XXXXXX";
+    int fd = mkstemp(file_name);
+    if (fd < 0) return false;
+    close(fd);
+
+    Synthetic_Camera cam;
+    cam.init("bad", 16, 32, 0.0, 2);
+    Frame_Recorder recorder;
+    if (!recorder.open(file_name, cam.get_rows(), cam.get_cols(),
+                       cam.get_pixel_format(), cam.get_buf_bytes(), FRAMES,
+                       cam.get_buf_count())) {
+        unlink(file_name);
+        return false;
+    }
+    cam.stream_start();
+    for (int i = 0; i < FRAMES; ++i) {
+        int count;
+        Usb_Frame* frame_ptr = cam.pop(count);
+        if (recorder.push(frame_ptr) < 0) cam.push(frame_ptr);
+    }
+    recorder.close();
+
+    // Claim that one record holds far more than a frame.
+
+    bool ok = true;
+    Capture_File_Header header;
+    Capture_Index_Entry entry;
+    off_t entry_offset = 0;
+    fd = open(file_name, O_RDWR);
+    if (fd < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        ok = false;
+    } else {
+        entry_offset = header.index_offset + BAD * sizeof(entry);
+        ok = pread(fd, &entry, sizeof(entry), entry_offset) == sizeof(entry);
+        entry.bytesused = 0x7fffffff;
+        ok = ok && pwrite(fd, &entry, sizeof(entry), entry_offset) ==
+                   sizeof(entry);
+    }
+
+    int played = 0;
+    int skipped_num = -1;
+    Replay_Camera replay;
+    if (ok && replay.init(file_name, 0.0, 2, false)) {
+        replay.stream_start();
+        int expect_num = 0;
+        while (1) {
+            int count;
+            Usb_Frame* frame_ptr = replay.pop(count);
+            if (frame_ptr == NULL) break;
+            if ((int)frame_ptr->get_frame_num() != expect_num) {
+                skipped_num = expect_num;
+            }
+            expect_num = frame_ptr->get_frame_num() + 1;
+            ++played;
+            replay.push(frame_ptr);
+        }
+    } else {
+        ok = false;
+    }
+    fprintf(stderr, "check bad_record: %d of %d records played, frame %d "
+            "skipped\n", played, FRAMES, skipped_num);
+
+    // Claim frames bigger than their slots.
+
+    header.frame_bytes = header.slot_bytes + 1;
+    Capture_File file;
+    if (fd < 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        file.open(file_name)) {
+        fprintf(stderr, "check bad_record: oversized frames accepted\n");
+        ok = false;
+    }
+    if (fd >= 0) close(fd);
+    unlink(file_name);
+    return ok && played == FRAMES - 1 && skipped_num == BAD;
+}
+
+/* A tap on a pipeline stage is a parallel branch: a slow one must miss
+   frames rather than hold up the rest of the pipeline, and a frame it
+   holds must not go back to the camera until it is released. */
+
+class Start_Stage: public Pipeline_Stage {
+    Any_Camera* cam_ptr;
+
+protected:
+    virtual void begin()
+    {
+        cam_ptr->stream_start();
+    }
+
+    virtual void process(Usb_Frame*)
+    { }
+
+public:
+    Start_Stage(Any_Camera* arg_cam_ptr)
+    : Pipeline_Stage("capture"),
+      cam_ptr(arg_cam_ptr)
+    { }
+};
+
+class Count_Stage: public Pipeline_Stage {
+public:
+    volatile int count;
+
+protected:
+    virtual void process(Usb_Frame*)
+    {
+        ++count;
+    }
+
+public:
+    Count_Stage()
+    : Pipeline_Stage("count"),
+      count(0)
+    { }
+};
+
+/* Pops frames from a tap, holds each for a while, and checks that its
+   buffer wasn't refilled meanwhile. */
+class Slow_Branch {
+public:
+    Any_Frame_Queue* queue_ptr;
+    volatile int count;
+    volatile int reused;
+
+    static void* main(void* branch_ptr)
+    {
+        Slow_Branch* b = (Slow_Branch*)branch_ptr;
+        while (1) {
+            int count;
+            Frame_Handle frame(b->queue_ptr->pop(count));
+            if (frame.empty()) continue;
+            int frame_num = frame->get_frame_num();
+            sleep_secs(0.02);
+            if (frame->get_frame_num() != frame_num) ++b->reused;
+            ++b->count;
+        }
+        return NULL;
+    }
+};
+
+static bool check_slow_tap()
+{
+    // Static, since the threads are still running when this returns.
+
+    static Synthetic_Camera cam;
+    cam.init("tap", 240, 320, 0.0, 6);
+    static Frame_Releaser releaser;
+    static Pipeline pipeline("tap", &cam, &releaser, cam.get_buf_count());
+    static Start_Stage start_stage(&cam);
+    static Count_Stage count_stage;
+
+    // One branch skips new frames while full; one keeps only the latest.
+
+    static Slow_Branch branch[2];
+    static Spsc_Frame_Queue drop_new(1, true, false);
+    static Mailbox_Frame_Queue keep_latest(&releaser, true);
+    branch[0].queue_ptr = &drop_new;
+    branch[1].queue_ptr = &keep_latest;
+    for (int i = 0; i < 2; ++i) {
+        branch[i].count = 0;
+        branch[i].reused = 0;
+        start_stage.add_tap(branch[i].queue_ptr);
+        pthread_t thread_id;
+        pthread_create(&thread_id, NULL, Slow_Branch::main,
+                       (void*)&branch[i]);
+    }
+    pipeline.add_stage(&start_stage);
+    pipeline.add_stage(&count_stage);
+    pipeline.start();
+    sleep_secs(0.5);
+
+    // Each slow branch takes at most 50 frames a second.
+
+    int passed = count_stage.count;
+    bool ok = passed > 1000;
+    for (int i = 0; i < 2; ++i) {
+        fprintf(stderr, "check slow_tap: branch %d took %d frames of %d, "
+                "%d refilled while held\n", i, branch[i].count, passed,
+                branch[i].reused);
+        if (branch[i].count == 0 || branch[i].reused != 0) ok = false;
+    }
+    return ok;
+}
+
+/* A pipeline fed by a replay that has run out must go quiet rather than
+   spin on the empty camera.  And its stages must run without timing when
+   the Pipeline_Stats is already full, as it is here. */
+
+static bool check_end_of_stream()
+{
+    while (pipeline_stats.add_stage("filler", "filler") != NULL) { }
+
+    static Replay_Camera replay;
+    if (!replay.init(replay_file_name, 0.0, 3, false)) {
+        fprintf(stderr, "check end_of_stream: can't open %s\n",
+                replay_file_name);
+        return false;
+    }
+    static Pipeline pipeline("eos", &replay, &replay, replay.get_buf_count());
+    static Start_Stage start_stage(&replay);
+    static Count_Stage count_stage;
+    pipeline.add_stage(&start_stage);
+    pipeline.add_stage(&count_stage);
+    pipeline.start();
+    sleep_secs(0.5);
+
+    int64_t cpu_begin = cpu_usec();
+    sleep_secs(0.5);
+    int64_t cpu = cpu_usec() - cpu_begin;
+    fprintf(stderr, "check end_of_stream: %d of %d frames passed, then "
+            "%.0f ms of CPU in 500 ms\n", count_stage.count, REPLAY_FRAMES,
+            cpu / 1000.0);
+    return count_stage.count == REPLAY_FRAMES && cpu < 50000;
+}
+
+/* Two cameras started together tick together, so Frame_Sync must pair
+   each frame with the one of the same number from the other camera, well
+   within the tolerance. */
+
+static bool check_sync()
+{
+    const int SETS = 50;
+    const int64_t TOLERANCE_USEC = 2000;
+
+    // Fail rather than hang if no sets come.
+
+    alarm(5);
+
+    // Static, since the feeder threads are still running when this returns.
+
+    static Synthetic_Camera cam[2];
+    static Frame_Sync sync(TOLERANCE_USEC);
+    for (int i = 0; i < 2; ++i) {
+        cam[i].init(i == 0 ? "left" : "right", 240, 320, 100.0, 4);
+    }
+    for (int i = 0; i < 2; ++i) {
+        cam[i].stream_start();
+        sync.add_input(&cam[i], &cam[i]);
+    }
+    sync.start();
+    int mismatched = 0;
+    int64_t max_skew = 0;
+    for (int n = 0; n < SETS; ++n) {
+        Frame_Set set;
+        sync.pop(set);
+        if (set.count != 2 ||
+            set.frame_ptr[0]->get_frame_num() !=
+                set.frame_ptr[1]->get_frame_num()) {
+            ++mismatched;
+        }
+        if (set.skew_usec > max_skew) max_skew = set.skew_usec;
+        sync.push(set);
+    }
+    fprintf(stderr, "check sync: %d sets, %d mismatched, skew at most "
+            "%lld usec\n", SETS, mismatched, (long long)max_skew);
+    return mismatched == 0 && max_skew <= TOLERANCE_USEC;
+}
+
+/* A camera of JPEG frames, each the same image: a smooth ramp of luma,
+   and chroma in 16 pixel blocks, so 4:2:0 sampling loses none of it. */
+
+class Jpeg_Camera: public Sim_Camera {
+public:
+    static const int FRAMES = 8;
+
+    int frame_count;
+
+    static uint8_t luma(int r, int c)
+    {
+        return 40 + (r + c) / 2;
+    }
+
+    static uint8_t cb(int r, int c)
+    {
+        return ((r / 16 + c / 16) % 2 == 0) ? 90 : 170;
+    }
+
+    static uint8_t cr(int r, int)
+    {
+        return ((r / 16) % 2 == 0) ? 110 : 150;
+    }
+
+    void init(int rows, int cols)
+    {
+        frame_count = 0;
+        init_pool("jpeg", rows, cols, V4L2_PIX_FMT_MJPEG, rows * cols * 3,
+                  2, 0.0);
+    }
+
+protected:
+    virtual bool fill_frame(Usb_Frame* frame_ptr, uint32_t& bytesused)
+    {
+        if (frame_count == FRAMES) return false;
+        ++frame_count;
+
+        struct jpeg_compress_struct cinfo;
+        struct jpeg_error_mgr err;
+        cinfo.err = jpeg_std_error(&err);
+        jpeg_create_compress(&cinfo);
+        unsigned char* out = NULL;
+        unsigned long out_bytes = 0;
+        jpeg_mem_dest(&cinfo, &out, &out_bytes);
+        cinfo.image_width = get_cols();
+        cinfo.image_height = get_rows();
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_YCbCr;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, 95, TRUE);
+        jpeg_start_compress(&cinfo, TRUE);
+        uint8_t* row = new uint8_t[get_cols() * 3];
+        while ((int)cinfo.next_scanline < get_rows()) {
+            int r = cinfo.next_scanline;
+            for (int c = 0; c < get_cols(); ++c) {
+                row[3 * c] = luma(r, c);
+                row[3 * c + 1] = cb(r, c);
+                row[3 * c + 2] = cr(r, c);
+            }
+            JSAMPROW row_ptr = row;
+            jpeg_write_scanlines(&cinfo, &row_ptr, 1);
+        }
+        jpeg_finish_compress(&cinfo);
+        jpeg_destroy_compress(&cinfo);
+        delete[] row;
+
+        bool ok = out_bytes <= (unsigned long)get_buf_bytes();
+        if (ok) memcpy(frame_ptr->get_img_data(), out, out_bytes);
+        bytesused = ok ? out_bytes : 0;
+        free(out);
+        return true;
+    }
+};
+
+/* An Mjpeg_Decoder with YUYV output must give the image the camera
+   encoded, in the packed 4:2:2 layout the detector takes, within the
+   error of the compression; and when the camera runs out, so must the
+   decoder, rather than wait for a frame that will never come. */
+
+static bool check_mjpeg_yuyv()
+{
+    const int ROWS = 96;
+    const int COLS = 128;
+    const int MAX_ERROR = 12;
+
+    alarm(5);
+    static Jpeg_Camera cam;
+    static Mjpeg_Decoder decoder;
+    cam.init(ROWS, COLS);
+    decoder.init(&cam, MJPEG_OUT_YUYV, 1, 2, 4);
+    decoder.stream_start();
+    int max_error = 0;
+    int frames = 0;
+    bool format_ok = decoder.get_pixel_format() == V4L2_PIX_FMT_YUYV;
+    for (int n = 0; n < Jpeg_Camera::FRAMES; ++n) {
+        int count;
+        Usb_Frame* frame_ptr = decoder.pop(count);
+        if (frame_ptr == NULL) break;
+        ++frames;
+        if (frame_ptr->get_pixel_format() != V4L2_PIX_FMT_YUYV ||
+            frame_ptr->get_rows() != ROWS || frame_ptr->get_cols() != COLS ||
+            frame_ptr->get_bytes_used() != (uint32_t)(ROWS * COLS * 2)) {
+            format_ok = false;
+        }
+        const uint8_t* data = frame_ptr->get_img_data();
+        for (int r = 0; r < ROWS; ++r) {
+            const uint8_t* p = data + r * frame_ptr->get_step();
+            for (int c = 0; c < COLS; c += 2, p += 4) {
+                int err[4] = { p[0] - Jpeg_Camera::luma(r, c),
+                               p[1] - Jpeg_Camera::cb(r, c),
+                               p[2] - Jpeg_Camera::luma(r, c + 1),
+                               p[3] - Jpeg_Camera::cr(r, c) };
+                for (int i = 0; i < 4; ++i) {
+                    int e = (err[i] < 0) ? -err[i] : err[i];
+                    if (e > max_error) max_error = e;
+                }
+            }
+        }
+        decoder.push(frame_ptr);
+    }
+    int count;
+    bool ended = decoder.pop(count) == NULL && decoder.is_end_of_stream();
+    fprintf(stderr, "check mjpeg_yuyv: %d of %d frames, layout %s, error at "
+            "most %d, %s\n", frames, Jpeg_Camera::FRAMES,
+            format_ok ? "ok" : "wrong", max_error,
+            ended ? "then ended" : "but didn't end");
+    return frames == Jpeg_Camera::FRAMES && format_ok &&
+           max_error <= MAX_ERROR && ended;
+}
+
+typedef bool (*Check_Func)();
+
+class Check {
+public:
+    const char* name;
+    Check_Func func;
+};
+
+static const Check CHECKS[] = {
+    { "sim_pacing", check_sim_pacing },
+    { "replay",     check_replay },
+    { "seek",       check_seek },
+    { "bad_record", check_bad_record },
+    { "slow_tap",   check_slow_tap },
+    { "end_of_stream", check_end_of_stream },
+    { "sync",       check_sync },
+    { "mjpeg_yuyv", check_mjpeg_yuyv }
+};
+
+// Run a check in a child process; return true if it passed.
+static bool run_check(const Check& check)
+{
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        dup2(2, 1);
+        _exit(check.func() ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    fprintf(stderr, "check %s: %s\n", check.name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+
+/**********************************************************************
+ * Run one configuration in a child process, and return its row, already
+ * formatted, through a pipe.
+ */
+
+class Bench_Job {
+public:
+    bool is_queue;
+    bool spsc;
+    bool blocking;
+    int pairs;
+    const Pipeline_Config* config_ptr;
+    double fps;
+};
+
+static bool run_job(const Bench_Job& job, double secs, bool json,
+                    char* buf, int bytes)
+{
+    int fd[2];
+    if (pipe(fd) != 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        close(fd[0]);
+        dup2(2, 1);  // keep the children's logging out of the results
+        Bench_Row row;
+        if (job.is_queue) {
+            run_queue(job.spsc, job.blocking, job.pairs, secs, row);
+        } else {
+            run_pipeline(*job.config_ptr, job.fps, secs, row);
+        }
+        format_row(row, json, buf, bytes);
+        if (write(fd[1], buf, strlen(buf)) < 0) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    int len = 0;
+    int n;
+    while (len < bytes - 1 &&
+           (n = read(fd[0], buf + len, bytes - 1 - len)) > 0) {
+        len += n;
+    }
+    buf[len] = '\0';
+    close(fd[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return len > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    bool check_only = false;
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-json") == 0) {
+            json = true;
+        } else if (strcmp(argv[arg], "-check") == 0) {
+            check_only = true;
+        } else {
+            fprintf(stderr, "usage: pipeline_bench [-json] [-check] "
+                    "[seconds [max_pairs [fps]]]\n");
+            return 1;
+        }
+        ++arg;
+    }
+    double secs = (arg < argc) ? atof(argv[arg++]) : 1.0;
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_pairs = (arg < argc) ? atoi(argv[arg++]) : (cpus < 4 ? cpus : 4);
+    if (max_pairs < 1) max_pairs = 1;
+    double paced_fps = (arg < argc) ? atof(argv[arg++]) : 120.0;
+
+    int fd = mkstemp(replay_file_name);
+    if (fd < 0) {
+        perror(replay_file_name);
+        return 1;
+    }
+    close(fd);
+    if (!record_synthetic(replay_file_name, REPLAY_FRAMES)) {
+        fprintf(stderr, "can't record %s\n", replay_file_name);
+        unlink(replay_file_name);
+        return 1;
+    }
+    int failed = 0;
+    int check_count = sizeof(CHECKS) / sizeof(CHECKS[0]);
+    for (int i = 0; i < check_count; ++i) {
+        if (!run_check(CHECKS[i])) ++failed;
+    }
+    if (check_only) {
+        unlink(replay_file_name);
+        return (failed == 0) ? 0 : 1;
+    }
+
+    const int MAX_JOBS = 64;
+    Bench_Job job[MAX_JOBS];
+    int job_count = 0;
+    for (int spsc = 0; spsc < 2; ++spsc) {
+        for (int blocking = 1; blocking >= 0; --blocking) {
+            for (int pairs = 1; pairs <= max_pairs; ++pairs) {
+                if (job_count == MAX_JOBS) break;
+                Bench_Job& j = job[job_count++];
+                j.is_queue = true;
+                j.spsc = spsc;
+                j.blocking = blocking;
+                j.pairs = pairs;
+                j.config_ptr = NULL;
+                j.fps = 0;
+            }
+        }
+    }
+    int config_count = sizeof(PIPELINE_CONFIGS) / sizeof(PIPELINE_CONFIGS[0]);
+    for (int c = 0; c < config_count; ++c) {
+        for (int paced = 0; paced < 2; ++paced) {
+            if (job_count == MAX_JOBS) break;
+            Bench_Job& j = job[job_count++];
+            j.is_queue = false;
+            j.config_ptr = &PIPELINE_CONFIGS[c];
+            j.fps = paced ? paced_fps : 0.0;
+        }
+    }
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("%s", CSV_HEADER);
+    }
+    bool first = true;
+    for (int i = 0; i < job_count; ++i) {
+        char buf[512];
+        if (!run_job(job[i], secs, json, buf, sizeof(buf))) {
+            fprintf(stderr, "job %d failed\n", i);
+            ++failed;
+            continue;
+        }
+        if (json && !first) printf(",\n");
+        printf("%s", buf);
+        fflush(stdout);
+        first = false;
+    }
+    if (json) printf("\n]\n");
+    unlink(replay_file_name);
+    return (failed == 0) ? 0 : 1;
+}
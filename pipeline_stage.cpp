@@ -0,0 +1,200 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pipeline_stage.h"
+#include "usb_camera.h"
+#include "frame_queue.h"
+#include "spsc_frame_queue.h"
+
+Any_Frame_Queue* new_frame_queue(Cam_Queue_Type queue_type,
+                                 Any_Frame_Queue* recycle_queue_ptr,
+                                 int max_size,
+                                 bool block_on_empty,
+                                 bool block_on_full)
+{
+    switch (queue_type) {
+    case CAM_QUEUE_MAILBOX:
+        return new Mailbox_Frame_Queue(recycle_queue_ptr, block_on_empty);
+    case CAM_QUEUE_SPSC:
+        return new Spsc_Frame_Queue(max_size, block_on_empty, block_on_full);
+    case CAM_QUEUE_MUTEX:
+    default:
+        return new Frame_Queue(max_size, block_on_empty, block_on_full);
+    }
+}
+
+Pipeline_Stage::Pipeline_Stage(const char* name)
+: cam_name(""),
+  in_queue_ptr(NULL),
+  out_queue_ptr(NULL),
+  source_cam_ptr(NULL),
+  drop_queue_ptr(NULL),
+  mailbox_ptr(NULL),
+  tap_count(0),
+  stats_ptr(NULL)
+{
+    strncpy(stage_name, name, sizeof(stage_name) - 1);
+    stage_name[sizeof(stage_name) - 1] = '\0';
+}
+
+Pipeline_Stage::~Pipeline_Stage()
+{ }
+
+bool Pipeline_Stage::add_tap(Any_Frame_Queue* new_tap_ptr)
+{
+    if (tap_count == MAX_TAPS) return false;
+    tap_ptr[tap_count++] = new_tap_ptr;
+    return true;
+}
+
+void Pipeline_Stage::connect(const char* arg_cam_name,
+                             Any_Frame_Queue* arg_in_queue_ptr,
+                             Any_Frame_Queue* arg_out_queue_ptr,
+                             Any_Frame_Queue* arg_drop_queue_ptr,
+                             Stage_Stats* arg_stats_ptr)
+{
+    cam_name = arg_cam_name;
+    in_queue_ptr = arg_in_queue_ptr;
+    out_queue_ptr = arg_out_queue_ptr;
+    drop_queue_ptr = arg_drop_queue_ptr;
+    source_cam_ptr = dynamic_cast<Any_Camera*>(in_queue_ptr);
+    mailbox_ptr = dynamic_cast<Mailbox_Frame_Queue*>(out_queue_ptr);
+    stats_ptr = (arg_stats_ptr != NULL) ? arg_stats_ptr : &unlisted_stats;
+}
+
+void Pipeline_Stage::pass_on(Usb_Frame* frame_ptr)
+{
+    /* Add every tap's reference before handing the frame to any of them,
+       so a fast tap can't return the frame to the camera while the others
+       are still being given it. */
+
+    frame_ptr->add_ref(tap_count);
+    for (int i = 0; i < tap_count; ++i) {
+        if (tap_ptr[i]->push(frame_ptr) < 0) frame_ptr->release();
+    }
+    if (out_queue_ptr->push(frame_ptr) < 0) {
+
+        // The next stage is behind, and would rather skip a frame.
+
+        drop_queue_ptr->push(frame_ptr);
+    }
+    if (mailbox_ptr != NULL) {
+        stats_ptr->set_overwrite_count(mailbox_ptr->get_overwritten_count());
+    }
+}
+
+void Pipeline_Stage::wait_if_ended()
+{
+    if (source_cam_ptr == NULL || !source_cam_ptr->is_end_of_stream()) {
+        return;
+    }
+    printf("%s %s: end of stream\n", cam_name, stage_name);
+    fflush(stdout);
+    while (1) pause();
+}
+
+void Pipeline_Stage::run()
+{
+    apply_thread_placement(placement, cam_name, stage_name);
+    begin();
+    while (1) {
+        int in_count;
+        stats_ptr->begin_pop();
+        Usb_Frame* frame_ptr = in_queue_ptr->pop(in_count);
+        if (frame_ptr == NULL) {
+            wait_if_ended();
+            continue;  // timeout
+        }
+        stats_ptr->end_pop(frame_ptr);
+        process(frame_ptr);
+        stats_ptr->end_process();
+        pass_on(frame_ptr);
+    }
+}
+
+void* Pipeline_Stage::thread_main(void* stage_ptr)
+{
+    ((Pipeline_Stage*)stage_ptr)->run();
+    return NULL;
+}
+
+void Pipeline_Stage::start()
+{
+    int rc = pthread_create(&thread_id, NULL, thread_main, (void*)this);
+    if (rc != 0) {
+        printf("can't pthread_create, error_code= %d\n", rc);
+        exit(-1);
+    }
+}
+
+Pipeline::Pipeline(const char* arg_cam_name,
+                   Any_Frame_Queue* arg_source_ptr,
+                   Any_Frame_Queue* arg_return_queue_ptr,
+                   int arg_default_queue_size)
+: cam_name(arg_cam_name),
+  source_ptr(arg_source_ptr),
+  return_queue_ptr(arg_return_queue_ptr),
+  default_queue_size(arg_default_queue_size),
+  stage_count(0),
+  built(false)
+{
+    for (int i = 0; i < MAX_STAGES; ++i) {
+        stage_ptr[i] = NULL;
+        queue_ptr[i] = NULL;
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    for (int i = 0; i < stage_count; ++i) delete queue_ptr[i];
+}
+
+bool Pipeline::add_stage(Pipeline_Stage* new_stage_ptr,
+                         const Stage_Link& new_link)
+{
+    if (stage_count == MAX_STAGES || built) return false;
+    stage_ptr[stage_count] = new_stage_ptr;
+    link[stage_count] = new_link;
+    ++stage_count;
+    return true;
+}
+
+void Pipeline::build()
+{
+    if (built) return;
+    built = true;
+    for (int i = 1; i < stage_count; ++i) {
+        int max_size = (link[i].max_size > 0) ? link[i].max_size
+                                              : default_queue_size;
+        queue_ptr[i] = new_frame_queue(link[i].queue_type, return_queue_ptr,
+                                       max_size, true, link[i].block_on_full);
+    }
+    for (int i = 0; i < stage_count; ++i) {
+        Any_Frame_Queue* in_ptr = (i == 0) ? source_ptr : queue_ptr[i];
+        Any_Frame_Queue* out_ptr = (i + 1 < stage_count) ? queue_ptr[i + 1]
+                                                         : return_queue_ptr;
+        stage_ptr[i]->connect(cam_name, in_ptr, out_ptr, return_queue_ptr,
+                              pipeline_stats.add_stage(cam_name,
+                                                 stage_ptr[i]->get_name()));
+    }
+}
+
+void Pipeline::start()
+{
+    build();
+    for (int i = stage_count - 1; i >= 0; --i) stage_ptr[i]->start();
+}
+
+void Pipeline::run()
+{
+    build();
+
+    // Start from the end, so each stage's consumer is ready before it.
+
+    for (int i = stage_count - 1; i > 0; --i) stage_ptr[i]->start();
+    stage_ptr[0]->run();
+}
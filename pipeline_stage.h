@@ -0,0 +1,323 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef PIPELINE_STAGE_H
+#define PIPELINE_STAGE_H
+
+#include <pthread.h>
+#include "any_frame_queue.h"
+#include "any_camera.h"
+#include "mailbox_frame_queue.h"
+#include "pipeline_stats.h"
+#include "thread_placement.h"
+
+/**********************************************************************
+ * @brief Identifies which Any_Frame_Queue implementation passes frames
+ *        from one pipeline stage to the next.
+ */
+enum Cam_Queue_Type {
+    CAM_QUEUE_MUTEX,   /// Frame_Queue; safe for any number of threads.
+    CAM_QUEUE_SPSC,    /// Spsc_Frame_Queue; one producer, one consumer.
+    CAM_QUEUE_MAILBOX  /// Mailbox_Frame_Queue; keep only the newest frame.
+};
+
+/**********************************************************************
+ * @brief Make a new queue of the given type.
+ *
+ * @param [in] queue_type         Which implementation.
+ * @param [in] recycle_queue_ptr  For CAM_QUEUE_MAILBOX, where overwritten
+ *                                frames go.
+ * @param [in] max_size           Capacity, for the other types.
+ * @param [in] block_on_empty     Whether pop() waits for a frame.
+ * @param [in] block_on_full      Whether push() waits for room.
+ * @return The queue; the caller deletes it.
+ */
+Any_Frame_Queue* new_frame_queue(Cam_Queue_Type queue_type,
+                                 Any_Frame_Queue* recycle_queue_ptr,
+                                 int max_size,
+                                 bool block_on_empty,
+                                 bool block_on_full);
+
+/**********************************************************************
+ * @brief How the queue into a stage behaves when the stage falls behind.
+ */
+class Stage_Link {
+public:
+    /** The kind of queue.  CAM_QUEUE_MAILBOX keeps only the newest frame,
+        giving older ones back. */
+    Cam_Queue_Type queue_type;
+
+    /** The capacity of the queue, or 0 for the camera's buffer count.
+        Ignored for CAM_QUEUE_MAILBOX. */
+    int max_size;
+
+    /** True to make the stage before wait for room; false to give the new
+        frame straight back instead.  Ignored for CAM_QUEUE_MAILBOX. */
+    bool block_on_full;
+
+    Stage_Link(Cam_Queue_Type arg_queue_type = CAM_QUEUE_SPSC,
+               int arg_max_size = 0,
+               bool arg_block_on_full = true)
+    : queue_type(arg_queue_type),
+      max_size(arg_max_size),
+      block_on_full(arg_block_on_full)
+    { }
+};
+
+/**********************************************************************
+ * @brief One stage of a camera's pipeline: a thread that pops frames from
+ *        an input queue, does something with each, and pushes it on.
+ *
+ * A subclass supplies process(), and optionally begin().  The loop, the
+ * timing (see Stage_Stats), thread placement, and the handling of a full
+ * output queue are the same for every stage, and live here.
+ *
+ * Besides its output queue, a stage may have taps (see add_tap()): each
+ * frame gets an extra reference pushed to every tap, so consumers such as
+ * a Frame_Recorder or a viewer can share the frame with the rest of the
+ * pipeline, as parallel branches, without copying it.  A frame goes back
+ * to its camera only when every branch has released it, so the pipeline's
+ * own return queue must then be a Frame_Releaser.
+ *
+ * Taps never hold up the pipeline: a tap whose push() fails simply misses
+ * the frame.  Each tap's queue sets its drop policy: a non-blocking
+ * Frame_Queue or Spsc_Frame_Queue skips new frames while it is full; a
+ * Mailbox_Frame_Queue recycling to a Frame_Releaser keeps only the latest.
+ *
+ * Stages are normally wired together by a Pipeline.
+ */
+class Pipeline_Stage {
+    friend class Parallel_Stage;
+public:
+    /** The most taps per stage. */
+    static const int MAX_TAPS = 4;
+
+private:
+    char stage_name[16];
+    const char* cam_name;
+    Any_Frame_Queue* in_queue_ptr;
+    Any_Frame_Queue* out_queue_ptr;
+
+    /** If in_queue_ptr is a camera, this points to it, so the end of its
+        stream can be seen; else NULL. */
+    Any_Camera* source_cam_ptr;
+
+    /** Where frames go when out_queue_ptr is full and doesn't block. */
+    Any_Frame_Queue* drop_queue_ptr;
+
+    /** If out_queue_ptr is a Mailbox_Frame_Queue, this points to it, so
+        its overwritten count can be reported; else NULL. */
+    Mailbox_Frame_Queue* mailbox_ptr;
+
+    Any_Frame_Queue* tap_ptr[MAX_TAPS];
+    int tap_count;
+
+    Stage_Stats* stats_ptr;
+
+    /** Where timing goes if the Pipeline_Stats had no room for this
+        stage; it is never reported. */
+    Stage_Stats unlisted_stats;
+
+    Thread_Placement placement;
+    pthread_t thread_id;
+
+    static void* thread_main(void* stage_ptr);
+
+    // Not copyable.
+    Pipeline_Stage(const Pipeline_Stage&);
+    Pipeline_Stage& operator=(const Pipeline_Stage&);
+
+protected:
+    /*******************************************************************//*
+     * @brief Called once in the stage's thread, before the first frame.
+     */
+    virtual void begin() { }
+
+    /*******************************************************************//*
+     * @brief Do this stage's work on one frame.  The frame is passed on
+     *        when this returns.
+     */
+    virtual void process(Usb_Frame* frame_ptr) = 0;
+
+    /*******************************************************************//*
+     * @brief Push a frame to the taps, then on to the output queue, or to
+     *        the drop queue if the output is full.
+     */
+    void pass_on(Usb_Frame* frame_ptr);
+
+    /*******************************************************************//*
+     * @brief Call when pop() returns no frame.  Returns at once if that
+     *        was only a timeout; but if the input is a camera whose stream
+     *        has ended, no frame will ever come, so block the thread for
+     *        good rather than spin on the camera.
+     */
+    void wait_if_ended();
+
+    const char* get_cam_name() const
+    {
+        return cam_name;
+    }
+
+    const Thread_Placement& get_placement() const
+    {
+        return placement;
+    }
+
+    Any_Frame_Queue* get_in_queue()
+    {
+        return in_queue_ptr;
+    }
+
+    Stage_Stats* get_stats()
+    {
+        return stats_ptr;
+    }
+
+public:
+    /*******************************************************************//*
+     * @param [in] stage_name  For logs and reports, such as "detect".
+     */
+    Pipeline_Stage(const char* stage_name);
+    virtual ~Pipeline_Stage();
+
+    const char* get_name() const
+    {
+        return stage_name;
+    }
+
+    /*******************************************************************//*
+     * @brief Set where the stage's thread runs.  Call before starting.
+     */
+    void set_placement(const Thread_Placement& new_placement)
+    {
+        placement = new_placement;
+    }
+
+    /*******************************************************************//*
+     * @brief Also push a reference to every frame to the given queue.
+     *
+     * The tap's push() must never block.  If it fails, the reference is
+     * released at once.  Whoever pops the frame from the tap releases it
+     * when done, for example by pushing it to a Frame_Releaser.
+     *
+     * @return False if there are already MAX_TAPS.
+     */
+    bool add_tap(Any_Frame_Queue* tap_ptr);
+
+    /*******************************************************************//*
+     * @brief Connect the stage's queues by hand, for use without a
+     *        Pipeline.
+     *
+     * @param [in] cam_name        For logs and reports.
+     * @param [in] in_queue_ptr    Where frames come from.
+     * @param [in] out_queue_ptr   Where they go.
+     * @param [in] drop_queue_ptr  Where they go if out_queue_ptr is full.
+     * @param [in] stats_ptr       Where timing is recorded.  If NULL,
+     *                             as Pipeline_Stats::add_stage() returns
+     *                             once full, timing isn't reported.
+     */
+    void connect(const char* cam_name,
+                 Any_Frame_Queue* in_queue_ptr,
+                 Any_Frame_Queue* out_queue_ptr,
+                 Any_Frame_Queue* drop_queue_ptr,
+                 Stage_Stats* stats_ptr);
+
+    /*******************************************************************//*
+     * @brief Run the stage in the calling thread.  Never returns; at
+     *        the end of a camera's stream, the thread blocks.
+     */
+    virtual void run();
+
+    /*******************************************************************//*
+     * @brief Run the stage in a new thread.
+     */
+    void start();
+};
+
+/**********************************************************************
+ * @brief Wires a chain of Pipeline_Stages together.
+ *
+ * Stages are added in the order frames pass through them.  The first
+ * stage pops from the source (normally the camera), each later stage
+ * pops from a queue made to the Stage_Link given with it, and the last
+ * stage pushes frames back to the return queue (normally the camera
+ * again).  Every stage gets a Stage_Stats named after it.
+ *
+ * The Pipeline owns the queues between stages, but not the stages.
+ */
+class Pipeline {
+public:
+    /** The most stages in a pipeline. */
+    static const int MAX_STAGES = 8;
+
+private:
+    const char* cam_name;
+    Any_Frame_Queue* source_ptr;
+    Any_Frame_Queue* return_queue_ptr;
+    int default_queue_size;
+
+    int stage_count;
+    Pipeline_Stage* stage_ptr[MAX_STAGES];
+    Stage_Link link[MAX_STAGES];
+
+    /** The queue into each stage after the first. */
+    Any_Frame_Queue* queue_ptr[MAX_STAGES];
+
+    bool built;
+
+    /*******************************************************************//*
+     * @brief Make the queues and connect the stages, if not yet done.
+     */
+    void build();
+
+    // Not copyable.
+    Pipeline(const Pipeline&);
+    Pipeline& operator=(const Pipeline&);
+
+public:
+    /*******************************************************************//*
+     * @param [in] cam_name            For logs and reports.
+     * @param [in] source_ptr          The first stage pops from here.
+     * @param [in] return_queue_ptr    The last stage pushes here; and
+     *                                 frames dropped along the way go
+     *                                 here.
+     * @param [in] default_queue_size  The capacity of queues whose
+     *                                 Stage_Link::max_size is 0; normally
+     *                                 the camera's buffer count.
+     */
+    Pipeline(const char* cam_name,
+             Any_Frame_Queue* source_ptr,
+             Any_Frame_Queue* return_queue_ptr,
+             int default_queue_size);
+    ~Pipeline();
+
+    /*******************************************************************//*
+     * @brief Add the next stage.
+     *
+     * @param [in] stage_ptr  The stage.  It must outlive the Pipeline.
+     * @param [in] link       The queue into the stage.  Ignored for the
+     *                        first stage, which pops from the source.
+     * @return False if there are already MAX_STAGES, or the pipeline has
+     *         been started.
+     */
+    bool add_stage(Pipeline_Stage* stage_ptr,
+                   const Stage_Link& link = Stage_Link());
+
+    int get_stage_count() const
+    {
+        return stage_count;
+    }
+
+    /*******************************************************************//*
+     * @brief Start every stage in its own thread, and return.
+     */
+    void start();
+
+    /*******************************************************************//*
+     * @brief Start every stage but the first in its own thread, and run
+     *        the first in the calling thread.  Never returns.
+     */
+    void run();
+};
+
+#endif
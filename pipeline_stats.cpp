@@ -0,0 +1,292 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "usb_camera.h"
+#include "pipeline_stats.h"
+
+Pipeline_Stats pipeline_stats;
+
+int64_t monotonic_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t monotonic_usec()
+{
+    return monotonic_nsec() / 1000;
+}
+
+int64_t thread_cpu_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t frame_age_usec(const Usb_Frame* frame_ptr)
+{
+    return (monotonic_nsec() - frame_ptr->get_timestamp_nsec()) / 1000;
+}
+
+
+Latency_Histogram::Latency_Histogram()
+{
+    memset(count, 0, sizeof(count));
+    total = 0;
+    max_usec = 0;
+}
+
+int Latency_Histogram::bucket_of(uint32_t usec)
+{
+    if (usec < 8) return usec;
+    int msb = 31 - __builtin_clz(usec);
+    int bucket = (msb - 1) * 4 + ((usec >> (msb - 2)) & 3);
+    return (bucket < BUCKETS) ? bucket : BUCKETS - 1;
+}
+
+uint32_t Latency_Histogram::bucket_floor(int bucket)
+{
+    if (bucket < 8) return bucket;
+    int msb = bucket / 4 + 1;
+    return (uint32_t)(4 + bucket % 4) << (msb - 2);
+}
+
+void Latency_Histogram::record(int64_t usec)
+{
+    if (usec < 0) usec = 0;
+    if (usec > 0xffffffffLL) usec = 0xffffffffLL;
+    uint32_t u = (uint32_t)usec;
+    __atomic_fetch_add(&count[bucket_of(u)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total, 1, __ATOMIC_RELAXED);
+    uint32_t old_max = __atomic_load_n(&max_usec, __ATOMIC_RELAXED);
+    while (u > old_max &&
+           !__atomic_compare_exchange_n(&max_usec, &old_max, u, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    { }
+}
+
+void Latency_Histogram::take_interval(Snapshot& prev, Snapshot& interval)
+{
+    for (int i = 0; i < BUCKETS; ++i) {
+        uint32_t c = __atomic_load_n(&count[i], __ATOMIC_RELAXED);
+        interval.count[i] = c - prev.count[i];
+        prev.count[i] = c;
+    }
+    uint64_t t = __atomic_load_n(&total, __ATOMIC_RELAXED);
+    interval.total = t - prev.total;
+    prev.total = t;
+
+    // The max is per interval, so reset it.
+
+    interval.max_usec = __atomic_exchange_n(&max_usec, 0, __ATOMIC_RELAXED);
+}
+
+uint32_t Latency_Histogram::Snapshot::percentile(double fraction) const
+{
+    if (total == 0) return 0;
+    uint64_t target = (uint64_t)(fraction * total);
+    if (target >= total) target = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += count[i];
+        if (seen > target) {
+
+            // Report the top of the bucket, but never more than the max.
+
+            uint32_t top = (i + 1 < BUCKETS) ? bucket_floor(i + 1) - 1
+                                             : bucket_floor(i);
+            return (top < max_usec || max_usec == 0) ? top : max_usec;
+        }
+    }
+    return max_usec;
+}
+
+
+Stage_Stats::Stage_Stats()
+: frame_count(0),
+  drop_count(0),
+  overwrite_count(0),
+  last_frame_num(-1),
+  pop_start_usec(0),
+  pop_end_usec(0),
+  pop_dequeue_nsec(0),
+  cpu_sample_nsec(-1),
+  cpu_sample_frame(0),
+  cpu_nsec(0),
+  cpu_frames(0),
+  frame_count_prev(0),
+  drop_count_prev(0),
+  overwrite_count_prev(0),
+  cpu_nsec_prev(0),
+  cpu_frames_prev(0)
+{
+    cam_name[0] = '\0';
+    stage_name[0] = '\0';
+    memset(&age_prev, 0, sizeof(age_prev));
+    memset(&wait_prev, 0, sizeof(wait_prev));
+    memset(&process_prev, 0, sizeof(process_prev));
+    memset(&done_prev, 0, sizeof(done_prev));
+}
+
+void Stage_Stats::begin_pop()
+{
+    pop_start_usec = monotonic_usec();
+}
+
+void Stage_Stats::end_pop(const Usb_Frame* frame_ptr)
+{
+    int64_t now_nsec = monotonic_nsec();
+    pop_end_usec = now_nsec / 1000;
+    wait_hist.record(pop_end_usec - pop_start_usec);
+    age_hist.record((now_nsec - frame_ptr->get_timestamp_nsec()) / 1000);
+    pop_dequeue_nsec = frame_ptr->get_dequeue_nsec();
+
+    int frame_num = frame_ptr->get_frame_num();
+    if (last_frame_num >= 0 && frame_num > last_frame_num + 1) {
+        __atomic_fetch_add(&drop_count, frame_num - last_frame_num - 1,
+                           __ATOMIC_RELAXED);
+    }
+    last_frame_num = frame_num;
+    __atomic_fetch_add(&frame_count, 1, __ATOMIC_RELAXED);
+}
+
+void Stage_Stats::end_process()
+{
+    int64_t now_nsec = monotonic_nsec();
+    process_hist.record(now_nsec / 1000 - pop_end_usec);
+    done_hist.record((now_nsec - pop_dequeue_nsec) / 1000);
+
+    // Reading the thread's CPU time costs a system call on some kernels,
+    // so do it only every CPU_SAMPLE_PERIOD frames, and charge the time
+    // since the last sample evenly to the frames between.
+
+    uint32_t frames = __atomic_load_n(&frame_count, __ATOMIC_RELAXED);
+    if (cpu_sample_nsec >= 0 &&
+        frames - cpu_sample_frame < CPU_SAMPLE_PERIOD) return;
+    int64_t cpu_now = thread_cpu_nsec();
+    if (cpu_sample_nsec >= 0) {
+        __atomic_store_n(&cpu_nsec, cpu_nsec + (cpu_now - cpu_sample_nsec),
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&cpu_frames,
+                         cpu_frames + (frames - cpu_sample_frame),
+                         __ATOMIC_RELAXED);
+    }
+    cpu_sample_nsec = cpu_now;
+    cpu_sample_frame = frames;
+}
+
+
+Pipeline_Stats::Pipeline_Stats()
+: stage_count(0),
+  report_file(stdout),
+  report_secs(1.0)
+{
+    pthread_mutex_init(&mutex, NULL);
+}
+
+Stage_Stats* Pipeline_Stats::add_stage(const char* cam_name,
+                                       const char* stage_name)
+{
+    pthread_mutex_lock(&mutex);
+    Stage_Stats* stats_ptr = NULL;
+    if (stage_count < MAX_STAGES) {
+        stats_ptr = &stage[stage_count];
+        strncpy(stats_ptr->cam_name, cam_name, sizeof(stats_ptr->cam_name));
+        stats_ptr->cam_name[sizeof(stats_ptr->cam_name) - 1] = '\0';
+        strncpy(stats_ptr->stage_name, stage_name,
+                sizeof(stats_ptr->stage_name));
+        stats_ptr->stage_name[sizeof(stats_ptr->stage_name) - 1] = '\0';
+
+        // Publish the stage only once it is filled in.
+
+        __atomic_store_n(&stage_count, stage_count + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mutex);
+    return stats_ptr;
+}
+
+Stage_Stats* Pipeline_Stats::find_stage(const char* cam_name,
+                                        const char* stage_name)
+{
+    int count = __atomic_load_n(&stage_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(stage[i].cam_name, cam_name) == 0 &&
+            strcmp(stage[i].stage_name, stage_name) == 0) {
+            return &stage[i];
+        }
+    }
+    return NULL;
+}
+
+void Pipeline_Stats::report(FILE* file_ptr)
+{
+    int count = __atomic_load_n(&stage_count, __ATOMIC_ACQUIRE);
+    Latency_Histogram::Snapshot age, wait, process, done;
+    for (int i = 0; i < count; ++i) {
+        Stage_Stats& s = stage[i];
+        s.age_hist.take_interval(s.age_prev, age);
+        s.wait_hist.take_interval(s.wait_prev, wait);
+        s.process_hist.take_interval(s.process_prev, process);
+        s.done_hist.take_interval(s.done_prev, done);
+        uint32_t frames = __atomic_load_n(&s.frame_count, __ATOMIC_RELAXED);
+        uint32_t drops = __atomic_load_n(&s.drop_count, __ATOMIC_RELAXED);
+        uint32_t overwrites = __atomic_load_n(&s.overwrite_count,
+                                              __ATOMIC_RELAXED);
+        int64_t cpu = __atomic_load_n(&s.cpu_nsec, __ATOMIC_RELAXED);
+        uint32_t cpu_frames = __atomic_load_n(&s.cpu_frames,
+                                              __ATOMIC_RELAXED);
+        uint32_t cpu_frame_delta = cpu_frames - s.cpu_frames_prev;
+        double cpu_usec = (cpu_frame_delta == 0) ? 0.0 :
+                (cpu - s.cpu_nsec_prev) / 1000.0 / cpu_frame_delta;
+        fprintf(file_ptr,
+                "%s %-8s frames=%5u dropped=%4u overwritten=%4u"
+                " age_us p50/p99/max=%u/%u/%u"
+                " wait_us=%u/%u/%u"
+                " proc_us=%u/%u/%u"
+                " done_us=%u/%u/%u"
+                " cpu_us=%.0f\n",
+                s.cam_name, s.stage_name,
+                frames - s.frame_count_prev, drops - s.drop_count_prev,
+                overwrites - s.overwrite_count_prev,
+                age.percentile(0.50), age.percentile(0.99), age.max_usec,
+                wait.percentile(0.50), wait.percentile(0.99), wait.max_usec,
+                process.percentile(0.50), process.percentile(0.99),
+                process.max_usec,
+                done.percentile(0.50), done.percentile(0.99), done.max_usec,
+                cpu_usec);
+        s.frame_count_prev = frames;
+        s.drop_count_prev = drops;
+        s.overwrite_count_prev = overwrites;
+        s.cpu_nsec_prev = cpu;
+        s.cpu_frames_prev = cpu_frames;
+    }
+    fflush(file_ptr);
+}
+
+void* Pipeline_Stats::report_thread(void* arg_ptr)
+{
+    Pipeline_Stats* stats_ptr = (Pipeline_Stats*)arg_ptr;
+    while (1) {
+        usleep((useconds_t)(stats_ptr->report_secs * 1e6));
+        stats_ptr->report(stats_ptr->report_file);
+    }
+    return NULL;
+}
+
+void Pipeline_Stats::start_reporter(double period_secs, FILE* file_ptr)
+{
+    report_secs = period_secs;
+    report_file = file_ptr;
+    pthread_t thread_id;
+    int rc = pthread_create(&thread_id, NULL, report_thread, (void*)this);
+    if (rc != 0) {
+        printf("can't pthread_create, error_code= %d\n", rc);
+        return;
+    }
+    pthread_detach(thread_id);
+}
@@ -0,0 +1,279 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+class Usb_Frame;
+
+/**********************************************************************
+ * @brief A histogram of durations in microseconds, with fixed buckets.
+ *
+ * Bucket boundaries are log-linear: values below 8 usec get a bucket
+ * each, and every power of two above that is split into 4 buckets, so any
+ * recorded value is reported to within 25%.  The last bucket holds
+ * everything from 7 << 22 usec, about 29.4 seconds, up.
+ *
+ * record() is lock-free and may be called from any thread.  Readers see
+ * a consistent-enough view without stopping writers.
+ */
+class Latency_Histogram {
+public:
+    /** The number of buckets. */
+    static const int BUCKETS = 96;
+
+    /** Holds a copy of a histogram's counters, for computing summaries
+        over an interval. */
+    class Snapshot {
+    public:
+        uint32_t count[BUCKETS];
+        uint64_t total;
+        uint32_t max_usec;
+
+        /*******************************************************************//*
+         * @brief Return the value in usec below which the given fraction of
+         *        the samples fall (to bucket resolution), or 0 if empty.
+         */
+        uint32_t percentile(double fraction) const;
+    };
+
+private:
+    uint32_t count[BUCKETS];
+    uint64_t total;
+    uint32_t max_usec;
+
+public:
+    Latency_Histogram();
+
+    /*******************************************************************//*
+     * @brief Return the bucket that holds the given value.
+     */
+    static int bucket_of(uint32_t usec);
+
+    /*******************************************************************//*
+     * @brief Return the smallest value held by the given bucket.
+     */
+    static uint32_t bucket_floor(int bucket);
+
+    /*******************************************************************//*
+     * @brief Add one sample.
+     */
+    void record(int64_t usec);
+
+    /*******************************************************************//*
+     * @brief Copy the counters accumulated since the previous call into
+     *        interval, and remember the current counters in prev.
+     *
+     * @param [in,out] prev      The snapshot returned by the previous call;
+     *                           initially all zeroes.
+     * @param [out] interval     Returns the samples since the previous call.
+     */
+    void take_interval(Snapshot& prev, Snapshot& interval);
+};
+
+
+/**********************************************************************
+ * @brief Counters and histograms for one stage of one camera's pipeline.
+ *
+ * A stage records each frame it handles with begin_pop(), end_pop() and
+ * end_process(), in that order, all from the stage's thread.
+ *
+ * For the capture stage, the age of a frame is the time from exposure to
+ * dequeue; for each stage, done is the time from dequeue to the end of
+ * that stage's processing, so the last stage's is dequeue to result.
+ * The stage thread's CPU time is sampled every CPU_SAMPLE_PERIOD frames
+ * rather than read for each.
+ */
+class Stage_Stats {
+    friend class Pipeline_Stats;
+private:
+    char cam_name[32];
+    char stage_name[16];
+
+    /** Time from the driver's timestamp to when this stage got the frame. */
+    Latency_Histogram age_hist;
+
+    /** Time this stage spent waiting on its input queue. */
+    Latency_Histogram wait_hist;
+
+    /** Time this stage spent processing each frame. */
+    Latency_Histogram process_hist;
+
+    /** Time from the frame's dequeue to the end of this stage's
+        processing. */
+    Latency_Histogram done_hist;
+
+    uint32_t frame_count;    /// frames handled
+    uint32_t drop_count;     /// frames missing from the sequence
+    uint32_t overwrite_count;  /// frames replaced in the output queue
+    int last_frame_num;      /// frame number of the last frame, or -1
+
+    int64_t pop_start_usec;  /// when the current begin_pop() was called
+    int64_t pop_end_usec;    /// when the current end_pop() was called
+    int64_t pop_dequeue_nsec;  /// when the current frame was dequeued
+
+    int64_t cpu_sample_nsec;   /// thread CPU time at the last sample, or -1
+    uint32_t cpu_sample_frame; /// frame_count at the last sample
+    int64_t cpu_nsec;          /// CPU time between samples, in total
+    uint32_t cpu_frames;       /// frames between samples, in total
+
+    /** Snapshots from the previous report. */
+    Latency_Histogram::Snapshot age_prev;
+    Latency_Histogram::Snapshot wait_prev;
+    Latency_Histogram::Snapshot process_prev;
+    Latency_Histogram::Snapshot done_prev;
+    uint32_t frame_count_prev;
+    uint32_t drop_count_prev;
+    uint32_t overwrite_count_prev;
+    int64_t cpu_nsec_prev;
+    uint32_t cpu_frames_prev;
+
+public:
+    /** Frames between reads of the stage thread's CPU time. */
+    static const uint32_t CPU_SAMPLE_PERIOD = 32;
+
+    Stage_Stats();
+
+    /*******************************************************************//*
+     * @brief Call just before popping a frame from the input queue.
+     */
+    void begin_pop();
+
+    /*******************************************************************//*
+     * @brief Call just after popping a frame from the input queue.
+     */
+    void end_pop(const Usb_Frame* frame_ptr);
+
+    /*******************************************************************//*
+     * @brief Call when done processing the frame, just before pushing it
+     *        to the output queue.
+     */
+    void end_process();
+
+    /*******************************************************************//*
+     * @brief Record the total number of frames replaced in this stage's
+     *        output queue so far (see Mailbox_Frame_Queue).
+     */
+    void set_overwrite_count(uint32_t total)
+    {
+        __atomic_store_n(&overwrite_count, total, __ATOMIC_RELAXED);
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of frames handled so far.
+     */
+    uint32_t get_frame_count() const
+    {
+        return __atomic_load_n(&frame_count, __ATOMIC_RELAXED);
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of frames missing from the sequence so far.
+     */
+    uint32_t get_drop_count() const
+    {
+        return __atomic_load_n(&drop_count, __ATOMIC_RELAXED);
+    }
+
+    /*******************************************************************//*
+     * @brief Return the histogram of frame ages when this stage got them.
+     */
+    Latency_Histogram* get_age_histogram()
+    {
+        return &age_hist;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the histogram of the time from dequeue to the end of
+     *        this stage's processing.
+     */
+    Latency_Histogram* get_done_histogram()
+    {
+        return &done_hist;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the average CPU time of this stage's thread per frame
+     *        so far, in usec, from the samples taken; 0 before the second.
+     */
+    double get_cpu_usec_per_frame() const
+    {
+        uint32_t frames = __atomic_load_n(&cpu_frames, __ATOMIC_RELAXED);
+        int64_t nsec = __atomic_load_n(&cpu_nsec, __ATOMIC_RELAXED);
+        return (frames == 0) ? 0.0 : nsec / 1000.0 / frames;
+    }
+};
+
+
+/**********************************************************************
+ * @brief The set of all Stage_Stats, and a thread that periodically
+ *        prints a summary of them.
+ */
+class Pipeline_Stats {
+private:
+    static const int MAX_STAGES = 32;
+    Stage_Stats stage[MAX_STAGES];
+    int stage_count;
+    pthread_mutex_t mutex;       /// protects stage_count
+    FILE* report_file;
+    double report_secs;
+
+    static void* report_thread(void* arg_ptr);
+
+public:
+    Pipeline_Stats();
+
+    /*******************************************************************//*
+     * @brief Return a new Stage_Stats for the given camera and stage, or
+     *        NULL if there are already MAX_STAGES.
+     */
+    Stage_Stats* add_stage(const char* cam_name, const char* stage_name);
+
+    /*******************************************************************//*
+     * @brief Return the Stage_Stats for the given camera and stage, or
+     *        NULL if there is none yet.
+     */
+    Stage_Stats* find_stage(const char* cam_name, const char* stage_name);
+
+    /*******************************************************************//*
+     * @brief Print a summary of every stage since the previous report.
+     */
+    void report(FILE* file_ptr);
+
+    /*******************************************************************//*
+     * @brief Start a thread that calls report() every period_secs.
+     */
+    void start_reporter(double period_secs, FILE* file_ptr = stdout);
+};
+
+/**********************************************************************
+ * @brief Return the current CLOCK_MONOTONIC time in nanoseconds.
+ *
+ * This is the clock of Usb_Frame::get_timestamp_nsec().
+ */
+int64_t monotonic_nsec();
+
+/**********************************************************************
+ * @brief Return the current CLOCK_MONOTONIC time in microseconds.
+ */
+int64_t monotonic_usec();
+
+/**********************************************************************
+ * @brief Return the CPU time used by the calling thread, in nanoseconds.
+ */
+int64_t thread_cpu_nsec();
+
+/**********************************************************************
+ * @brief Return how long ago, in microseconds, the given frame was
+ *        captured according to its driver timestamp.
+ */
+int64_t frame_age_usec(const Usb_Frame* frame_ptr);
+
+/** The statistics for the whole process. */
+extern Pipeline_Stats pipeline_stats;
+
+#endif
@@ -0,0 +1,389 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/videodev2.h>
+#include <jpeglib.h>
+#include "preview_streamer.h"
+
+#define BOUNDARY "preview_frame"
+
+/* libjpeg-turbo compresses BGR as is; plain libjpeg takes only RGB, so
+   without it BGR24 frames are swapped to RGB as they are shrunk. */
+#ifdef JCS_EXTENSIONS
+static const bool SWAP_BGR = false;
+#else
+static const bool SWAP_BGR = true;
+#endif
+
+Preview_Streamer::Preview_Streamer()
+: port(0),
+  decimation(1),
+  scale(1),
+  quality(60),
+  pixel_format(0),
+  rows(0),
+  cols(0),
+  components(0),
+  placement(-1, SCHED_IDLE, 0),
+  listen_fd(-1),
+  client_count(0),
+  stage_img(NULL),
+  stage_full(0),
+  offer_count(0),
+  skip_count(0),
+  send_count(0)
+{
+    pthread_mutex_init(&client_mutex, NULL);
+    pthread_mutex_init(&stage_mutex, NULL);
+    pthread_cond_init(&stage_cond, NULL);
+}
+
+bool Preview_Streamer::start(int arg_port,
+                             int frame_rows,
+                             int frame_cols,
+                             uint32_t arg_pixel_format,
+                             int arg_decimation,
+                             int arg_scale,
+                             int arg_quality)
+{
+    switch (arg_pixel_format) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_BGR24:
+        components = 3;
+        break;
+    case V4L2_PIX_FMT_GREY:
+        components = 1;
+        break;
+    default:
+        return false;
+    }
+    port = arg_port;
+    pixel_format = arg_pixel_format;
+    decimation = (arg_decimation < 1) ? 1 : arg_decimation;
+    scale = (arg_scale < 1) ? 1 : arg_scale;
+    quality = arg_quality;
+    rows = frame_rows / scale;
+    cols = frame_cols / scale;
+    stage_img = new uint8_t[rows * cols * components];
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) return false;
+    int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, MAX_CLIENTS) != 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    pthread_t thread_id;
+    int rc = pthread_create(&thread_id, NULL, encode_main, (void*)this);
+    if (rc != 0) {
+        printf("can't pthread_create, error_code= %d\n", rc);
+        exit(-1);
+    }
+    pthread_detach(thread_id);
+    rc = pthread_create(&thread_id, NULL, serve_main, (void*)this);
+    if (rc != 0) {
+        printf("can't pthread_create, error_code= %d\n", rc);
+        exit(-1);
+    }
+    pthread_detach(thread_id);
+    return true;
+}
+
+void Preview_Streamer::shrink(const Usb_Frame* frame_ptr,
+                              const Pyramid_Level* luma_ptr)
+{
+    const uint8_t* src = frame_ptr->get_img_data();
+    int src_step = frame_ptr->get_step();
+    uint8_t* dst = stage_img;
+    if (luma_ptr != NULL &&
+        (pixel_format == V4L2_PIX_FMT_BGR24 || luma_ptr->pixel_bytes != 1 ||
+         luma_ptr->rows < rows || luma_ptr->cols < cols)) {
+        luma_ptr = NULL;
+    }
+    if (luma_ptr != NULL && pixel_format == V4L2_PIX_FMT_GREY) {
+        for (int r = 0; r < rows; ++r) {
+            memcpy(dst, luma_ptr->data + (size_t)r * luma_ptr->step, cols);
+            dst += cols;
+        }
+    } else if (pixel_format == V4L2_PIX_FMT_YUYV ||
+        pixel_format == V4L2_PIX_FMT_UYVY) {
+
+        // Pick each pixel's Y, and the U and V of its macropixel.
+
+        int y_off = (pixel_format == V4L2_PIX_FMT_YUYV) ? 0 : 1;
+        int u_off = (pixel_format == V4L2_PIX_FMT_YUYV) ? 1 : 0;
+        int v_off = u_off + 2;
+        for (int r = 0; r < rows; ++r) {
+            const uint8_t* s = src + (size_t)r * scale * src_step;
+            const uint8_t* l = NULL;
+            if (luma_ptr != NULL) {
+                l = luma_ptr->data + (size_t)r * luma_ptr->step;
+            }
+            for (int c = 0; c < cols; ++c) {
+                int x = c * scale;
+                const uint8_t* m = s + 4 * (x >> 1);
+                dst[0] = (l == NULL) ? m[y_off + 2 * (x & 1)] : l[c];
+                dst[1] = m[u_off];
+                dst[2] = m[v_off];
+                dst += 3;
+            }
+        }
+    } else if (pixel_format == V4L2_PIX_FMT_BGR24 && SWAP_BGR) {
+        for (int r = 0; r < rows; ++r) {
+            const uint8_t* s = src + (size_t)r * scale * src_step;
+            for (int c = 0; c < cols; ++c) {
+                const uint8_t* p = s + c * scale * 3;
+                dst[0] = p[2];
+                dst[1] = p[1];
+                dst[2] = p[0];
+                dst += 3;
+            }
+        }
+    } else {
+        for (int r = 0; r < rows; ++r) {
+            const uint8_t* s = src + (size_t)r * scale * src_step;
+            for (int c = 0; c < cols; ++c) {
+                const uint8_t* p = s + c * scale * components;
+                for (int k = 0; k < components; ++k) dst[k] = p[k];
+                dst += components;
+            }
+        }
+    }
+}
+
+void Preview_Streamer::draw_targets(const Target_Result& targets)
+{
+    // Red, in whatever color space stage_img holds.
+
+    uint8_t color[3] = { 255, 0, 0 };
+    if (pixel_format == V4L2_PIX_FMT_BGR24) {
+
+        // Staged as RGB when SWAP_BGR, else as it came.
+
+        if (!SWAP_BGR) {
+            color[0] = 0;
+            color[2] = 255;
+        }
+    } else if (components == 3) {
+        color[0] = 76;
+        color[1] = 85;
+        color[2] = 255;
+    }
+    for (int i = 0; i < targets.blob_count; ++i) {
+        const Target_Blob& b = targets.blob[i];
+        int x0 = b.x_min / scale;
+        int y0 = b.y_min / scale;
+        int x1 = b.x_max / scale;
+        int y1 = b.y_max / scale;
+
+        // The staged image drops any part row or column left by scale.
+
+        if (x0 >= cols || y0 >= rows) continue;
+        if (x1 >= cols) x1 = cols - 1;
+        if (y1 >= rows) y1 = rows - 1;
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                if (y != y0 && y != y1 && x != x0 && x != x1) continue;
+                uint8_t* p = stage_img + (y * cols + x) * components;
+                for (int k = 0; k < components; ++k) p[k] = color[k];
+            }
+        }
+    }
+}
+
+bool Preview_Streamer::offer(const Usb_Frame* frame_ptr,
+                             const Target_Result* targets_ptr,
+                             const Pyramid_Level* luma_ptr)
+{
+    if (stage_img == NULL) return false;
+    if (offer_count++ % decimation != 0) return false;
+    if (__atomic_load_n(&client_count, __ATOMIC_RELAXED) == 0) return false;
+    if (__atomic_load_n(&stage_full, __ATOMIC_ACQUIRE)) {
+        __atomic_add_fetch(&skip_count, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    shrink(frame_ptr, luma_ptr);
+    if (targets_ptr != NULL) draw_targets(*targets_ptr);
+    pthread_mutex_lock(&stage_mutex);
+    stage_full = 1;
+    pthread_cond_signal(&stage_cond);
+    pthread_mutex_unlock(&stage_mutex);
+    return true;
+}
+
+void Preview_Streamer::send_to_clients(const uint8_t* jpeg,
+                                       unsigned long jpeg_bytes)
+{
+    char part_header[128];
+    int header_bytes = snprintf(part_header, sizeof(part_header),
+                                "--" BOUNDARY "\r\n"
+                                "Content-Type: image/jpeg\r\n"
+                                "Content-Length: %lu\r\n\r\n", jpeg_bytes);
+    static const char part_end[] = "\r\n";
+    struct iovec iov[3];
+    iov[0].iov_base = part_header;
+    iov[0].iov_len = header_bytes;
+    iov[1].iov_base = (void*)jpeg;
+    iov[1].iov_len = jpeg_bytes;
+    iov[2].iov_base = (void*)part_end;
+    iov[2].iov_len = sizeof(part_end) - 1;
+    size_t total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+
+    /* A client that can't take a whole image within its send timeout is
+       dropped, since a partial part would corrupt its stream. */
+
+    pthread_mutex_lock(&client_mutex);
+    int i = 0;
+    while (i < client_count) {
+        ssize_t sent = sendmsg(client_fd[i], &msg, MSG_NOSIGNAL);
+        if (sent == (ssize_t)total) {
+            ++i;
+        } else {
+            close(client_fd[i]);
+            client_fd[i] = client_fd[client_count - 1];
+            __atomic_store_n(&client_count, client_count - 1,
+                             __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&client_mutex);
+}
+
+void Preview_Streamer::encode_loop()
+{
+    char name[32];
+    snprintf(name, sizeof(name), "preview:%d", port);
+    apply_thread_placement(placement, name, "encode");
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    // A JPEG of a real image is never near its raw size.
+
+    unsigned long buf_bytes = (unsigned long)rows * cols * components + 4096;
+    uint8_t* jpeg_buf = new uint8_t[buf_bytes];
+    int row_bytes = cols * components;
+    while (1) {
+        pthread_mutex_lock(&stage_mutex);
+        while (!stage_full) pthread_cond_wait(&stage_cond, &stage_mutex);
+        pthread_mutex_unlock(&stage_mutex);
+
+        /* If the image doesn't fit, libjpeg allocates a bigger buffer
+           rather than use ours; free that one when done. */
+
+        unsigned char* out = jpeg_buf;
+        unsigned long out_bytes = buf_bytes;
+        jpeg_mem_dest(&cinfo, &out, &out_bytes);
+        cinfo.image_width = cols;
+        cinfo.image_height = rows;
+        cinfo.input_components = components;
+        if (components == 1) {
+            cinfo.in_color_space = JCS_GRAYSCALE;
+        } else if (pixel_format == V4L2_PIX_FMT_BGR24) {
+#ifdef JCS_EXTENSIONS
+            cinfo.in_color_space = JCS_EXT_BGR;
+#else
+            cinfo.in_color_space = JCS_RGB;
+#endif
+        } else {
+            cinfo.in_color_space = JCS_YCbCr;
+        }
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, quality, TRUE);
+        cinfo.dct_method = JDCT_IFAST;
+        jpeg_start_compress(&cinfo, TRUE);
+        while (cinfo.next_scanline < cinfo.image_height) {
+            JSAMPROW row = stage_img + cinfo.next_scanline * row_bytes;
+            jpeg_write_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_compress(&cinfo);
+
+        // The staging image is free for the next frame.
+
+        __atomic_store_n(&stage_full, 0, __ATOMIC_RELEASE);
+
+        send_to_clients(out, out_bytes);
+        if (out != jpeg_buf) free(out);
+        __atomic_add_fetch(&send_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void Preview_Streamer::serve_loop()
+{
+    char name[32];
+    snprintf(name, sizeof(name), "preview:%d", port);
+    apply_thread_placement(placement, name, "serve");
+
+    static const char response[] =
+            "HTTP/1.0 200 OK\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: close\r\n"
+            "Content-Type: multipart/x-mixed-replace; boundary=" BOUNDARY
+            "\r\n\r\n";
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+
+        /* Whatever was asked for, the answer is the stream.  Read the
+           request so closing doesn't reset the connection, but don't wait
+           long for it. */
+
+        struct timeval tv;
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        char request[1024];
+        recv(fd, request, sizeof(request), 0);
+        if (send(fd, response, sizeof(response) - 1, MSG_NOSIGNAL) !=
+            (ssize_t)sizeof(response) - 1) {
+            close(fd);
+            continue;
+        }
+
+        pthread_mutex_lock(&client_mutex);
+        if (client_count < MAX_CLIENTS) {
+            client_fd[client_count] = fd;
+            __atomic_store_n(&client_count, client_count + 1,
+                             __ATOMIC_RELAXED);
+        } else {
+            close(fd);
+        }
+        pthread_mutex_unlock(&client_mutex);
+    }
+}
+
+void* Preview_Streamer::encode_main(void* streamer_ptr)
+{
+    ((Preview_Streamer*)streamer_ptr)->encode_loop();
+    return NULL;
+}
+
+void* Preview_Streamer::serve_main(void* streamer_ptr)
+{
+    ((Preview_Streamer*)streamer_ptr)->serve_loop();
+    return NULL;
+}
@@ -0,0 +1,168 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef PREVIEW_STREAMER_H
+#define PREVIEW_STREAMER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "usb_camera.h"
+#include "target_detector.h"
+#include "frame_pyramid.h"
+#include "thread_placement.h"
+
+/**********************************************************************
+ * @brief Serves a reduced, decimated preview of a camera as an MJPEG
+ *        stream over HTTP.
+ *
+ * A pipeline stage calls offer() with each frame.  Every Nth frame is
+ * shrunk, by sampling, into a staging image owned by the streamer, and
+ * the stage carries on; the frame itself is not held.  An encoder thread
+ * compresses the staging image to JPEG and sends it to every connected
+ * client as one part of a multipart/x-mixed-replace response, which any
+ * browser shows as live video:
+ *
+ *     http://<host>:<port>/
+ *
+ * If the encoder is still busy with the last image, or no one is
+ * watching, offer() skips the frame, so the preview can never slow the
+ * pipeline.  The encoder runs under SCHED_IDLE by default, so it only
+ * uses time no other thread wants.
+ *
+ * Packed 4:2:2 frames are passed to the encoder as YCbCr, which is what
+ * JPEG stores anyway, so no color conversion is done.  GREY and BGR24
+ * frames are also supported.  If the frame has been through a
+ * Frame_Pyramid, the level of the preview's size can be offered along
+ * with it; its averaged luma replaces the sampled luma, which aliases.
+ *
+ * Once started, the streamer runs until the process exits.
+ */
+class Preview_Streamer {
+public:
+    /** The most clients watching at once. */
+    static const int MAX_CLIENTS = 4;
+
+private:
+    int port;
+    int decimation;            /// Offer every decimation'th frame.
+    int scale;                 /// Shrink each dimension by this much.
+    int quality;               /// JPEG quality, 1 to 100.
+    uint32_t pixel_format;     /// Of the frames offered.
+    int rows;                  /// Of the preview.
+    int cols;
+    int components;            /// Bytes per preview pixel: 1 or 3.
+    Thread_Placement placement;
+
+    int listen_fd;
+
+    /** The connected clients.  Protected by client_mutex. */
+    int client_fd[MAX_CLIENTS];
+    int client_count;
+    pthread_mutex_t client_mutex;
+
+    /** The image waiting to be encoded, set by offer() and cleared by the
+        encoder when it is done with it. */
+    uint8_t* stage_img;
+    int stage_full;
+    pthread_mutex_t stage_mutex;
+    pthread_cond_t stage_cond;
+
+    int offer_count;           /// Frames offered.
+    int skip_count;            /// Due frames skipped while busy.
+    int send_count;            /// Images encoded and sent.
+
+    /*******************************************************************//*
+     * @brief Copy every scale'th pixel of a frame into stage_img, taking
+     *        luma from luma_ptr if it isn't NULL.
+     */
+    void shrink(const Usb_Frame* frame_ptr, const Pyramid_Level* luma_ptr);
+
+    /*******************************************************************//*
+     * @brief Outline the targets in stage_img.
+     */
+    void draw_targets(const Target_Result& targets);
+
+    /*******************************************************************//*
+     * @brief Send one encoded image to every client, dropping any client
+     *        that has gone away.
+     */
+    void send_to_clients(const uint8_t* jpeg, unsigned long jpeg_bytes);
+
+    void encode_loop();
+    void serve_loop();
+    static void* encode_main(void* streamer_ptr);
+    static void* serve_main(void* streamer_ptr);
+
+    // Not copyable.
+    Preview_Streamer(const Preview_Streamer&);
+    Preview_Streamer& operator=(const Preview_Streamer&);
+
+public:
+    Preview_Streamer();
+
+    /*******************************************************************//*
+     * @brief Set where the encoder thread runs.  Must be called before
+     *        start().
+     */
+    void set_placement(const Thread_Placement& new_placement)
+    {
+        placement = new_placement;
+    }
+
+    /*******************************************************************//*
+     * @brief Listen for viewers and start the encoder.
+     *
+     * @param [in] port          TCP port to serve on.
+     * @param [in] rows          Rows in each frame.
+     * @param [in] cols          Columns in each frame.
+     * @param [in] pixel_format  YUYV, UYVY, GREY, or BGR24.
+     * @param [in] decimation    Preview one frame in this many.
+     * @param [in] scale         Shrink each dimension by this: 1, 2, or 4.
+     * @param [in] quality       JPEG quality, 1 to 100.
+     * @return False if the format isn't supported or the port can't be
+     *         listened on.
+     */
+    bool start(int port,
+               int rows,
+               int cols,
+               uint32_t pixel_format,
+               int decimation = 4,
+               int scale = 2,
+               int quality = 60);
+
+    /*******************************************************************//*
+     * @brief Offer a frame for the preview.  Never blocks.
+     *
+     * @param [in] frame_ptr    The frame; it is only read, and not kept.
+     * @param [in] targets_ptr  If not NULL, these are outlined.
+     * @param [in] luma_ptr     If not NULL, a gray copy of the frame
+     *                          reduced by get_scale(), such as a
+     *                          Frame_Pyramid level, to take luma from.
+     *                          Ignored for BGR24 frames, or if it is
+     *                          smaller than the preview.
+     * @return True if the frame will be sent.
+     */
+    bool offer(const Usb_Frame* frame_ptr,
+               const Target_Result* targets_ptr = NULL,
+               const Pyramid_Level* luma_ptr = NULL);
+
+    /*******************************************************************//*
+     * @brief Return how much each dimension is shrunk by.
+     */
+    int get_scale() const
+    {
+        return scale;
+    }
+
+    int get_skip_count() const
+    {
+        return __atomic_load_n(&skip_count, __ATOMIC_RELAXED);
+    }
+
+    int get_send_count() const
+    {
+        return __atomic_load_n(&send_count, __ATOMIC_RELAXED);
+    }
+};
+
+#endif
@@ -0,0 +1,69 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <string.h>
+#include "replay_camera.h"
+
+Replay_Camera::Replay_Camera()
+: next_record(0),
+  loop(false),
+  seq_offset(0),
+  last_seq(0)
+{ }
+
+bool Replay_Camera::init(const char* file_name,
+                         double fps,
+                         int buf_count,
+                         bool arg_loop)
+{
+    if (!file.open(file_name)) return false;
+    const Capture_File_Header& h = file.get_header();
+    next_record = 0;
+    loop = arg_loop;
+    seq_offset = 0;
+    last_seq = 0;
+    init_pool(file_name, h.rows, h.cols, h.pixel_format, h.frame_bytes,
+              buf_count, fps);
+    return true;
+}
+
+void Replay_Camera::seek_frame_num(uint32_t frame_num)
+{
+    next_record = file.find_frame_num(frame_num);
+}
+
+void Replay_Camera::seek_timestamp(int64_t timestamp_usec)
+{
+    next_record = file.find_timestamp(timestamp_usec);
+}
+
+bool Replay_Camera::fill_frame(Usb_Frame* frame_ptr, uint32_t& bytesused)
+{
+    int count = file.get_record_count();
+    uint32_t frame_bytes = file.get_header().frame_bytes;
+    int skipped = 0;
+    while (1) {
+        if (next_record >= count) {
+            if (!loop || count == 0) return false;
+
+            // Start over, numbering frames after the last one played.
+
+            next_record = 0;
+            seq_offset = last_seq + 1 - file.get_entry(0).sequence;
+        }
+
+        /* A record claiming more data than a buffer holds is corrupt; skip
+           it, leaving a gap in the frame numbers as a drop would. */
+
+        if (file.get_entry(next_record).bytesused <= frame_bytes) break;
+        ++next_record;
+        if (++skipped == count) return false;
+    }
+    const Capture_Index_Entry& e = file.get_entry(next_record);
+    memcpy(frame_ptr->get_img_data(), file.get_data(next_record), e.bytesused);
+    last_seq = e.sequence + seq_offset;
+    set_frame_num(frame_ptr, last_seq);
+    bytesused = e.bytesused;
+    ++next_record;
+    return true;
+}
@@ -0,0 +1,63 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef REPLAY_CAMERA_H
+#define REPLAY_CAMERA_H
+
+#include "capture_file.h"
+#include "sim_camera.h"
+
+/**********************************************************************
+ * @brief A camera that plays back frames from a capture file (see
+ *        capture_file.h), as written by Frame_Recorder.
+ *
+ * Frames keep the frame numbers they were recorded with, so drops in the
+ * recording still show up as gaps.  Timestamps are those of the replay,
+ * not the recording, so latency measured downstream is meaningful.
+ */
+class Replay_Camera: public Sim_Camera {
+private:
+    Capture_File file;
+    int next_record;            /// index of the next record to play
+    bool loop;                  /// start over at the end of the file
+    uint32_t seq_offset;        /// added to recorded frame numbers
+    uint32_t last_seq;          /// last frame number played
+
+protected:
+    virtual bool fill_frame(Usb_Frame* frame_ptr, uint32_t& bytesused);
+
+public:
+    Replay_Camera();
+
+    /*******************************************************************//*
+     * @brief Open a capture file for replay.
+     *
+     * @param [in] file_name  The capture file.
+     * @param [in] fps        Frames per second; 0 means as fast as buffers
+     *                        are given back.
+     * @param [in] buf_count  The number of buffers.
+     * @param [in] loop       True to start over at the end of the file;
+     *                        false to return NULL from pop() instead.
+     * @return False if the file can't be opened or isn't a capture file.
+     *         Records that claim more than the header's frame_bytes are
+     *         skipped on playback.
+     */
+    bool init(const char* file_name,
+              double fps = 0.0,
+              int buf_count = 5,
+              bool loop = false);
+
+    /*******************************************************************//*
+     * @brief Continue playback from the first recorded frame whose number is
+     *        at least frame_num.
+     */
+    void seek_frame_num(uint32_t frame_num);
+
+    /*******************************************************************//*
+     * @brief Continue playback from the first recorded frame whose
+     *        timestamp is at least timestamp_usec.
+     */
+    void seek_timestamp(int64_t timestamp_usec);
+};
+
+#endif
@@ -0,0 +1,176 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "result_publisher.h"
+#include "pipeline_stats.h"
+
+static uint8_t* put16(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+    return p + 2;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+    return p + 4;
+}
+
+static uint8_t* put64(uint8_t* p, uint64_t v)
+{
+    p = put32(p, (uint32_t)(v >> 32));
+    return put32(p, (uint32_t)v);
+}
+
+static uint8_t* put_float(uint8_t* p, float f)
+{
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    return put32(p, v);
+}
+
+static uint32_t get16(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get64(const uint8_t* p)
+{
+    return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+static float get_float(const uint8_t* p)
+{
+    uint32_t v = get32(p);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+int Result_Packet::encode(const Target_Result& result,
+                          int64_t latency_usec,
+                          int64_t send_usec,
+                          uint8_t* buf)
+{
+    uint8_t* p = buf;
+    p = put32(p, MAGIC);
+    p = put16(p, VERSION);
+    p = put16(p, result.blob_count);
+    p = put32(p, result.frame_num);
+    p = put32(p, (uint32_t)latency_usec);
+    p = put64(p, (uint64_t)(result.timestamp_nsec / 1000));
+    p = put64(p, send_usec);
+    for (int i = 0; i < result.blob_count; ++i) {
+        const Target_Blob& b = result.blob[i];
+        p = put16(p, b.x_min);
+        p = put16(p, b.y_min);
+        p = put16(p, b.x_max);
+        p = put16(p, b.y_max);
+        p = put32(p, b.area);
+        p = put_float(p, b.x_center);
+        p = put_float(p, b.y_center);
+    }
+    return p - buf;
+}
+
+bool Result_Packet::decode(const uint8_t* buf,
+                           int len,
+                           Target_Result& result,
+                           int64_t& latency_usec,
+                           int64_t& send_usec)
+{
+    if (len < HEADER_BYTES) return false;
+    if (get32(buf) != MAGIC || get16(buf + 4) != (uint32_t)VERSION) {
+        return false;
+    }
+    int blob_count = get16(buf + 6);
+    if (blob_count > Target_Result::MAX_BLOBS ||
+        len < HEADER_BYTES + blob_count * BLOB_BYTES) {
+        return false;
+    }
+    result.blob_count = blob_count;
+    result.frame_num = get32(buf + 8);
+    latency_usec = get32(buf + 12);
+    result.timestamp_nsec = (int64_t)get64(buf + 16) * 1000;
+    send_usec = get64(buf + 24);
+    const uint8_t* p = buf + HEADER_BYTES;
+    for (int i = 0; i < blob_count; ++i) {
+        Target_Blob& b = result.blob[i];
+        b.x_min = get16(p);
+        b.y_min = get16(p + 2);
+        b.x_max = get16(p + 4);
+        b.y_max = get16(p + 6);
+        b.area = get32(p + 8);
+        b.x_center = get_float(p + 12);
+        b.y_center = get_float(p + 16);
+        p += BLOB_BYTES;
+    }
+    return true;
+}
+
+Result_Publisher::Result_Publisher()
+: sock_fd(-1),
+  dest_count(0),
+  sent_count(0),
+  drop_count(0)
+{
+    memset(dest_addr, 0, sizeof(dest_addr));
+    memset(msg, 0, sizeof(msg));
+    iov.iov_base = packet;
+    iov.iov_len = 0;
+}
+
+Result_Publisher::~Result_Publisher()
+{
+    if (sock_fd >= 0) close(sock_fd);
+}
+
+bool Result_Publisher::add_destination(const char* ip_addr, int port)
+{
+    if (dest_count == MAX_DESTS) return false;
+    struct sockaddr_in& addr = dest_addr[dest_count];
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip_addr, &addr.sin_addr) != 1) return false;
+    if (sock_fd < 0) {
+        sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock_fd < 0) return false;
+    }
+
+    // Every message sends the same buffer; only the address differs.
+
+    struct msghdr& hdr = msg[dest_count].msg_hdr;
+    hdr.msg_name = &addr;
+    hdr.msg_namelen = sizeof(addr);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    ++dest_count;
+    return true;
+}
+
+int Result_Publisher::publish(const Target_Result& result,
+                              int64_t latency_usec)
+{
+    if (dest_count == 0) return 0;
+    iov.iov_len = Result_Packet::encode(result, latency_usec,
+                                        monotonic_usec(), packet);
+    int sent = sendmmsg(sock_fd, msg, dest_count, MSG_DONTWAIT);
+    if (sent < 0) sent = 0;
+    sent_count += sent;
+    drop_count += dest_count - sent;
+    return sent;
+}
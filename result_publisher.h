@@ -0,0 +1,141 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef RESULT_PUBLISHER_H
+#define RESULT_PUBLISHER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "target_detector.h"
+
+/**********************************************************************
+ * @brief The wire format of one frame's targets.
+ *
+ * A packet is a fixed HEADER_BYTES header followed by blob_count blobs
+ * of BLOB_BYTES each, all in network byte order:
+ *
+ *     offset  size  field
+ *      0      4     magic, MAGIC
+ *      4      2     version, VERSION
+ *      6      2     blob_count
+ *      8      4     frame_num
+ *     12      4     latency_usec: capture to publish
+ *     16      8     timestamp_usec: CLOCK_MONOTONIC when captured
+ *     24      8     send_usec: CLOCK_MONOTONIC when sent
+ *
+ * and per blob:
+ *
+ *      0      2     x_min
+ *      2      2     y_min
+ *      4      2     x_max
+ *      6      2     y_max
+ *      8      4     area
+ *     12      4     x_center, IEEE 754 single
+ *     16      4     y_center, IEEE 754 single
+ *
+ * So the controller can read it with fixed offsets, and needs no parser.
+ */
+class Result_Packet {
+public:
+    static const uint32_t MAGIC = 0x54363936;   /// "T696"
+    static const int VERSION = 1;
+    static const int HEADER_BYTES = 32;
+    static const int BLOB_BYTES = 20;
+    static const int MAX_BYTES =
+            HEADER_BYTES + Target_Result::MAX_BLOBS * BLOB_BYTES;
+
+    /*******************************************************************//*
+     * @brief Write a packet.
+     *
+     * @param [in] result        The targets.
+     * @param [in] latency_usec  Time from capture to publish.
+     * @param [in] send_usec     The monotonic_usec() time of sending.
+     * @param [out] buf          At least MAX_BYTES.
+     * @return The number of bytes written.
+     */
+    static int encode(const Target_Result& result,
+                      int64_t latency_usec,
+                      int64_t send_usec,
+                      uint8_t* buf);
+
+    /*******************************************************************//*
+     * @brief Read a packet written by encode().
+     *
+     * @return False if buf doesn't hold a whole packet of this version.
+     */
+    static bool decode(const uint8_t* buf,
+                       int len,
+                       Target_Result& result,
+                       int64_t& latency_usec,
+                       int64_t& send_usec);
+};
+
+/**********************************************************************
+ * @brief Sends each frame's targets over UDP.
+ *
+ * publish() encodes a Result_Packet into a buffer allocated with the
+ * publisher, and sends it to every destination with a single
+ * sendmmsg(2), so a frame costs one system call however many listeners
+ * there are, and nothing is allocated.  Sends never block: if the socket
+ * buffer is full the packet is dropped and counted, since a late result
+ * is of no use to the controller.
+ *
+ * publish() must be called by one thread at a time.
+ */
+class Result_Publisher {
+public:
+    /** The most destinations. */
+    static const int MAX_DESTS = 4;
+
+private:
+    int sock_fd;
+    int dest_count;
+    struct sockaddr_in dest_addr[MAX_DESTS];
+    struct mmsghdr msg[MAX_DESTS];
+    struct iovec iov;
+    uint8_t packet[Result_Packet::MAX_BYTES];
+
+    int sent_count;       /// Packets sent, counting each destination.
+    int drop_count;       /// Packets that could not be sent.
+
+    // Not copyable.
+    Result_Publisher(const Result_Publisher&);
+    Result_Publisher& operator=(const Result_Publisher&);
+
+public:
+    Result_Publisher();
+    ~Result_Publisher();
+
+    /*******************************************************************//*
+     * @brief Add a place to send results.
+     *
+     * @param [in] ip_addr  Dotted IPv4 address, such as "10.6.96.2".
+     * @param [in] port     UDP port.
+     * @return False if the address is bad, the socket can't be created,
+     *         or there are already MAX_DESTS destinations.
+     */
+    bool add_destination(const char* ip_addr, int port);
+
+    /*******************************************************************//*
+     * @brief Send one frame's targets to every destination.
+     *
+     * @param [in] result        The targets.
+     * @param [in] latency_usec  Time from capture until now, such as
+     *                           frame_age_usec() of the frame.
+     * @return The number of destinations the packet was sent to.
+     */
+    int publish(const Target_Result& result, int64_t latency_usec);
+
+    int get_sent_count() const
+    {
+        return sent_count;
+    }
+
+    int get_drop_count() const
+    {
+        return drop_count;
+    }
+};
+
+#endif
@@ -0,0 +1,144 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+
+/* Receive the Result_Packets sent by a Result_Publisher and report how
+   long they took to arrive.
+
+   Run on the same machine as the publisher, the send time in each packet
+   is on the same clock as ours, so the network latency can be measured
+   directly; adding the packet's capture-to-publish latency gives the
+   whole delay from capture to the controller having the result.  Lost
+   packets are found from gaps in the frame numbers.
+
+   With -test, a thread in this program publishes synthetic results to
+   the loopback address at 125 Hz, so the path can be measured without a
+   camera.
+
+   Usage: result_receiver [-test] [port [packet_count]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "result_publisher.h"
+#include "pipeline_stats.h"
+
+static int port = 5800;
+static int packet_count = 1000;
+
+// Publish packet_count results with the largest blob count, at 125 Hz.
+static void* test_sender(void*)
+{
+    Result_Publisher publisher;
+    if (!publisher.add_destination("127.0.0.1", port)) {
+        printf("can't publish to port %d\n", port);
+        exit(-1);
+    }
+    Target_Result result;
+    result.blob_count = Target_Result::MAX_BLOBS;
+    for (int i = 0; i < result.blob_count; ++i) {
+        Target_Blob& b = result.blob[i];
+        b.x_min = 10 * i;
+        b.y_min = 5 * i;
+        b.x_max = b.x_min + 8;
+        b.y_max = b.y_min + 4;
+        b.area = 45;
+        b.x_center = b.x_min + 4.0f;
+        b.y_center = b.y_min + 2.0f;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 8000000;
+    for (int i = 0; i < packet_count; ++i) {
+        int64_t now = monotonic_usec();
+        result.frame_num = i;
+        result.timestamp_nsec = now * 1000;
+        publisher.publish(result, 0);
+        nanosleep(&ts, NULL);
+    }
+    printf("sent %d, dropped %d\n", publisher.get_sent_count(),
+           publisher.get_drop_count());
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    bool test = false;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-test") == 0) {
+        test = true;
+        ++arg;
+    }
+    if (arg < argc) port = atoi(argv[arg++]);
+    if (arg < argc) packet_count = atoi(argv[arg++]);
+
+    int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (sock_fd < 0 ||
+        bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        printf("can't listen on port %d\n", port);
+        return 1;
+    }
+    printf("listening on port %d for %d packets\n", port, packet_count);
+
+    pthread_t sender_id;
+    if (test) {
+        int rc = pthread_create(&sender_id, NULL, test_sender, NULL);
+        if (rc != 0) {
+            printf("can't pthread_create, error_code= %d\n", rc);
+            exit(-1);
+        }
+    }
+
+    Latency_Histogram net_hist;     // publish to receive
+    Latency_Histogram total_hist;   // capture to receive
+    uint8_t buf[Result_Packet::MAX_BYTES];
+    int received = 0;
+    int lost = 0;
+    int bad = 0;
+    int last_frame_num = -1;
+    while (received < packet_count) {
+        int len = recv(sock_fd, buf, sizeof(buf), 0);
+        int64_t now = monotonic_usec();
+        if (len < 0) continue;
+        Target_Result result;
+        int64_t latency_usec;
+        int64_t send_usec;
+        if (!Result_Packet::decode(buf, len, result, latency_usec,
+                                   send_usec)) {
+            ++bad;
+            continue;
+        }
+        ++received;
+        if (last_frame_num >= 0 && result.frame_num > last_frame_num + 1) {
+            lost += result.frame_num - last_frame_num - 1;
+        }
+        last_frame_num = result.frame_num;
+        net_hist.record(now - send_usec);
+        total_hist.record(now - send_usec + latency_usec);
+    }
+    if (test) pthread_join(sender_id, NULL);
+    close(sock_fd);
+
+    Latency_Histogram::Snapshot zero = Latency_Histogram::Snapshot();
+    Latency_Histogram::Snapshot net;
+    Latency_Histogram::Snapshot total;
+    net_hist.take_interval(zero, net);
+    zero = Latency_Histogram::Snapshot();
+    total_hist.take_interval(zero, total);
+    printf("received %d, lost %d, bad %d\n", received, lost, bad);
+    printf("publish to receive usec: p50 %u p99 %u max %u\n",
+           net.percentile(0.5), net.percentile(0.99), net.max_usec);
+    printf("capture to receive usec: p50 %u p99 %u max %u\n",
+           total.percentile(0.5), total.percentile(0.99), total.max_usec);
+    return 0;
+}
@@ -0,0 +1,231 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "sim_camera.h"
+#include "pipeline_stats.h"
+
+static const int64_t NSEC_PER_SECOND = 1000000000;
+
+// Sleep until the given CLOCK_MONOTONIC time.
+static void sleep_until_nsec(int64_t when_nsec)
+{
+    struct timespec ts;
+    ts.tv_sec = when_nsec / NSEC_PER_SECOND;
+    ts.tv_nsec = when_nsec % NSEC_PER_SECOND;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    { }
+}
+
+Sim_Camera::Sim_Camera()
+: buf_count(0),
+  buf_bytes(0),
+  rows(0),
+  cols(0),
+  pixel_format(0),
+  frame(NULL),
+  vbuf(NULL),
+  img_mem(NULL),
+  period_nsec(0),
+  next_due_nsec(0),
+  sequence(0),
+  end_of_stream(false),
+  filled_ptr(NULL),
+  filled_head(0),
+  filled_count(0),
+  free_ptr(NULL),
+  free_nsec(NULL),
+  free_head(0),
+  free_count(0)
+{
+    dev_name[0] = '\0';
+    pthread_mutex_init(&free_mutex, NULL);
+    pthread_cond_init(&free_cond, NULL);
+}
+
+Sim_Camera::~Sim_Camera()
+{
+    deinit_pool();
+    pthread_cond_destroy(&free_cond);
+    pthread_mutex_destroy(&free_mutex);
+}
+
+void Sim_Camera::init_pool(const char* device_name,
+                           int arg_rows,
+                           int arg_cols,
+                           uint32_t arg_pixel_format,
+                           int arg_buf_bytes,
+                           int arg_buf_count,
+                           double fps)
+{
+    deinit_pool();
+    strncpy(this->dev_name, device_name, FILENAME_MAX);
+    this->dev_name[FILENAME_MAX - 1] = '\0';
+    this->rows = arg_rows;
+    this->cols = arg_cols;
+    this->pixel_format = arg_pixel_format;
+    this->buf_bytes = arg_buf_bytes;
+    this->buf_count = (arg_buf_count < 1) ? 1 : arg_buf_count;
+    this->period_nsec = (fps > 0.0) ? (int64_t)(NSEC_PER_SECOND / fps) : 0;
+
+    frame = new Usb_Frame[buf_count];
+    vbuf = new struct v4l2_buffer[buf_count];
+    img_mem = new uint8_t[(size_t)buf_count * buf_bytes];
+    filled_ptr = new Usb_Frame*[buf_count];
+    free_ptr = new Usb_Frame*[buf_count];
+    free_nsec = new int64_t[buf_count];
+    filled_head = 0;
+    filled_count = 0;
+    free_head = 0;
+    free_count = 0;
+    for (int i = 0; i < buf_count; ++i) {
+        memset(&vbuf[i], 0, sizeof(vbuf[i]));
+        vbuf[i].type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        vbuf[i].memory = V4L2_MEMORY_USERPTR;
+        vbuf[i].index = i;
+        vbuf[i].length = buf_bytes;
+        vbuf[i].flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+        frame[i].vbuf_ptr = &vbuf[i];
+        frame[i].img_data = img_mem + (size_t)i * buf_bytes;
+        frame[i].rows = rows;
+        frame[i].cols = cols;
+        frame[i].step = cols * packed_pixel_bytes(pixel_format);
+        frame[i].pixel_format = pixel_format;
+        frame[i].owner_ptr = this;
+        free_ptr[free_count] = &frame[i];
+        free_nsec[free_count] = 0;
+        ++free_count;
+    }
+}
+
+void Sim_Camera::deinit_pool()
+{
+    delete[] free_nsec;
+    delete[] free_ptr;
+    delete[] filled_ptr;
+    delete[] img_mem;
+    delete[] vbuf;
+    delete[] frame;
+    free_ptr = NULL;
+    free_nsec = NULL;
+    filled_ptr = NULL;
+    img_mem = NULL;
+    vbuf = NULL;
+    frame = NULL;
+    buf_count = 0;
+    filled_count = 0;
+    free_count = 0;
+}
+
+void Sim_Camera::stream_start()
+{
+    sequence = 0;
+    end_of_stream = false;
+    next_due_nsec = monotonic_nsec();
+}
+
+void Sim_Camera::stream_stop()
+{
+    end_of_stream = true;
+}
+
+Usb_Frame* Sim_Camera::take_free(bool wait, int64_t due_nsec)
+{
+    Usb_Frame* frame_ptr = NULL;
+    pthread_mutex_lock(&free_mutex);
+    while (wait && free_count == 0) {
+        pthread_cond_wait(&free_cond, &free_mutex);
+    }
+    if (free_count > 0 && (wait || free_nsec[free_head] <= due_nsec)) {
+        frame_ptr = free_ptr[free_head];
+        if (++free_head == buf_count) free_head = 0;
+        --free_count;
+    }
+    pthread_mutex_unlock(&free_mutex);
+    return frame_ptr;
+}
+
+void Sim_Camera::capture(Usb_Frame* frame_ptr, int64_t timestamp_nsec)
+{
+    struct v4l2_buffer* vp = frame_ptr->vbuf_ptr;
+    vp->sequence = sequence;
+    vp->timestamp.tv_sec = timestamp_nsec / NSEC_PER_SECOND;
+    vp->timestamp.tv_usec = (timestamp_nsec % NSEC_PER_SECOND) / 1000;
+
+    // As a driver would give it: to the usec, on the monotonic clock.
+
+    frame_ptr->timestamp_nsec = timestamp_nsec / 1000 * 1000;
+    frame_ptr->timestamp_known = true;
+    uint32_t bytesused = 0;
+    if (!fill_frame(frame_ptr, bytesused)) {
+        end_of_stream = true;
+        push(frame_ptr);
+        return;
+    }
+    vp->bytesused = bytesused;
+    frame_ptr->ref_count = 1;
+    int tail = filled_head + filled_count;
+    if (tail >= buf_count) tail -= buf_count;
+    filled_ptr[tail] = frame_ptr;
+    ++filled_count;
+}
+
+void Sim_Camera::catch_up()
+{
+    /* A frame that came due while no buffer was free is lost, even if one
+       has come back since. */
+
+    int64_t now = monotonic_nsec();
+    while (next_due_nsec <= now && !end_of_stream) {
+        Usb_Frame* frame_ptr = take_free(false, next_due_nsec);
+        if (frame_ptr != NULL) capture(frame_ptr, next_due_nsec);
+        ++sequence;
+        next_due_nsec += period_nsec;
+    }
+}
+
+Usb_Frame* Sim_Camera::pop(int& count)
+{
+    if (period_nsec == 0) {
+
+        // Unpaced: capture as soon as a buffer is free.
+
+        if (!end_of_stream) {
+            Usb_Frame* frame_ptr = take_free(true, 0);
+            capture(frame_ptr, monotonic_nsec());
+            ++sequence;
+        }
+    } else {
+        catch_up();
+        while (filled_count == 0 && !end_of_stream) {
+            sleep_until_nsec(next_due_nsec);
+            catch_up();
+        }
+    }
+
+    if (filled_count == 0) {
+        count = 0;
+        return NULL;
+    }
+    Usb_Frame* frame_ptr = filled_ptr[filled_head];
+    if (++filled_head == buf_count) filled_head = 0;
+    --filled_count;
+    count = filled_count;
+    frame_ptr->dequeue_nsec = monotonic_nsec();
+    return frame_ptr;
+}
+
+int Sim_Camera::push(Usb_Frame* frame_ptr)
+{
+    pthread_mutex_lock(&free_mutex);
+    int tail = free_head + free_count;
+    if (tail >= buf_count) tail -= buf_count;
+    free_ptr[tail] = frame_ptr;
+    free_nsec[tail] = monotonic_nsec();
+    int count = ++free_count;
+    pthread_cond_signal(&free_cond);
+    pthread_mutex_unlock(&free_mutex);
+    return count;
+}
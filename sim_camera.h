@@ -0,0 +1,190 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef SIM_CAMERA_H
+#define SIM_CAMERA_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+#include "any_camera.h"
+#include "usb_camera.h"
+
+/**********************************************************************
+ * @brief Base class for cameras that produce frames without hardware.
+ *
+ * A Sim_Camera behaves like the V4L2 driver behind a Usb_Camera.  It owns
+ * a fixed pool of buffers.  At every tick of the configured frame rate
+ * it "captures" a frame into a free buffer (one that has been given back
+ * with push()) by calling fill_frame().  If no buffer is free at that
+ * moment the frame is lost, and the gap shows up in the frame numbers,
+ * just as it would with a real camera.  pop() returns the oldest captured
+ * frame, waiting for the next tick if there is none.
+ *
+ * There is no capture thread: the ticks that have come due are caught up
+ * on each pop().  So that this gives the same result as capturing on
+ * time, push() notes when each buffer came back, and a tick only fills a
+ * buffer that was already free at that tick.  Free buffers are filled in
+ * the order they came back, as the driver fills its queue.
+ *
+ * A frame rate of 0 means "as fast as possible": no frames are ever
+ * lost, and pop() captures into the next free buffer as soon as there is
+ * one.
+ *
+ * Timestamps are taken from CLOCK_MONOTONIC and flagged
+ * V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC.
+ */
+class Sim_Camera: public Any_Camera {
+private:
+    char dev_name[FILENAME_MAX];
+    int buf_count;                     /// size of frame and vbuf arrays
+    int buf_bytes;                     /// size of each image buffer
+    int rows;
+    int cols;
+    uint32_t pixel_format;
+    Usb_Frame* frame;                  /// space for the frames
+    struct v4l2_buffer* vbuf;          /// space for the video buffers
+    uint8_t* img_mem;                  /// space for all images
+
+    int64_t period_nsec;               /// time between frames; 0 = no pacing
+    int64_t next_due_nsec;             /// CLOCK_MONOTONIC time of next frame
+    uint32_t sequence;                 /// number of the next frame
+    bool end_of_stream;                /// fill_frame() has run out of frames
+
+    /** Frames that have been captured but not yet popped, oldest first.
+        Accessed only by the thread that calls pop(). */
+    Usb_Frame** filled_ptr;
+    int filled_head;
+    int filled_count;
+
+    /** Frames given back with push(), available to be filled, oldest
+        first, and the CLOCK_MONOTONIC time each came back. */
+    Usb_Frame** free_ptr;
+    int64_t* free_nsec;
+    int free_head;
+    int free_count;
+
+    /** Protects free_ptr, free_nsec, free_head and free_count. */
+    pthread_mutex_t free_mutex;
+
+    /** Signals a pop() waiting for a free buffer in unpaced mode. */
+    pthread_cond_t free_cond;
+
+    /*******************************************************************//*
+     * @brief Take the oldest buffer off the free list, or return NULL if
+     *        there is none that came back by due_nsec.  If wait is true,
+     *        block until one is available, whenever it came back.
+     */
+    Usb_Frame* take_free(bool wait, int64_t due_nsec);
+
+    /*******************************************************************//*
+     * @brief Capture, or lose, every frame that has come due by now.
+     */
+    void catch_up();
+
+    /*******************************************************************//*
+     * @brief Capture one frame into the given free buffer, and append it to
+     *        the filled list.
+     */
+    void capture(Usb_Frame* frame_ptr, int64_t timestamp_nsec);
+
+protected:
+
+    /*******************************************************************//*
+     * @brief Allocate the buffer pool.  Derived classes call this from
+     *        their own init().
+     *
+     * @param [in] device_name  The name to report from get_device_name().
+     * @param [in] rows         The number of rows in each image.
+     * @param [in] cols         The number of columns in each image.
+     * @param [in] pixel_format The fourcc code of the images.
+     * @param [in] buf_bytes    The size of each image buffer.
+     * @param [in] buf_count    The number of buffers.
+     * @param [in] fps          Frames per second; 0 means no pacing.
+     */
+    void init_pool(const char* device_name,
+                   int rows,
+                   int cols,
+                   uint32_t pixel_format,
+                   int buf_bytes,
+                   int buf_count,
+                   double fps);
+
+    /*******************************************************************//*
+     * @brief Free the buffer pool.
+     */
+    void deinit_pool();
+
+    /*******************************************************************//*
+     * @brief Fill in the image data of the given frame.
+     *
+     * Called with the frame's timestamp and sequence number already set.
+     * Implementations write at most get_buf_bytes() bytes to
+     * frame_ptr->get_img_data().
+     *
+     * @param [in,out] frame_ptr  The frame to fill.
+     * @param [out] bytesused     Returns the number of bytes written.
+     * @return False if there are no more frames; frame_ptr is then unused.
+     */
+    virtual bool fill_frame(Usb_Frame* frame_ptr, uint32_t& bytesused) = 0;
+
+    /*******************************************************************//*
+     * @brief Return the index of the given frame in the buffer pool, in the
+     *        range 0..get_buf_count()-1.
+     */
+    int buf_index(const Usb_Frame* frame_ptr) const
+    {
+        return (int)(frame_ptr - frame);
+    }
+
+    /*******************************************************************//*
+     * @brief Override the sequence number of the frame being filled.
+     */
+    static void set_frame_num(Usb_Frame* frame_ptr, uint32_t sequence)
+    {
+        frame_ptr->vbuf_ptr->sequence = sequence;
+    }
+
+public:
+    Sim_Camera();
+    virtual ~Sim_Camera();
+
+    virtual const char* get_device_name() const { return dev_name; }
+    virtual int get_buf_count() const { return buf_count; }
+    virtual int get_rows() const { return rows; }
+    virtual int get_cols() const { return cols; }
+    virtual uint32_t get_pixel_format() const { return pixel_format; }
+
+    /*******************************************************************//*
+     * @brief Return the size of each image buffer in bytes.
+     */
+    int get_buf_bytes() const { return buf_bytes; }
+
+    virtual void stream_start();
+    virtual void stream_stop();
+
+    /*******************************************************************//*
+     * @brief Return true once fill_frame() has run out, or the stream is
+     *        stopped, and every frame captured has been popped.  Call only
+     *        from the thread that calls pop().
+     */
+    virtual bool is_end_of_stream() const
+    {
+        return end_of_stream && filled_count == 0;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the oldest captured frame.
+     *
+     * @return The frame, or NULL if the source has no more frames.
+     */
+    virtual Usb_Frame* pop(int& count);
+
+    /*******************************************************************//*
+     * @brief Give back a frame so its buffer may be refilled.
+     */
+    virtual int push(Usb_Frame* frame_ptr);
+};
+
+#endif
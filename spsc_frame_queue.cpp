@@ -0,0 +1,113 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <pthread.h>
+#include "spsc_frame_queue.h"
+
+/* A note on memory ordering.
+
+   Items are handed off with release stores of tail (producer) and head
+   (consumer), paired with acquire loads on the other side.
+
+   Parking uses the usual Dekker pattern: the waiter sets its *_waiting
+   flag and then re-reads the index; the other side stores the index and
+   then reads the flag.  Both sides use sequentially consistent operations
+   here, so at least one of them is guaranteed to see the other's store.
+   The waiter holds the mutex from setting the flag until pthread_cond_wait()
+   releases it, so a signal sent under the mutex can't be lost. */
+
+Spsc_Frame_Queue::Spsc_Frame_Queue(int max_size,
+                                   bool do_block_on_empty,
+                                   bool do_block_on_full)
+{
+    block_on_empty = do_block_on_empty;
+    block_on_full = do_block_on_full;
+    size = max_size;
+    if (size < 1) size = 1;
+    ptr = new Usb_Frame*[size + 1];
+    head = 0;
+    tail = 0;
+    empty_waiting = 0;
+    full_waiting = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&empty_cond, NULL);
+    pthread_cond_init(&full_cond, NULL);
+}
+
+Spsc_Frame_Queue::~Spsc_Frame_Queue()
+{
+    pthread_cond_destroy(&full_cond);
+    pthread_cond_destroy(&empty_cond);
+    pthread_mutex_destroy(&mutex);
+    delete[] ptr;
+}
+
+int Spsc_Frame_Queue::push(Usb_Frame* frame_ptr)
+{
+    int t = tail;
+    int new_tail = next_index(t);
+    int h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (h == new_tail) {
+        if (!block_on_full) return -1;  // would overflow
+
+        // Queue is full.  Park until the consumer frees a slot.
+
+        pthread_mutex_lock(&mutex);
+        __atomic_store_n(&full_waiting, 1, __ATOMIC_SEQ_CST);
+        while ((h = __atomic_load_n(&head, __ATOMIC_SEQ_CST)) == new_tail) {
+            pthread_cond_wait(&full_cond, &mutex);
+        }
+        __atomic_store_n(&full_waiting, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    ptr[t] = frame_ptr;
+    __atomic_store_n(&tail, new_tail, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&empty_waiting, __ATOMIC_SEQ_CST)) {
+
+        // The consumer is parked on an empty queue.  Wake it.
+
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&empty_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+    return item_count(h, new_tail);
+}
+
+Usb_Frame* Spsc_Frame_Queue::pop(int& count)
+{
+    int h = head;
+    int t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    if (h == t) {
+        if (!block_on_empty) {
+            count = 0;
+            return NULL;
+        }
+
+        // Queue is empty.  Park until the producer adds an item.
+
+        pthread_mutex_lock(&mutex);
+        __atomic_store_n(&empty_waiting, 1, __ATOMIC_SEQ_CST);
+        while ((t = __atomic_load_n(&tail, __ATOMIC_SEQ_CST)) == h) {
+            pthread_cond_wait(&empty_cond, &mutex);
+        }
+        __atomic_store_n(&empty_waiting, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    Usb_Frame* return_value = ptr[h];
+    int new_head = next_index(h);
+    __atomic_store_n(&head, new_head, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&full_waiting, __ATOMIC_SEQ_CST)) {
+
+        // The producer is parked on a full queue.  Wake it.
+
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&full_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+    count = item_count(new_head, t);
+    return return_value;
+}
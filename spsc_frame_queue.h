@@ -0,0 +1,147 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef SPSC_FRAME_QUEUE_H
+#define SPSC_FRAME_QUEUE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "any_frame_queue.h"
+
+/******************************************************************//**
+ * @brief Implements a lock-free queue of frames for exactly one producer
+ *        thread and exactly one consumer thread.
+ *
+ * This has the same interface and blocking semantics as Frame_Queue, but
+ * in the common case neither push() nor pop() takes a lock or makes a
+ * system call.  The head index is written only by the consumer and the
+ * tail index only by the producer; each lives on its own cache line so
+ * the two threads do not fight over the same line.  A thread parks on a
+ * condition variable only when the queue is really empty (pop) or really
+ * full (push).
+ *
+ * It is an error to call push() from more than one thread, or pop() from
+ * more than one thread.
+ */
+class Spsc_Frame_Queue: public Any_Frame_Queue {
+private:
+    /** The size of a cache line on the target processor, in bytes. */
+    static const int CACHE_LINE_BYTES = 64;
+
+    /** True indicates that if the queue is empty, pop() will block until a
+        new item is available.  False indicates that if the queue is empty,
+        pop() will return NULL immediately. */
+    bool block_on_empty;
+
+    /** True indicates that if the queue is full, push() will block until
+        space is made available.  False indicates that if the queue is full,
+        push will return immediately with an error. */
+    bool block_on_full;
+
+    /** The maximum number of items that will fit in this queue.  The used
+        portion of the ptr array is size + 1 elements. */
+    int size;
+    Usb_Frame** ptr;  /// Contains all items on the queue; size + 1 elements
+
+    /* The padding arrays keep head, tail, and the parking state on separate
+       cache lines, however the object itself happens to be aligned. */
+    char pad0[CACHE_LINE_BYTES];
+
+    /** Index in ptr array of the head of the queue.  Written only by the
+        consumer. */
+    int head;
+
+    /** Non-zero while the consumer is parked waiting for an item. */
+    int empty_waiting;
+
+    char pad1[CACHE_LINE_BYTES];
+
+    /** Index in ptr array of the tail of the queue.  Written only by the
+        producer. */
+    int tail;
+
+    /** Non-zero while the producer is parked waiting for free space. */
+    int full_waiting;
+
+    char pad2[CACHE_LINE_BYTES];
+
+    /** Protects the condition variables below.  Only acquired when a thread
+        must park, or must wake a parked thread. */
+    pthread_mutex_t mutex;
+
+    /** Signals a consumer waiting for an empty queue to become non-empty. */
+    pthread_cond_t empty_cond;
+
+    /** Signals a producer waiting for a full queue to acquire free space. */
+    pthread_cond_t full_cond;
+
+    /******************************************************************//**
+     * @brief Return the index in ptr following the given index.
+     */
+    int next_index(int index) const
+    {
+        return (index == size) ? 0 : index + 1;
+    }
+
+    /******************************************************************//**
+     * @brief Return the count of items between the given head and tail.
+     */
+    int item_count(int h, int t) const
+    {
+        int count = t - h;
+        if (count < 0) count += size + 1;
+        return count;
+    }
+
+    // Not copyable; the ptr array is owned.
+    Spsc_Frame_Queue(const Spsc_Frame_Queue&);
+    Spsc_Frame_Queue& operator=(const Spsc_Frame_Queue&);
+
+public:
+
+    /******************************************************************//**
+     * @brief Construct a new Spsc_Frame_Queue.
+     *
+     * @param [in] max_size        The maximum number of items the queue will
+     *                             be able to hold.  Storage is allocated
+     *                             to fit; there is no fixed upper limit.
+     * @param [in] block_on_empty  True indicates that if the queue is empty,
+     *                             pop() will block until a new item is
+     *                             available.
+     * @param [in] block_on_full   True indicates that if the queue is full,
+     *                             push() will block until space is made
+     *                             available.
+     */
+    Spsc_Frame_Queue(int max_size = 1,
+                     bool block_on_empty = true,
+                     bool block_on_full = true);
+
+    virtual ~Spsc_Frame_Queue();
+
+    /******************************************************************//**
+     * @brief Push a new item onto the queue.  Call from the producer thread
+     *        only.
+     *
+     * See Frame_Queue::push() for the blocking semantics.
+     *
+     * @param [in] frame_ptr  The item to push.
+     * @return On success the number of items now on the queue; -1 on failure.
+     *         Failure occurs if the queue is full and block_on_full is false.
+     */
+    virtual int push(Usb_Frame* frame_ptr);
+
+    /******************************************************************//**
+     * @brief Pop the next item from the front of the queue.  Call from the
+     *        consumer thread only.
+     *
+     * See Frame_Queue::pop() for the blocking semantics.
+     *
+     * @param [out] count  Returns the number of items on the queue after the
+     *                     pop operation.
+     * @return The item at the front of the queue, or NULL if the queue is
+     *         empty and block_on_empty is false.
+     */
+    virtual Usb_Frame* pop(int& count);
+};
+
+#endif
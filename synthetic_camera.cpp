@@ -0,0 +1,120 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <string.h>
+#include "synthetic_camera.h"
+
+// YUV of the target square: a saturated green.
+static const uint8_t TARGET_Y = 180;
+static const uint8_t TARGET_U = 60;
+static const uint8_t TARGET_V = 50;
+
+Synthetic_Camera::Synthetic_Camera()
+: background(NULL),
+  drawn_x(NULL),
+  drawn_y(NULL)
+{ }
+
+Synthetic_Camera::~Synthetic_Camera()
+{
+    delete[] drawn_y;
+    delete[] drawn_x;
+    delete[] background;
+}
+
+void Synthetic_Camera::init(const char* device_name,
+                            int rows,
+                            int cols,
+                            double fps,
+                            int buf_count)
+{
+    cols &= ~1;
+    init_pool(device_name, rows, cols, V4L2_PIX_FMT_YUYV, rows * cols * 2,
+              buf_count, fps);
+    target_size = (rows / 8) & ~1;
+    if (target_size < 2) target_size = 2;
+
+    // Luma ramps left to right; chroma steps through bands top to bottom.
+
+    delete[] background;
+    background = new uint8_t[get_buf_bytes()];
+    for (int r = 0; r < rows; ++r) {
+        uint8_t* p = background + r * cols * 2;
+        uint8_t u = (uint8_t)(96 + (r * 4 / rows) * 16);
+        uint8_t v = (uint8_t)(160 - (r * 4 / rows) * 16);
+        for (int c = 0; c < cols; c += 2) {
+            p[0] = (uint8_t)(32 + c * 96 / cols);
+            p[1] = u;
+            p[2] = (uint8_t)(32 + (c + 1) * 96 / cols);
+            p[3] = v;
+            p += 4;
+        }
+    }
+
+    delete[] drawn_y;
+    delete[] drawn_x;
+    drawn_x = new int[get_buf_count()];
+    drawn_y = new int[get_buf_count()];
+    for (int i = 0; i < get_buf_count(); ++i) {
+        drawn_x[i] = -1;
+        drawn_y[i] = -1;
+    }
+}
+
+void Synthetic_Camera::get_target_pos(uint32_t frame_num, int& x, int& y) const
+{
+    // Bounce around the frame, 3 pixels right and 2 down per frame.
+
+    int x_range = get_cols() - target_size;
+    int y_range = get_rows() - target_size;
+    int xi = (int)((frame_num * 3) % (uint32_t)(2 * x_range));
+    int yi = (int)((frame_num * 2) % (uint32_t)(2 * y_range));
+    x = (xi < x_range) ? xi : 2 * x_range - xi;
+    y = (yi < y_range) ? yi : 2 * y_range - yi;
+    x &= ~1;
+}
+
+void Synthetic_Camera::restore_background(uint8_t* img, int x, int y) const
+{
+    int step = get_cols() * 2;
+    for (int r = y; r < y + target_size; ++r) {
+        memcpy(img + r * step + x * 2, background + r * step + x * 2,
+               target_size * 2);
+    }
+}
+
+void Synthetic_Camera::draw_target(uint8_t* img, int x, int y) const
+{
+    int step = get_cols() * 2;
+    for (int r = y; r < y + target_size; ++r) {
+        uint8_t* p = img + r * step + x * 2;
+        for (int c = 0; c < target_size; c += 2) {
+            p[0] = TARGET_Y;
+            p[1] = TARGET_U;
+            p[2] = TARGET_Y;
+            p[3] = TARGET_V;
+            p += 4;
+        }
+    }
+}
+
+bool Synthetic_Camera::fill_frame(Usb_Frame* frame_ptr, uint32_t& bytesused)
+{
+    /* Only the pixels under the old and new squares change, so the cost of
+       a frame is independent of the image size. */
+
+    int i = buf_index(frame_ptr);
+    uint8_t* img = frame_ptr->get_img_data();
+    if (drawn_x[i] < 0) {
+        memcpy(img, background, get_buf_bytes());
+    } else {
+        restore_background(img, drawn_x[i], drawn_y[i]);
+    }
+    int x, y;
+    get_target_pos(frame_ptr->get_frame_num(), x, y);
+    draw_target(img, x, y);
+    drawn_x[i] = x;
+    drawn_y[i] = y;
+    bytesused = get_buf_bytes();
+    return true;
+}
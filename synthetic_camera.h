@@ -0,0 +1,68 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef SYNTHETIC_CAMERA_H
+#define SYNTHETIC_CAMERA_H
+
+#include "sim_camera.h"
+
+/**********************************************************************
+ * @brief A camera that generates a YUYV test pattern.
+ *
+ * Every frame shows a fixed gradient background with a bright green
+ * square (a stand-in for a lit retroreflective target) that moves a few
+ * pixels per frame, so consecutive frames differ and a frame's number can
+ * be read back from the square's position.
+ */
+class Synthetic_Camera: public Sim_Camera {
+private:
+    uint8_t* background;    /// the background image, buf_bytes long
+    int target_size;        /// width and height of the square, in pixels
+
+    /** For each buffer, the position of the square drawn into it last, or
+        -1 if it holds a clean background. */
+    int* drawn_x;
+    int* drawn_y;
+
+    /*******************************************************************//*
+     * @brief Copy the given rectangle of the background into img.
+     */
+    void restore_background(uint8_t* img, int x, int y) const;
+
+    /*******************************************************************//*
+     * @brief Draw the target square into img with its upper left corner at
+     *        (x, y).
+     */
+    void draw_target(uint8_t* img, int x, int y) const;
+
+protected:
+    virtual bool fill_frame(Usb_Frame* frame_ptr, uint32_t& bytesused);
+
+public:
+    Synthetic_Camera();
+    virtual ~Synthetic_Camera();
+
+    /*******************************************************************//*
+     * @brief Initialize the camera.
+     *
+     * @param [in] device_name The name to report from get_device_name().
+     * @param [in] rows        The number of rows in each image.
+     * @param [in] cols        The number of columns in each image; must be
+     *                         even.
+     * @param [in] fps         Frames per second; 0 means as fast as buffers
+     *                         are given back.
+     * @param [in] buf_count   The number of buffers.
+     */
+    void init(const char* device_name,
+              int rows = 240,
+              int cols = 320,
+              double fps = 30.0,
+              int buf_count = 5);
+
+    /*******************************************************************//*
+     * @brief Return the position of the target square in the given frame.
+     */
+    void get_target_pos(uint32_t frame_num, int& x, int& y) const;
+};
+
+#endif
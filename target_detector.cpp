@@ -0,0 +1,353 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <string.h>
+#include "target_detector.h"
+
+Target_Detector::Target_Detector()
+: rows(0),
+  cols(0),
+  min_area(1),
+  tracking(false),
+  margin(16),
+  sweep_period(30),
+  track_valid(false),
+  x_velocity(0),
+  y_velocity(0),
+  frames_since_sweep(0),
+  roi_count(0),
+  full_count(0),
+  sweep_count(0),
+  fallback_count(0),
+  mask(NULL),
+  mask_step(0),
+  max_runs(0),
+  run_count(0),
+  run(NULL),
+  parent(NULL),
+  accum(NULL),
+  overflow_count(0),
+  last_usec(0)
+{
+    pthread_mutex_init(&latest_mutex, NULL);
+}
+
+Target_Detector::~Target_Detector()
+{
+    delete[] accum;
+    delete[] parent;
+    delete[] run;
+    delete[] mask;
+    pthread_mutex_destroy(&latest_mutex);
+}
+
+void Target_Detector::init(int arg_rows,
+                           int arg_cols,
+                           const Yuv_Range& arg_range,
+                           int arg_min_area)
+{
+    delete[] accum;
+    delete[] parent;
+    delete[] run;
+    delete[] mask;
+    rows = arg_rows;
+    cols = arg_cols;
+    range = arg_range;
+    min_area = (arg_min_area < 1) ? 1 : arg_min_area;
+
+    // Round each row of the mask up to a whole 8 byte word, so the run
+    // scan can read 8 pixels at a time.
+
+    mask_step = (cols + 7) & ~7;
+    mask = new uint8_t[(size_t)rows * mask_step];
+    memset(mask, 0, (size_t)rows * mask_step);
+
+    // A sensible threshold sets a few percent of the pixels at most.
+
+    max_runs = rows * cols / 16;
+    if (max_runs < 1024) max_runs = 1024;
+    run = new Run[max_runs];
+    parent = new int[max_runs];
+    accum = new Accum[max_runs];
+}
+
+int Target_Detector::find(int i)
+{
+    int root = i;
+    while (parent[root] != root) root = parent[root];
+    while (parent[i] != root) {
+        int next = parent[i];
+        parent[i] = root;
+        i = next;
+    }
+    return root;
+}
+
+// Join the sets containing runs a and b; the lower index becomes the root.
+void Target_Detector::join(int a, int b)
+{
+    a = find(a);
+    b = find(b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+// The runs are stored in frame coordinates; m points to column x_begin of
+// row y of the mask.
+bool Target_Detector::label_row(const uint8_t* m,
+                                int y,
+                                int x_begin,
+                                int width,
+                                int prev_begin,
+                                int prev_end)
+{
+    int prev = prev_begin;
+    int x = 0;
+    while (x < width) {
+
+        // Skip clear pixels, 8 at a time where possible.
+
+        while (x + 8 <= width) {
+            uint64_t word;
+            memcpy(&word, m + x, sizeof(word));
+            if (word != 0) break;
+            x += 8;
+        }
+        while (x < width && m[x] == 0) ++x;
+        if (x >= width) break;
+
+        int begin = x_begin + x;
+        while (x < width && m[x] != 0) ++x;
+        int end = x_begin + x;
+        if (run_count == max_runs) return false;
+
+        int i = run_count++;
+        run[i].row = y;
+        run[i].col_begin = begin;
+        run[i].col_end = end;
+        parent[i] = i;
+
+        /* Join with every run above that touches this one, including
+           diagonally.  Runs above that end before this one begins can't
+           touch any later run on this row either. */
+
+        while (prev < prev_end && run[prev].col_end < begin) ++prev;
+        for (int p = prev; p < prev_end && run[p].col_begin <= end; ++p) {
+            join(p, i);
+        }
+    }
+    return true;
+}
+
+void Target_Detector::collect_blobs()
+{
+    // Sum each run into the root of its component.
+
+    for (int i = 0; i < run_count; ++i) {
+        int r = find(i);
+        const Run& rn = run[i];
+        int len = rn.col_end - rn.col_begin;
+        Accum& a = accum[r];
+        if (r == i) {
+            a.x_min = rn.col_begin;
+            a.x_max = rn.col_end - 1;
+            a.y_min = rn.row;
+            a.y_max = rn.row;
+            a.area = 0;
+            a.sum_x = 0;
+            a.sum_y = 0;
+        } else {
+            if (rn.col_begin < a.x_min) a.x_min = rn.col_begin;
+            if (rn.col_end - 1 > a.x_max) a.x_max = rn.col_end - 1;
+            if (rn.row > a.y_max) a.y_max = rn.row;
+        }
+        a.area += len;
+        a.sum_x += (int64_t)(rn.col_begin + rn.col_end - 1) * len / 2;
+        a.sum_y += (int64_t)rn.row * len;
+    }
+
+    // Keep the largest components, largest first.
+
+    result.blob_count = 0;
+    for (int i = 0; i < run_count; ++i) {
+        if (parent[i] != i || accum[i].area < min_area) continue;
+        const Accum& a = accum[i];
+        int n = result.blob_count;
+        if (n == Target_Result::MAX_BLOBS) {
+            if (a.area <= result.blob[n - 1].area) continue;
+            --n;
+        } else {
+            ++result.blob_count;
+        }
+        while (n > 0 && result.blob[n - 1].area < a.area) {
+            result.blob[n] = result.blob[n - 1];
+            --n;
+        }
+        Target_Blob& b = result.blob[n];
+        b.x_min = a.x_min;
+        b.y_min = a.y_min;
+        b.x_max = a.x_max;
+        b.y_max = a.y_max;
+        b.area = a.area;
+        b.x_center = (float)a.sum_x / a.area;
+        b.y_center = (float)a.sum_y / a.area;
+    }
+}
+
+void Target_Detector::search(Yuv422_Order order,
+                             const Usb_Frame* frame_ptr,
+                             int x_begin,
+                             int y_begin,
+                             int x_end,
+                             int y_end)
+{
+    int src_step = frame_ptr->get_step();
+    const uint8_t* src = frame_ptr->get_img_data() +
+                         (size_t)y_begin * src_step + 2 * x_begin;
+    uint8_t* m = mask + (size_t)y_begin * mask_step + x_begin;
+    int width = x_end - x_begin;
+    yuv422_threshold(order, src, src_step, range, m, mask_step,
+                     y_end - y_begin, width);
+
+    run_count = 0;
+    int prev_begin = 0;
+    int prev_end = 0;
+    for (int y = y_begin; y < y_end; ++y) {
+        if (!label_row(m, y, x_begin, width, prev_begin, prev_end)) {
+            ++overflow_count;
+            break;
+        }
+        m += mask_step;
+        prev_begin = prev_end;
+        prev_end = run_count;
+    }
+    collect_blobs();
+}
+
+bool Target_Detector::blob_at_window_edge(int x_begin, int y_begin,
+                                          int x_end, int y_end,
+                                          int frame_rows,
+                                          int frame_cols) const
+{
+    for (int i = 0; i < result.blob_count; ++i) {
+        const Target_Blob& b = result.blob[i];
+        if ((b.x_min == x_begin && x_begin > 0) ||
+            (b.y_min == y_begin && y_begin > 0) ||
+            (b.x_max == x_end - 1 && x_end < frame_cols) ||
+            (b.y_max == y_end - 1 && y_end < frame_rows)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Target_Detector::set_tracking(bool enable,
+                                   int arg_margin,
+                                   int arg_sweep_period)
+{
+    tracking = enable;
+    margin = (arg_margin < 0) ? 0 : arg_margin;
+    sweep_period = (arg_sweep_period < 1) ? 1 : arg_sweep_period;
+    track_valid = false;
+}
+
+int Target_Detector::detect(Yuv422_Order order, const Usb_Frame* frame_ptr)
+{
+    int64_t start_usec = monotonic_usec();
+    int frame_rows = frame_ptr->get_rows();
+    int frame_cols = frame_ptr->get_cols();
+    if (frame_rows > rows) frame_rows = rows;
+    if (frame_cols > cols) frame_cols = cols;
+    int frame_num = frame_ptr->get_frame_num();
+
+    bool sweep_due = (++frames_since_sweep >= sweep_period);
+    bool searched = false;
+    float prev_x = 0;
+    float prev_y = 0;
+    if (track_valid) {
+        prev_x = result.blob[0].x_center;
+        prev_y = result.blob[0].y_center;
+    }
+    if (tracking && track_valid && !sweep_due) {
+
+        /* Predict where the targets will be, allowing for any frames
+           dropped since the last one, and search only there. */
+
+        int gap = frame_num - result.frame_num;
+        if (gap < 1) gap = 1;
+        int dx = (int)(x_velocity * gap);
+        int dy = (int)(y_velocity * gap);
+        int x_begin = frame_cols;
+        int y_begin = frame_rows;
+        int x_end = 0;
+        int y_end = 0;
+        for (int i = 0; i < result.blob_count; ++i) {
+            const Target_Blob& b = result.blob[i];
+            if (b.x_min < x_begin) x_begin = b.x_min;
+            if (b.y_min < y_begin) y_begin = b.y_min;
+            if (b.x_max + 1 > x_end) x_end = b.x_max + 1;
+            if (b.y_max + 1 > y_end) y_end = b.y_max + 1;
+        }
+        x_begin += dx - margin;
+        x_end += dx + margin;
+        y_begin += dy - margin;
+        y_end += dy + margin;
+        if (x_begin < 0) x_begin = 0;
+        if (y_begin < 0) y_begin = 0;
+        if (x_end > frame_cols) x_end = frame_cols;
+        if (y_end > frame_rows) y_end = frame_rows;
+        x_begin &= ~1;
+        x_end = (x_end + 1) & ~1;
+        if (x_end > frame_cols) x_end = frame_cols & ~1;
+
+        if (x_begin < x_end && y_begin < y_end) {
+            search(order, frame_ptr, x_begin, y_begin, x_end, y_end);
+            if (result.blob_count > 0 &&
+                !blob_at_window_edge(x_begin, y_begin, x_end, y_end,
+                                     frame_rows, frame_cols)) {
+                ++roi_count;
+                searched = true;
+            }
+        }
+        if (!searched) ++fallback_count;
+    }
+    if (!searched) {
+        if (tracking && track_valid && sweep_due) ++sweep_count;
+        search(order, frame_ptr, 0, 0, frame_cols, frame_rows);
+        ++full_count;
+        frames_since_sweep = 0;
+    }
+
+    // Update the motion estimate from the largest blob.
+
+    if (result.blob_count > 0 && track_valid) {
+        int gap = frame_num - result.frame_num;
+        if (gap < 1) gap = 1;
+        x_velocity = (result.blob[0].x_center - prev_x) / gap;
+        y_velocity = (result.blob[0].y_center - prev_y) / gap;
+    } else {
+        x_velocity = 0;
+        y_velocity = 0;
+    }
+    track_valid = (result.blob_count > 0);
+
+    result.frame_num = frame_num;
+    result.timestamp_nsec = frame_ptr->get_timestamp_nsec();
+    pthread_mutex_lock(&latest_mutex);
+    latest = result;
+    pthread_mutex_unlock(&latest_mutex);
+
+    last_usec = monotonic_usec() - start_usec;
+    time_hist.record(last_usec);
+    return result.blob_count;
+}
+
+void Target_Detector::get_latest(Target_Result& latest_out)
+{
+    pthread_mutex_lock(&latest_mutex);
+    latest_out = latest;
+    pthread_mutex_unlock(&latest_mutex);
+}
@@ -0,0 +1,323 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef TARGET_DETECTOR_H
+#define TARGET_DETECTOR_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "usb_camera.h"
+#include "yuv_convert.h"
+#include "pipeline_stats.h"
+
+/**********************************************************************
+ * @brief One connected blob of pixels found by a Target_Detector.
+ */
+class Target_Blob {
+public:
+    int x_min;         /// Leftmost column of the bounding box.
+    int y_min;         /// Top row of the bounding box.
+    int x_max;         /// Rightmost column of the bounding box (inclusive).
+    int y_max;         /// Bottom row of the bounding box (inclusive).
+    int area;          /// The number of pixels in the blob.
+    float x_center;    /// Column of the centroid.
+    float y_center;    /// Row of the centroid.
+};
+
+/**********************************************************************
+ * @brief The blobs found in one frame, largest first.
+ */
+class Target_Result {
+public:
+    /** The most blobs reported per frame. */
+    static const int MAX_BLOBS = 16;
+
+    int frame_num;         /// Usb_Frame::get_frame_num() of the frame.
+    int64_t timestamp_nsec;  /// Usb_Frame::get_timestamp_nsec() of the frame.
+    int blob_count;        /// The number of valid entries in blob.
+    Target_Blob blob[MAX_BLOBS];
+
+    Target_Result()
+    : frame_num(-1),
+      timestamp_nsec(0),
+      blob_count(0)
+    { }
+};
+
+/**********************************************************************
+ * @brief Finds lit retroreflective targets in packed 4:2:2 frames.
+ *
+ * detect() thresholds the frame in YUV space (see yuv422_threshold())
+ * straight out of the Usb_Frame buffer, with no copy and no color
+ * conversion, then labels the connected components of the mask in a
+ * single pass.  Pixels are 8-connected.
+ *
+ * The labeling works on horizontal runs of set pixels: each run is joined
+ * (union-find) to the runs it touches on the row above, and the bounding
+ * box, area and centroid of each component are summed from its runs.
+ * Only the mask is touched per pixel; everything after that is per run.
+ *
+ * Storage is allocated once by init(), so detect() never allocates.  If
+ * a frame has more runs than fit, the rows past the limit are ignored
+ * and get_overflow_count() is incremented; that only happens when the
+ * threshold is badly wrong.
+ *
+ * With tracking on (see set_tracking()), once targets have been found
+ * detect() searches only a window around where they are predicted to be
+ * in the next frame: their bounding boxes, moved by the last frame's
+ * motion and grown by a margin.  If the window comes up empty, or a blob
+ * runs into its edge, the same frame is searched again in full.  Every
+ * sweep_period frames the whole frame is searched anyway, so new targets
+ * are picked up.
+ */
+class Target_Detector {
+private:
+    /** A horizontal run of set mask pixels, [col_begin, col_end). */
+    class Run {
+    public:
+        int row;
+        int col_begin;
+        int col_end;
+    };
+
+    /** The sums for one component, kept at its root run. */
+    class Accum {
+    public:
+        int x_min;
+        int y_min;
+        int x_max;
+        int y_max;
+        int area;
+        int64_t sum_x;
+        int64_t sum_y;
+    };
+
+    int rows;
+    int cols;
+    Yuv_Range range;
+    int min_area;
+
+    // Tracking settings; see set_tracking().
+    bool tracking;
+    int margin;
+    int sweep_period;
+
+    // Tracking state.
+    bool track_valid;           /// result holds the previous frame's blobs
+    float x_velocity;           /// Motion of the largest blob, pixels/frame.
+    float y_velocity;
+    int frames_since_sweep;
+
+    // How often each kind of search ran.
+    int roi_count;
+    int full_count;
+    int sweep_count;
+    int fallback_count;
+
+    uint8_t* mask;          /// rows x cols; mask_step bytes per row
+    int mask_step;
+
+    int max_runs;
+    int run_count;
+    Run* run;
+    int* parent;            /// union-find forest over run indices
+    Accum* accum;
+
+    Target_Result result;   /// The blobs of the most recent detect().
+    int overflow_count;
+    int64_t last_usec;      /// Time taken by the most recent detect().
+    Latency_Histogram time_hist;
+
+    /** Protects latest. */
+    pthread_mutex_t latest_mutex;
+
+    /** A copy of result for other threads; see get_latest(). */
+    Target_Result latest;
+
+    int find(int i);
+    void join(int a, int b);
+
+    /*******************************************************************//*
+     * @brief Append the runs of mask row y to the run array, and join each
+     *        to the runs it touches in the previous row.
+     *
+     * @param [in] y           The row.
+     * @param [in] width       The number of mask columns to scan.
+     * @param [in] prev_begin  Index of the first run of row y - 1.
+     * @param [in] prev_end    One past the last run of row y - 1.
+     * @return False if the run array is full.
+     */
+    bool label_row(const uint8_t* m,
+                   int y,
+                   int x_begin,
+                   int width,
+                   int prev_begin,
+                   int prev_end);
+
+    /*******************************************************************//*
+     * @brief Threshold and label a window of the frame, and fill in
+     *        result.blob.
+     *
+     * The window's left edge and width must be even, since the two pixels
+     * of a macropixel share their chroma.
+     */
+    void search(Yuv422_Order order,
+                const Usb_Frame* frame_ptr,
+                int x_begin,
+                int y_begin,
+                int x_end,
+                int y_end);
+
+    /*******************************************************************//*
+     * @brief Return true if a blob in result touches an edge of the given
+     *        window that isn't also an edge of the frame.
+     */
+    bool blob_at_window_edge(int x_begin, int y_begin,
+                             int x_end, int y_end,
+                             int frame_rows, int frame_cols) const;
+
+    /*******************************************************************//*
+     * @brief Resolve the components and fill in result.
+     */
+    void collect_blobs();
+
+    // Not copyable.
+    Target_Detector(const Target_Detector&);
+    Target_Detector& operator=(const Target_Detector&);
+
+public:
+    Target_Detector();
+    ~Target_Detector();
+
+    /*******************************************************************//*
+     * @brief Allocate storage for frames up to the given size.
+     *
+     * @param [in] rows      The most rows in any frame.
+     * @param [in] cols      The most columns in any frame.
+     * @param [in] range     The color of the targets.
+     * @param [in] min_area  Blobs with fewer pixels are ignored as noise.
+     */
+    void init(int rows, int cols, const Yuv_Range& range, int min_area = 4);
+
+    /*******************************************************************//*
+     * @brief Change the color of the targets.
+     */
+    void set_range(const Yuv_Range& new_range)
+    {
+        range = new_range;
+    }
+
+    /*******************************************************************//*
+     * @brief Find the targets in a packed 4:2:2 frame.
+     *
+     * @param [in] order      The byte order of the frame.
+     * @param [in] frame_ptr  The frame; it is only read.
+     * @return The number of blobs found, at most Target_Result::MAX_BLOBS.
+     */
+    int detect(Yuv422_Order order, const Usb_Frame* frame_ptr);
+
+    /*******************************************************************//*
+     * @brief Turn region-of-interest tracking on or off.
+     *
+     * @param [in] enable        True to search only around the previous
+     *                           frame's targets once some have been found.
+     * @param [in] margin        Pixels added on every side of the
+     *                           predicted target boxes.
+     * @param [in] sweep_period  Search the whole frame at least once in
+     *                           this many frames.
+     */
+    void set_tracking(bool enable, int margin = 16, int sweep_period = 30);
+
+    /*******************************************************************//*
+     * @brief Return the number of frames searched only within a window.
+     */
+    int get_roi_count() const
+    {
+        return roi_count;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of frames searched in full, for any reason.
+     */
+    int get_full_count() const
+    {
+        return full_count;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of full searches made because a periodic
+     *        sweep was due.
+     */
+    int get_sweep_count() const
+    {
+        return sweep_count;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of full searches made because a window
+     *        search lost the track.  These frames are searched twice.
+     */
+    int get_fallback_count() const
+    {
+        return fallback_count;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the blobs found by the most recent detect().  Only the
+     *        thread calling detect() may use this.
+     */
+    const Target_Result& get_result() const
+    {
+        return result;
+    }
+
+    /*******************************************************************//*
+     * @brief Copy the blobs found by the most recent detect().  Safe to
+     *        call from any thread.
+     */
+    void get_latest(Target_Result& latest_out);
+
+    /*******************************************************************//*
+     * @brief Return the mask made by the most recent detect().  After a
+     *        window search, only the window is up to date.
+     */
+    const uint8_t* get_mask() const
+    {
+        return mask;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the bytes per row of get_mask().
+     */
+    int get_mask_step() const
+    {
+        return mask_step;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the time in usec taken by the most recent detect().
+     */
+    int64_t get_last_usec() const
+    {
+        return last_usec;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the histogram of detect() times, in usec.
+     */
+    Latency_Histogram* get_time_histogram()
+    {
+        return &time_hist;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the number of frames that had too many runs to label
+     *        completely.
+     */
+    int get_overflow_count() const
+    {
+        return overflow_count;
+    }
+};
+
+#endif
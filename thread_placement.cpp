@@ -0,0 +1,99 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "thread_placement.h"
+
+static const char* policy_name(int policy)
+{
+    switch (policy) {
+    case SCHED_OTHER: return "OTHER";
+    case SCHED_FIFO: return "FIFO";
+    case SCHED_RR: return "RR";
+    case SCHED_IDLE: return "IDLE";
+    default: return "?";
+    }
+}
+
+// Write the cores in set as a list of ranges, such as "0-1,3".
+static void cpu_set_str(const cpu_set_t& set, int str_bytes, char* str)
+{
+    int len = 0;
+    str[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && len < str_bytes; ++cpu) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set)) ++last;
+        const char* sep = (len == 0) ? "" : ",";
+        if (last == cpu) {
+            len += snprintf(str + len, str_bytes - len, "%s%d", sep, cpu);
+        } else {
+            len += snprintf(str + len, str_bytes - len, "%s%d-%d",
+                            sep, cpu, last);
+        }
+        cpu = last;
+    }
+}
+
+int apply_thread_placement(const Thread_Placement& placement,
+                           const char* cam_name,
+                           const char* stage_name)
+{
+    pthread_t self = pthread_self();
+    int first_err = 0;
+
+    /* Threads inherit the affinity and scheduling class of the thread that
+       created them, so both are always set, even to the defaults. */
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (placement.cpu >= 0) {
+        CPU_SET(placement.cpu, &set);
+    } else {
+        long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+        for (int cpu = 0; cpu < cpu_count && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    int rc = pthread_setaffinity_np(self, sizeof(set), &set);
+    if (rc != 0) {
+        printf("%s %s: can't set cpu %d: %s\n",
+               cam_name, stage_name, placement.cpu, strerror(rc));
+        first_err = rc;
+    }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    if (placement.policy != SCHED_OTHER) {
+        param.sched_priority = placement.priority;
+    }
+    rc = pthread_setschedparam(self, placement.policy, &param);
+    if (rc != 0) {
+        printf("%s %s: can't set SCHED_%s priority %d: %s\n",
+               cam_name, stage_name, policy_name(placement.policy),
+               placement.priority, strerror(rc));
+        if (first_err == 0) first_err = rc;
+    }
+
+    // Log what the thread actually got, which may not be what was asked.
+
+    const int STR_BYTES = 64;
+    char cpus[STR_BYTES];
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(self, sizeof(set), &set) == 0) {
+        cpu_set_str(set, STR_BYTES, cpus);
+    } else {
+        strcpy(cpus, "?");
+    }
+    int policy = SCHED_OTHER;
+    memset(&param, 0, sizeof(param));
+    pthread_getschedparam(self, &policy, &param);
+    printf("%s %s: cpus %s, SCHED_%s priority %d\n",
+           cam_name, stage_name, cpus, policy_name(policy),
+           param.sched_priority);
+    fflush(stdout);
+    return first_err;
+}
@@ -0,0 +1,70 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <sched.h>
+
+/**********************************************************************
+ * @brief The jobs the threads of a camera pipeline do.  Each may be
+ *        placed differently; see Thread_Placement.
+ */
+enum Thread_Role {
+    THREAD_ROLE_CAPTURE,   /// Dequeues frames from the camera.
+    THREAD_ROLE_PROCESS,   /// Decodes, reduces, or searches frames.
+    THREAD_ROLE_DISPLAY,   /// Shows or sends the results.
+    THREAD_ROLE_COUNT
+};
+
+/**********************************************************************
+ * @brief Where a thread runs: which core, and under which scheduling
+ *        class.
+ *
+ * The default leaves the thread as pthread_create(3) made it: free to run
+ * on any core, under SCHED_OTHER.
+ *
+ * Pinning the capture thread to a core of its own, under SCHED_FIFO, keeps
+ * it from being migrated or preempted by the processing and display
+ * threads, so frames are dequeued as soon as the driver has them.
+ * SCHED_FIFO needs root or CAP_SYS_NICE (or an RLIMIT_RTPRIO); without it
+ * the thread keeps its old class and a warning is printed.
+ */
+class Thread_Placement {
+public:
+    int cpu;         /// The core to pin to, or -1 to allow any core.
+    int policy;      /// SCHED_OTHER, SCHED_FIFO, or SCHED_IDLE.
+    int priority;    /// For SCHED_FIFO, 1 (lowest) to 99; else ignored.
+
+    Thread_Placement()
+    : cpu(-1),
+      policy(SCHED_OTHER),
+      priority(0)
+    { }
+
+    Thread_Placement(int arg_cpu, int arg_policy, int arg_priority)
+    : cpu(arg_cpu),
+      policy(arg_policy),
+      priority(arg_priority)
+    { }
+};
+
+/**********************************************************************
+ * @brief Place the calling thread, and log where it actually ended up.
+ *
+ * Each pipeline thread calls this as it starts, so that threads that are
+ * not created with pthread_create(3) (such as cam_thread() morphing into
+ * the capture thread) are handled the same way.  Failures are logged but
+ * are not fatal; the thread runs wherever it was.
+ *
+ * @param [in] placement   Where to run.
+ * @param [in] cam_name    The camera the thread works for, for the log.
+ * @param [in] stage_name  What the thread does, for the log.
+ * @return 0 if the placement was fully applied, else the error number of
+ *         the first part that failed.
+ */
+int apply_thread_placement(const Thread_Placement& placement,
+                           const char* cam_name,
+                           const char* stage_name);
+
+#endif
@@ -14,10 +14,13 @@
 #include <assert.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <exception>
 #include "usb_camera.h"
 #include "frame_queue.h"
+#include "cam_cap_cache.h"
+#include "pipeline_stats.h"
 
 void Usb_Cam_Err_Ioctl::request_name(int request,
                                      size_t name_bytes,
@@ -201,6 +204,9 @@ void Usb_Cam_Err_Ioctl::request_name(int request,
     case VIDIOC_TRY_ENCODER_CMD:
         strncpy(name, "VIDIOC_TRY_ENCODER_CMD", name_bytes);
         break; 
+    case VIDIOC_EXPBUF:
+        strncpy(name, "VIDIOC_EXPBUF", name_bytes);
+        break; 
     default:
         snprintf(name, name_bytes, "request=, %d", request);
         break;
@@ -208,19 +214,24 @@ void Usb_Cam_Err_Ioctl::request_name(int request,
     name[name_bytes-1] = '\0';
 }
 
-void Usb_Camera::init_mmap(int buf_count_arg)
+void Usb_Camera::init_mmap(int buf_count_arg, bool export_dmabuf)
 {
 
     /* Request buffers from the driver. */
 
     struct v4l2_requestbuffers req = {0};
-    if (buf_count_arg > MAX_BUFS) buf_count_arg = MAX_BUFS;
+    if (buf_count_arg < 1) buf_count_arg = 1;
     req.count = buf_count_arg;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_MMAP;
     yioctl(VIDIOC_REQBUFS, &req);
     this->buf_count = req.count;
 
+    /* Allocate one frame and one video buffer per driver buffer. */
+
+    frame = new Usb_Frame[this->buf_count];
+    vbuf = new struct v4l2_buffer[this->buf_count];
+
     /* Create a new Frame_Queue to hold one as many frames as there
        are buffers. */
 
@@ -250,6 +261,24 @@ void Usb_Camera::init_mmap(int buf_count_arg)
         /* Associate the buffer with the frame. */
 
         frame[i].vbuf_ptr = &vbuf[i];
+        frame[i].owner_ptr = this;
+        frame[i].ref_count = 0;
+        frame[i].dmabuf_fd = -1;
+        frame[i].step = this->step;
+        frame[i].pixel_format = this->pixel_format;
+
+        /* Export the buffer as a DMABUF, so consumers can share it without
+           copying. */
+
+        if (export_dmabuf) {
+            struct v4l2_exportbuffer expbuf;
+            memset(&expbuf, 0, sizeof(expbuf));
+            expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            expbuf.index = i;
+            expbuf.flags = O_RDWR | O_CLOEXEC;
+            yioctl(VIDIOC_EXPBUF, &expbuf);
+            frame[i].dmabuf_fd = expbuf.fd;
+        }
 
         /* Push the frame onto the frame queue, so it can be popped later. */
 
@@ -284,19 +313,105 @@ Usb_Frame* Usb_Camera::pop(int& count)
     int r = select(fd+1, &fds, NULL, NULL, &tv);
     if (r < 0) return NULL;  // timeout
 
+    return dequeue(count);
+}
+
+Usb_Frame* Usb_Camera::dequeue(int& count)
+{
     Usb_Frame* frame_ptr = frame_queue_ptr->pop(count);
     if (frame_ptr == NULL) throw Usb_Cam_Err_Unexpected_Empty_Free_List();
- 
-    // Dequeue the vbuf.
 
-    yioctl(VIDIOC_DQBUF, frame_ptr->vbuf_ptr);
+    /* Dequeue the vbuf.  The driver says which buffer it filled; normally
+       that is the oldest one queued, but don't depend on it. */
+
+    struct v4l2_buffer buf = zero_v4l2_buffer();
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    yioctl(VIDIOC_DQBUF, &buf);
+    int64_t dequeue_nsec = monotonic_nsec();
+    assert((int)buf.index < buf_count);
+    frame_ptr = &frame[buf.index];
+    vbuf[buf.index] = buf;
+    frame_ptr->ref_count = 1;
+    frame_ptr->dequeue_nsec = dequeue_nsec;
+
+    /* Move the timestamp to the monotonic clock, once.  A copied timestamp
+       is whatever the buffer was queued with, not a capture time. */
+
+    int64_t stamp = ((int64_t)buf.timestamp.tv_sec * 1000000 +
+                     buf.timestamp.tv_usec) * 1000;
+    uint32_t clock = buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK;
+    frame_ptr->timestamp_known = (clock != V4L2_BUF_FLAG_TIMESTAMP_COPY);
+    if (clock == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        frame_ptr->timestamp_nsec = stamp;
+    } else if (clock == V4L2_BUF_FLAG_TIMESTAMP_COPY) {
+        frame_ptr->timestamp_nsec = dequeue_nsec;
+    } else {
+
+        // Older drivers stamp frames with the wall clock.
+
+        struct timespec real, mono;
+        clock_gettime(CLOCK_REALTIME, &real);
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        frame_ptr->timestamp_nsec = stamp +
+                ((int64_t)mono.tv_sec - real.tv_sec) * 1000000000 +
+                (mono.tv_nsec - real.tv_nsec);
+    }
 
     frame_ptr->rows = this->rows;
     frame_ptr->cols = this->cols;
+    frame_ptr->step = this->step;
+    frame_ptr->pixel_format = this->pixel_format;
     return frame_ptr;
 }
   
 
+bool Usb_Frame::get_view(Gray_View& view) const
+{
+    if (pixel_format != V4L2_PIX_FMT_GREY) return false;
+    view.data = img_data;
+    view.rows = rows;
+    view.cols = cols;
+    view.step = step;
+    return true;
+}
+
+bool Usb_Frame::get_view(Yuv422_View& view) const
+{
+    if (pixel_format == V4L2_PIX_FMT_YUYV) {
+        view.order = YUV422_YUYV;
+    } else if (pixel_format == V4L2_PIX_FMT_UYVY) {
+        view.order = YUV422_UYVY;
+    } else {
+        return false;
+    }
+    view.data = img_data;
+    view.rows = rows;
+    view.cols = cols;
+    view.step = step;
+    return true;
+}
+
+bool Usb_Frame::get_view(Bgr_View& view) const
+{
+    if (pixel_format != V4L2_PIX_FMT_BGR24) return false;
+    view.data = img_data;
+    view.rows = rows;
+    view.cols = cols;
+    view.step = step;
+    return true;
+}
+
+bool Usb_Frame::get_view(Compressed_View& view) const
+{
+    if (packed_pixel_bytes(pixel_format) != 0) return false;
+    view.data = img_data;
+    view.bytes = vbuf_ptr->bytesused;
+    view.pixel_format = pixel_format;
+    return true;
+}
+
+
 void Usb_Camera::set_format_and_frame_size(int format_id,
                                            int arg_rows,
                                            int arg_cols)
@@ -316,6 +431,17 @@ void Usb_Camera::set_format_and_frame_size(int format_id,
 
     this->cols = fmt.fmt.pix.width;
     this->rows = fmt.fmt.pix.height;
+
+    // The driver may pick another format than asked, and may pad rows.
+
+    this->pixel_format = fmt.fmt.pix.pixelformat;
+    int pixel_bytes = packed_pixel_bytes(this->pixel_format);
+    this->step = fmt.fmt.pix.bytesperline;
+    if (pixel_bytes == 0) {
+        this->step = 0;
+    } else if (this->step < this->cols * pixel_bytes) {
+        this->step = this->cols * pixel_bytes;
+    }
     if (format_id > 0) this->fmt_current = format_id;
 
     /*
@@ -343,6 +469,14 @@ int Usb_Camera::get_format(int format_id,
     return return_format_id;
 }
 
+int Usb_Camera::find_format(uint32_t pixel_format) const
+{
+    for (int i = 0; i < this->fmt_count; ++i) {
+        if (fmt_desc[i].pixelformat == pixel_format) return i;
+    }
+    return -1;
+}
+
 
 const char* Usb_Camera::format_str(const struct v4l2_fmtdesc& fmt_desc,
                                    size_t bytes,
@@ -399,6 +533,21 @@ int Usb_Camera::get_supported_frame_sizes(
 {
     const struct v4l2_fmtdesc* fmt_desc_ptr;
     format_id = get_format(format_id, fmt_desc_ptr);
+
+    // Take them from the cache if it knows them.
+
+    const Cam_Caps::Size_List* list_ptr = NULL;
+    if (caps_ptr != NULL) {
+        list_ptr = caps_ptr->find_sizes(fmt_desc_ptr->pixelformat);
+        cap_cache_ptr->count(list_ptr != NULL);
+    }
+    if (list_ptr != NULL) {
+        size_t count = list_ptr->count;
+        if (count > size) count = size;
+        memcpy(frm_size, list_ptr->size, count * sizeof(frm_size[0]));
+        return count;
+    }
+
     unsigned int i = 0;
     while (1) {
         if ((size_t)i >= size) break;
@@ -412,6 +561,19 @@ int Usb_Camera::get_supported_frame_sizes(
         }
         ++i;
     }
+
+    // Remember them, if we have them all and they fit.
+
+    if (caps_ptr != NULL && (size_t)i < size &&
+        (int)i <= Cam_Caps::MAX_SIZES &&
+        caps_ptr->size_list_count < Cam_Caps::MAX_FORMATS) {
+        Cam_Caps::Size_List& list =
+            caps_ptr->size_list[caps_ptr->size_list_count++];
+        list.pixel_format = fmt_desc_ptr->pixelformat;
+        list.count = i;
+        memcpy(list.size, frm_size, i * sizeof(frm_size[0]));
+        cap_cache_ptr->mark_dirty();
+    }
     return i;
 }
 
@@ -441,6 +603,26 @@ int Usb_Camera::get_supported_frame_intervals(
     const struct v4l2_fmtdesc* fmt_desc_ptr;
     format_id = get_format(format_id, fmt_desc_ptr);
 
+    // Take the adjusted size and the intervals from the cache if it knows
+    // them.
+
+    int req_rows = arg_rows;
+    int req_cols = arg_cols;
+    const Cam_Caps::Ival_List* list_ptr = NULL;
+    if (caps_ptr != NULL) {
+        list_ptr = caps_ptr->find_ivals(fmt_desc_ptr->pixelformat,
+                                        req_rows, req_cols);
+        cap_cache_ptr->count(list_ptr != NULL);
+    }
+    if (list_ptr != NULL) {
+        arg_rows = list_ptr->rows;
+        arg_cols = list_ptr->cols;
+        size_t count = list_ptr->count;
+        if (count > size) count = size;
+        memcpy(frm_ival, list_ptr->ival, count * sizeof(frm_ival[0]));
+        return count;
+    }
+
     // Verify image size
     struct v4l2_format fmt = {(v4l2_buf_type)0};
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -471,13 +653,39 @@ int Usb_Camera::get_supported_frame_intervals(
         }
         ++i;
     }
+
+    // Remember them, if we have them all and they fit.
+
+    if (caps_ptr != NULL && (size_t)i < size &&
+        (int)i <= Cam_Caps::MAX_IVALS &&
+        caps_ptr->ival_list_count < Cam_Caps::MAX_MODES) {
+        Cam_Caps::Ival_List& list =
+            caps_ptr->ival_list[caps_ptr->ival_list_count++];
+        list.pixel_format = fmt_desc_ptr->pixelformat;
+        list.req_rows = req_rows;
+        list.req_cols = req_cols;
+        list.rows = arg_rows;
+        list.cols = arg_cols;
+        list.count = i;
+        memcpy(list.ival, frm_ival, i * sizeof(frm_ival[0]));
+        cap_cache_ptr->mark_dirty();
+    }
     return i;
 }
 
 
 Usb_Camera::Usb_Camera()
 : fd(-1),
-  frame_queue_ptr(NULL)
+  buf_count(0),
+  step(0),
+  pixel_format(0),
+  frame(NULL),
+  vbuf(NULL),
+  fmt_count(0),
+  fmt_desc(NULL),
+  frame_queue_ptr(NULL),
+  cap_cache_ptr(NULL),
+  caps_ptr(NULL)
 { }
 
 Usb_Camera::~Usb_Camera()
@@ -489,33 +697,63 @@ void Usb_Camera::deinit()
 {
     if (this->fd < 0) return;
     for (int i = 0; i < buf_count; ++i) {
+        if (frame[i].dmabuf_fd >= 0) close(frame[i].dmabuf_fd);
         munmap(frame[i].img_data, buf_bytes);
     }
     close(this->fd);
     this->fd = -1;
     delete frame_queue_ptr;
+    frame_queue_ptr = NULL;
+    delete[] frame;
+    frame = NULL;
+    delete[] vbuf;
+    vbuf = NULL;
+    buf_count = 0;
+    delete[] fmt_desc;
+    fmt_desc = NULL;
+    fmt_count = 0;
+    caps_ptr = NULL;
 }
 
 
-void Usb_Camera::init(const char* device_name,
-                      int format_id,
-                      int arg_rows,
-                      int arg_cols,
-                      int arg_buf_count)
+void Usb_Camera::init_formats()
 {
-    deinit();
-    this->fd = open(device_name, O_RDWR);
-    if (this->fd == -1) {
-        throw Usb_Cam_Err_Cant_Open_Device(device_name, errno);
+
+    // Identify the device, and take its formats from the cache if it
+    // knows them.
+
+    caps_ptr = NULL;
+    if (cap_cache_ptr != NULL) {
+        struct v4l2_capability cap;
+        memset(&cap, 0, sizeof(cap));
+        yioctl(VIDIOC_QUERYCAP, &cap);
+        caps_ptr = cap_cache_ptr->lookup(cap);
+        cap_cache_ptr->count(caps_ptr != NULL && caps_ptr->fmt_count > 0);
+    }
+    if (caps_ptr != NULL && caps_ptr->fmt_count > 0) {
+        this->fmt_count = caps_ptr->fmt_count;
+        this->fmt_desc = new struct v4l2_fmtdesc[this->fmt_count];
+        memcpy(this->fmt_desc, caps_ptr->fmt_desc,
+               this->fmt_count * sizeof(*this->fmt_desc));
+        return;
     }
-    strncpy(this->dev_name, device_name, FILENAME_MAX);
-    this->fmt_current = 0;
 
-    // Ennumerate supported image formats to this->fmt_desc array.
+    // Not in the cache, so ennumerate supported image formats to
+    // this->fmt_desc array, growing the array as needed.
 
+    int fmt_capacity = 0;
     unsigned int i = 0;
     while (1) {
-        if ((int)i >= MAX_FMTS) break;
+        if ((int)i >= fmt_capacity) {
+            int new_capacity = (fmt_capacity == 0) ? 8 : 2 * fmt_capacity;
+            struct v4l2_fmtdesc* new_desc =
+                new struct v4l2_fmtdesc[new_capacity];
+            memcpy(new_desc, this->fmt_desc, i * sizeof(*new_desc));
+            delete[] this->fmt_desc;
+            this->fmt_desc = new_desc;
+            fmt_capacity = new_capacity;
+        }
+        memset(&this->fmt_desc[i], 0, sizeof(this->fmt_desc[i]));
         this->fmt_desc[i].type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         this->fmt_desc[i].index = i;
         try {
@@ -527,7 +765,48 @@ void Usb_Camera::init(const char* device_name,
     }
     this->fmt_count = i;
 
+    // Remember them, if they fit.
+
+    if (caps_ptr != NULL && i > 0 && (int)i <= Cam_Caps::MAX_FORMATS) {
+        caps_ptr->fmt_count = i;
+        memcpy(caps_ptr->fmt_desc, this->fmt_desc,
+               i * sizeof(*this->fmt_desc));
+        cap_cache_ptr->mark_dirty();
+    }
+}
+
+
+void Usb_Camera::open_device(const char* device_name)
+{
+    deinit();
+    this->fd = open(device_name, O_RDWR);
+    if (this->fd == -1) {
+        throw Usb_Cam_Err_Cant_Open_Device(device_name, errno);
+    }
+    strncpy(this->dev_name, device_name, FILENAME_MAX);
+    this->fmt_current = 0;
+
+    init_formats();
+}
+
+
+void Usb_Camera::init(const char* device_name,
+                      int format_id,
+                      int arg_rows,
+                      int arg_cols,
+                      int arg_buf_count,
+                      bool export_dmabuf)
+{
+
+    // A device already open_device()ed, with no buffers yet, needn't be
+    // opened and enumerated again.
+
+    if (this->fd < 0 || buf_count > 0 ||
+        strcmp(this->dev_name, device_name) != 0) {
+        open_device(device_name);
+    }
+
     //set_format_and_frame_size(2, 480, 640);
     set_format_and_frame_size(format_id, arg_rows, arg_cols);
-    init_mmap(arg_buf_count);
+    init_mmap(arg_buf_count, export_dmabuf);
 }
@@ -17,7 +17,8 @@
 #include <assert.h>
 #include <linux/videodev2.h>
 
-#include "any_frame_queue.h"
+#include "any_camera.h"
+#include "image_view.h"
 
 /**********************************************************************//**
  * @brief Base class for any exception thrown by this module.
@@ -134,12 +135,16 @@ public:
 
 
 class Usb_Camera;
+class Cam_Cap_Cache;
+class Cam_Caps;
 
 /**********************************************************************//**
  * @brief Represents a frame captured by a Usb_Camera.
  */
 class Usb_Frame {
     friend class Usb_Camera;
+    friend class Sim_Camera;
+    friend class Mjpeg_Decoder;
 private:
 
     /** Identifies the buffer information for this frame used by the driver. */
@@ -147,6 +152,20 @@ private:
     uint8_t* img_data; /// Points to the first pixel of the image.
     int rows;          /// The number of rows in the image.
     int cols;          /// The number of colums in the image.
+    int step;          /// Bytes per row, or 0 for compressed formats.
+    uint32_t pixel_format;  /// V4L2_PIX_FMT_XXXX
+    int dmabuf_fd;     /// The exported DMABUF of the buffer, or -1.
+    int64_t dequeue_nsec;  /// monotonic_nsec() when the frame was dequeued.
+    int64_t timestamp_nsec;  /// See get_timestamp_nsec().
+    bool timestamp_known;    /// See is_timestamp_known().
+
+    /** The number of outstanding references to this frame.  See add_ref()
+        and release(). */
+    int ref_count;
+
+    /** The camera that owns this frame; release() gives the frame back to
+        it. */
+    Any_Frame_Queue* owner_ptr;
 
     /**********************************************************************//**
      * @brief Construct a NULL frame.
@@ -157,19 +176,132 @@ private:
     : vbuf_ptr(NULL),
       img_data(NULL),
       rows(0),
-      cols(0)
+      cols(0),
+      step(0),
+      pixel_format(0),
+      dmabuf_fd(-1),
+      dequeue_nsec(0),
+      timestamp_nsec(0),
+      timestamp_known(false),
+      ref_count(0),
+      owner_ptr(NULL)
     { }
 
 public:
 
     /**********************************************************************//**
-     * @brief Return the time at which this frame was captured.
+     * @brief Return a file descriptor for the DMABUF exported for this
+     *        frame's buffer, or -1 if the camera did not export one.
+     *
+     * The descriptor may be passed to other devices or processes (a
+     * hardware encoder, for example) to share the image without copying
+     * it.  It remains owned by the camera; do not close it.
+     */
+    int get_dmabuf_fd() const
+    {
+        return dmabuf_fd;
+    }
+
+    /**********************************************************************//**
+     * @brief Add references to this frame.
+     *
+     * A frame returned by a camera's pop() holds one reference.  Anyone
+     * who shares the frame with another consumer adds a reference for it;
+     * each consumer calls release() when done.  Consumers that know they
+     * hold the only reference may instead push the frame straight back to
+     * the camera, as before.
+     *
+     * @param [in] count  The number of references to add.
+     */
+    void add_ref(int count = 1)
+    {
+        __atomic_add_fetch(&ref_count, count, __ATOMIC_RELAXED);
+    }
+
+    /**********************************************************************//**
+     * @brief Drop one reference to this frame.  When the last reference is
+     *        dropped, the frame is pushed back to the camera that owns it,
+     *        so its buffer can be refilled.
+     *
+     * @return The number of references that remain.
+     */
+    int release()
+    {
+        int count = __atomic_sub_fetch(&ref_count, 1, __ATOMIC_ACQ_REL);
+        if (count == 0) owner_ptr->push(this);
+        return count;
+    }
+
+    /**********************************************************************//**
+     * @brief Return the number of outstanding references to this frame.
+     */
+    int get_ref_count() const
+    {
+        return __atomic_load_n(&ref_count, __ATOMIC_RELAXED);
+    }
+
+    /**********************************************************************//**
+     * @brief Return the time at which this frame was captured, as the
+     *        driver gave it.
+     *
+     * Which clock this is depends on the driver; see get_flags().  Prefer
+     * get_timestamp_nsec().
      */
     struct timeval get_timestamp() const
     {
         return vbuf_ptr->timestamp;
     }
 
+    /**********************************************************************//**
+     * @brief Return the time at which this frame was captured, on the
+     *        CLOCK_MONOTONIC clock, in nanoseconds.
+     *
+     * This is worked out once, when the frame is dequeued.  Drivers that
+     * set V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC already use that clock.  Older
+     * drivers use the wall clock; their timestamps are moved to the
+     * monotonic clock by the two clocks' offset at dequeue, which is only
+     * wrong if the wall clock was stepped in between.  Drivers that set
+     * V4L2_BUF_FLAG_TIMESTAMP_COPY give no capture time at all; their
+     * frames are stamped with get_dequeue_nsec() instead, and
+     * is_timestamp_known() returns false.
+     */
+    int64_t get_timestamp_nsec() const
+    {
+        return timestamp_nsec;
+    }
+
+    /**********************************************************************//**
+     * @brief Return false if the driver gave no capture time, so
+     *        get_timestamp_nsec() is only the time of dequeue.
+     */
+    bool is_timestamp_known() const
+    {
+        return timestamp_known;
+    }
+
+    /**********************************************************************//**
+     * @brief Return the time at which this frame was dequeued from the
+     *        driver, on the CLOCK_MONOTONIC clock, in nanoseconds.
+     *
+     * So get_dequeue_nsec() - get_timestamp_nsec() is the time from
+     * capture to dequeue.
+     */
+    int64_t get_dequeue_nsec() const
+    {
+        return dequeue_nsec;
+    }
+
+    /**********************************************************************//**
+     * @brief Return the V4L2_BUF_FLAG_XXXX flags of this frame's buffer.
+     *
+     * The V4L2_BUF_FLAG_TIMESTAMP_MASK bits tell which clock
+     * get_timestamp() was taken from.
+     */
+    uint32_t get_flags() const
+    {
+        return vbuf_ptr->flags;
+    }
+
     /**********************************************************************//**
      * @brief Return the frame number.
      *
@@ -182,6 +314,29 @@ public:
         return vbuf_ptr->sequence;
     }
 
+    /**********************************************************************//**
+     * @brief Return the index of this frame's buffer within its camera,
+     *        from 0 to get_buf_count() - 1.
+     *
+     * The index stays the same each time the buffer is reused, so it can
+     * key storage kept alongside each buffer.
+     */
+    int get_buf_index() const
+    {
+        return vbuf_ptr->index;
+    }
+
+    /**********************************************************************//**
+     * @brief Return the number of bytes of image data in this frame.
+     *
+     * For uncompressed formats this is the size of the whole image; for
+     * compressed formats such as MJPEG it varies from frame to frame.
+     */
+    uint32_t get_bytes_used() const
+    {
+        return vbuf_ptr->bytesused;
+    }
+
     /**********************************************************************//**
      * @brief Return the number of rows in this image.
      */
@@ -198,6 +353,40 @@ public:
         return cols;
     }
 
+    /**********************************************************************//**
+     * @brief Return the bytes from the start of one row of this image to
+     *        the start of the next (the driver's bytesperline), or 0 for
+     *        compressed formats.
+     *
+     * This may be more than the width of a row; don't assume rows are
+     * packed.
+     */
+    int get_step() const
+    {
+        return step;
+    }
+
+    /**********************************************************************//**
+     * @brief Return the fourcc code (V4L2_PIX_FMT_XXXX) of this image.
+     */
+    uint32_t get_pixel_format() const
+    {
+        return pixel_format;
+    }
+
+    /**********************************************************************//**
+     * @brief Fill in a view of this image, without copying it.
+     *
+     * The view is valid only while this frame is held.
+     *
+     * @return False, leaving view unchanged, if this image's pixel format
+     *         is not the kind the view describes.
+     */
+    bool get_view(Gray_View& view) const;
+    bool get_view(Yuv422_View& view) const;
+    bool get_view(Bgr_View& view) const;
+    bool get_view(Compressed_View& view) const;
+
     /**********************************************************************//**
      * @brief Return a pointer to the first pixel in the image.
      * 
@@ -211,23 +400,25 @@ public:
 };
     
     
-class Usb_Camera : public Any_Frame_Queue {
-    static const int MAX_BUFS = 5;
-    static const int MAX_FMTS = 5;
+class Usb_Camera : public Any_Camera {
     int fd;                            /// handle for the USB camera device
 private:
     int buf_count;                     /// size of frame and vbuf arrays
     int buf_bytes;                     /// size of each image buffer
     int rows;
     int cols;
-    Usb_Frame frame[MAX_BUFS];         /// space for the images
-    struct v4l2_buffer vbuf[MAX_BUFS]; /// space for the video buffers
+    int step;                          /// bytes per row, from VIDIOC_S_FMT
+    uint32_t pixel_format;             /// the format VIDIOC_S_FMT set
+    Usb_Frame* frame;                  /// space for the images
+    struct v4l2_buffer* vbuf;          /// space for the video buffers
     Usb_Frame* free_head_ptr;          /// points to next available Usb_Frame
     char dev_name[FILENAME_MAX];
     int fmt_count;
     int fmt_current;
-    struct v4l2_fmtdesc fmt_desc[MAX_FMTS];
+    struct v4l2_fmtdesc* fmt_desc;     /// fmt_count supported formats
     Any_Frame_Queue* frame_queue_ptr;
+    Cam_Cap_Cache* cap_cache_ptr;      /// see set_cap_cache(), or NULL
+    Cam_Caps* caps_ptr;                /// this device's entry, or NULL
 
     /*******************************************************************//*
      * @brief Make a call to system ioctl(2) with error checking.
@@ -258,13 +449,21 @@ private:
      * Allocate space for the specified number of video buffers.
      *
      * @param [in] buf_count  The number of buffers to use in processing.
-     *                        If this number exceeds MAX_BUFS, or exceeds the
-     *                        capacity of the device, a smaller number will
-     *                        be used.  For the actual number in use call
+     *                        The frame and vbuf arrays are allocated to
+     *                        match.  If this number exceeds the capacity
+     *                        of the device, a smaller number will be
+     *                        used.  For the actual number in use call
      *                        get_buf_count().
-     *                        
+     * @param [in] export_dmabuf True to export each buffer as a DMABUF.
+     */
+    void init_mmap(int buf_count, bool export_dmabuf);
+
+
+    /*******************************************************************//*
+     * @brief Fill this->fmt_desc with the supported image formats, from
+     *        the capability cache if it knows them, else from the device.
      */
-    void init_mmap(int buf_count);
+    void init_formats();
 
 
     /*******************************************************************//*
@@ -290,10 +489,38 @@ public:
     ~Usb_Camera();
 
 
+    /*******************************************************************//*
+     * @brief Use the given cache for what the device supports, so a
+     *        restart needn't ask it again.
+     *
+     * Call before init().  The cache must outlive this camera's init(),
+     * get_supported_frame_sizes() and get_supported_frame_intervals()
+     * calls; save it once they are done.  NULL stops using it.
+     */
+    void set_cap_cache(Cam_Cap_Cache* new_cap_cache_ptr)
+    {
+        cap_cache_ptr = new_cap_cache_ptr;
+    }
+
+
+    /*******************************************************************//*
+     * @brief Open the camera device and read its formats, without choosing
+     *        one or allocating buffers.
+     *
+     * The camera can then be asked what it supports, for example by
+     * Mode_Planner, before init() sets it up.  Throws
+     * Usb_Cam_Err_Cant_Open_Device if the device can't be opened.
+     *
+     * @param [in] device_name The name of the device to open on the filesystem,
+     *                         for example, "/dev/video10".
+     */
+    void open_device(const char* device_name);
+
+
     /*******************************************************************//*
      * @brief Initialize the camera.
      *
-     * Open the camera device.
+     * Open the camera device, unless open_device() has just opened it.
      * Allocate space for the specified number of video buffers.
      *
      * @param [in] device_name The name of the device to open on the filesystem,
@@ -302,16 +529,22 @@ public:
      * @param [in] rows        Specifies the number of rows in the image.
      * @param [in] cols        Specifies the number of columns in the image.
      * @param [in] buf_count   The number of buffers to use in processing.
-     *                         If this number exceeds MAX_BUFS, or exceeds the
-     *                         capacity of the device, a smaller number will
-     *                         be used.  For the actual number in use call
-     *                         get_buf_count().
+     *                         There is no fixed upper limit; more buffers
+     *                         absorb more processing jitter before the
+     *                         driver starts dropping frames.  If this
+     *                         number exceeds the capacity of the device,
+     *                         a smaller number will be used.  For the
+     *                         actual number in use call get_buf_count().
+     * @param [in] export_dmabuf True to export every buffer as a DMABUF
+     *                         (VIDIOC_EXPBUF); see
+     *                         Usb_Frame::get_dmabuf_fd().
      */
     void init(const char* device_name,
               int format_id = 0,
               int rows = 480,
               int cols = 640,
-              int buf_count = 1);
+              int buf_count = 1,
+              bool export_dmabuf = false);
 
     
     /*******************************************************************//*
@@ -324,7 +557,7 @@ public:
      * @brief Return the device_name passed into the constuctor call that
      *        created this Usb_Camera.
      */
-    const char* get_device_name()
+    virtual const char* get_device_name() const
     {
         return dev_name;
     }
@@ -342,6 +575,16 @@ public:
         return fmt_current;
     }
 
+
+    /*******************************************************************//*
+     * @brief Return the fourcc code (V4L2_PIX_FMT_XXXX) of the format the
+     *        camera is currently producing.
+     */
+    virtual uint32_t get_pixel_format() const
+    {
+        return pixel_format;
+    }
+
     /*******************************************************************//*
      * @brief Get a description of the specified image format.
      *
@@ -360,6 +603,13 @@ public:
                    const struct v4l2_fmtdesc*& desc_ptr) const;
 
 
+    /*******************************************************************//*
+     * @brief Return the format_id of the supported format with the given
+     *        fourcc code (V4L2_PIX_FMT_XXXX), or -1 if there is none.
+     */
+    int find_format(uint32_t pixel_format) const;
+
+
     /*******************************************************************//*
      * @brief Fill the given string with a human-readable description of
      *        the given camera format.
@@ -473,7 +723,7 @@ public:
     /*******************************************************************//*
      * @brief Return the number of video buffers in use by the driver.
      */
-    int get_buf_count() const { return buf_count; };
+    virtual int get_buf_count() const { return buf_count; };
 
 
     /*******************************************************************//*
@@ -481,7 +731,7 @@ public:
      *
      * This must be called before the first call to frame_capture().
      */
-    void stream_start()
+    virtual void stream_start()
     {
         uint32_t type = vbuf[0].type;
 printf("stream_start %d %d %d\n", this->fd, VIDIOC_STREAMON, type);
@@ -492,12 +742,36 @@ printf("stream_start %d %d %d\n", this->fd, VIDIOC_STREAMON, type);
     /*******************************************************************//*
      * @brief Stop the video stream.
      */
-    void stream_stop()
+    virtual void stream_stop()
     {
         uint32_t type = vbuf[0].type;
         yioctl(VIDIOC_STREAMOFF, &type);
     }
 
+    /*******************************************************************//*
+     * @brief Return the file descriptor of the open device, or -1.
+     *
+     * The descriptor becomes readable when a captured frame is ready to be
+     * dequeued.  It may be passed to select(2), poll(2) or epoll(7).
+     */
+    int get_fd() const
+    {
+        return fd;
+    }
+
+    /*******************************************************************//*
+     * @brief Return the next captured frame, without waiting for one.
+     *
+     * Call this only when get_fd() is known to be readable; otherwise it
+     * blocks until the driver has a frame.
+     *
+     * @param [out] count  Returns the number of buffers still queued to the
+     *                     driver.
+     * @return The frame from whence an image may be derived.  Errors result
+     *         in exceptions being thrown.
+     */
+    Usb_Frame* dequeue(int& count);
+
     /*******************************************************************//*
      * @brief Capture the next frame and return it.
      *
@@ -521,12 +795,12 @@ printf("stream_start %d %d %d\n", this->fd, VIDIOC_STREAMON, type);
      */
     virtual int push(Usb_Frame* frame_ptr);
 
-    int get_rows() const
+    virtual int get_rows() const
     {
         return rows;
     }
 
-    int get_cols() const
+    virtual int get_cols() const
     {
         return cols;
     }
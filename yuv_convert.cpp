@@ -0,0 +1,806 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#include <stdint.h>
+#include "yuv_convert.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define YUV_CONVERT_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define YUV_CONVERT_SSE2
+#include <emmintrin.h>
+#ifdef __AVX2__
+#define YUV_CONVERT_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+/* Every row kernel below converts as many leading pixels of one row as it
+   can, and returns the number of columns it converted.  The caller
+   finishes the row with the scalar kernel. */
+
+static inline uint8_t clamp_u8(int x)
+{
+    if (x < 0) return 0;
+    if (x > 255) return 255;
+    return (uint8_t)x;
+}
+
+// Convert one pixel; see the equations in yuv_convert.h.
+static inline void yuv_to_bgr_pixel(int y, int u, int v, uint8_t* bgr)
+{
+    int c = (y - 16) * 74;
+    int d = u - 128;
+    int e = v - 128;
+    bgr[0] = clamp_u8((c + 129 * d + 32) >> 6);
+    bgr[1] = clamp_u8((c - 25 * d - 52 * e + 32) >> 6);
+    bgr[2] = clamp_u8((c + 102 * e + 32) >> 6);
+}
+
+static void bgr_row_scalar(Yuv422_Order order,
+                           const uint8_t* src,
+                           uint8_t* dst,
+                           int col_begin,
+                           int cols)
+{
+    // Offsets of Y0, U, Y1, V within each 4 byte macropixel.
+    int y0 = (order == YUV422_YUYV) ? 0 : 1;
+    int u = (order == YUV422_YUYV) ? 1 : 0;
+    for (int col = col_begin; col < cols; col += 2) {
+        const uint8_t* m = src + 2 * col;
+        yuv_to_bgr_pixel(m[y0], m[u], m[u + 2], dst + 3 * col);
+        yuv_to_bgr_pixel(m[y0 + 2], m[u], m[u + 2], dst + 3 * col + 3);
+    }
+}
+
+static void gray_row_scalar(Yuv422_Order order,
+                            const uint8_t* src,
+                            uint8_t* dst,
+                            int col_begin,
+                            int cols)
+{
+    const uint8_t* y = src + ((order == YUV422_YUYV) ? 0 : 1);
+    for (int col = col_begin; col < cols; ++col) {
+        dst[col] = y[2 * col];
+    }
+}
+
+static inline bool in_range(int x, int min, int max)
+{
+    return x >= min && x <= max;
+}
+
+static void threshold_row_scalar(Yuv422_Order order,
+                                 const uint8_t* src,
+                                 const Yuv_Range& r,
+                                 uint8_t* dst,
+                                 int col_begin,
+                                 int cols)
+{
+    int y0 = (order == YUV422_YUYV) ? 0 : 1;
+    int u = (order == YUV422_YUYV) ? 1 : 0;
+    for (int col = col_begin; col < cols; col += 2) {
+        const uint8_t* m = src + 2 * col;
+        bool chroma_ok = in_range(m[u], r.u_min, r.u_max) &&
+                         in_range(m[u + 2], r.v_min, r.v_max);
+        dst[col] = (chroma_ok && in_range(m[y0], r.y_min, r.y_max)) ?
+                   255 : 0;
+        dst[col + 1] = (chroma_ok &&
+                        in_range(m[y0 + 2], r.y_min, r.y_max)) ? 255 : 0;
+    }
+}
+
+// Average each 2x2 block of luma from rows src0 and src1.
+static void luma_half_row_scalar(Yuv422_Order order,
+                                 const uint8_t* src0,
+                                 const uint8_t* src1,
+                                 uint8_t* dst,
+                                 int col_begin,
+                                 int dst_cols)
+{
+    int y0 = (order == YUV422_YUYV) ? 0 : 1;
+    for (int col = col_begin; col < dst_cols; ++col) {
+        const uint8_t* a = src0 + 4 * col + y0;
+        const uint8_t* b = src1 + 4 * col + y0;
+        dst[col] = (a[0] + a[2] + b[0] + b[2] + 2) >> 2;
+    }
+}
+
+// Average each 2x2 block of gray from rows src0 and src1.
+static void gray_half_row_scalar(const uint8_t* src0,
+                                 const uint8_t* src1,
+                                 uint8_t* dst,
+                                 int col_begin,
+                                 int dst_cols)
+{
+    for (int col = col_begin; col < dst_cols; ++col) {
+        const uint8_t* a = src0 + 2 * col;
+        const uint8_t* b = src1 + 2 * col;
+        dst[col] = (a[0] + a[1] + b[0] + b[1] + 2) >> 2;
+    }
+}
+
+#if defined(YUV_CONVERT_NEON)
+
+const char* yuv_convert_simd_name()
+{
+    return "NEON";
+}
+
+// Convert 8 pixels that share the given chroma.
+static inline void neon_bgr8(uint8x8_t y,
+                             int16x8_t d,
+                             int16x8_t e,
+                             uint8x8_t& b,
+                             uint8x8_t& g,
+                             uint8x8_t& r)
+{
+    int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(y));
+    c = vmulq_n_s16(vsubq_s16(c, vdupq_n_s16(16)), 74);
+    int16x8_t round = vdupq_n_s16(32);
+    int16x8_t bb = vqaddq_s16(vqaddq_s16(c, vmulq_n_s16(d, 129)), round);
+    int16x8_t gg = vqaddq_s16(vqsubq_s16(vqsubq_s16(c, vmulq_n_s16(d, 25)),
+                                         vmulq_n_s16(e, 52)),
+                              round);
+    int16x8_t rr = vqaddq_s16(vqaddq_s16(c, vmulq_n_s16(e, 102)), round);
+    b = vqmovun_s16(vshrq_n_s16(bb, 6));
+    g = vqmovun_s16(vshrq_n_s16(gg, 6));
+    r = vqmovun_s16(vshrq_n_s16(rr, 6));
+}
+
+static int bgr_row_simd(Yuv422_Order order,
+                        const uint8_t* src,
+                        uint8_t* dst,
+                        int cols)
+{
+    int col = 0;
+    for (; col + 16 <= cols; col += 16) {
+
+        // De-interleave 8 macropixels (16 pixels) into 4 lanes.
+
+        uint8x8x4_t m = vld4_u8(src + 2 * col);
+        uint8x8_t y0, y1, u, v;
+        if (order == YUV422_YUYV) {
+            y0 = m.val[0]; u = m.val[1]; y1 = m.val[2]; v = m.val[3];
+        } else {
+            u = m.val[0]; y0 = m.val[1]; v = m.val[2]; y1 = m.val[3];
+        }
+        int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u)),
+                                vdupq_n_s16(128));
+        int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)),
+                                vdupq_n_s16(128));
+        uint8x8_t b0, g0, r0, b1, g1, r1;
+        neon_bgr8(y0, d, e, b0, g0, r0);
+        neon_bgr8(y1, d, e, b1, g1, r1);
+
+        // Re-interleave even and odd pixels, then store as BGR triples.
+
+        uint8x8x2_t bz = vzip_u8(b0, b1);
+        uint8x8x2_t gz = vzip_u8(g0, g1);
+        uint8x8x2_t rz = vzip_u8(r0, r1);
+        uint8x16x3_t out;
+        out.val[0] = vcombine_u8(bz.val[0], bz.val[1]);
+        out.val[1] = vcombine_u8(gz.val[0], gz.val[1]);
+        out.val[2] = vcombine_u8(rz.val[0], rz.val[1]);
+        vst3q_u8(dst + 3 * col, out);
+    }
+    return col;
+}
+
+static int gray_row_simd(Yuv422_Order order,
+                         const uint8_t* src,
+                         uint8_t* dst,
+                         int cols)
+{
+    int col = 0;
+    int lane = (order == YUV422_YUYV) ? 0 : 1;
+    for (; col + 16 <= cols; col += 16) {
+        uint8x16x2_t m = vld2q_u8(src + 2 * col);
+        vst1q_u8(dst + col, m.val[lane]);
+    }
+    return col;
+}
+
+static int threshold_row_simd(Yuv422_Order order,
+                              const uint8_t* src,
+                              const Yuv_Range& r,
+                              uint8_t* dst,
+                              int cols)
+{
+    int col = 0;
+    int y_lane = (order == YUV422_YUYV) ? 0 : 1;
+    const uint8x16_t y_min = vdupq_n_u8(r.y_min);
+    const uint8x16_t y_max = vdupq_n_u8(r.y_max);
+
+    // The chroma lane holds U V U V ...; compare both with one vector.
+
+    const uint8x16_t c_min =
+        vreinterpretq_u8_u16(vdupq_n_u16(r.u_min | (r.v_min << 8)));
+    const uint8x16_t c_max =
+        vreinterpretq_u8_u16(vdupq_n_u16(r.u_max | (r.v_max << 8)));
+    for (; col + 16 <= cols; col += 16) {
+        uint8x16x2_t m = vld2q_u8(src + 2 * col);
+        uint8x16_t y = m.val[y_lane];
+        uint8x16_t c = m.val[1 - y_lane];
+        uint8x16_t y_ok = vandq_u8(vcgeq_u8(y, y_min), vcleq_u8(y, y_max));
+        uint8x16_t c_ok = vandq_u8(vcgeq_u8(c, c_min), vcleq_u8(c, c_max));
+
+        // AND each U result with its V; both pixels of the macropixel
+        // then line up with their luma.
+
+        c_ok = vandq_u8(c_ok, vrev16q_u8(c_ok));
+        vst1q_u8(dst + col, vandq_u8(y_ok, c_ok));
+    }
+    return col;
+}
+
+static int luma_half_row_simd(Yuv422_Order order,
+                              const uint8_t* src0,
+                              const uint8_t* src1,
+                              uint8_t* dst,
+                              int dst_cols)
+{
+    int col = 0;
+    int lane = (order == YUV422_YUYV) ? 0 : 1;
+    for (; col + 16 <= dst_cols; col += 16) {
+
+        // Each output pixel comes from one macropixel in each row.
+
+        uint8x16x4_t a = vld4q_u8(src0 + 4 * col);
+        uint8x16x4_t b = vld4q_u8(src1 + 4 * col);
+        uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(a.val[lane]),
+                                           vget_low_u8(a.val[lane + 2])),
+                                  vaddl_u8(vget_low_u8(b.val[lane]),
+                                           vget_low_u8(b.val[lane + 2])));
+        uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(a.val[lane]),
+                                           vget_high_u8(a.val[lane + 2])),
+                                  vaddl_u8(vget_high_u8(b.val[lane]),
+                                           vget_high_u8(b.val[lane + 2])));
+        vst1q_u8(dst + col, vcombine_u8(vrshrn_n_u16(lo, 2),
+                                        vrshrn_n_u16(hi, 2)));
+    }
+    return col;
+}
+
+static int gray_half_row_simd(const uint8_t* src0,
+                              const uint8_t* src1,
+                              uint8_t* dst,
+                              int dst_cols)
+{
+    int col = 0;
+    for (; col + 16 <= dst_cols; col += 16) {
+
+        // Pairwise add adjacent pixels, then add the two rows.
+
+        uint16x8_t lo = vaddq_u16(vpaddlq_u8(vld1q_u8(src0 + 2 * col)),
+                                  vpaddlq_u8(vld1q_u8(src1 + 2 * col)));
+        uint16x8_t hi = vaddq_u16(vpaddlq_u8(vld1q_u8(src0 + 2 * col + 16)),
+                                  vpaddlq_u8(vld1q_u8(src1 + 2 * col + 16)));
+        vst1q_u8(dst + col, vcombine_u8(vrshrn_n_u16(lo, 2),
+                                        vrshrn_n_u16(hi, 2)));
+    }
+    return col;
+}
+
+#elif defined(YUV_CONVERT_SSE2)
+
+const char* yuv_convert_simd_name()
+{
+#ifdef YUV_CONVERT_AVX2
+    return "AVX2";
+#else
+    return "SSE2";
+#endif
+}
+
+// Convert 8 pixels given as 16 bit lanes.
+static inline void sse2_bgr8(__m128i y,
+                             __m128i d,
+                             __m128i e,
+                             __m128i& b,
+                             __m128i& g,
+                             __m128i& r)
+{
+    __m128i c = _mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)),
+                                _mm_set1_epi16(74));
+    __m128i round = _mm_set1_epi16(32);
+    b = _mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(129)));
+    g = _mm_subs_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(25)));
+    g = _mm_subs_epi16(g, _mm_mullo_epi16(e, _mm_set1_epi16(52)));
+    r = _mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(102)));
+    b = _mm_srai_epi16(_mm_adds_epi16(b, round), 6);
+    g = _mm_srai_epi16(_mm_adds_epi16(g, round), 6);
+    r = _mm_srai_epi16(_mm_adds_epi16(r, round), 6);
+}
+
+static int bgr_row_simd(Yuv422_Order order,
+                        const uint8_t* src,
+                        uint8_t* dst,
+                        int cols)
+{
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    const __m128i low_words = _mm_set1_epi32(0x0000ffff);
+    const __m128i bias = _mm_set1_epi16(128);
+    uint8_t b[16] __attribute__((aligned(16)));
+    uint8_t g[16] __attribute__((aligned(16)));
+    uint8_t r[16] __attribute__((aligned(16)));
+    int col = 0;
+    for (; col + 16 <= cols; col += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + 2 * col));
+        __m128i z = _mm_loadu_si128((const __m128i*)(src + 2 * col + 16));
+
+        // Split luma and chroma bytes into 16 bit lanes.
+
+        __m128i ya, yb, ca, cb;
+        if (order == YUV422_YUYV) {
+            ya = _mm_and_si128(a, low_bytes);
+            yb = _mm_and_si128(z, low_bytes);
+            ca = _mm_srli_epi16(a, 8);
+            cb = _mm_srli_epi16(z, 8);
+        } else {
+            ya = _mm_srli_epi16(a, 8);
+            yb = _mm_srli_epi16(z, 8);
+            ca = _mm_and_si128(a, low_bytes);
+            cb = _mm_and_si128(z, low_bytes);
+        }
+
+        // Chroma alternates U, V.  Gather 8 Us and 8 Vs, then duplicate
+        // each so it lines up with both of the pixels that share it.
+
+        __m128i u = _mm_packs_epi32(_mm_and_si128(ca, low_words),
+                                    _mm_and_si128(cb, low_words));
+        __m128i v = _mm_packs_epi32(_mm_srli_epi32(ca, 16),
+                                    _mm_srli_epi32(cb, 16));
+        u = _mm_sub_epi16(u, bias);
+        v = _mm_sub_epi16(v, bias);
+        __m128i b_lo, g_lo, r_lo, b_hi, g_hi, r_hi;
+        sse2_bgr8(ya, _mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v),
+                  b_lo, g_lo, r_lo);
+        sse2_bgr8(yb, _mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v),
+                  b_hi, g_hi, r_hi);
+        _mm_store_si128((__m128i*)b, _mm_packus_epi16(b_lo, b_hi));
+        _mm_store_si128((__m128i*)g, _mm_packus_epi16(g_lo, g_hi));
+        _mm_store_si128((__m128i*)r, _mm_packus_epi16(r_lo, r_hi));
+
+        // SSE2 has no byte shuffle, so interleave the planes in scalar code.
+
+        uint8_t* out = dst + 3 * col;
+        for (int i = 0; i < 16; ++i) {
+            out[0] = b[i];
+            out[1] = g[i];
+            out[2] = r[i];
+            out += 3;
+        }
+    }
+    return col;
+}
+
+static int gray_row_simd(Yuv422_Order order,
+                         const uint8_t* src,
+                         uint8_t* dst,
+                         int cols)
+{
+    int col = 0;
+#ifdef YUV_CONVERT_AVX2
+    const __m256i low_bytes_256 = _mm256_set1_epi16(0x00ff);
+    for (; col + 32 <= cols; col += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + 2 * col));
+        __m256i z = _mm256_loadu_si256((const __m256i*)(src + 2 * col + 32));
+        if (order == YUV422_YUYV) {
+            a = _mm256_and_si256(a, low_bytes_256);
+            z = _mm256_and_si256(z, low_bytes_256);
+        } else {
+            a = _mm256_srli_epi16(a, 8);
+            z = _mm256_srli_epi16(z, 8);
+        }
+
+        // The pack works within 128 bit lanes; put the quadwords back in
+        // order afterwards.
+
+        __m256i y = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, z), 0xd8);
+        _mm256_storeu_si256((__m256i*)(dst + col), y);
+    }
+#endif
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    for (; col + 16 <= cols; col += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + 2 * col));
+        __m128i z = _mm_loadu_si128((const __m128i*)(src + 2 * col + 16));
+        if (order == YUV422_YUYV) {
+            a = _mm_and_si128(a, low_bytes);
+            z = _mm_and_si128(z, low_bytes);
+        } else {
+            a = _mm_srli_epi16(a, 8);
+            z = _mm_srli_epi16(z, 8);
+        }
+        _mm_storeu_si128((__m128i*)(dst + col), _mm_packus_epi16(a, z));
+    }
+    return col;
+}
+
+// Return 0x00ff in each 16 bit lane of a macropixel's pixels that are
+// inside the range, given 0xff in each byte of ok that is.
+static inline __m128i sse2_threshold_pixels(Yuv422_Order order, __m128i ok)
+{
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    __m128i y_ok;
+    __m128i c_ok;
+    if (order == YUV422_YUYV) {
+        y_ok = _mm_and_si128(ok, low_bytes);
+        c_ok = _mm_srli_epi16(ok, 8);
+    } else {
+        y_ok = _mm_srli_epi16(ok, 8);
+        c_ok = _mm_and_si128(ok, low_bytes);
+    }
+
+    // AND each U result with its V, by swapping adjacent 16 bit lanes.
+
+    __m128i c_swap = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c_ok, 0xb1),
+                                         0xb1);
+    return _mm_and_si128(y_ok, _mm_and_si128(c_ok, c_swap));
+}
+
+static int threshold_row_simd(Yuv422_Order order,
+                              const uint8_t* src,
+                              const Yuv_Range& r,
+                              uint8_t* dst,
+                              int cols)
+{
+    int col = 0;
+
+    // Byte-wise bounds in the same order as a macropixel.
+
+    __m128i lo;
+    __m128i hi;
+    if (order == YUV422_YUYV) {
+        lo = _mm_set1_epi32(r.y_min | (r.u_min << 8) | (r.y_min << 16) |
+                            (r.v_min << 24));
+        hi = _mm_set1_epi32(r.y_max | (r.u_max << 8) | (r.y_max << 16) |
+                            (r.v_max << 24));
+    } else {
+        lo = _mm_set1_epi32(r.u_min | (r.y_min << 8) | (r.v_min << 16) |
+                            (r.y_min << 24));
+        hi = _mm_set1_epi32(r.u_max | (r.y_max << 8) | (r.v_max << 16) |
+                            (r.y_max << 24));
+    }
+    const __m128i zero = _mm_setzero_si128();
+    for (; col + 16 <= cols; col += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + 2 * col));
+        __m128i z = _mm_loadu_si128((const __m128i*)(src + 2 * col + 16));
+
+        // A byte is in range when neither saturating difference is
+        // positive.
+
+        __m128i a_ok = _mm_cmpeq_epi8(_mm_or_si128(_mm_subs_epu8(lo, a),
+                                                   _mm_subs_epu8(a, hi)),
+                                      zero);
+        __m128i z_ok = _mm_cmpeq_epi8(_mm_or_si128(_mm_subs_epu8(lo, z),
+                                                   _mm_subs_epu8(z, hi)),
+                                      zero);
+        __m128i mask = _mm_packus_epi16(sse2_threshold_pixels(order, a_ok),
+                                        sse2_threshold_pixels(order, z_ok));
+        _mm_storeu_si128((__m128i*)(dst + col), mask);
+    }
+    return col;
+}
+
+// Return, in each 32 bit lane, the sum of the two 16 bit values of a and
+// of b in that lane.
+static inline __m128i sse2_sum_pairs(__m128i a, __m128i b)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    return _mm_madd_epi16(_mm_add_epi16(a, b), ones);
+}
+
+static int luma_half_row_simd(Yuv422_Order order,
+                              const uint8_t* src0,
+                              const uint8_t* src1,
+                              uint8_t* dst,
+                              int dst_cols)
+{
+    int col = 0;
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; col + 16 <= dst_cols; col += 16) {
+
+        // 16 output pixels come from 16 macropixels (64 bytes) per row.
+
+        __m128i sum[4];
+        for (int i = 0; i < 4; ++i) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(src0 + 4 * col +
+                                                         16 * i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(src1 + 4 * col +
+                                                         16 * i));
+            if (order == YUV422_YUYV) {
+                a = _mm_and_si128(a, low_bytes);
+                b = _mm_and_si128(b, low_bytes);
+            } else {
+                a = _mm_srli_epi16(a, 8);
+                b = _mm_srli_epi16(b, 8);
+            }
+
+            // Each 32 bit lane now holds one macropixel's Y0 and Y1.
+
+            sum[i] = sse2_sum_pairs(a, b);
+        }
+        __m128i lo = _mm_srli_epi16(_mm_add_epi16(
+                                        _mm_packs_epi32(sum[0], sum[1]), two),
+                                    2);
+        __m128i hi = _mm_srli_epi16(_mm_add_epi16(
+                                        _mm_packs_epi32(sum[2], sum[3]), two),
+                                    2);
+        _mm_storeu_si128((__m128i*)(dst + col), _mm_packus_epi16(lo, hi));
+    }
+    return col;
+}
+
+static int gray_half_row_simd(const uint8_t* src0,
+                              const uint8_t* src1,
+                              uint8_t* dst,
+                              int dst_cols)
+{
+    int col = 0;
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; col + 16 <= dst_cols; col += 16) {
+        __m128i half[2];
+        for (int i = 0; i < 2; ++i) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(src0 + 2 * col +
+                                                         16 * i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(src1 + 2 * col +
+                                                         16 * i));
+
+            // Add even and odd pixels of both rows in 16 bit lanes.
+
+            __m128i sum = _mm_add_epi16(
+                              _mm_add_epi16(_mm_and_si128(a, low_bytes),
+                                            _mm_srli_epi16(a, 8)),
+                              _mm_add_epi16(_mm_and_si128(b, low_bytes),
+                                            _mm_srli_epi16(b, 8)));
+            half[i] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        }
+        _mm_storeu_si128((__m128i*)(dst + col),
+                         _mm_packus_epi16(half[0], half[1]));
+    }
+    return col;
+}
+
+#else
+
+const char* yuv_convert_simd_name()
+{
+    return "scalar";
+}
+
+static int bgr_row_simd(Yuv422_Order, const uint8_t*, uint8_t*, int)
+{
+    return 0;
+}
+
+static int gray_row_simd(Yuv422_Order, const uint8_t*, uint8_t*, int)
+{
+    return 0;
+}
+
+static int threshold_row_simd(Yuv422_Order, const uint8_t*,
+                              const Yuv_Range&, uint8_t*, int)
+{
+    return 0;
+}
+
+static int luma_half_row_simd(Yuv422_Order, const uint8_t*, const uint8_t*,
+                              uint8_t*, int)
+{
+    return 0;
+}
+
+static int gray_half_row_simd(const uint8_t*, const uint8_t*, uint8_t*, int)
+{
+    return 0;
+}
+
+#endif
+
+
+void yuv422_to_bgr(Yuv422_Order order,
+                   const uint8_t* src, int src_step,
+                   uint8_t* dst, int dst_step,
+                   int rows, int cols)
+{
+    for (int row = 0; row < rows; ++row) {
+        int done = bgr_row_simd(order, src, dst, cols);
+        bgr_row_scalar(order, src, dst, done, cols);
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+void yuv422_to_gray(Yuv422_Order order,
+                    const uint8_t* src, int src_step,
+                    uint8_t* dst, int dst_step,
+                    int rows, int cols)
+{
+    for (int row = 0; row < rows; ++row) {
+        int done = gray_row_simd(order, src, dst, cols);
+        gray_row_scalar(order, src, dst, done, cols);
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+void yuv422_luma_half(Yuv422_Order order,
+                      const uint8_t* src, int src_step,
+                      uint8_t* dst, int dst_step,
+                      int rows, int cols)
+{
+    int dst_rows = rows / 2;
+    int dst_cols = cols / 2;
+    for (int row = 0; row < dst_rows; ++row) {
+        const uint8_t* src1 = src + src_step;
+        int done = luma_half_row_simd(order, src, src1, dst, dst_cols);
+        luma_half_row_scalar(order, src, src1, dst, done, dst_cols);
+        src += 2 * src_step;
+        dst += dst_step;
+    }
+}
+
+void gray_half(const uint8_t* src, int src_step,
+               uint8_t* dst, int dst_step,
+               int rows, int cols)
+{
+    int dst_rows = rows / 2;
+    int dst_cols = cols / 2;
+    for (int row = 0; row < dst_rows; ++row) {
+        const uint8_t* src1 = src + src_step;
+        int done = gray_half_row_simd(src, src1, dst, dst_cols);
+        gray_half_row_scalar(src, src1, dst, done, dst_cols);
+        src += 2 * src_step;
+        dst += dst_step;
+    }
+}
+
+void yuv422_threshold(Yuv422_Order order,
+                      const uint8_t* src, int src_step,
+                      const Yuv_Range& range,
+                      uint8_t* dst, int dst_step,
+                      int rows, int cols)
+{
+    for (int row = 0; row < rows; ++row) {
+        int done = threshold_row_simd(order, src, range, dst, cols);
+        threshold_row_scalar(order, src, range, dst, done, cols);
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+// Convert one BGR pixel to HSV in place, with OpenCV's 8 bit ranges.
+static inline void bgr_to_hsv_pixel(uint8_t* p)
+{
+    int b = p[0];
+    int g = p[1];
+    int r = p[2];
+    int v = b;
+    if (g > v) v = g;
+    if (r > v) v = r;
+    int min = b;
+    if (g < min) min = g;
+    if (r < min) min = r;
+    int diff = v - min;
+    int s = (v == 0) ? 0 : (diff * 255 + v / 2) / v;
+    int h = 0;
+    if (diff != 0) {
+
+        // Hue in units of 2 degrees, so a full circle fits in 0..179.
+
+        if (v == r) {
+            h = (30 * (g - b) * 2 / diff + 1) / 2;
+        } else if (v == g) {
+            h = 60 + (30 * (b - r) * 2 / diff + 1) / 2;
+        } else {
+            h = 120 + (30 * (r - g) * 2 / diff + 1) / 2;
+        }
+        if (h < 0) h += 180;
+        if (h >= 180) h -= 180;
+    }
+    p[0] = (uint8_t)h;
+    p[1] = (uint8_t)s;
+    p[2] = (uint8_t)v;
+}
+
+void yuv422_to_hsv(Yuv422_Order order,
+                   const uint8_t* src, int src_step,
+                   uint8_t* dst, int dst_step,
+                   int rows, int cols)
+{
+    /* Convert to BGR with the vector kernel, directly into dst, then
+       transform each pixel in place while it is still in cache. */
+
+    for (int row = 0; row < rows; ++row) {
+        int done = bgr_row_simd(order, src, dst, cols);
+        bgr_row_scalar(order, src, dst, done, cols);
+        uint8_t* p = dst;
+        for (int col = 0; col < cols; ++col) {
+            bgr_to_hsv_pixel(p);
+            p += 3;
+        }
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+void yuv422_to_bgr_scalar(Yuv422_Order order,
+                          const uint8_t* src, int src_step,
+                          uint8_t* dst, int dst_step,
+                          int rows, int cols)
+{
+    for (int row = 0; row < rows; ++row) {
+        bgr_row_scalar(order, src, dst, 0, cols);
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+void yuv422_to_gray_scalar(Yuv422_Order order,
+                           const uint8_t* src, int src_step,
+                           uint8_t* dst, int dst_step,
+                           int rows, int cols)
+{
+    for (int row = 0; row < rows; ++row) {
+        gray_row_scalar(order, src, dst, 0, cols);
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+void yuv422_threshold_scalar(Yuv422_Order order,
+                             const uint8_t* src, int src_step,
+                             const Yuv_Range& range,
+                             uint8_t* dst, int dst_step,
+                             int rows, int cols)
+{
+    for (int row = 0; row < rows; ++row) {
+        threshold_row_scalar(order, src, range, dst, 0, cols);
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+void yuv422_to_hsv_scalar(Yuv422_Order order,
+                          const uint8_t* src, int src_step,
+                          uint8_t* dst, int dst_step,
+                          int rows, int cols)
+{
+    for (int row = 0; row < rows; ++row) {
+        bgr_row_scalar(order, src, dst, 0, cols);
+        uint8_t* p = dst;
+        for (int col = 0; col < cols; ++col) {
+            bgr_to_hsv_pixel(p);
+            p += 3;
+        }
+        src += src_step;
+        dst += dst_step;
+    }
+}
+
+void yuv422_luma_half_scalar(Yuv422_Order order,
+                             const uint8_t* src, int src_step,
+                             uint8_t* dst, int dst_step,
+                             int rows, int cols)
+{
+    for (int row = 0; row < rows / 2; ++row) {
+        luma_half_row_scalar(order, src, src + src_step, dst, 0, cols / 2);
+        src += 2 * src_step;
+        dst += dst_step;
+    }
+}
+
+void gray_half_scalar(const uint8_t* src, int src_step,
+                      uint8_t* dst, int dst_step,
+                      int rows, int cols)
+{
+    for (int row = 0; row < rows / 2; ++row) {
+        gray_half_row_scalar(src, src + src_step, dst, 0, cols / 2);
+        src += 2 * src_step;
+        dst += dst_step;
+    }
+}
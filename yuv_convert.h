@@ -0,0 +1,198 @@
+/**********************************************************************
+ * Placed in the public domain by the author, Daniel Clouse, November 15, 2014.
+ */
+#ifndef YUV_CONVERT_H
+#define YUV_CONVERT_H
+
+#include <stdint.h>
+
+/**********************************************************************
+ * @brief Color conversion of packed 4:2:2 YUV images.
+ *
+ * Packed 4:2:2 images store two pixels in every four bytes: two luma
+ * samples and one shared pair of chroma samples.  Both common byte orders
+ * are supported (see Yuv422_Order).
+ *
+ * The conversion to BGR uses the ITU-R BT.601 "studio swing" equations in
+ * 6-bit fixed point:
+ *
+ *     C = Y - 16,  D = U - 128,  E = V - 128
+ *     R = clamp((74 * C + 102 * E + 32) >> 6)
+ *     G = clamp((74 * C -  25 * D - 52 * E + 32) >> 6)
+ *     B = clamp((74 * C + 129 * D + 32) >> 6)
+ *
+ * The SIMD kernels (NEON on ARM, SSE2 or AVX2 on x86) produce output
+ * identical to the scalar versions, which are exported for reference.
+ * The number of columns must be even.  Steps are the distance in bytes
+ * between the starts of consecutive rows.
+ */
+
+/** The order of the bytes in a packed 4:2:2 image. */
+enum Yuv422_Order {
+    YUV422_YUYV,   /// Y0 U Y1 V (V4L2_PIX_FMT_YUYV)
+    YUV422_UYVY    /// U Y0 V Y1 (V4L2_PIX_FMT_UYVY)
+};
+
+/**********************************************************************
+ * @brief Return the name of the instruction set used by the kernels in
+ *        this build: "NEON", "AVX2", "SSE2" or "scalar".
+ */
+const char* yuv_convert_simd_name();
+
+/**********************************************************************
+ * @brief Convert a packed 4:2:2 image to 3 byte per pixel BGR.
+ *
+ * @param [in] order     The byte order of src.
+ * @param [in] src       Points to the first pixel of the source image.
+ * @param [in] src_step  Bytes per row of src; at least 2 * cols.
+ * @param [out] dst      Points to the first pixel of the BGR image.
+ * @param [in] dst_step  Bytes per row of dst; at least 3 * cols.
+ * @param [in] rows      The number of rows in the image.
+ * @param [in] cols      The number of columns in the image.
+ */
+void yuv422_to_bgr(Yuv422_Order order,
+                   const uint8_t* src, int src_step,
+                   uint8_t* dst, int dst_step,
+                   int rows, int cols);
+
+/**********************************************************************
+ * @brief Extract the luma plane of a packed 4:2:2 image as 1 byte per
+ *        pixel gray.
+ *
+ * Parameters are as for yuv422_to_bgr(), except that dst_step need only be
+ * at least cols.
+ */
+void yuv422_to_gray(Yuv422_Order order,
+                    const uint8_t* src, int src_step,
+                    uint8_t* dst, int dst_step,
+                    int rows, int cols);
+
+/**********************************************************************
+ * @brief Convert a packed 4:2:2 image to 3 byte per pixel HSV.
+ *
+ * Uses the same 8-bit ranges as OpenCV's CV_BGR2HSV: H in 0..179,
+ * S and V in 0..255.  Parameters are as for yuv422_to_bgr().
+ */
+void yuv422_to_hsv(Yuv422_Order order,
+                   const uint8_t* src, int src_step,
+                   uint8_t* dst, int dst_step,
+                   int rows, int cols);
+
+/**********************************************************************
+ * @brief Make a half size gray image from the luma of a packed 4:2:2
+ *        image.
+ *
+ * Each output pixel is the rounded average of a 2x2 block of luma, so
+ * this is a 2x box-filter reduction and gray conversion in one pass.
+ * The output has rows / 2 rows and cols / 2 columns.  Parameters are
+ * otherwise as for yuv422_to_gray().
+ */
+void yuv422_luma_half(Yuv422_Order order,
+                      const uint8_t* src, int src_step,
+                      uint8_t* dst, int dst_step,
+                      int rows, int cols);
+
+/**********************************************************************
+ * @brief Make a half size copy of a 1 byte per pixel gray image.
+ *
+ * Each output pixel is the rounded average of a 2x2 block.  The output
+ * has rows / 2 rows and cols / 2 columns.
+ *
+ * @param [in] src       Points to the first pixel of the source image.
+ * @param [in] src_step  Bytes per row of src.
+ * @param [out] dst      Points to the first pixel of the output.
+ * @param [in] dst_step  Bytes per row of dst.
+ * @param [in] rows      The number of rows in the source image.
+ * @param [in] cols      The number of columns in the source image.
+ */
+void gray_half(const uint8_t* src, int src_step,
+               uint8_t* dst, int dst_step,
+               int rows, int cols);
+
+/**********************************************************************
+ * @brief A box in YUV space.  A pixel is inside the box when each of its
+ *        components lies within the corresponding [min, max] range.
+ */
+class Yuv_Range {
+public:
+    uint8_t y_min;
+    uint8_t y_max;
+    uint8_t u_min;
+    uint8_t u_max;
+    uint8_t v_min;
+    uint8_t v_max;
+
+    Yuv_Range()
+    : y_min(0),
+      y_max(255),
+      u_min(0),
+      u_max(255),
+      v_min(0),
+      v_max(255)
+    { }
+};
+
+/**********************************************************************
+ * @brief Make a binary mask of the pixels of a packed 4:2:2 image that lie
+ *        inside a Yuv_Range.
+ *
+ * Thresholding in YUV avoids converting to BGR or HSV first.  Each mask
+ * byte is 255 if the pixel is inside the range, else 0.  The two pixels
+ * of a macropixel share their U and V.  Parameters are as for
+ * yuv422_to_gray().
+ */
+void yuv422_threshold(Yuv422_Order order,
+                      const uint8_t* src, int src_step,
+                      const Yuv_Range& range,
+                      uint8_t* dst, int dst_step,
+                      int rows, int cols);
+
+/**********************************************************************
+ * @brief Scalar reference version of yuv422_to_bgr().
+ */
+void yuv422_to_bgr_scalar(Yuv422_Order order,
+                          const uint8_t* src, int src_step,
+                          uint8_t* dst, int dst_step,
+                          int rows, int cols);
+
+/**********************************************************************
+ * @brief Scalar reference version of yuv422_to_gray().
+ */
+void yuv422_to_gray_scalar(Yuv422_Order order,
+                           const uint8_t* src, int src_step,
+                           uint8_t* dst, int dst_step,
+                           int rows, int cols);
+
+/**********************************************************************
+ * @brief Scalar reference version of yuv422_to_hsv().
+ */
+void yuv422_to_hsv_scalar(Yuv422_Order order,
+                          const uint8_t* src, int src_step,
+                          uint8_t* dst, int dst_step,
+                          int rows, int cols);
+
+/**********************************************************************
+ * @brief Scalar reference version of yuv422_luma_half().
+ */
+void yuv422_luma_half_scalar(Yuv422_Order order,
+                             const uint8_t* src, int src_step,
+                             uint8_t* dst, int dst_step,
+                             int rows, int cols);
+
+/**********************************************************************
+ * @brief Scalar reference version of gray_half().
+ */
+void gray_half_scalar(const uint8_t* src, int src_step,
+                      uint8_t* dst, int dst_step,
+                      int rows, int cols);
+
+/**********************************************************************
+ * @brief Scalar reference version of yuv422_threshold().
+ */
+void yuv422_threshold_scalar(Yuv422_Order order,
+                             const uint8_t* src, int src_step,
+                             const Yuv_Range& range,
+                             uint8_t* dst, int dst_step,
+                             int rows, int cols);
+
+#endif